@@ -1,44 +1,155 @@
 {
+  "target_defaults": {
+    'variables': {
+      'pgconfig': 'pg_config'
+    },
+    "include_dirs": [
+      '<!@(<(pgconfig) --includedir)',
+      '/usr/include/'
+    ],
+    "conditions": [
+      [
+        'OS=="win"', {
+          'libraries' : ['libpq.lib', 'libsqlite3.lib'],
+          'msvs_settings': {
+            'VCLinkerTool' : {
+              'AdditionalLibraryDirectories' : [
+                '<!@(<(pgconfig) --libdir)\\'
+              ]
+            },
+          }
+        },
+        'OS=="mac"', {
+          'libraries' : ['-lpq -L<!@(<(pgconfig) --libdir) -lsqlite3 -L/usr/lib'],
+          "xcode_settings": {
+              'OTHER_CPLUSPLUSFLAGS' : ['-std=c++11','-stdlib=libc++'],
+              'OTHER_LDFLAGS': ['-stdlib=libc++'],
+              'MACOSX_DEPLOYMENT_TARGET': '10.7' }
+          },
+        { # Other OS
+           'libraries' : ['-lpq -L<!@(<(pgconfig) --libdir) -lsqlite3 -L/usr/lib']
+        }
+      ]
+    ]
+  },
   "targets": [
     {
       "target_name": "dblogger",
       "sources": [
         "cpp/main.cc",
         "cpp/logger.cc",
+        "cpp/destination.cc",
+        "cpp/flight_recorder.cc",
         "cpp/db.cc",
+        "cpp/schema.cc",
         "cpp/db_logger.cc",
-        "cpp/stdout_logger.cc"
-      ],
-      'variables': {
-        'pgconfig': 'pg_config'
-      },
-      "include_dirs": [
-        '<!@(<(pgconfig) --includedir)',
-        '/usr/include/'
-      ],
-      "conditions": [
-        [
-          'OS=="win"', {
-            'libraries' : ['libpq.lib', 'libsqlite3.lib'],
-            'msvs_settings': {
-              'VCLinkerTool' : {
-                'AdditionalLibraryDirectories' : [
-                  '<!@(<(pgconfig) --libdir)\\'
-                ]
-              },
-            }
-          },
-          'OS=="mac"', {
-            'libraries' : ['-lpq -L<!@(<(pgconfig) --libdir) -lsqlite3 -L/usr/lib'],
-            "xcode_settings": {
-                'OTHER_CPLUSPLUSFLAGS' : ['-std=c++11','-stdlib=libc++'],
-                'OTHER_LDFLAGS': ['-stdlib=libc++'],
-                'MACOSX_DEPLOYMENT_TARGET': '10.7' }
-            },
-          { # Other OS
-             'libraries' : ['-lpq -L<!@(<(pgconfig) --libdir) -lsqlite3 -L/usr/lib']
-          }
-        ]
+        "cpp/hash.cc",
+        "cpp/tail.cc",
+        "cpp/exporter.cc",
+        "cpp/parquet.cc",
+        "cpp/stdout_logger.cc",
+        "cpp/file_logger.cc",
+        "cpp/collector_logger.cc",
+        "cpp/segment_logger.cc",
+        "cpp/segment.cc",
+        "cpp/shard.cc",
+        "cpp/source_map.cc",
+        "cpp/record.cc",
+        "cpp/tag_set.cc",
+        "cpp/sink.cc",
+        "cpp/json.cc",
+        "cpp/stats.cc"
+      ]
+    },
+    {
+      "target_name": "dblogger-collector",
+      "type": "executable",
+      "sources": [
+        "cpp/collector.cc",
+        "cpp/cli.cc",
+        "cpp/db.cc",
+        "cpp/schema.cc",
+        "cpp/db_logger.cc",
+        "cpp/hash.cc",
+        "cpp/tail.cc",
+        "cpp/record.cc",
+        "cpp/tag_set.cc",
+        "cpp/sink.cc",
+        "cpp/stats.cc"
+      ]
+    },
+    {
+      "target_name": "dblogger-shards",
+      "type": "executable",
+      "sources": [
+        "cpp/shard_tool.cc",
+        "cpp/shard.cc",
+        "cpp/cli.cc",
+        "cpp/db.cc",
+        "cpp/schema.cc",
+        "cpp/db_logger.cc",
+        "cpp/hash.cc",
+        "cpp/tail.cc",
+        "cpp/sink.cc",
+        "cpp/tag_set.cc",
+        "cpp/stats.cc"
+      ]
+    },
+    {
+      "target_name": "dblogger-migrate",
+      "type": "executable",
+      "sources": [
+        "cpp/migrate.cc",
+        "cpp/cli.cc",
+        "cpp/db.cc",
+        "cpp/schema.cc",
+        "cpp/stats.cc"
+      ]
+    },
+    {
+      "target_name": "dblogger-export",
+      "type": "executable",
+      "sources": [
+        "cpp/export_tool.cc",
+        "cpp/exporter.cc",
+        "cpp/parquet.cc",
+        "cpp/segment.cc",
+        "cpp/cli.cc",
+        "cpp/db.cc",
+        "cpp/schema.cc",
+        "cpp/json.cc",
+        "cpp/stats.cc"
+      ]
+    },
+    {
+      "target_name": "dblogger-ship",
+      "type": "executable",
+      "sources": [
+        "cpp/ship.cc",
+        "cpp/shard.cc",
+        "cpp/cli.cc",
+        "cpp/db.cc",
+        "cpp/schema.cc",
+        "cpp/db_logger.cc",
+        "cpp/hash.cc",
+        "cpp/tail.cc",
+        "cpp/sink.cc",
+        "cpp/tag_set.cc",
+        "cpp/stats.cc"
+      ]
+    },
+    {
+      "target_name": "dblogger-test-formats",
+      "type": "executable",
+      "sources": [
+        "test/formats.cc",
+        "cpp/parquet.cc",
+        "cpp/record.cc",
+        "cpp/segment.cc",
+        "cpp/segment_logger.cc",
+        "cpp/sink.cc",
+        "cpp/tag_set.cc",
+        "cpp/stats.cc"
       ]
     }
   ]
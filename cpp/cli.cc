@@ -0,0 +1,78 @@
+#include <cstdlib>
+#include "cli.h"
+
+bool parse_arguments(int argc, char **argv, map<string, string> &arguments) {
+	for (int i = 1; i < argc; i++) {
+		string key = argv[i];
+		if ((key.size() < 3) || (key.substr(0, 2) != "--")) {
+			return false;
+		}
+		key = key.substr(2);
+
+		if ((i + 1 < argc) && (string(argv[i + 1]).substr(0, 2) != "--")) {
+			arguments[key] = argv[i + 1];
+			i++;
+		} else {
+			arguments[key] = "true";
+		}
+	}
+	return true;
+}
+
+string get_argument(const map<string, string> &arguments, string key, string fallback) {
+	auto search = arguments.find(key);
+	if (search == arguments.end()) {
+		return fallback;
+	}
+	return search->second;
+}
+
+int get_int_argument(const map<string, string> &arguments, string key, int fallback) {
+	auto search = arguments.find(key);
+	if (search == arguments.end()) {
+		return fallback;
+	}
+	return std::atoi(search->second.c_str());
+}
+
+DBConnection *connect_from_arguments(const map<string, string> &arguments, string key_prefix, string application_name) {
+	string password = get_argument(arguments, key_prefix + "password", "undefined");
+	if ((password == "undefined") && getenv("DBLOGGER_PASSWORD")) {
+		password = getenv("DBLOGGER_PASSWORD");
+	}
+
+	// "undefined" is what the JS bindings pass for missing values
+	DBConnection *connection = new DBConnection(
+		get_argument(arguments, key_prefix + "type", "sqlite"),
+		get_argument(arguments, key_prefix + "host", "undefined"),
+		get_int_argument(arguments, key_prefix + "port", 0),
+		get_argument(arguments, key_prefix + "user", "undefined"),
+		password,
+		get_argument(arguments, key_prefix + "name", "undefined"),
+		get_argument(arguments, key_prefix + "prefix", "logger"),
+		application_name,
+		get_int_argument(arguments, key_prefix + "layout", 1)
+	);
+	if (arguments.count(key_prefix + "hash-ids") > 0) {
+		connection->enable_hash_ids();
+	}
+	return connection;
+}
+
+string connection_key(const DBConnection *connection) {
+	return connection->db_type + "://" + connection->db_host + ":" + std::to_string(connection->db_port) + "/" + connection->db_name + "/" + connection->prefix;
+}
+
+string connection_usage(string key_prefix) {
+	string p = "  --" + key_prefix;
+	return
+		p + "type <sqlite|postgres>  DB type (default: sqlite)\n" +
+		p + "name <name>             DB name or SQLite file\n" +
+		p + "host <host>             DB host\n" +
+		p + "port <port>             DB port\n" +
+		p + "user <user>             DB user\n" +
+		p + "password <password>     DB password (or DBLOGGER_PASSWORD environment variable)\n" +
+		p + "prefix <prefix>         Table prefix (default: logger)\n" +
+		p + "layout <1|2>            Log table layout for a new DB (default: 1)\n" +
+		p + "hash-ids                Use hashes of names as dimension IDs\n";
+}
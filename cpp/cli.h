@@ -0,0 +1,29 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <string>
+#include <map>
+
+#include "db.h"
+
+using std::string;
+using std::map;
+
+// Command line helpers for the native tools.
+// Arguments are `--key value` pairs, `--flag` without a value is stored as "true".
+bool parse_arguments(int argc, char **argv, map<string, string> &arguments);
+string get_argument(const map<string, string> &arguments, string key, string fallback);
+int get_int_argument(const map<string, string> &arguments, string key, int fallback);
+
+// Open a DB connection from `--type`, `--host`, `--port`, `--user`, `--name`, `--prefix`, `--layout` and `--hash-ids`,
+// the password is taken from `--password` or the `DBLOGGER_PASSWORD` environment variable.
+// Arguments may be prefixed (e.g. `--target-host`) to configure more than one connection.
+DBConnection *connect_from_arguments(const map<string, string> &arguments, string key_prefix, string application_name);
+
+// Identity of the DB of a connection, tools keep a watermark per target DB under this key
+string connection_key(const DBConnection *connection);
+
+// Help text for the connection arguments
+string connection_usage(string key_prefix);
+
+#endif // CLI_H
@@ -0,0 +1,217 @@
+/*
+ * dblogger-collector: receives log entries from many processes over a Unix domain socket
+ * and writes them to the DB with a single connection, batches are committed together.
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "db_logger.h"
+#include "record.h"
+#include "stats.h"
+
+using std::cerr;
+using std::vector;
+
+static volatile sig_atomic_t terminate_requested = 0;
+static volatile sig_atomic_t rotate_requested = 0;
+
+static void handle_signal(int signal) {
+	if (signal == SIGHUP) {
+		rotate_requested = 1;
+	} else {
+		terminate_requested = 1;
+	}
+}
+
+static void usage(void) {
+	cerr << "Usage: dblogger-collector --socket <path> [options]\n\n"
+		"  --socket <path>           Unix domain socket to listen on\n"
+		"  --mode <octal>            Permissions of the socket file (default: 660)\n"
+		"  --queue <count>           Maximum number of buffered entries (default: 100000)\n"
+		"  --batch <count>           Maximum number of entries per transaction (default: 1000)\n"
+		"  --rollup <seconds>        Write entry counts per minute to `<prefix>_rollup_minute` at this interval\n\n"
+		<< connection_usage("");
+}
+
+static int listen_socket(string path, int mode) {
+	struct sockaddr_un address;
+	if (path.size() >= sizeof(address.sun_path)) {
+		cerr << "Socket path too long: " << path << "\n";
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		cerr << "Could not create socket: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	// remove a stale socket of a previous run
+	unlink(path.c_str());
+
+	if ((bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) || (listen(fd, 128) != 0)) {
+		cerr << "Could not listen on " << path << ": " << strerror(errno) << "\n";
+		close(fd);
+		return -1;
+	}
+	chmod(path.c_str(), mode);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	return fd;
+}
+
+// Decode all complete frames in the buffer of a client, returns false on protocol errors
+static bool process_frames(string &buffer, DBSink *sink) {
+	size_t offset = 0;
+	while (buffer.size() - offset >= 4) {
+		const unsigned char *data = (const unsigned char *)buffer.data() + offset;
+		uint32_t length = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+		if (length > record_max_size) {
+			return false;
+		}
+		if (buffer.size() - offset - 4 < length) {
+			break;
+		}
+
+		LogEntry entry;
+		if (!record_decode(buffer.data() + offset + 4, length, entry)) {
+			return false;
+		}
+		sink->submit(entry);
+		offset += 4 + length;
+	}
+
+	buffer.erase(0, offset);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	map<string, string> arguments;
+	if (!parse_arguments(argc, argv, arguments) || (arguments.count("socket") == 0)) {
+		usage();
+		return 1;
+	}
+
+	string socket_path = get_argument(arguments, "socket", "");
+	int mode = (int)strtol(get_argument(arguments, "mode", "660").c_str(), NULL, 8);
+
+	DBConnection *connection = connect_from_arguments(arguments, "", "collector");
+	if (!connection->valid) {
+		cerr << "Could not connect to the DB\n";
+		return 1;
+	}
+	DBSink *sink = new DBSink(
+		connection,
+		0,
+		get_int_argument(arguments, "queue", 100000),
+		get_int_argument(arguments, "batch", 1000)
+	);
+	sink->rollup_interval = get_int_argument(arguments, "rollup", 0);
+
+	int listener = listen_socket(socket_path, mode);
+	if (listener < 0) {
+		return 1;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGHUP, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	vector<struct pollfd> fds = vector<struct pollfd>();
+	vector<string> buffers = vector<string>();
+	fds.push_back({ listener, POLLIN, 0 });
+	buffers.push_back(string());
+
+	char chunk[65536];
+	while (!terminate_requested) {
+		if (rotate_requested) {
+			rotate_requested = 0;
+			sink->rotate();
+		}
+
+		int ready = poll(fds.data(), fds.size(), 1000);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			cerr << "poll failed: " << strerror(errno) << "\n";
+			break;
+		}
+
+		// new clients
+		if (fds[0].revents & POLLIN) {
+			int client;
+			while ((client = accept(listener, NULL, NULL)) >= 0) {
+				fcntl(client, F_SETFL, O_NONBLOCK);
+				fds.push_back({ client, POLLIN, 0 });
+				buffers.push_back(string());
+			}
+		}
+
+		// read from clients, closed or broken connections are removed
+		for (size_t i = fds.size() - 1; i >= 1; i--) {
+			if (fds[i].revents == 0) {
+				continue;
+			}
+
+			bool keep = true;
+			while (true) {
+				ssize_t received = read(fds[i].fd, chunk, sizeof(chunk));
+				if (received > 0) {
+					buffers[i].append(chunk, received);
+					continue;
+				}
+				if ((received < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+					break;
+				}
+				if ((received < 0) && (errno == EINTR)) {
+					continue;
+				}
+				keep = false;
+				break;
+			}
+
+			if (!process_frames(buffers[i], sink)) {
+				cerr << "Dropping client connection: malformed record\n";
+				keep = false;
+			}
+			if (!keep) {
+				close(fds[i].fd);
+				fds.erase(fds.begin() + i);
+				buffers.erase(buffers.begin() + i);
+			}
+		}
+	}
+
+	// write all queued entries before exiting
+	close(listener);
+	unlink(socket_path.c_str());
+	for (size_t i = 1; i < fds.size(); i++) {
+		close(fds[i].fd);
+	}
+	delete sink;
+
+	if (stats.dropped.load() > 0) {
+		cerr << "Dropped " << stats.dropped.load() << " log entries\n";
+	}
+	return 0;
+}
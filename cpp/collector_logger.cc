@@ -0,0 +1,119 @@
+#include <iostream>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "collector_logger.h"
+#include "record.h"
+#include "stats.h"
+
+using std::cerr;
+
+CollectorSink::CollectorSink(string socket_path, int level, size_t queue_size) :
+	Sink(level, set<string>(), queue_size), socket_path(socket_path) {
+
+	fd = -1;
+	last_attempt = 0;
+	connect_socket();
+}
+
+CollectorSink::~CollectorSink() {
+	stop();
+	close_socket();
+}
+
+bool
+CollectorSink::connect_socket() {
+	last_attempt = time(NULL);
+
+	struct sockaddr_un address;
+	if (socket_path.size() >= sizeof(address.sun_path)) {
+		cerr << "Collector socket path too long: " << socket_path << "\n";
+		return false;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		cerr << "Could not create collector socket: " << strerror(errno) << "\n";
+		return false;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		cerr << "Could not connect to collector at " << socket_path << ": " << strerror(errno) << "\n";
+		close_socket();
+		return false;
+	}
+	return true;
+}
+
+void
+CollectorSink::close_socket() {
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+}
+
+void
+CollectorSink::reopen() {
+	close_socket();
+	connect_socket();
+}
+
+void
+CollectorSink::write(const LogEntry *entries, size_t count) {
+	if ((fd < 0) && (time(NULL) > last_attempt)) {
+		connect_socket();
+	}
+	if (fd < 0) {
+		stats_add(stats.dropped, count);
+		return;
+	}
+
+	string buffer = string();
+	size_t sent_count = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (record_append_frame(buffer, entries[i])) {
+			sent_count++;
+		} else {
+			cerr << "Log entry too large for the collector (more than " << record_max_size << " bytes), dropped\n";
+			stats_add(stats.dropped);
+		}
+	}
+
+	int flags = 0;
+#ifdef MSG_NOSIGNAL
+	flags = MSG_NOSIGNAL;
+#endif
+
+	size_t offset = 0;
+	while (offset < buffer.size()) {
+		ssize_t sent = send(fd, buffer.data() + offset, buffer.size() - offset, flags);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			// the collector went away, a partially sent frame can not be resumed on a new connection
+			cerr << "Could not send to collector at " << socket_path << ": " << strerror(errno) << "\n";
+			close_socket();
+			stats_add(stats.dropped, sent_count);
+			return;
+		}
+		offset += sent;
+	}
+	stats_add(stats.bytes_collector, buffer.size());
+}
@@ -0,0 +1,32 @@
+#ifndef COLLECTOR_LOGGER_H
+#define COLLECTOR_LOGGER_H
+
+#include <string>
+
+#include "log_entry.h"
+#include "sink.h"
+
+using std::string;
+
+// Sends log entries to a local `dblogger-collector` over a Unix domain socket.
+// If the collector is not reachable entries are dropped, reconnects are tried at most once per second.
+class CollectorSink : public Sink {
+	public:
+		CollectorSink(string socket_path, int level, size_t queue_size);
+		~CollectorSink();
+
+		const string socket_path;
+
+	protected:
+		void write(const LogEntry *entries, size_t count);
+		void reopen();
+
+	private:
+		bool connect_socket();
+		void close_socket();
+
+		int fd;
+		time_t last_attempt;
+};
+
+#endif // COLLECTOR_LOGGER_H
@@ -1,6 +1,12 @@
 #include <iostream>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <sys/select.h>
 #include "db.h"
+#include "probes.h"
+#include "schema.h"
+#include "stats.h"
 
 using std::cerr;
 using std::exception;
@@ -12,22 +18,30 @@ static void postgres_notice_processor(void *arg, const char *message) {
 DBConnection::DBConnection(
 	string db_type, string db_host, int db_port,
 	string db_user, string db_password, string db_name,
-	string prefix, string logger_name) :
+	string prefix, string logger_name, int layout, bool migrate) :
 		db_type(db_type), db_host(db_host), db_port(db_port),
 		db_user(db_user), db_password(db_password), db_name(db_name),
-		prefix(prefix) {
+		prefix(prefix), application_name(logger_name), requested_layout(layout) {
 
-	global_log_level = 0;
+	valid = false;
+	this->layout = 1;
+	sqlite = NULL;
 	pg = NULL;
+	inserted_first = -1;
+	inserted_last = -1;
+	hash_ids = false;
 
 	if (db_type == "sqlite") {
 		int result = sqlite3_open_v2(db_name.c_str(), &sqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
 		if ((result != SQLITE_OK) && (sqlite != NULL)) {
 			cerr << "Could not initialize DB: " << sqlite3_errmsg(sqlite) << "\n";
 			sqlite3_close_v2(sqlite);
+			sqlite = NULL;
 			return;
 		}
 		if (sqlite != NULL) {
+			// wait for other processes that migrate the schema instead of failing
+			sqlite3_busy_timeout(sqlite, 5000);
 			valid = true;
 		}
 	} else if (db_type == "postgres") {
@@ -72,7 +86,9 @@ DBConnection::DBConnection(
 	if (valid) {
 		// squelch notices logged to stderr
 		PQsetNoticeProcessor(pg, &postgres_notice_processor, NULL);
-		setup();
+		if (migrate) {
+			setup();
+		}
 	}
 }
 
@@ -94,106 +110,313 @@ DBConnection::~DBConnection() {
 void
 DBConnection::setup() {
 	if (db_type == "sqlite") {
+		// connection settings, these are not persisted in the DB file
 		execute("PRAGMA synchronous = 0;");
-		execute("PRAGMA auto_vacuum = 0;");
-		execute("CREATE TABLE IF NOT EXISTS `" + prefix + "_hosts` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(255) NOT NULL, UNIQUE (id), CONSTRAINT 'host_unique' UNIQUE (name COLLATE NOCASE));");
-		execute("CREATE TABLE IF NOT EXISTS `" + prefix + "_logger` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(255) NOT NULL, UNIQUE (id), CONSTRAINT 'name_unique' UNIQUE (name COLLATE NOCASE));");
-		execute("CREATE TABLE IF NOT EXISTS `" + prefix + "_tag` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(255) NOT NULL, UNIQUE (id), CONSTRAINT 'tag_unique' UNIQUE (name COLLATE NOCASE));");
-		execute("CREATE TABLE IF NOT EXISTS `" + prefix + "_source` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `path` VARCHAR(1024) NOT NULL, UNIQUE (id), CONSTRAINT 'path_unique' UNIQUE (path));");
-		execute("CREATE TABLE IF NOT EXISTS `" + prefix + "_function` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(1024) NOT NULL, `lineNumber` INTEGER DEFAULT NULL, `sourceID` INTEGER REFERENCES `logger_source` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, UNIQUE (id), CONSTRAINT 'func_unique' UNIQUE (name, lineNumber, sourceID));");
-		execute("CREATE TABLE IF NOT EXISTS `" + prefix + "_log` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `level` INTEGER NOT NULL, `message` TEXT, `pid` INTEGER NOT NULL, `time` INTEGER NOT NULL, `functionID` INTEGER REFERENCES `logger_function` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, `loggerID` INTEGER REFERENCES `logger_logger` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, `hostnameID` INTEGER REFERENCES `logger_hosts` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, UNIQUE (id));");
-		execute("CREATE TABLE IF NOT EXISTS `logger_log_tag` (`tagID` INTEGER NOT NULL REFERENCES `logger_tag` (`id`) ON DELETE CASCADE ON UPDATE CASCADE, `logID` INTEGER NOT NULL REFERENCES `logger_log` (`id`) ON DELETE CASCADE ON UPDATE CASCADE, PRIMARY KEY (`tagID`, `logID`));");
+	}
+
+	vector<SchemaMigration> migrations = schema_migrations(db_type, prefix, requested_layout);
+	if (migrations.size() == 0) {
+		return;
+	}
+
+	// fast path: one query if the schema is up to date
+	int latest = migrations.back().version;
+	if (schema_version() >= latest) {
+		warn_layout();
+		return;
+	}
+
+	string schema_table;
+	if (db_type == "sqlite") {
+		schema_table = "`" + prefix + "_schema`";
+		if (!execute("BEGIN IMMEDIATE;")) {
+			cerr << "Could not lock the DB for the schema migration: " << sqlite3_errmsg(sqlite) << "\n";
+			valid = false;
+			return;
+		}
+	} else {
+		// serialize concurrent migrations of processes starting at the same time, the lock
+		// is released at the end of the transaction
+		schema_table = "\"" + prefix + "_schema\"";
+		if (!execute("BEGIN;") || !execute("SELECT pg_advisory_xact_lock(hashtext('" + prefix + "_schema'));")) {
+			return;
+		}
+	}
+
+	bool success = execute("CREATE TABLE IF NOT EXISTS " + schema_table + " (version INTEGER PRIMARY KEY, time INTEGER NOT NULL, layout INTEGER NOT NULL DEFAULT 1);");
+
+	// another process may have migrated while we were waiting for the lock
+	int current = success ? schema_version() : 0;
+	if (current == 0) {
+		// a new layout can only be chosen for a new DB, not for a log table of an older version
+		layout = ((requested_layout >= 2) && !log_table_exists()) ? 2 : 1;
+	}
+	if (layout != requested_layout) {
+		migrations = schema_migrations(db_type, prefix, layout);
+	}
+
+	for (SchemaMigration &migration : migrations) {
+		if (!success) {
+			break;
+		}
+		if (migration.version <= current) {
+			continue;
+		}
+
+		for (SchemaStep &step : migration.steps) {
+			if ((step.column.size() > 0) && (db_type == "sqlite")) {
+				auto columns = query("SELECT COUNT(*) AS count FROM pragma_table_info('" + step.table + "') WHERE name = '" + step.column + "'");
+				bool exists = (columns->size() > 0) && (columns->front()["count"] != "0");
+				delete columns;
+				if (exists) {
+					continue;
+				}
+			}
+			if (!execute(step.sql)) {
+				success = false;
+				break;
+			}
+		}
+		if (success) {
+			success = execute(
+				"INSERT INTO " + schema_table + " (version, time, layout) VALUES (" +
+					std::to_string(migration.version) + ", " + std::to_string(time(NULL)) + ", " + std::to_string(layout) + ");"
+			);
+		}
+		if (!success) {
+			cerr << "Could not migrate the logger schema to version " << migration.version << "\n";
+		}
+	}
+
+	if (success) {
+		success = execute("COMMIT;");
+	}
+	if (!success) {
+		// execute() refuses to run on an invalidated connection, roll back directly
+		if (db_type == "sqlite") {
+			sqlite3_exec(sqlite, "ROLLBACK;", NULL, NULL, NULL);
+		} else if (pg != NULL) {
+			PQclear(PQexec(pg, "ROLLBACK;"));
+		}
+		valid = false;
+		return;
+	}
+	warn_layout();
+}
+
+// Returns the schema version of the DB or 0 if it has not been set up by a versioned logger yet,
+// the storage layout of the log table is read with it. Talks to the driver directly: a missing
+// version table is expected and not an error.
+int
+DBConnection::schema_version() {
+	int version = 0;
+	stats_add(stats.db_statements);
+
+	// `layout` does not exist before schema version 4
+	string sql = "SELECT * FROM \"" + prefix + "_schema\" ORDER BY version DESC LIMIT 1;";
+	if (db_type == "sqlite") {
+		sqlite3_mutex* mtx = sqlite3_db_mutex(sqlite);
+		sqlite3_mutex_enter(mtx);
+
+		sqlite3_stmt *stmt = NULL;
+		if (sqlite3_prepare_v2(sqlite, sql.c_str(), sql.size(), &stmt, NULL) == SQLITE_OK) {
+			if (sqlite3_step(stmt) == SQLITE_ROW) {
+				for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+					string name = sqlite3_column_name(stmt, i);
+					if (name == "version") {
+						version = sqlite3_column_int(stmt, i);
+					} else if (name == "layout") {
+						layout = sqlite3_column_int(stmt, i);
+					}
+				}
+			}
+			sqlite3_finalize(stmt);
+		}
+		sqlite3_mutex_leave(mtx);
 	} else if (db_type == "postgres") {
-		// Hosts + Indexes
-		execute("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_hosts_id_seq\";");
-		execute("CREATE TABLE IF NOT EXISTS \"" + prefix + "_hosts\" ("
-			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_hosts_id_seq'),"
-			"	\"name\" varchar(1024) NOT NULL COLLATE \"default\","
-			"	CONSTRAINT \"" + prefix + "_logger_hosts_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_host_name_idx\" UNIQUE (\"name\") NOT DEFERRABLE INITIALLY IMMEDIATE"
-			");"
-		);
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_host_name_idx\" ON \"" + prefix + "_hosts\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_hosts_id_key\" ON \"" + prefix + "_hosts\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-
-		// Logger + Indexes
-		execute("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_logger_id_seq\";");
-		execute("CREATE TABLE IF NOT EXISTS \"" + prefix + "_logger\" ("
-			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_logger_id_seq'),"
-			"	\"name\" varchar(255) NOT NULL COLLATE \"default\","
-			"	CONSTRAINT \"" + prefix + "_logger_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_logger_name_idx\" UNIQUE (\"name\") NOT DEFERRABLE INITIALLY IMMEDIATE"
-			");"
-		);
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_name_idx\" ON \"" + prefix + "_logger\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_logger_id_key\" ON \"" + prefix + "_logger\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-
-		// Tag + Indexes
-		execute("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_tag_id_seq\";");
-		execute("CREATE TABLE IF NOT EXISTS \"" + prefix + "_tag\" ("
-			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_tag_id_seq'),"
-			"	\"name\" varchar(255) NOT NULL COLLATE \"default\","
-			"	CONSTRAINT \"" + prefix + "_logger_tag_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_tag_name_idx\" UNIQUE (\"name\") NOT DEFERRABLE INITIALLY IMMEDIATE"
-			");"
-		);
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_tag_id_key\" ON \"" + prefix + "_tag\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_tag_name_idx\" ON \"" + prefix + "_tag\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
-
-		// Source + Indexes
-		execute("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_source_id_seq\";");
-		execute("CREATE TABLE IF NOT EXISTS\"" + prefix + "_source\" ("
-			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_source_id_seq'),"
-			"	\"path\" varchar(1024) NOT NULL COLLATE \"default\","
-			"	CONSTRAINT \"" + prefix + "_logger_source_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_source_path_idx\" UNIQUE (\"path\") NOT DEFERRABLE INITIALLY IMMEDIATE"
-			");"
-		);
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_source_id_key\" ON \"" + prefix + "_source\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_source_path_idx\" ON \"" + prefix + "_source\" USING btree(\"path\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
-
-		// Function + Indexes
-		execute("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_function_id_seq\";");
-		execute("CREATE TABLE IF NOT EXISTS \"" + prefix + "_function\" ("
-			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_function_id_seq'),"
-			"	\"name\" varchar(1024) NOT NULL COLLATE \"default\","
-			"	\"lineNumber\" int4, \"sourceID\" int4,"
-			"	CONSTRAINT \"" + prefix + "_function_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_source_fk\" FOREIGN KEY (\"sourceID\") REFERENCES \"" + prefix + "_source\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_func_uniq\" UNIQUE (\"name\",\"lineNumber\",\"sourceID\") NOT DEFERRABLE INITIALLY IMMEDIATE"
-			");"
-		);
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_function_id_key\" ON \"" + prefix + "_function\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_func_uniq\" ON \"" + prefix + "_function\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST, \"lineNumber\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST, \"sourceID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-		execute("CREATE INDEX IF NOT EXISTS \"" + prefix + "_function_name_idx\" ON \"" + prefix + "_function\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
-
-		// Log + Indexes
-		execute("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_log_id_seq\";");
-		execute("CREATE TABLE IF NOT EXISTS \"" + prefix + "_log\" ("
-			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_log_id_seq'),"
-			"	\"level\" int4 NOT NULL DEFAULT 0, \"message\" text COLLATE \"default\","
-			"	\"pid\" int4 NOT NULL, \"time\" int4 NOT NULL, \"functionID\" int4, \"loggerID\" int4, \"hostnameID\" int4,"
-			"	CONSTRAINT \"" + prefix + "_log_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_log_function_fk\" FOREIGN KEY (\"functionID\") REFERENCES \"" + prefix + "_function\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_log_host_fk\" FOREIGN KEY (\"hostnameID\") REFERENCES \"" + prefix + "_hosts\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_log_logger_fk\" FOREIGN KEY (\"loggerID\") REFERENCES \"" + prefix + "_logger\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE"
-			");"
-		);
-		execute("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_log_id_key\" ON \"" + prefix + "_log\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-		execute("CREATE INDEX IF NOT EXISTS \"" + prefix + "_log_pid_idx\" ON \"" + prefix + "_log\" USING btree(pid \"pg_catalog\".\"int4_ops\" ASC NULLS LAST, \"hostnameID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
-
-		// Log->Tag + Indexes
-		execute("CREATE TABLE IF NOT EXISTS \"" + prefix + "_log_tag\" ("
-			"	\"tagID\" int4 NOT NULL, \"logID\" int4 NOT NULL,"
-			"	CONSTRAINT \"" + prefix + "_log_tag_id_key\" PRIMARY KEY (\"tagID\", \"logID\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_log_tag_log_fk\" FOREIGN KEY (\"logID\") REFERENCES \"" + prefix + "_log\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
-			"	CONSTRAINT \"" + prefix + "_log_tag_tag_fk\" FOREIGN KEY (\"tagID\") REFERENCES \"" + prefix + "_tag\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE"
-			");"
-		);
-		execute("CREATE INDEX IF NOT EXISTS \"" + prefix + "_log_tag_id_key\" ON \"" + prefix + "_log_tag\" USING btree(\"tagID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST, \"logID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+		// outside of a transaction a missing table only fails this statement, inside of the
+		// migration transaction the table has already been created
+		PGresult *result = PQexec(pg, sql.c_str());
+		if (result) {
+			if ((PQresultStatus(result) == PGRES_TUPLES_OK) && (PQntuples(result) == 1)) {
+				version = std::atoi(PQgetvalue(result, 0, PQfnumber(result, "version")));
+				int column = PQfnumber(result, "layout");
+				if (column >= 0) {
+					layout = std::atoi(PQgetvalue(result, 0, column));
+				}
+			}
+			PQclear(result);
+		}
 	}
+
+	return version;
 }
 
+bool
+DBConnection::log_table_exists() {
+	vector< map<string, string> > *result;
+	if (db_type == "sqlite") {
+		result = query("SELECT COUNT(*) AS count FROM sqlite_master WHERE type = 'table' AND name = '" + prefix + "_log'");
+	} else {
+		result = query("SELECT COUNT(*) AS count FROM pg_catalog.pg_tables WHERE schemaname = current_schema() AND tablename = '" + prefix + "_log'");
+	}
+	bool exists = (result->size() > 0) && (result->front()["count"] != "0");
+	delete result;
+	return exists;
+}
+
+void
+DBConnection::warn_layout() {
+	if (requested_layout > layout) {
+		cerr << "The " << prefix << "_log table uses layout " << layout << ", run dblogger-migrate to convert it to layout " << requested_layout << "\n";
+	}
+}
+
+bool
+DBConnection::enable_hash_ids() {
+	if (!valid) return false;
+
+	if (db_type == "postgres") {
+		// every dimension ID column and every column referencing one
+		const char *columns[][2] = {
+			{ "_logger", "id" }, { "_hosts", "id" }, { "_source", "id" }, { "_function", "id" }, { "_function", "sourceID" },
+			{ "_tag", "id" }, { "_tagset", "id" }, { "_tagset_member", "tagsetID" }, { "_tagset_member", "tagID" },
+			{ "_log", "loggerID" }, { "_log", "hostnameID" }, { "_log", "functionID" }, { "_log", "tagsetID" }, { "_log_tag", "tagID" }
+		};
+		string list = "";
+		for (auto &column : columns) {
+			list += string((list.size() > 0) ? ", " : "") + "('" + prefix + column[0] + "', '" + column[1] + "')";
+		}
+		auto result = query("SELECT count(*) AS narrow FROM information_schema.columns WHERE table_schema = current_schema() "
+			"AND data_type <> 'bigint' AND (table_name, column_name) IN (" + list + ")");
+		bool narrow = !result || (result->size() == 0) || (result->front()["narrow"] != "0");
+		delete result;
+		if (narrow) {
+			cerr << "Hash IDs need int8 ID columns in the " << prefix << " tables, see the readme. Using sequence IDs.\n";
+			return false;
+		}
+	}
+
+	hash_ids = true;
+	return true;
+}
+
+void
+DBConnection::setup_field_indexes(vector<string> keys, bool gin) {
+	if (!valid) return;
+
+	for (string key : keys) {
+		// keys are used in identifiers and paths, only allow simple names
+		bool usable = (key.size() > 0);
+		for (char c : key) {
+			if (!isalnum((unsigned char)c) && (c != '_')) {
+				usable = false;
+			}
+		}
+		if (!usable) {
+			cerr << "Ignoring field index for '" << key << "': only letters, digits and underscores are allowed\n";
+			continue;
+		}
+
+		if (db_type == "sqlite") {
+			execute("CREATE INDEX IF NOT EXISTS `" + prefix + "_log_fields_" + key + "_idx` ON `" + prefix + "_log` (json_extract(`fields`, '$." + key + "'));");
+		} else if (db_type == "postgres") {
+			execute("CREATE INDEX IF NOT EXISTS \"" + prefix + "_log_fields_" + key + "_idx\" ON \"" + prefix + "_log\" USING btree((\"fields\"->>'" + key + "'));");
+		}
+	}
+
+	if (gin && (db_type == "postgres")) {
+		execute("CREATE INDEX IF NOT EXISTS \"" + prefix + "_log_fields_idx\" ON \"" + prefix + "_log\" USING gin(\"fields\" jsonb_path_ops);");
+	}
+}
+
+IndexProfileResult
+DBConnection::setup_index_profile(string profile, int64_t sqlite_max_rows) {
+	if (!valid) return INDEX_PROFILE_FAILED;
+	if (profile.empty() || (profile == "none")) return INDEX_PROFILE_DONE;
+	if (profile != "time") {
+		cerr << "Unknown index profile '" << profile << "'\n";
+		return INDEX_PROFILE_FAILED;
+	}
+
+	string table = prefix + "_log";
+	if (db_type == "sqlite") {
+		auto existing = query("SELECT name FROM sqlite_master WHERE type = 'index' AND name = '" + table + "_time_level_idx'");
+		bool exists = (existing->size() > 0);
+		delete existing;
+		if (exists) {
+			return INDEX_PROFILE_DONE;
+		}
+
+		// SQLite builds an index in one write transaction, writers wait for it (busy timeout)
+		if (sqlite_max_rows > 0) {
+			auto result = query("SELECT COALESCE(MAX(`id`) - MIN(`id`), 0) AS rows FROM `" + table + "`");
+			int64_t rows = (result->size() > 0) ? std::atoll(result->front()["rows"].c_str()) : 0;
+			delete result;
+			if (rows > sqlite_max_rows) {
+				cerr << "Not indexing " << table << " with about " << rows << " rows while logging, run dblogger-migrate --index-profile " << profile << "\n";
+				return INDEX_PROFILE_SKIPPED;
+			}
+		}
+		bool created = execute("CREATE INDEX IF NOT EXISTS `" + table + "_time_level_idx` ON `" + table + "` (`time`, `level`);");
+		return created ? INDEX_PROFILE_DONE : INDEX_PROFILE_FAILED;
+	}
+	if (db_type != "postgres") {
+		return INDEX_PROFILE_FAILED;
+	}
+
+	// one builder per DB, CONCURRENTLY does not block writers but waits for their transactions
+	string lock = "hashtext('" + table + "_index_profile')";
+	auto locked = query("SELECT pg_try_advisory_lock(" + lock + ") AS locked");
+	bool builder = (locked->size() > 0) && (locked->front()["locked"] == "t");
+	delete locked;
+	if (!builder) {
+		return INDEX_PROFILE_DONE;
+	}
+
+	const char *indexes[][2] = {
+		// block range index, a few pages for the whole append-only table
+		{ "_time_brin", "USING brin (\"time\")" },
+		// errors and fatals by time
+		{ "_error_idx", "USING btree (\"time\") WHERE \"level\" >= 50" }
+	};
+	bool created = true;
+	for (auto &index : indexes) {
+		string name = table + index[0];
+
+		// an interrupted concurrent build leaves an invalid index behind that IF NOT EXISTS would keep
+		auto state = query("SELECT i.indisvalid AS valid FROM pg_catalog.pg_index i JOIN pg_catalog.pg_class c ON c.oid = i.indexrelid "
+			"WHERE c.relname = '" + name + "' AND c.relnamespace = current_schema()::regnamespace");
+		string index_valid = (state->size() > 0) ? state->front()["valid"] : "";
+		delete state;
+		if (index_valid == "t") {
+			continue;
+		}
+		if (index_valid == "f") {
+			execute("DROP INDEX CONCURRENTLY IF EXISTS \"" + name + "\";");
+		}
+
+		created = execute("CREATE INDEX CONCURRENTLY IF NOT EXISTS \"" + name + "\" ON \"" + table + "\" " + index[1] + ";") && created;
+	}
+
+	delete query("SELECT pg_advisory_unlock(" + lock + ") AS unlocked");
+	return created ? INDEX_PROFILE_DONE : INDEX_PROFILE_FAILED;
+}
+
+void
+DBConnection::cancel() {
+	if (sqlite != NULL) {
+		sqlite3_interrupt(sqlite);
+	}
+	if (pg != NULL) {
+		PGcancel *request = PQgetCancel(pg);
+		char error[256];
+		if ((request == NULL) || !PQcancel(request, error, sizeof(error))) {
+			cerr << "Could not cancel the running statement: " << ((request != NULL) ? error : "no connection") << "\n";
+		}
+		PQfreeCancel(request);
+	}
+}
 
 sqlite3_stmt *prepare_sqlite_statement(string sql, map<string, string> parameters, sqlite3 *sqlite) {
 	sqlite3_stmt *stmt = NULL;
@@ -219,7 +442,7 @@ sqlite3_stmt *prepare_sqlite_statement(string sql, map<string, string> parameter
 	return stmt;
 }
 
-sqlite3_stmt *prepare_sqlite_statement(string sql, vector<string> parameters, sqlite3 *sqlite) {
+sqlite3_stmt *prepare_sqlite_statement(string sql, vector<string> parameters, const vector<bool> &nulls, sqlite3 *sqlite) {
 	sqlite3_stmt *stmt = NULL;
 
 	int result = sqlite3_prepare_v2(sqlite, sql.c_str(), sql.size(), &stmt, NULL);
@@ -230,7 +453,11 @@ sqlite3_stmt *prepare_sqlite_statement(string sql, vector<string> parameters, sq
 
 	int index = 1;
 	for (string value : parameters) {
-		result = sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_TRANSIENT);
+		if (((size_t)index <= nulls.size()) && nulls[index - 1]) {
+			result = sqlite3_bind_null(stmt, index);
+		} else {
+			result = sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_TRANSIENT);
+		}
 		if (result != SQLITE_OK) {
 			cerr << "Could not bind parameter #" << index << ": " << sqlite3_errmsg(sqlite) << "\n";
 	 		return NULL;
@@ -241,7 +468,7 @@ sqlite3_stmt *prepare_sqlite_statement(string sql, vector<string> parameters, sq
 	return stmt;
 }
 
-PGresult *execute_pg_statement(string sql, vector<string> parameters, PGconn *pg) {
+PGresult *execute_pg_statement(string sql, vector<string> parameters, const vector<bool> &nulls, PGconn *pg) {
 	int nParams = parameters.size();
 	const char **values = NULL;
 
@@ -250,7 +477,7 @@ PGresult *execute_pg_statement(string sql, vector<string> parameters, PGconn *pg
 
 		int i = 0;
 		for (string value : parameters) {
-			if (value == "NULL") {
+			if (((size_t)i < nulls.size()) && nulls[i]) {
 				values[i] = NULL;
 			} else {
 				values[i] = (const char *)std::calloc(1, value.length() + 1);
@@ -283,24 +510,97 @@ PGresult *execute_pg_statement(string sql, vector<string> parameters, PGconn *pg
 	return result;
 }
 
+// Bind parameters without copying them, the values must stay alive until the statement is finalized
+sqlite3_stmt *prepare_sqlite_binary_statement(const string &sql, const vector<const string *> &parameters, const vector<bool> &binary, sqlite3 *sqlite) {
+	sqlite3_stmt *stmt = NULL;
+
+	int result = sqlite3_prepare_v2(sqlite, sql.c_str(), sql.size(), &stmt, NULL);
+	if (result != SQLITE_OK) {
+		cerr << "Could not prepare SQL statement " << sql << ": " << sqlite3_errmsg(sqlite) << "\n";
+		return NULL;
+	}
+
+	for (size_t i = 0; i < parameters.size(); i++) {
+		const string *value = parameters[i];
+		if (value == NULL) {
+			result = sqlite3_bind_null(stmt, i + 1);
+		} else if ((i < binary.size()) && binary[i]) {
+			result = sqlite3_bind_blob(stmt, i + 1, value->data(), value->size(), SQLITE_STATIC);
+		} else {
+			result = sqlite3_bind_text(stmt, i + 1, value->data(), value->size(), SQLITE_STATIC);
+		}
+		if (result != SQLITE_OK) {
+			cerr << "Could not bind parameter #" << (i + 1) << ": " << sqlite3_errmsg(sqlite) << "\n";
+			sqlite3_finalize(stmt);
+			return NULL;
+		}
+	}
+
+	return stmt;
+}
+
+// Binary parameters are sent in binary format with their length, no copies are made
+PGresult *execute_pg_binary_statement(const string &sql, const vector<const string *> &parameters, const vector<bool> &binary, PGconn *pg) {
+	int nParams = parameters.size();
+	vector<const char *> values = vector<const char *>(nParams);
+	vector<int> lengths = vector<int>(nParams);
+	vector<int> formats = vector<int>(nParams);
+
+	for (int i = 0; i < nParams; i++) {
+		values[i] = (parameters[i] != NULL) ? parameters[i]->c_str() : NULL;
+		lengths[i] = (parameters[i] != NULL) ? parameters[i]->size() : 0;
+		formats[i] = (((size_t)i < binary.size()) && binary[i]) ? 1 : 0;
+	}
+
+	return PQexecParams(pg, sql.c_str(), nParams, NULL, values.data(), lengths.data(), formats.data(), 0);
+}
+
+static size_t parameter_bytes(const vector<string> &parameters) {
+	size_t bytes = 0;
+	for (const string &value : parameters) {
+		bytes += value.size();
+	}
+	return bytes;
+}
+
+static size_t parameter_bytes(const vector<const string *> &parameters) {
+	size_t bytes = 0;
+	for (const string *value : parameters) {
+		bytes += (value != NULL) ? value->size() : 0;
+	}
+	return bytes;
+}
+
 /*
  * Public API
  */
 
-int
+int64_t
 DBConnection::insert(string sql) {
 	return insert(sql, vector<string>());
 }
 
-int
+int64_t
 DBConnection::insert(string sql, vector<string> parameters) {
 	return insert(sql, parameters, false);
 }
 
-int
-DBConnection::insert(string sql, vector<string> parameters, bool ignore_conflicts) {
+int64_t
+DBConnection::insert(string sql, vector<string> parameters, bool ignore_conflicts, const vector<bool> &nulls) {
+	DBLOGGER_PROBE2(db__insert__start, sql.c_str(), parameter_bytes(parameters));
+	int64_t id = insert_statement(sql, parameters, ignore_conflicts, nulls);
+	DBLOGGER_PROBE2(db__insert__done, sql.c_str(), id);
+	return id;
+}
+
+int64_t
+DBConnection::insert_statement(string &sql, vector<string> &parameters, bool ignore_conflicts, const vector<bool> &nulls) {
 	if (!valid) return -1;
 
+	StatsTimer timer(stats.db_insert_time);
+	stats_add(stats.db_statements);
+	stats_add(stats.bytes_db, parameter_bytes(parameters));
+
 	if (db_type == "sqlite") {
 		string finished_sql;
 		if (ignore_conflicts) {
@@ -312,18 +612,22 @@ DBConnection::insert(string sql, vector<string> parameters, bool ignore_conflict
 		sqlite3_mutex* mtx = sqlite3_db_mutex(sqlite);
 		sqlite3_mutex_enter(mtx);
 
-		sqlite3_stmt *stmt = prepare_sqlite_statement(finished_sql, parameters, sqlite);
+		sqlite3_stmt *stmt = prepare_sqlite_statement(finished_sql, parameters, nulls, sqlite);
 		if (stmt != NULL) {
 			int result = sqlite3_step(stmt);
 			sqlite3_finalize(stmt);
 			if ((result != SQLITE_DONE) && (result != SQLITE_ROW)) {
 				sqlite3_mutex_leave(mtx);
+				stats_add(stats.db_errors);
 				return -1;
 			}
-			int id = sqlite3_last_insert_rowid(sqlite);
+			// the last insert rowid is left over from an earlier insert when the conflict was ignored
+			int64_t id = (sqlite3_changes(sqlite) > 0) ? sqlite3_last_insert_rowid(sqlite) : -1;
 			sqlite3_mutex_leave(mtx);
 			return id;
 		}
+		sqlite3_mutex_leave(mtx);
+		stats_add(stats.db_errors);
 	} else if (db_type == "postgres") {
 		string finished_sql;
 		if (ignore_conflicts) {
@@ -331,21 +635,23 @@ DBConnection::insert(string sql, vector<string> parameters, bool ignore_conflict
 		} else {
 			finished_sql = "INSERT " + sql + " RETURNING *";
 		}
-		PGresult *result = execute_pg_statement(finished_sql, parameters, pg);
+		PGresult *result = execute_pg_statement(finished_sql, parameters, nulls, pg);
 
 		if (result) {
 			int status = PQresultStatus(result);
 			if ((status == PGRES_TUPLES_OK) && (PQntuples(result) == 1)) {
 				// fetch id from result
 				int field_number = PQfnumber(result, "id");
-				int id = -1;
+				int64_t id = -1;
 				if (field_number >= 0) {
 					char *value = PQgetvalue(result, 0, field_number);
-					id = std::atoi(value);
+					id = std::strtoll(value, NULL, 10);
 				}
 				PQclear(result);
 				return id;
 			} else if (status == PGRES_TUPLES_OK) {
+				// conflict ignored, nothing inserted
+				PQclear(result);
 				return -1;
 			} else {
 				cerr << "PostgreSQL Error: (status = " << status << ") " << PQresultErrorMessage(result);
@@ -353,6 +659,7 @@ DBConnection::insert(string sql, vector<string> parameters, bool ignore_conflict
 			}
 		}
 
+		stats_add(stats.db_errors);
 		valid = false;
 		cerr << "PostgreSQL Error: Insert failed, Out of memory or bad connection\n";
 	}
@@ -367,29 +674,43 @@ DBConnection::execute(string sql) {
 }
 
 bool
-DBConnection::execute(string sql, vector<string> parameters) {
+DBConnection::execute(string sql, vector<string> parameters, const vector<bool> &nulls) {
+	DBLOGGER_PROBE2(db__execute__start, sql.c_str(), parameter_bytes(parameters));
+	bool success = execute_statement(sql, parameters, nulls);
+	DBLOGGER_PROBE2(db__execute__done, sql.c_str(), success);
+	return success;
+}
+
+bool
+DBConnection::execute_statement(string &sql, vector<string> &parameters, const vector<bool> &nulls) {
 	if (!valid) return false;
 
+	StatsTimer timer(stats.db_execute_time);
+	stats_add(stats.db_statements);
+	stats_add(stats.bytes_db, parameter_bytes(parameters));
+
 	if (db_type == "sqlite") {
 		// SQLite implementation of execute
 		sqlite3_mutex* mtx = sqlite3_db_mutex(sqlite);
 		sqlite3_mutex_enter(mtx);
 
-		sqlite3_stmt *stmt = prepare_sqlite_statement(sql, parameters, sqlite);
+		sqlite3_stmt *stmt = prepare_sqlite_statement(sql, parameters, nulls, sqlite);
 		if (stmt != NULL) {
 			int result = sqlite3_step(stmt);
 			sqlite3_finalize(stmt);
 			if ((result != SQLITE_DONE) && (result != SQLITE_ROW)) {
 				sqlite3_mutex_leave(mtx);
+				stats_add(stats.db_errors);
 				return false;
 			}
 			sqlite3_mutex_leave(mtx);
 			return true;
 		}
 		sqlite3_mutex_leave(mtx);
+		stats_add(stats.db_errors);
 	} else if (db_type == "postgres") {
 		// Postgres implementation of execute
-		PGresult *result = execute_pg_statement(sql, parameters, pg);
+		PGresult *result = execute_pg_statement(sql, parameters, nulls, pg);
 
 		if (result) {
 			int status = PQresultStatus(result);
@@ -400,11 +721,13 @@ DBConnection::execute(string sql, vector<string> parameters) {
 				return true;
 			}
 
+			stats_add(stats.db_errors);
 			valid = false;
 			cerr << "PostgreSQL Error: " << PQresultErrorMessage(result);
 			return false;
 		}
 
+		stats_add(stats.db_errors);
 		valid = false;
 		cerr << "PostgreSQL Error: Exec query failed, Out of memory or bad connection\n";
 		return false;
@@ -414,34 +737,94 @@ DBConnection::execute(string sql, vector<string> parameters) {
 	return false;
 }
 
+bool
+DBConnection::execute(string sql, const vector<const string *> &parameters, const vector<bool> &binary) {
+	DBLOGGER_PROBE2(db__execute__start, sql.c_str(), parameter_bytes(parameters));
+	bool success = execute_binary_statement(sql, parameters, binary);
+	DBLOGGER_PROBE2(db__execute__done, sql.c_str(), success);
+	return success;
+}
+
+bool
+DBConnection::execute_binary_statement(string &sql, const vector<const string *> &parameters, const vector<bool> &binary) {
+	if (!valid) return false;
+
+	StatsTimer timer(stats.db_execute_time);
+	stats_add(stats.db_statements);
+	stats_add(stats.bytes_db, parameter_bytes(parameters));
+
+	if (db_type == "sqlite") {
+		sqlite3_mutex* mtx = sqlite3_db_mutex(sqlite);
+		sqlite3_mutex_enter(mtx);
+
+		sqlite3_stmt *stmt = prepare_sqlite_binary_statement(sql, parameters, binary, sqlite);
+		int result = (stmt != NULL) ? sqlite3_step(stmt) : SQLITE_ERROR;
+		sqlite3_finalize(stmt);
+		sqlite3_mutex_leave(mtx);
+		if ((result != SQLITE_DONE) && (result != SQLITE_ROW)) {
+			stats_add(stats.db_errors);
+			return false;
+		}
+		return true;
+	} else if (db_type == "postgres") {
+		PGresult *result = execute_pg_binary_statement(sql, parameters, binary, pg);
+		int status = result ? PQresultStatus(result) : PGRES_FATAL_ERROR;
+		if ((status == PGRES_COMMAND_OK) || (status == PGRES_TUPLES_OK)) {
+			PQclear(result);
+			return true;
+		}
+
+		stats_add(stats.db_errors);
+		valid = false;
+		cerr << "PostgreSQL Error: " << (result ? PQresultErrorMessage(result) : "Exec query failed, Out of memory or bad connection\n");
+		PQclear(result);
+		return false;
+	}
+
+	return false;
+}
+
 vector< map<string, string> >*
 DBConnection::query(string sql) {
 	return query(sql, vector<string>());
 }
 
 vector< map<string, string> >*
-DBConnection::query(string sql, vector<string> parameters) {
+DBConnection::query(string sql, vector<string> parameters, const vector<bool> &nulls) {
+	DBLOGGER_PROBE2(db__query__start, sql.c_str(), parameter_bytes(parameters));
+	auto result = query_statement(sql, parameters, nulls);
+	DBLOGGER_PROBE2(db__query__done, sql.c_str(), result ? result->size() : 0);
+	return result;
+}
+
+vector< map<string, string> >*
+DBConnection::query_statement(string &sql, vector<string> &parameters, const vector<bool> &nulls) {
 	auto result = new vector< map<string, string> >();
 	if (!valid) return result;
 
+	StatsTimer timer(stats.db_query_time);
+	stats_add(stats.db_statements);
+
 	if (db_type == "sqlite") {
 		sqlite3_mutex* mtx = sqlite3_db_mutex(sqlite);
 		sqlite3_mutex_enter(mtx);
 
-		sqlite3_stmt *stmt = prepare_sqlite_statement(sql, parameters, sqlite);
+		sqlite3_stmt *stmt = prepare_sqlite_statement(sql, parameters, nulls, sqlite);
 		if (stmt != NULL) {
 			int status = sqlite3_step(stmt);
 			while (status == SQLITE_ROW) {
 				auto row = map<string, string>();
 				for(int i = 0; i < sqlite3_column_count(stmt); i++) {
 					auto name = string((char *)sqlite3_column_name(stmt, i));
-					auto value = string((char *)sqlite3_column_text(stmt, i));
+					const char *text = (const char *)sqlite3_column_text(stmt, i);
+					auto value = string(text ? text : ""); // NULL is returned as empty string like libpq does
 					row[name] = value;
 				}
 				result->push_back(row);
 				status = sqlite3_step(stmt);
 			}
 			if (status != SQLITE_DONE) {
+				stats_add(stats.db_errors);
 				cerr << "SQL query failed " << sql << ": " << sqlite3_errmsg(sqlite);
 			}
 			sqlite3_finalize(stmt);
@@ -450,7 +833,7 @@ DBConnection::query(string sql, vector<string> parameters) {
 		}
 		sqlite3_mutex_leave(mtx);
 	} else if (db_type == "postgres") {
-		PGresult *pg_result = execute_pg_statement(sql, parameters, pg);
+		PGresult *pg_result = execute_pg_statement(sql, parameters, nulls, pg);
 
 		if (pg_result) {
 			int status = PQresultStatus(pg_result);
@@ -466,11 +849,13 @@ DBConnection::query(string sql, vector<string> parameters) {
 					result->push_back(row_result);
 				}
 			} else {
+				stats_add(stats.db_errors);
 				valid = false;
 				cerr << "PostgreSQL Error: " << PQresultErrorMessage(pg_result);
 			}
 			PQclear(pg_result);
 		} else {
+			stats_add(stats.db_errors);
 			valid = false;
 			cerr << "PostgreSQL Error: Query failed, Out of memory or bad connection\n";
 		}
@@ -480,3 +865,83 @@ DBConnection::query(string sql, vector<string> parameters) {
 
 	return result;
 }
+
+/*
+ * Change notifications
+ */
+
+void
+DBConnection::sqlite_update_hook(void *arg, int operation, const char *database, const char *table, sqlite3_int64 rowid) {
+	DBConnection *connection = (DBConnection *)arg;
+	if ((operation != SQLITE_INSERT) || (connection->tracked_table != table)) {
+		return;
+	}
+	if ((connection->inserted_first < 0) || (rowid < connection->inserted_first)) {
+		connection->inserted_first = rowid;
+	}
+	if (rowid > connection->inserted_last) {
+		connection->inserted_last = rowid;
+	}
+}
+
+void
+DBConnection::track_inserts(string table) {
+	if ((db_type != "sqlite") || (sqlite == NULL)) {
+		return;
+	}
+	tracked_table = table;
+	sqlite3_update_hook(sqlite, &DBConnection::sqlite_update_hook, this);
+}
+
+bool
+DBConnection::inserted_range(int64_t &first, int64_t &last) {
+	if (inserted_first < 0) {
+		return false;
+	}
+	first = inserted_first;
+	last = inserted_last;
+	inserted_first = -1;
+	inserted_last = -1;
+	return true;
+}
+
+bool
+DBConnection::listen(string channel) {
+	if ((db_type != "postgres") || !valid) {
+		return false;
+	}
+	return execute("LISTEN \"" + channel + "\";");
+}
+
+bool
+DBConnection::wait_notifications(int timeout_ms, vector<string> &payloads) {
+	if ((db_type != "postgres") || !valid) {
+		return false;
+	}
+
+	int socket = PQsocket(pg);
+	if (socket < 0) {
+		valid = false;
+		return false;
+	}
+
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(socket, &readable);
+	struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	if (select(socket + 1, &readable, NULL, NULL, &timeout) < 0) {
+		return true; // interrupted
+	}
+
+	if (!PQconsumeInput(pg)) {
+		cerr << "PostgreSQL Error: " << PQerrorMessage(pg);
+		valid = false;
+		return false;
+	}
+	PGnotify *notify;
+	while ((notify = PQnotifies(pg)) != NULL) {
+		payloads.push_back(notify->extra);
+		PQfreemem(notify);
+	}
+	return true;
+}
@@ -4,6 +4,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <stdint.h>
 
 #include <sqlite3.h>
 #include <libpq-fe.h>
@@ -13,22 +14,53 @@ using std::map;
 using std::vector;
 using std::exception;
 
+enum IndexProfileResult { INDEX_PROFILE_DONE, INDEX_PROFILE_SKIPPED, INDEX_PROFILE_FAILED };
+
 class DBConnection {
 	public:
-		DBConnection(string db_type, string db_host, int db_port, string db_user, string db_password, string db_name, string prefix, string logger_name);
+		// `migrate: false` skips the schema setup, for helper connections to a DB that is set up already
+		DBConnection(string db_type, string db_host, int db_port, string db_user, string db_password, string db_name, string prefix, string logger_name, int layout = 1, bool migrate = true);
 		~DBConnection();
 		bool execute(string sql);
-		bool execute(string sql, vector<string> parameters); // not available for all DB implementations
+		// parameters marked in `nulls` are bound as NULL
+		bool execute(string sql, vector<string> parameters, const vector<bool> &nulls = vector<bool>()); // not available for all DB implementations
+		// parameters are bound without copying them, the ones marked in `binary` as blobs (bytea on
+		// Postgres), all others as text. A NULL pointer is a NULL value.
+		bool execute(string sql, const vector<const string *> &parameters, const vector<bool> &binary);
 		vector< map<string, string> >* query(string sql);
-		vector< map<string, string> >* query(string sql, vector<string> parameters);
-		int insert(string sql);
-		int insert(string sql, vector<string> parameters);
-		int insert(string sql, vector<string> parameters, bool ignore_conflicts);
+		vector< map<string, string> >* query(string sql, vector<string> parameters, const vector<bool> &nulls = vector<bool>());
+		// returns the ID of the new row, -1 on errors and when the row was skipped by `ignore_conflicts`
+		int64_t insert(string sql);
+		int64_t insert(string sql, vector<string> parameters);
+		int64_t insert(string sql, vector<string> parameters, bool ignore_conflicts, const vector<bool> &nulls = vector<bool>());
+		void setup_field_indexes(vector<string> keys, bool gin);
+
+		// Indexes for time range and level queries on the log table, profile "time": a BRIN index on
+		// `time` and a partial index on `level >= 50` on Postgres (built CONCURRENTLY), an index on
+		// (`time`, `level`) on SQLite. SQLite blocks writers while building an index, it is skipped
+		// when the table has more than `sqlite_max_rows` rows (0: no limit). Postgres builds are
+		// done by one connection at a time, the others return INDEX_PROFILE_DONE right away.
+		IndexProfileResult setup_index_profile(string profile, int64_t sqlite_max_rows = 0);
+
+		// abort the statement running on this connection from another thread
+		void cancel();
+
+		// Use hashes of the natural keys as dimension IDs, see hash_id(). Postgres needs int8 ID
+		// columns, false (with a warning) if they are still int4.
+		bool enable_hash_ids();
+		bool hash_ids;
+
+		// SQLite: remember the first and last rowid inserted into `table` on this connection,
+		// inserted_range() returns and resets them, false if nothing was inserted
+		void track_inserts(string table);
+		bool inserted_range(int64_t &first, int64_t &last);
+
+		// Postgres: LISTEN on a channel and wait up to `timeout_ms` for notifications, their
+		// payloads are appended to `payloads`. False if the connection failed.
+		bool listen(string channel);
+		bool wait_notifications(int timeout_ms, vector<string> &payloads);
 
 		bool valid;
-		string logger_name;
-		int global_log_level;
-		bool log_to_stdout;
 
 		const string db_type;
 		const string db_host;
@@ -37,12 +69,30 @@ class DBConnection {
 		const string db_password;
 		const string db_name;
 		const string prefix;
+		const string application_name;
+
+		// storage layout of the log table: 1 (32 bit IDs, seconds) or 2 (64 bit IDs, microseconds),
+		// a layout other than 1 is only used for new DBs or after running dblogger-migrate
+		const int requested_layout;
+		int layout;
 
 	private:
 		void setup();
+		int schema_version();
+		bool log_table_exists();
+		void warn_layout();
+		int64_t insert_statement(string &sql, vector<string> &parameters, bool ignore_conflicts, const vector<bool> &nulls);
+		bool execute_statement(string &sql, vector<string> &parameters, const vector<bool> &nulls);
+		bool execute_binary_statement(string &sql, const vector<const string *> &parameters, const vector<bool> &binary);
+		vector< map<string, string> >* query_statement(string &sql, vector<string> &parameters, const vector<bool> &nulls);
 
 		sqlite3 *sqlite;
 		PGconn *pg;
+
+		static void sqlite_update_hook(void *arg, int operation, const char *database, const char *table, sqlite3_int64 rowid);
+		string tracked_table;
+		int64_t inserted_first;
+		int64_t inserted_last;
 };
 
 #endif
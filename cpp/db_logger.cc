@@ -1,119 +1,950 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <string>
 #include "db_logger.h"
+#include "hash.h"
+#include "probes.h"
+#include "stats.h"
+#include "tail.h"
 
+using std::cerr;
 using std::cout;
 using std::to_string;
 
-static string *saved_logger_name = NULL;
-static string saved_logger_id = "0";
-static auto tag_cache = map<string, string>();
+// Natural keys of logger, host and tag names are compared case insensitively on SQLite
+// (NOCASE unique constraints), their hash IDs have to agree
+static string fold_key(DBConnection *connection, const string &key) {
+	if (connection->db_type != "sqlite") {
+		return key;
+	}
+	string folded = key;
+	for (char &c : folded) {
+		c = tolower((unsigned char)c);
+	}
+	return folded;
+}
 
-void log_db(DBConnection *connection, int level, time_t date, string hostname, int pid, string filename, string function, int line, int column, vector<string>parts, set<string>tags) {
-	connection->execute("BEGIN TRANSACTION");
+// Condition for logger, host and tag names, the SQLite unique indexes of these are NOCASE
+static string name_condition(DBConnection *connection) {
+	return (connection->db_type == "sqlite") ? "name = $1 COLLATE NOCASE" : "name = $1";
+}
 
-	if (saved_logger_name != &connection->logger_name) {
-		// logger name changed
-		saved_logger_name = &connection->logger_name;
+// Renumber the placeholders $1 ... $count of a condition to $2 ... $count + 1
+static string condition_shifted(string condition, size_t count) {
+	for (size_t i = count; i >= 1; i--) {
+		size_t position;
+		while ((position = condition.find("$" + to_string(i))) != string::npos) {
+			condition.replace(position, 1 + to_string(i).size(), "$" + to_string(i + 1));
+		}
+	}
+	return condition;
+}
 
-		auto replacements = vector<string>();
-		replacements.push_back(*saved_logger_name);
+// Insert a dimension row with the hash of its natural key as ID and return the ID of the row with
+// the key: the hash, or the ID of a row inserted before hash IDs were used. A new key costs one
+// statement, processes inserting the same key concurrently agree on the ID without a lookup.
+// The row is always looked up by its key, never by the hash: on SQLite rows inserted without hash
+// IDs continue the AUTOINCREMENT sequence above the hashes, so the hash can be the ID of another key.
+static string insert_hashed(DBConnection *connection, const string &table, const string &columns, const string &condition, const string &hash_key, const vector<string> &values) {
+	string id = to_string(hash_id(hash_key));
+	string placeholders = "$1";
+	for (size_t i = 0; i < values.size(); i++) {
+		placeholders += ", $" + to_string(i + 2);
+	}
+	vector<string> row = values;
+	row.insert(row.begin(), id);
+
+	// the row of the key, also when it differs only in case from a NOCASE key
+	string select = "SELECT id FROM " + table + " WHERE " + condition;
 
-		// fetch id
-		auto result = connection->query("SELECT id FROM " + connection->prefix + "_logger WHERE name = $1", replacements);
+	if (connection->db_type == "postgres") {
+		// the conflicting row is found in the same statement, unless it was committed while waiting for
+		// the conflict: the statement snapshot is older, so look it up once more
+		auto result = connection->query(
+			"WITH inserted AS (INSERT INTO " + table + " (id, " + columns + ") VALUES (" + placeholders + ") ON CONFLICT DO NOTHING RETURNING id) "
+			"SELECT id FROM inserted UNION ALL (SELECT id FROM " + table + " WHERE " + condition_shifted(condition, values.size()) + " LIMIT 1) LIMIT 1", row
+		);
+		if (result && (result->size() == 0)) {
+			delete result;
+			result = connection->query(select, values);
+		}
+		string found = (result && (result->size() > 0)) ? result->front()[string("id")] : "-1";
+		delete result;
+		return found;
+	}
+
+	// SQLite: the insert returns the hash, -1 when the key (or the hash) is taken already
+	if (to_string(connection->insert("INTO " + table + " (id, " + columns + ") VALUES (" + placeholders + ")", row, true)) == id) {
+		return id;
+	}
+	auto result = connection->query(select, values);
+	string found = (result && (result->size() > 0)) ? result->front()[string("id")] : "-1";
+	delete result;
+	return found;
+}
+
+// Look up the ID of a dimension value, inserts the value if it is not in the DB yet.
+// The transaction is only started on the first cache miss. `condition` compares `columns`
+// with the replacements $1, $2, ...
+static string fetch_dimension(DBConnection *connection, bool &in_transaction, map<string, string> &cache, atomic<uint64_t> &hits, atomic<uint64_t> &misses, string key, string hash_key, string table, string columns, string condition, vector<string> replacements) {
+	auto search = cache.find(key);
+	if (search != cache.end()) {
+		stats_add(hits);
+		return search->second;
+	}
+	stats_add(misses);
+
+	if (!in_transaction) {
+		connection->execute("BEGIN TRANSACTION");
+		in_transaction = true;
+	}
+
+	string id;
+	if (connection->hash_ids) {
+		id = insert_hashed(connection, table, columns, condition, hash_key, replacements);
+	} else {
+		auto result = connection->query("SELECT id FROM " + table + " WHERE " + condition, replacements);
 		if (result && result->size() > 0) {
-			saved_logger_id = result->front()[string("id")];
+			id = result->front()[string("id")];
 		} else {
-			// insert logger name into DB, will ignore the insert statement when a constraint error occurs
-			saved_logger_id = to_string(connection->insert("INTO " + connection->prefix + "_logger (name) VALUES ($1)", replacements));
+			// insert value into DB, will ignore the insert statement when a constraint error occurs
+			string placeholders = "";
+			for (size_t i = 0; i < replacements.size(); i++) {
+				placeholders += ((i > 0) ? ", $" : "$") + to_string(i + 1);
+			}
+			id = to_string(connection->insert("INTO " + table + " (" + columns + ") VALUES (" + placeholders + ")", replacements));
 		}
+		delete result;
 	}
 
-	// insert host name into DB, will ignore the insert statement when a constraint error occurs
-	auto replacements = vector<string>();
-	replacements.push_back(hostname);
+	// do not cache failed inserts
+	if (id != "-1") {
+		cache[key] = id;
+	}
+	return id;
+}
 
-	auto result = connection->query("SELECT id FROM " + connection->prefix + "_hosts WHERE name = $1", replacements);
-	string hostname_id;
-	if (result && result->size() > 0) {
-		hostname_id = result->front()[string("id")];
-	} else {
-		hostname_id = to_string(connection->insert("INTO " + connection->prefix + "_hosts (name) VALUES ($1)", replacements));
+// Look up the ID of an interned tag set, the set is stored once as the sorted list of its tag IDs
+// with one member row per tag. Entries without tags have no tag set (empty ID, NULL in the DB).
+static string fetch_tagset(DBConnection *connection, bool &in_transaction, DimensionCache &cache, const TagSetRef &tag_set) {
+	if (tag_set->names.empty()) {
+		return "";
 	}
 
-	// insert source path into DB, will ignore the insert statement when a constraint error occurs
-	replacements = vector<string>();
-	replacements.push_back(filename);
+	auto search = cache.tagsets.find(tag_set->key);
+	if (search != cache.tagsets.end()) {
+		stats_add(stats.tag_cache_hits);
+		return search->second;
+	}
+
+	// resolve the tags, the set is ordered by name so the ID list is stable
+	auto tag_ids = vector<string>();
+	string tag_list = "";
+	for (const string &tag : tag_set->names) {
+		auto replacements = vector<string>();
+		replacements.push_back(tag);
+		string tag_id = fetch_dimension(connection, in_transaction, cache.tags, stats.tag_cache_hits, stats.tag_cache_misses, tag, fold_key(connection, tag),
+			connection->prefix + "_tag", "name", name_condition(connection), replacements
+		);
+		if (tag_id == "-1") {
+			return "";
+		}
+		tag_ids.push_back(tag_id);
+		tag_list += (tag_list.size() > 0) ? "," + tag_id : tag_id;
+	}
+
+	if (!in_transaction) {
+		connection->execute("BEGIN TRANSACTION");
+		in_transaction = true;
+	}
 
-	result = connection->query("SELECT id FROM " + connection->prefix + "_source WHERE path = $1", replacements);
-	string source_id;
-	if (result && result->size() > 0) {
-		source_id = result->front()[string("id")];
+	auto replacements = vector<string>();
+	replacements.push_back(tag_list);
+	string id;
+	bool inserted = false;
+	if (connection->hash_ids) {
+		// the member rows are inserted by every process that sees the set first, they are identical
+		id = insert_hashed(connection, connection->prefix + "_tagset", "\"tagIDs\"", "\"tagIDs\" = $1", tag_list, replacements);
+		inserted = (id != "-1");
 	} else {
-		source_id = to_string(connection->insert("INTO " + connection->prefix + "_source (path) VALUES ($1)", replacements));
+		auto result = connection->query("SELECT id FROM " + connection->prefix + "_tagset WHERE \"tagIDs\" = $1", replacements);
+		if (result && result->size() > 0) {
+			id = result->front()[string("id")];
+		} else {
+			id = to_string(connection->insert("INTO " + connection->prefix + "_tagset (\"tagIDs\") VALUES ($1)", replacements));
+			inserted = (id != "-1");
+		}
+		delete result;
+	}
+	if (inserted) {
+		for (const string &tag_id : tag_ids) {
+			replacements = vector<string>();
+			replacements.push_back(id);
+			replacements.push_back(tag_id);
+			connection->insert("INTO " + connection->prefix + "_tagset_member (\"tagsetID\", \"tagID\") VALUES ($1, $2)", replacements, true);
+		}
 	}
 
-	// insert function definition into DB, will ignore the insert statement when a constraint error occurs
+	if (id == "-1") {
+		return "";
+	}
+	cache.tagsets[tag_set->key] = id;
+	return id;
+}
+
+static const string log_columns = "level, message, pid, time, \"loggerID\", \"hostnameID\", \"functionID\", fields, \"tagsetID\", context";
+static const size_t log_column_count = 10;
+
+// Append the values of the log row of an entry with resolved dimensions to `row`, `nulls` marks the NULL values
+static void append_row(DBConnection *connection, const LogEntry &entry, const string &logger_id, const string &hostname_id, const string &function_id, const string &tagset_id, vector<string> &row, vector<bool> &nulls) {
+	row.push_back(to_string(entry.level));
+	row.push_back(entry.message());
+	row.push_back(to_string(entry.pid));
+	row.push_back(to_string((connection->layout >= 2) ? entry.time_us : (int64_t)entry.date));
+	row.push_back(logger_id);
+	row.push_back(hostname_id);
+	row.push_back(function_id);
+	row.push_back(entry.fields);
+	row.push_back(tagset_id);
+	row.push_back(entry.context);
+	nulls.insert(nulls.end(), { false, false, false, false, false, false, false, entry.fields.empty(), tagset_id.empty(), entry.context.empty() });
+}
+
+// Resolve the dimensions of an entry and append the values of its log row to `row`,
+// when `batch` is set the caller manages the transaction
+static void resolve_entry(DBConnection *connection, DimensionCache &cache, const LogEntry &entry, bool batch, vector<string> &row, vector<bool> &nulls) {
+	bool in_transaction = batch;
+
+	// logger name
+	auto replacements = vector<string>();
+	replacements.push_back(entry.logger_name);
+	string logger_id = fetch_dimension(connection, in_transaction, cache.loggers, stats.dimension_cache_hits, stats.dimension_cache_misses, entry.logger_name, fold_key(connection, entry.logger_name),
+		connection->prefix + "_logger", "name", name_condition(connection), replacements
+	);
+
+	// host name
+	replacements = vector<string>();
+	replacements.push_back(entry.hostname);
+	string hostname_id = fetch_dimension(connection, in_transaction, cache.hosts, stats.dimension_cache_hits, stats.dimension_cache_misses, entry.hostname, fold_key(connection, entry.hostname),
+		connection->prefix + "_hosts", "name", name_condition(connection), replacements
+	);
+
+	// source path
 	replacements = vector<string>();
-	replacements.push_back(function);
-	replacements.push_back(to_string(line));
+	replacements.push_back(entry.filename);
+	string source_id = fetch_dimension(connection, in_transaction, cache.sources, stats.dimension_cache_hits, stats.dimension_cache_misses, entry.filename, entry.filename,
+		connection->prefix + "_source", "path", "path = $1", replacements
+	);
+
+	// function definition
+	replacements = vector<string>();
+	replacements.push_back(entry.function);
+	replacements.push_back(to_string(entry.line));
 	replacements.push_back(source_id);
+	string function_key = entry.function + "\n" + to_string(entry.line) + "\n" + source_id;
+	string function_id = fetch_dimension(connection, in_transaction, cache.functions, stats.dimension_cache_hits, stats.dimension_cache_misses, function_key, function_key,
+		connection->prefix + "_function", "name, \"lineNumber\", \"sourceID\"", "name = $1 AND \"lineNumber\" = $2 AND \"sourceID\" = $3", replacements
+	);
 
-	result = connection->query("SELECT id FROM " + connection->prefix + "_function WHERE name = $1 AND \"lineNumber\" = $2 AND \"sourceID\" = $3", replacements);
-	string function_id;
-	if (result && result->size() > 0) {
-		function_id = result->front()[string("id")];
-	} else {
-		function_id = to_string(connection->insert("INTO " + connection->prefix + "_function (name, \"lineNumber\", \"sourceID\") VALUES ($1, $2, $3)", replacements));
+	// tags
+	string tagset_id = fetch_tagset(connection, in_transaction, cache, entry.tags);
+
+	if (in_transaction && !batch) {
+		connection->execute("COMMIT TRANSACTION");
 	}
 
-	connection->execute("COMMIT TRANSACTION");
+	append_row(connection, entry, logger_id, hostname_id, function_id, tagset_id, row, nulls);
+}
 
-	// insert log entry
-	string message = "";
-	for (string part : parts) {
-		message += part + " ";
+// Append the values of the log row of an entry if all its dimensions are cached,
+// returns false without touching `row` on the first cache miss
+static bool cached_entry(DBConnection *connection, DimensionCache &cache, const LogEntry &entry, vector<string> &row, vector<bool> &nulls) {
+	auto logger = cache.loggers.find(entry.logger_name);
+	auto host = cache.hosts.find(entry.hostname);
+	auto source = cache.sources.find(entry.filename);
+	if ((logger == cache.loggers.end()) || (host == cache.hosts.end()) || (source == cache.sources.end())) {
+		return false;
 	}
-	replacements = vector<string>();
-	replacements.push_back(to_string(level));
-	replacements.push_back(message);
-	replacements.push_back(to_string(pid));
-	replacements.push_back(to_string(date));
-	replacements.push_back(saved_logger_id);
-	replacements.push_back(hostname_id);
-	replacements.push_back(function_id);
-
-	auto entry_id = connection->insert("INTO " + connection->prefix + "_log (level, message, pid, time, \"loggerID\", \"hostnameID\", \"functionID\") VALUES ($1, $2, $3, $4, $5, $6, $7)", replacements);
-
-	// fetch or create Tags
-	auto tagIDs = vector<string>();
-	for (string tag : tags) {
-		auto search = tag_cache.find(tag);
-		if (search != tag_cache.end()) {
-			tagIDs.push_back(search->second);
+	auto function = cache.functions.find(entry.function + "\n" + to_string(entry.line) + "\n" + source->second);
+	if (function == cache.functions.end()) {
+		return false;
+	}
+	string tagset_id = "";
+	if (!entry.tags->names.empty()) {
+		auto tagset = cache.tagsets.find(entry.tags->key);
+		if (tagset == cache.tagsets.end()) {
+			return false;
+		}
+		tagset_id = tagset->second;
+		stats_add(stats.tag_cache_hits);
+	}
+	stats_add(stats.dimension_cache_hits, 4);
+
+	append_row(connection, entry, logger->second, host->second, function->second, tagset_id, row, nulls);
+	return true;
+}
+
+// Attachments of a written log row, the data is bound as blob/bytea without copying it
+static void write_attachments(DBConnection *connection, const LogEntry &entry, const string &log_id) {
+	auto positions = vector<string>();
+	auto sizes = vector<string>();
+	for (size_t i = 0; i < entry.attachments.size(); i++) {
+		positions.push_back(to_string(i));
+		sizes.push_back(to_string(entry.attachments[i].size));
+	}
+
+	string sql = "INSERT INTO " + connection->prefix + "_attachment (\"logID\", position, type, size, data) VALUES ";
+	auto parameters = vector<const string *>();
+	auto binary = vector<bool>();
+	for (size_t i = 0; i < entry.attachments.size(); i++) {
+		size_t parameter = parameters.size() + 1;
+		sql += (i > 0) ? ", (" : "(";
+		for (size_t j = 0; j < 5; j++) {
+			sql += ((j > 0) ? ", $" : "$") + to_string(parameter + j);
+		}
+		sql += ")";
+
+		const LogAttachment &attachment = entry.attachments[i];
+		parameters.push_back(&log_id);
+		parameters.push_back(&positions[i]);
+		parameters.push_back(&attachment.type);
+		parameters.push_back(&sizes[i]);
+		parameters.push_back(&attachment.data);
+		binary.insert(binary.end(), { false, false, false, false, true });
+	}
+
+	// a failed statement is counted in db_errors, the log row is kept
+	connection->execute(sql, parameters, binary);
+}
+
+// Postgres array literal, the elements marked in `nulls` are NULL, all others are quoted
+static string pg_array(const vector<string> &values, const vector<bool> &nulls) {
+	string literal = "{";
+	for (size_t i = 0; i < values.size(); i++) {
+		literal += (i > 0) ? "," : "";
+		if ((i < nulls.size()) && nulls[i]) {
+			literal += "NULL";
 			continue;
 		}
+		literal += "\"";
+		for (char c : values[i]) {
+			if ((c == '"') || (c == '\\')) {
+				literal += '\\';
+			}
+			literal += c;
+		}
+		literal += "\"";
+	}
+	return literal + "}";
+}
 
-		// insert tag into DB, will ignore the insert statement when a constraint error occurs
-		auto replacements = vector<string>();
-		replacements.push_back(tag);
+// Write entries through the server side ingest function (Postgres, schema version 5): one
+// statement resolves all dimensions and inserts the log rows, the returned IDs fill the cache
+// and link the attachments
+static void ingest_entries(DBConnection *connection, DimensionCache &cache, const LogEntry *entries, size_t count) {
+	vector<string> columns[12];
+	vector<bool> nulls[12];
+	for (size_t i = 0; i < count; i++) {
+		const LogEntry &entry = entries[i];
+		string tags = "";
+		for (const string &tag : entry.tags->names) {
+			tags += (tags.size() > 0) ? "\x1f" + tag : tag;
+		}
+		columns[0].push_back(to_string(entry.level));
+		columns[1].push_back(entry.message());
+		columns[2].push_back(to_string(entry.pid));
+		columns[3].push_back(to_string((connection->layout >= 2) ? entry.time_us : (int64_t)entry.date));
+		columns[4].push_back(entry.logger_name);
+		columns[5].push_back(entry.hostname);
+		columns[6].push_back(entry.filename);
+		columns[7].push_back(entry.function);
+		columns[8].push_back(to_string(entry.line));
+		columns[9].push_back(entry.fields);
+		nulls[9].push_back(entry.fields.empty());
+		columns[10].push_back(tags);
+		columns[11].push_back(entry.context);
+		nulls[11].push_back(entry.context.empty());
+	}
 
-		auto result = connection->query("SELECT id FROM " + connection->prefix + "_tag WHERE name = $1", replacements);
-		string tag_id;
-		if (result && result->size() > 0) {
-			tag_id = result->front()[string("id")];
+	auto parameters = vector<string>();
+	for (size_t i = 0; i < 12; i++) {
+		parameters.push_back(pg_array(columns[i], nulls[i]));
+	}
+	auto result = connection->query(
+		"SELECT * FROM \"" + connection->prefix + "_ingest_batch\"($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12)",
+		parameters
+	);
+
+	size_t written = result ? result->size() : 0;
+	if (written != count) {
+		stats_add(stats.dropped, count - written);
+	}
+	for (size_t i = 0; i < written && i < count; i++) {
+		const LogEntry &entry = entries[i];
+		auto &row = (*result)[i];
+		stats_add(stats.dimension_cache_misses, 4);
+
+		cache.loggers[entry.logger_name] = row["logger_id"];
+		cache.hosts[entry.hostname] = row["host_id"];
+		cache.sources[entry.filename] = row["source_id"];
+		cache.functions[entry.function + "\n" + to_string(entry.line) + "\n" + row["source_id"]] = row["function_id"];
+		if (!entry.tags->names.empty() && (row["tagset_id"].size() > 0)) {
+			cache.tagsets[entry.tags->key] = row["tagset_id"];
+		}
+		if (entry.attachments.size() > 0) {
+			write_attachments(connection, entry, row["log_id"]);
+		}
+	}
+	delete result;
+}
+
+// Placeholders for `rows` log rows: ($1, ..., $10), ($11, ...
+static string row_placeholders(size_t rows) {
+	string sql = "";
+	size_t parameter = 1;
+	for (size_t i = 0; i < rows; i++) {
+		sql += (i > 0) ? ", (" : "(";
+		for (size_t j = 0; j < log_column_count; j++) {
+			sql += ((j > 0) ? ", $" : "$") + to_string(parameter++);
+		}
+		sql += ")";
+	}
+	return sql;
+}
+
+// Insert the resolved log rows of `count` entries, `values` holds log_column_count values per
+// entry, `nulls` marks the NULL values. Runs of entries without attachments are written with one statement, an entry with
+// attachments is inserted on its own as its ID is needed for the attachment rows.
+static void insert_rows(DBConnection *connection, const LogEntry *entries, size_t count, const vector<string> &values, const vector<bool> &nulls) {
+	size_t run_start = 0;
+	for (size_t i = 0; i <= count; i++) {
+		if ((i < count) && (entries[i].attachments.size() == 0)) {
+			continue;
+		}
+
+		if (i > run_start) {
+			auto run = vector<string>(values.begin() + run_start * log_column_count, values.begin() + i * log_column_count);
+			auto run_nulls = vector<bool>(nulls.begin() + run_start * log_column_count, nulls.begin() + i * log_column_count);
+			if (!connection->execute("INSERT INTO " + connection->prefix + "_log (" + log_columns + ") VALUES " + row_placeholders(i - run_start), run, run_nulls)) {
+				stats_add(stats.dropped, i - run_start);
+			}
+		}
+		run_start = i + 1;
+
+		if (i < count) {
+			auto row = vector<string>(values.begin() + i * log_column_count, values.begin() + (i + 1) * log_column_count);
+			auto row_nulls = vector<bool>(nulls.begin() + i * log_column_count, nulls.begin() + (i + 1) * log_column_count);
+			auto entry_id = connection->insert("INTO " + connection->prefix + "_log (" + log_columns + ") VALUES " + row_placeholders(1), row, false, row_nulls);
+			if (entry_id < 0) {
+				stats_add(stats.dropped);
+			} else {
+				write_attachments(connection, entries[i], to_string(entry_id));
+			}
+		}
+	}
+}
+
+void log_db(DBConnection *connection, DimensionCache &cache, const LogEntry &entry) {
+	DBLOGGER_PROBE1(db__start, 1);
+	{
+		StatsTimer timer(stats.db_time);
+
+		// the ingest functions return int4 IDs, hash IDs are resolved by the client
+		auto row = vector<string>();
+		auto nulls = vector<bool>();
+		if ((connection->db_type != "postgres") || connection->hash_ids) {
+			resolve_entry(connection, cache, entry, false, row, nulls);
+		} else if (!cached_entry(connection, cache, entry, row, nulls)) {
+			// one round trip for an entry with uncached dimensions
+			ingest_entries(connection, cache, &entry, 1);
+		}
+
+		if (row.size() > 0) {
+			insert_rows(connection, &entry, 1, row, nulls);
+		}
+	}
+	DBLOGGER_PROBE1(db__done, 1);
+}
+
+void log_db_batch(DBConnection *connection, DimensionCache &cache, const LogEntry *entries, size_t count) {
+	DBLOGGER_PROBE1(db__start, count);
+	{
+		StatsTimer timer(stats.db_time);
+
+		// multi row inserts, SQLite allows 999 parameters per statement in older versions
+		bool postgres = (connection->db_type == "postgres");
+		bool ingest = postgres && !connection->hash_ids;
+		size_t chunk_size = postgres ? 1000 : 999 / log_column_count;
+
+		// a single Postgres statement does not need a transaction, attachments are separate statements
+		bool transaction = !ingest || (count > chunk_size);
+		for (size_t i = 0; (i < count) && !transaction; i++) {
+			transaction = (entries[i].attachments.size() > 0);
+		}
+		if (transaction) {
+			connection->execute("BEGIN TRANSACTION");
+		}
+
+		for (size_t start = 0; start < count; start += chunk_size) {
+			size_t rows = (count - start < chunk_size) ? count - start : chunk_size;
+			auto values = vector<string>();
+			auto nulls = vector<bool>();
+			values.reserve(rows * log_column_count);
+
+			// Postgres resolves a chunk with uncached dimensions server side
+			bool cached = true;
+			for (size_t i = start; (i < start + rows) && cached; i++) {
+				if (ingest) {
+					cached = cached_entry(connection, cache, entries[i], values, nulls);
+				} else {
+					resolve_entry(connection, cache, entries[i], true, values, nulls);
+				}
+			}
+			if (!cached) {
+				ingest_entries(connection, cache, entries + start, rows);
+				continue;
+			}
+			insert_rows(connection, entries + start, rows, values, nulls);
+		}
+
+		if (transaction) {
+			connection->execute("COMMIT TRANSACTION");
+		}
+	}
+	DBLOGGER_PROBE1(db__done, count);
+}
+
+/*
+ * Rollups
+ */
+
+static inline const string &rollup_id(const string &id) {
+	static const string unknown = "0";
+	return id.empty() ? unknown : id;
+}
+
+void rollup_add(const DimensionCache &cache, const LogEntry *entries, size_t count, RollupCounters &counters) {
+	for (size_t i = 0; i < count; i++) {
+		const LogEntry &entry = entries[i];
+		auto logger = cache.loggers.find(entry.logger_name);
+		auto host = cache.hosts.find(entry.hostname);
+		auto source = cache.sources.find(entry.filename);
+		string function_id = "";
+		if (source != cache.sources.end()) {
+			auto function = cache.functions.find(entry.function + "\n" + to_string(entry.line) + "\n" + source->second);
+			function_id = (function != cache.functions.end()) ? function->second : "";
+		}
+
+		RollupKey key = RollupKey(
+			(int64_t)entry.date - (int64_t)entry.date % 60,
+			entry.level,
+			rollup_id((logger != cache.loggers.end()) ? logger->second : ""),
+			rollup_id((host != cache.hosts.end()) ? host->second : ""),
+			rollup_id(function_id)
+		);
+		counters[key]++;
+	}
+}
+
+void rollup_flush(DBConnection *connection, RollupCounters &counters) {
+	if (counters.empty()) {
+		return;
+	}
+
+	string table = "\"" + connection->prefix + "_rollup_minute\"";
+	size_t chunk_size = (connection->db_type == "postgres") ? 1000 : 999 / 6;
+	bool written = connection->execute("BEGIN TRANSACTION");
+
+	auto counter = counters.begin();
+	while (written && (counter != counters.end())) {
+		string sql = "INSERT INTO " + table + " (\"minute\", \"level\", \"loggerID\", \"hostnameID\", \"functionID\", \"count\") VALUES ";
+		auto parameters = vector<string>();
+		for (size_t row = 0; (row < chunk_size) && (counter != counters.end()); row++, counter++) {
+			sql += (row > 0) ? ", (" : "(";
+			for (size_t j = 0; j < 6; j++) {
+				sql += ((j > 0) ? ", $" : "$") + to_string(parameters.size() + j + 1);
+			}
+			sql += ")";
+
+			parameters.push_back(to_string(std::get<0>(counter->first)));
+			parameters.push_back(to_string(std::get<1>(counter->first)));
+			parameters.push_back(std::get<2>(counter->first));
+			parameters.push_back(std::get<3>(counter->first));
+			parameters.push_back(std::get<4>(counter->first));
+			parameters.push_back(to_string(counter->second));
+		}
+		sql += " ON CONFLICT (\"minute\", \"level\", \"loggerID\", \"hostnameID\", \"functionID\") DO UPDATE SET \"count\" = " + table + ".\"count\" + excluded.\"count\"";
+		written = connection->execute(sql, parameters);
+	}
+
+	if (written && connection->execute("COMMIT TRANSACTION")) {
+		counters.clear();
+	} else {
+		connection->execute("ROLLBACK TRANSACTION");
+	}
+}
+
+vector< map<string, string> > *rollup_query(DBConnection *connection, int64_t from, int64_t to, int min_level, int interval, const set<string> &group_by) {
+	string p = "\"" + connection->prefix;
+	string bucket = (interval > 60) ? "(r.\"minute\" / " + to_string(interval) + ") * " + to_string(interval) : "r.\"minute\"";
+	string columns = bucket + " AS time";
+	string joins = "";
+	string groups = "1";
+
+	if (group_by.count("level") > 0) {
+		columns += ", r.\"level\" AS level";
+		groups += ", r.\"level\"";
+	}
+	if (group_by.count("logger") > 0) {
+		columns += ", g.\"name\" AS logger";
+		joins += " LEFT JOIN " + p + "_logger\" g ON g.\"id\" = r.\"loggerID\"";
+		groups += ", r.\"loggerID\", g.\"name\"";
+	}
+	if (group_by.count("host") > 0) {
+		columns += ", h.\"name\" AS host";
+		joins += " LEFT JOIN " + p + "_hosts\" h ON h.\"id\" = r.\"hostnameID\"";
+		groups += ", r.\"hostnameID\", h.\"name\"";
+	}
+	if (group_by.count("function") > 0) {
+		columns += ", f.\"name\" AS function, f.\"lineNumber\" AS line, s.\"path\" AS source";
+		joins += " LEFT JOIN " + p + "_function\" f ON f.\"id\" = r.\"functionID\" LEFT JOIN " + p + "_source\" s ON s.\"id\" = f.\"sourceID\"";
+		groups += ", r.\"functionID\", f.\"name\", f.\"lineNumber\", s.\"path\"";
+	}
+
+	auto parameters = vector<string>();
+	parameters.push_back(to_string(min_level));
+	string conditions = "r.\"level\" >= $1";
+	if (from > 0) {
+		parameters.push_back(to_string(from));
+		conditions += " AND r.\"minute\" >= $" + to_string(parameters.size());
+	}
+	if (to > 0) {
+		parameters.push_back(to_string(to));
+		conditions += " AND r.\"minute\" < $" + to_string(parameters.size());
+	}
+
+	return connection->query(
+		"SELECT " + columns + ", SUM(r.\"count\") AS count FROM " + p + "_rollup_minute\" r" + joins + " "
+		"WHERE " + conditions + " GROUP BY " + groups + " ORDER BY 1;",
+		parameters
+	);
+}
+
+/*
+ * Retention
+ */
+
+// First column of the first row as a number, `fallback` for errors, no rows and NULL
+static int64_t query_int(DBConnection *connection, const string &sql, const string &column, int64_t fallback) {
+	vector< map<string, string> > *rows = connection->query(sql);
+	int64_t value = fallback;
+	if ((rows != NULL) && (rows->size() > 0) && ((*rows)[0][column] != "")) {
+		value = std::stoll((*rows)[0][column]);
+	}
+	delete rows;
+	return value;
+}
+
+long retention_step(DBConnection *connection, const RetentionPolicy &policy, size_t chunk_size) {
+	if ((connection->db_type != "sqlite") || !connection->valid) {
+		return 0;
+	}
+
+	string p = "\"" + connection->prefix;
+	int64_t first = query_int(connection, "SELECT MIN(\"id\") AS first FROM " + p + "_log\";", "first", -1);
+	int64_t last = query_int(connection, "SELECT MAX(\"id\") AS last FROM " + p + "_log\";", "last", -1);
+
+	// entries before `cut` are deleted, IDs grow with time so the oldest entries come first
+	int64_t cut = first;
+	if ((first >= 0) && (policy.max_rows > 0) && (last - first + 1 > policy.max_rows)) {
+		cut = std::max(cut, last - policy.max_rows + 1);
+	}
+	if ((first >= 0) && (policy.max_age > 0)) {
+		int64_t threshold = time(NULL) - policy.max_age;
+		threshold = (connection->layout < 2) ? threshold : threshold * 1000000;
+		int64_t expired = query_int(connection,
+			"SELECT MAX(\"id\") AS id FROM (SELECT \"id\", \"time\" FROM " + p + "_log\" ORDER BY \"id\" LIMIT " + to_string(chunk_size) + ") "
+			"WHERE \"time\" < " + to_string(threshold) + ";", "id", -1);
+		cut = std::max(cut, expired + 1);
+	}
+
+	int64_t page_size = query_int(connection, "PRAGMA page_size;", "page_size", 4096);
+	int64_t free_pages = query_int(connection, "PRAGMA freelist_count;", "freelist_count", 0);
+	if ((first >= 0) && (policy.max_bytes > 0)) {
+		int64_t used = (query_int(connection, "PRAGMA page_count;", "page_count", 0) - free_pages) * page_size;
+		if (used > policy.max_bytes) {
+			cut = std::max(cut, first + (int64_t)chunk_size);
+		}
+	}
+	cut = std::min(cut, first + (int64_t)chunk_size);
+
+	// the newest entry is kept: layout 2 tables have no AUTOINCREMENT, the rowids of an empty table
+	// start at 1 again and readers continuing after a saved ID would skip the new entries
+	cut = std::min(cut, last);
+
+	long deleted = 0;
+	if ((first >= 0) && (cut > first)) {
+		auto parameters = vector<string>{ to_string(cut) };
+		bool success = connection->execute("BEGIN TRANSACTION") &&
+			connection->execute("DELETE FROM " + p + "_log_tag\" WHERE \"logID\" < $1;", parameters) &&
+			connection->execute("DELETE FROM " + p + "_attachment\" WHERE \"logID\" < $1;", parameters) &&
+			connection->execute("DELETE FROM " + p + "_log\" WHERE \"id\" < $1;", parameters);
+		if (!success || !connection->execute("COMMIT TRANSACTION")) {
+			connection->execute("ROLLBACK TRANSACTION");
+			return 0;
+		}
+		deleted = cut - first;
+		free_pages = query_int(connection, "PRAGMA freelist_count;", "freelist_count", 0);
+	}
+
+	// incremental_vacuum releases one page per step of the statement, query() runs all steps
+	long released = 0;
+	if ((free_pages > 0) && (query_int(connection, "PRAGMA auto_vacuum;", "auto_vacuum", 0) == 2)) {
+		released = std::min(free_pages, (int64_t)chunk_size);
+		delete connection->query("PRAGMA incremental_vacuum(" + to_string(released) + ");");
+	}
+	return deleted + released;
+}
+
+bool retention_auto_vacuum(DBConnection *connection, int64_t max_bytes) {
+	if ((connection->db_type != "sqlite") || !connection->valid) {
+		return false;
+	}
+	if (query_int(connection, "PRAGMA auto_vacuum;", "auto_vacuum", 0) == 2) {
+		return true;
+	}
+
+	int64_t bytes = query_int(connection, "PRAGMA page_count;", "page_count", 0) * query_int(connection, "PRAGMA page_size;", "page_size", 4096);
+	if (bytes > max_bytes) {
+		cerr << "Retention can not shrink " << connection->db_name << ", it does not use auto_vacuum = INCREMENTAL. "
+			<< "Convert it while no process is logging to it: sqlite3 " << connection->db_name << " 'PRAGMA auto_vacuum = INCREMENTAL; VACUUM;'\n";
+		return false;
+	}
+	return connection->execute("PRAGMA auto_vacuum = INCREMENTAL;") && connection->execute("VACUUM;");
+}
+
+/*
+ * Sink
+ */
+
+DBSink::DBSink(DBConnection *connection, int level, size_t queue_size, size_t batch_size) :
+	Sink(level, set<string>(), queue_size, batch_size), connection(connection) {
+
+	field_gin_index = false;
+	rollup_interval = 0;
+	rollup_written = time(NULL);
+	retention = RetentionPolicy();
+	retention_prepared = false;
+	retention_stopping = false;
+	index_result = -2;
+	index_builder = NULL;
+	index_stopping = false;
+	connection->track_inserts(connection->prefix + "_log");
+}
+
+DBSink::~DBSink() {
+	stop_index_profile();
+	stop_retention();
+	stop();
+	write_pending();
+	delete connection;
+}
+
+void
+DBSink::write(const LogEntry *entries, size_t count) {
+	if (!connection->valid) {
+		stats_add(stats.reconnects);
+		reopen();
+	}
+
+	if (count == 1) {
+		log_db(connection, cache, entries[0]);
+	} else {
+		log_db_batch(connection, cache, entries, count);
+	}
+
+	// SQLite tails of this process read the committed rows
+	int64_t first, last;
+	if (connection->inserted_range(first, last) && Tail::active()) {
+		Tail::publish(connection, first, last);
+	}
+
+	if (rollup_interval > 0) {
+		rollup_add(cache, entries, count, rollup);
+		if (time(NULL) - rollup_written >= rollup_interval) {
+			write_pending();
+		}
+	}
+}
+
+void
+DBSink::write_pending() {
+	if (!rollup.empty() && connection->valid) {
+		rollup_flush(connection, rollup);
+	}
+	rollup_written = time(NULL);
+}
+
+void
+DBSink::reopen() {
+	// the counters hold IDs of the current DB, a rotated SQLite file starts over
+	write_pending();
+	if (connection->db_type == "sqlite") {
+		rollup.clear();
+	}
+
+	auto new_connection = new DBConnection(
+		connection->db_type,
+		connection->db_host,
+		connection->db_port,
+		connection->db_user,
+		connection->db_password,
+		connection->db_name,
+		connection->prefix,
+		connection->application_name,
+		connection->requested_layout
+	);
+	new_connection->setup_field_indexes(field_indexes, field_gin_index);
+	if (connection->hash_ids) {
+		new_connection->enable_hash_ids();
+	}
+	new_connection->track_inserts(new_connection->prefix + "_log");
+
+	delete connection;
+	connection = new_connection;
+	cache.clear();
+	retention_prepared = false;
+}
+
+void
+DBSink::start_retention(RetentionPolicy policy) {
+	if (!policy.enabled() || (connection->db_type != "sqlite") || retention_worker.joinable()) {
+		return;
+	}
+	retention = policy;
+	retention_worker = std::thread(&DBSink::run_retention, this);
+}
+
+void
+DBSink::stop_retention() {
+	{
+		std::lock_guard<std::mutex> lock(retention_mutex);
+		retention_stopping = true;
+	}
+	retention_changed.notify_all();
+	if (retention_worker.joinable()) {
+		retention_worker.join();
+	}
+}
+
+void
+DBSink::run_retention() {
+	std::unique_lock<std::mutex> lock(retention_mutex);
+	while (!retention_stopping) {
+		// one small chunk per turn of the write lock, writers get in between chunks
+		long done = 0;
+		lock.unlock();
+		{
+			std::lock_guard<std::mutex> write_lock(write_mutex);
+			if (!retention_prepared) {
+				// a new file takes a moment to convert, large files are left to the user
+				retention_auto_vacuum(connection, 32 * 1024 * 1024);
+				retention_prepared = true;
+			}
+			done = retention_step(connection, retention, 500);
+		}
+		lock.lock();
+
+		auto pause = (done > 0) ? std::chrono::milliseconds(5) : std::chrono::milliseconds(1000);
+		retention_changed.wait_for(lock, pause, [this]{ return retention_stopping; });
+	}
+}
+
+/*
+ * Index profiles
+ */
+
+void
+DBSink::start_index_profile(string profile) {
+	if (index_worker.joinable()) {
+		return;
+	}
+	index_result = -1;
+	index_worker = std::thread(&DBSink::run_index_profile, this, profile);
+}
+
+void
+DBSink::stop_index_profile() {
+	{
+		std::lock_guard<std::mutex> lock(index_mutex);
+		index_stopping = true;
+		if (index_builder != NULL) {
+			index_builder->cancel();
+		}
+	}
+	if (index_worker.joinable()) {
+		index_worker.join();
+	}
+}
+
+void
+DBSink::run_index_profile(string profile) {
+	IndexProfileResult result;
+	DBConnection *builder = NULL;
+	string table;
+	{
+		std::lock_guard<std::mutex> write_lock(write_mutex);
+		table = connection->prefix + "_log";
+		if (connection->db_type == "sqlite") {
+			// writers wait for the write lock instead of running into the busy timeout of the index build
+			result = connection->setup_index_profile(profile, sqlite_index_max_rows);
 		} else {
-			tag_id = to_string(connection->insert("INTO " + connection->prefix + "_tag (name) VALUES ($1)", replacements));
+			// CONCURRENTLY waits for the transactions of the writers, so it can not run on their connection
+			builder = new DBConnection(
+				connection->db_type,
+				connection->db_host,
+				connection->db_port,
+				connection->db_user,
+				connection->db_password,
+				connection->db_name,
+				connection->prefix,
+				connection->application_name,
+				connection->requested_layout,
+				false
+			);
 		}
+	}
 
-		tag_cache[tag] = tag_id;
-		tagIDs.push_back(tag_id);
+	if (builder != NULL) {
+		bool cancelled;
+		{
+			std::lock_guard<std::mutex> lock(index_mutex);
+			cancelled = index_stopping;
+			index_builder = cancelled ? NULL : builder;
+		}
+		result = cancelled ? INDEX_PROFILE_FAILED : builder->setup_index_profile(profile);
+		{
+			std::lock_guard<std::mutex> lock(index_mutex);
+			index_builder = NULL;
+		}
+		delete builder;
 	}
 
-	for (string tagID : tagIDs) {
-		replacements = vector<string>();
-		replacements.push_back(tagID);
-		replacements.push_back(to_string(entry_id));
-		connection->insert("INTO " + connection->prefix + "_log_tag (\"tagID\", \"logID\") VALUES ($1, $2)", replacements);
+	std::lock_guard<std::mutex> lock(index_mutex);
+	if ((result == INDEX_PROFILE_FAILED) && !index_stopping) {
+		cerr << "Could not create the indexes of profile " << profile << " on " << table << "\n";
+	}
+	index_result = result;
+}
+
+string
+DBSink::index_profile_status() const {
+	switch (index_result.load()) {
+		case -2: return "none";
+		case -1: return "building";
+		case INDEX_PROFILE_DONE: return "done";
+		case INDEX_PROFILE_SKIPPED: return "skipped";
+		default: return "failed";
 	}
 }
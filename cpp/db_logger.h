@@ -3,14 +3,138 @@
 
 #include <string>
 #include <set>
+#include <tuple>
 #include <vector>
+#include <time.h>
 
 #include "db.h"
+#include "log_entry.h"
+#include "sink.h"
 
 using std::set;
 using std::string;
 using std::vector;
 
-void log_db(DBConnection *connection, int level, time_t date, string hostname, int pid, string filename, string function, int line, int column, vector<string>parts, set<string>tags);
+// IDs of dimension values (logger names, hosts, sources, functions, tags and tag sets) already in the DB,
+// only valid for the connection they were fetched from. Tag sets are keyed by TagSet::key.
+struct DimensionCache {
+	map<string, string> loggers;
+	map<string, string> hosts;
+	map<string, string> sources;
+	map<string, string> functions;
+	map<string, string> tags;
+	map<string, string> tagsets;
 
-#endif // DB_LOGGER_H
\ No newline at end of file
+	void clear() {
+		loggers.clear();
+		hosts.clear();
+		sources.clear();
+		functions.clear();
+		tags.clear();
+		tagsets.clear();
+	}
+};
+
+void log_db(DBConnection *connection, DimensionCache &cache, const LogEntry &entry);
+void log_db_batch(DBConnection *connection, DimensionCache &cache, const LogEntry *entries, size_t count);
+
+// Entry counts by minute (seconds since the epoch), level, logger ID, host ID and function ID,
+// "0" for a dimension without ID
+typedef std::tuple<int64_t, int, string, string, string> RollupKey;
+typedef map<RollupKey, int64_t> RollupCounters;
+
+// Count written entries, their dimension IDs are taken from the cache filled by log_db()
+void rollup_add(const DimensionCache &cache, const LogEntry *entries, size_t count, RollupCounters &counters);
+
+// Add the counters to `<prefix>_rollup_minute` with upserts and clear them, counters of a
+// failed statement are kept for the next flush
+void rollup_flush(DBConnection *connection, RollupCounters &counters);
+
+// Entry counts of `<prefix>_rollup_minute` from `from` to before `to` (seconds, 0 for no
+// limit) in buckets of `interval` seconds, grouped by the columns in `group_by` (level,
+// logger, host, function). Rows have the keys time, count and the grouped columns.
+vector< map<string, string> > *rollup_query(DBConnection *connection, int64_t from, int64_t to, int min_level, int interval, const set<string> &group_by);
+
+// Limits of the SQLite log table, 0 disables a limit
+struct RetentionPolicy {
+	int64_t max_age; // seconds
+	int64_t max_rows;
+	int64_t max_bytes; // pages in use, free pages are not counted
+
+	bool enabled() const {
+		return (max_age > 0) || (max_rows > 0) || (max_bytes > 0);
+	}
+};
+
+// Delete up to `chunk_size` of the oldest entries beyond the limits of `policy` together with
+// their `log_tag` rows and attachments in one transaction, then give free pages back to the
+// file system with `incremental_vacuum` (DBs with `auto_vacuum = INCREMENTAL`). Returns the
+// number of deleted entries plus released pages, 0 if there is nothing left to do.
+long retention_step(DBConnection *connection, const RetentionPolicy &policy, size_t chunk_size);
+
+// Switch an SQLite DB to `auto_vacuum = INCREMENTAL` so retention can shrink the file. Existing files
+// need a VACUUM, which blocks writers and rewrites the whole file: files of more than `max_bytes`
+// are not converted, false with a warning.
+bool retention_auto_vacuum(DBConnection *connection, int64_t max_bytes);
+
+// Writes log entries into the DB, reconnects if the connection became invalid.
+// Batches written by the queue worker are committed in one transaction.
+class DBSink : public Sink {
+	public:
+		DBSink(DBConnection *connection, int level, size_t queue_size, size_t batch_size = 256);
+		~DBSink();
+
+		// field index configuration, re-applied after reconnecting
+		vector<string> field_indexes;
+		bool field_gin_index;
+
+		DBConnection *connection;
+		DimensionCache cache;
+
+		// seconds between writes of the entry counts to `<prefix>_rollup_minute`, 0 disables them
+		int rollup_interval;
+
+		// enforce `policy` on a background thread that deletes small chunks between writes,
+		// SQLite only
+		void start_retention(RetentionPolicy policy);
+
+		// build the indexes of an index profile on a background job, see
+		// DBConnection::setup_index_profile(). SQLite tables of up to `sqlite_index_max_rows` rows are
+		// indexed on the connection of the sink between two writes, Postgres builds run on a connection
+		// of their own. Closing the sink cancels the build and waits for the job.
+		void start_index_profile(string profile);
+
+		// "building", "done", "skipped", "failed" or "none" without an index profile
+		string index_profile_status() const;
+
+		static const int64_t sqlite_index_max_rows = 100000;
+
+	protected:
+		void write(const LogEntry *entries, size_t count);
+		void write_pending();
+		void reopen();
+
+	private:
+		void run_retention();
+		void stop_retention();
+		void run_index_profile(string profile);
+		void stop_index_profile();
+
+		RollupCounters rollup;
+		time_t rollup_written;
+
+		RetentionPolicy retention;
+		bool retention_prepared; // auto_vacuum of the current connection was checked
+		std::thread retention_worker;
+		std::mutex retention_mutex;
+		std::condition_variable retention_changed;
+		bool retention_stopping;
+
+		std::thread index_worker;
+		std::mutex index_mutex;
+		std::atomic<int> index_result; // IndexProfileResult, -1 while building, -2 without a build
+		DBConnection *index_builder; // Postgres connection of the running build
+		bool index_stopping;
+};
+
+#endif // DB_LOGGER_H
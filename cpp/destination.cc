@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <map>
+#include "destination.h"
+#include "file_logger.h"
+
+using std::map;
+
+static auto destinations = map<string, Destination *>();
+
+Destination::Destination(string name) : name(name) {
+	configured = false;
+	level = 0;
+	log_to_stdout = false;
+	structured_fields = false;
+	source_maps = false;
+	attachment_max_size = 65536;
+	logger_name = "default";
+	flight_recorder = NULL;
+	stdout_sink = NULL;
+	db_sink = NULL;
+	segment_sink = NULL;
+}
+
+Destination::~Destination() {
+	reconfigure(NULL, NULL, vector<Sink *>());
+	delete flight_recorder;
+}
+
+Destination *
+Destination::find(string name) {
+	auto search = destinations.find(name);
+	if ((search == destinations.end()) || !search->second->configured) {
+		return NULL;
+	}
+	return search->second;
+}
+
+Destination *
+Destination::get(string name) {
+	auto search = destinations.find(name);
+	if (search != destinations.end()) {
+		return search->second;
+	}
+
+	Destination *destination = new Destination(name);
+	destinations[name] = destination;
+	return destination;
+}
+
+void
+Destination::rotate_all(void) {
+	for (auto item : destinations) {
+		item.second->rotate();
+	}
+}
+
+void
+Destination::flush_all(void) {
+	for (auto item : destinations) {
+		item.second->flush();
+	}
+}
+
+size_t
+Destination::dump_flight_recorders(void) {
+	size_t count = 0;
+	for (auto item : destinations) {
+		count += item.second->dump_flight_recorder();
+	}
+	return count;
+}
+
+void
+Destination::reconfigure(StdoutSink *stdout_sink, DBSink *db_sink, vector<Sink *> sinks, SegmentSink *segment_sink) {
+	delete this->stdout_sink;
+	delete this->db_sink;
+	for (auto sink : this->sinks) {
+		// sinks can be carried over to the new configuration
+		if (std::find(sinks.begin(), sinks.end(), sink) == sinks.end()) {
+			delete sink;
+		}
+	}
+
+	this->stdout_sink = stdout_sink;
+	this->db_sink = db_sink;
+	this->sinks = sinks;
+	this->segment_sink = segment_sink;
+}
+
+bool
+Destination::accepts(int level, const TagSet &tags, bool to_stdout) const {
+	if (to_stdout && stdout_sink && stdout_sink->accepts(level, tags)) {
+		return true;
+	}
+	if (db_sink && db_sink->accepts(level, tags)) {
+		return true;
+	}
+	for (auto sink : sinks) {
+		if (sink->accepts(level, tags)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+Destination::dispatch(const LogEntry &entry, bool to_stdout) {
+	if (to_stdout && stdout_sink) {
+		stdout_sink->submit(entry);
+	}
+	if (db_sink) {
+		db_sink->submit(entry);
+	}
+	for (auto sink : sinks) {
+		sink->submit(entry);
+	}
+}
+
+void
+Destination::rotate(void) {
+	if (db_sink) {
+		db_sink->rotate();
+	}
+	for (auto sink : sinks) {
+		sink->rotate();
+	}
+}
+
+void
+Destination::flush(void) {
+	if (stdout_sink) {
+		stdout_sink->flush();
+	}
+	if (db_sink) {
+		db_sink->flush();
+	}
+	for (auto sink : sinks) {
+		sink->flush();
+	}
+}
+
+size_t
+Destination::dump_flight_recorder(void) {
+	if (flight_recorder == NULL) {
+		return 0;
+	}
+
+	if (!flight_recorder_path.empty()) {
+		vector<LogEntry> entries = flight_recorder->take(true);
+		FileSink file(flight_recorder_path, 0, 0, 0, set<string>(), 0);
+		for (const LogEntry &entry : entries) {
+			file.submit(entry);
+		}
+		return entries.size();
+	}
+
+	vector<LogEntry> entries = flight_recorder->take(false);
+	for (const LogEntry &entry : entries) {
+		if (db_sink) {
+			db_sink->submit(entry);
+		}
+		for (auto sink : sinks) {
+			sink->submit(entry);
+		}
+	}
+	flush();
+	return entries.size();
+}
@@ -0,0 +1,76 @@
+#ifndef DESTINATION_H
+#define DESTINATION_H
+
+#include <string>
+#include <vector>
+
+#include <node.h>
+
+#include "flight_recorder.h"
+#include "log_entry.h"
+#include "sink.h"
+#include "stdout_logger.h"
+#include "db_logger.h"
+#include "segment_logger.h"
+
+using std::string;
+using std::vector;
+
+// A named set of sinks with its own DB connection, caches and writer threads.
+// Loggers bind to a destination when they are created, destinations live until the
+// process exits and may be re-configured, which replaces their sinks.
+class Destination {
+	public:
+		// find a destination by name, returns NULL if it has not been configured yet
+		static Destination *find(string name);
+
+		// find or create a destination
+		static Destination *get(string name);
+
+		static void rotate_all(void);
+		static void flush_all(void);
+		static size_t dump_flight_recorders(void);
+
+		// replace all sinks, old sinks that are not in `sinks` are flushed and closed. `segment_sink`
+		// is one of `sinks` or NULL
+		void reconfigure(StdoutSink *stdout_sink, DBSink *db_sink, vector<Sink *> sinks, SegmentSink *segment_sink = NULL);
+
+		// true if any sink would take an entry, checked before the arguments are serialized
+		bool accepts(int level, const TagSet &tags, bool to_stdout) const;
+		void dispatch(const LogEntry &entry, bool to_stdout);
+		void rotate(void);
+		void flush(void);
+
+		// write the entries of the flight recorder to `flight_recorder_path` (NDJSON, all entries) or
+		// to the DB and file sinks (only the ones that were not persisted), returns the entry count
+		size_t dump_flight_recorder(void);
+
+		const string name;
+		bool configured;
+		int level;
+		bool log_to_stdout;
+		bool structured_fields;
+		bool source_maps;
+		size_t attachment_max_size;
+
+		// AsyncLocalStorage (or any object with `getStore()`) holding the context fields
+		v8::Global<v8::Object> context_storage;
+		string logger_name;
+
+		// ring of recent entries including the ones below `level`, NULL if disabled
+		FlightRecorder *flight_recorder;
+		string flight_recorder_path;
+
+		StdoutSink *stdout_sink;
+		DBSink *db_sink;
+		vector<Sink *> sinks;
+
+		// the sink of `type: 'segment'`, also in `sinks`, export reads its directory
+		SegmentSink *segment_sink;
+
+	private:
+		explicit Destination(string name);
+		~Destination();
+};
+
+#endif // DESTINATION_H
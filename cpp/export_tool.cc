@@ -0,0 +1,89 @@
+/*
+ * dblogger-export: writes the entries of a log DB to an NDJSON or Parquet file.
+ *
+ * The log table is read in `id` order, page by page, and the dimensions are resolved from
+ * in-memory copies of their tables, see export_log(). --from and --to take UTC times
+ * (`YYYY-MM-DD`, `YYYY-MM-DD HH:MM:SS` or `YYYY-MM-DDTHH:MM:SS`) or seconds since the epoch.
+ * With `--type segment` the directory `--name` of segment storage is exported.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+#include "cli.h"
+#include "exporter.h"
+
+using std::cerr;
+
+static void usage(void) {
+	cerr << "Usage: dblogger-export --name <name> --output <file> [options] [connection options]\n\n"
+		"  --output <file>           Output file, - for stdout\n"
+		"  --format <ndjson|parquet> Output format (default: ndjson)\n"
+		"  --from <time>             First time to export (UTC date, time or epoch seconds)\n"
+		"  --to <time>               Export entries before this time\n"
+		"  --min-level <level>       Lowest level to export (default: 0)\n"
+		"  --batch <count>           Entries per query (default: 10000)\n\n"
+		"  --type segment --name <directory> exports segment storage\n"
+		<< connection_usage("");
+}
+
+// Microseconds since the epoch, -1 if `value` is not a time
+static int64_t parse_time(string value) {
+	if (value.empty()) {
+		return 0;
+	}
+
+	const char *formats[] = { "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S", "%Y-%m-%d" };
+	for (const char *format : formats) {
+		struct tm parts;
+		memset(&parts, 0, sizeof(parts));
+		const char *end = strptime(value.c_str(), format, &parts);
+		if ((end != NULL) && (*end == '\0' || *end == 'Z')) {
+			return (int64_t)timegm(&parts) * 1000000;
+		}
+	}
+
+	char *end = NULL;
+	long long seconds = strtoll(value.c_str(), &end, 10);
+	return ((end != NULL) && (*end == '\0')) ? seconds * 1000000 : -1;
+}
+
+int main(int argc, char **argv) {
+	map<string, string> arguments;
+	if (!parse_arguments(argc, argv, arguments) || (arguments.count("output") == 0) || (arguments.count("name") == 0)) {
+		usage();
+		return 1;
+	}
+
+	ExportOptions options;
+	options.path = get_argument(arguments, "output", "-");
+	options.format = get_argument(arguments, "format", "ndjson");
+	options.from_us = parse_time(get_argument(arguments, "from", ""));
+	options.to_us = parse_time(get_argument(arguments, "to", ""));
+	options.min_level = get_int_argument(arguments, "min-level", 0);
+	int batch_size = get_int_argument(arguments, "batch", 10000);
+	options.page_size = (batch_size > 0) ? batch_size : 10000;
+	if ((options.from_us < 0) || (options.to_us < 0)) {
+		cerr << "Could not parse --from or --to\n";
+		return 1;
+	}
+
+	string error = "";
+	long exported;
+	if (get_argument(arguments, "type", "sqlite") == "segment") {
+		exported = export_segments(get_argument(arguments, "name", ""), options, error);
+	} else {
+		DBConnection *connection = connect_from_arguments(arguments, "", "export");
+		exported = export_log(connection, options, error);
+		delete connection;
+	}
+	if (exported < 0) {
+		cerr << error << "\n";
+		return 1;
+	}
+
+	cerr << "Exported " << exported << " entries\n";
+	return 0;
+}
@@ -0,0 +1,466 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include "exporter.h"
+#include "json.h"
+#include "parquet.h"
+#include "segment.h"
+
+using std::to_string;
+using std::unordered_map;
+
+// Entries are written in batches by several processes, their times are not strictly ordered by ID
+static const int64_t time_slack_us = 10 * 60 * 1000000LL;
+
+struct ExportFunction {
+	string name;
+	string line;
+	int64_t source_id;
+};
+
+// Dimension tables by ID, a table is reloaded when an entry references an unknown ID
+class ExportDimensions {
+	public:
+		ExportDimensions(DBConnection *connection) : connection(connection), p("\"" + connection->prefix) {
+			load_names(loggers, p + "_logger\"", "name");
+			load_names(hosts, p + "_hosts\"", "name");
+			load_names(sources, p + "_source\"", "path");
+			load_functions();
+			load_tagsets();
+		}
+
+		const string *logger(const string &id) { return lookup(loggers, id, [this] { load_names(loggers, p + "_logger\"", "name"); }); }
+		const string *host(const string &id) { return lookup(hosts, id, [this] { load_names(hosts, p + "_hosts\"", "name"); }); }
+		const string *source(int64_t id) { return lookup(sources, to_string(id), [this] { load_names(sources, p + "_source\"", "path"); }); }
+		const ExportFunction *function(const string &id) { return lookup(functions, id, [this] { load_functions(); }); }
+		const vector<string> *tagset(const string &id) { return lookup(tagsets, id, [this] { load_tagsets(); }); }
+
+	private:
+		template<typename T, typename Reload> const T *lookup(unordered_map<int64_t, T> &table, const string &id, Reload reload) {
+			if (id.empty()) {
+				return NULL;
+			}
+			int64_t key = std::atoll(id.c_str());
+			auto search = table.find(key);
+			if (search == table.end()) {
+				reload();
+				search = table.find(key);
+				if (search == table.end()) {
+					// deleted dimension (the reference is set to NULL eventually), don't reload again
+					table[key] = T();
+					return NULL;
+				}
+			}
+			return &search->second;
+		}
+
+		void load_names(unordered_map<int64_t, string> &table, string name, string column) {
+			auto result = connection->query("SELECT \"id\", \"" + column + "\" AS name FROM " + name + ";");
+			for (auto &row : *result) {
+				table[std::atoll(row["id"].c_str())] = row["name"];
+			}
+			delete result;
+		}
+
+		void load_functions() {
+			auto result = connection->query("SELECT \"id\", \"name\", \"lineNumber\", \"sourceID\" FROM " + p + "_function\";");
+			for (auto &row : *result) {
+				ExportFunction &function = functions[std::atoll(row["id"].c_str())];
+				function.name = row["name"];
+				function.line = row["lineNumber"];
+				function.source_id = row["sourceID"].empty() ? -1 : std::atoll(row["sourceID"].c_str());
+			}
+			delete result;
+		}
+
+		void load_tagsets() {
+			auto result = connection->query(
+				"SELECT m.\"tagsetID\", t.\"name\" FROM " + p + "_tagset_member\" m JOIN " + p + "_tag\" t ON t.\"id\" = m.\"tagID\" "
+				"ORDER BY m.\"tagsetID\", t.\"name\";");
+			tagsets.clear();
+			for (auto &row : *result) {
+				tagsets[std::atoll(row["tagsetID"].c_str())].push_back(row["name"]);
+			}
+			delete result;
+		}
+
+		DBConnection *connection;
+		const string p;
+		unordered_map<int64_t, string> loggers;
+		unordered_map<int64_t, string> hosts;
+		unordered_map<int64_t, string> sources;
+		unordered_map<int64_t, ExportFunction> functions;
+		unordered_map<int64_t, vector<string> > tagsets;
+};
+
+// Time of the log table in microseconds
+static inline int64_t time_us(const DBConnection *connection, const string &time) {
+	int64_t value = std::atoll(time.c_str());
+	return (connection->layout < 2) ? value * 1000000 : value;
+}
+
+// First ID of an entry written at or after `from_us`, assuming times grow with IDs
+static int64_t find_start_id(DBConnection *connection, int64_t from_us) {
+	string table = "\"" + connection->prefix + "_log\"";
+	auto bounds = connection->query("SELECT MIN(\"id\") AS first, MAX(\"id\") AS last FROM " + table + ";");
+	int64_t low = (bounds->size() > 0) ? std::atoll((*bounds)[0]["first"].c_str()) : 0;
+	int64_t high = (bounds->size() > 0) ? std::atoll((*bounds)[0]["last"].c_str()) : 0;
+	delete bounds;
+	if (from_us <= 0) {
+		return low;
+	}
+
+	while (low < high) {
+		int64_t middle = low + (high - low) / 2;
+		auto result = connection->query("SELECT \"id\", \"time\" FROM " + table + " WHERE \"id\" >= " + to_string(middle) + " ORDER BY \"id\" LIMIT 1;");
+		if (result->empty()) {
+			delete result;
+			break;
+		}
+		int64_t id = std::atoll((*result)[0]["id"].c_str());
+		int64_t time = time_us(connection, (*result)[0]["time"]);
+		delete result;
+
+		if (time < from_us) {
+			low = id + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+/*
+ * Output formats
+ */
+
+// An entry with resolved dimensions, NULL for unknown names
+struct ExportRow {
+	int64_t id;
+	int64_t time_us;
+	int level;
+	int pid;
+	const string *logger;
+	const string *host;
+	const string *source;
+	const string *function;
+	int line; // -1 if unknown
+	const vector<string> *tags;
+	const string *message;
+	const string *fields; // empty if there are none
+	const string *context;
+};
+
+class ExportWriter {
+	public:
+		virtual ~ExportWriter() {}
+		virtual bool open(string path) = 0;
+		virtual void write(const ExportRow &row) = 0;
+		virtual bool flush() = 0;
+		virtual bool close() = 0;
+};
+
+// One JSON object per line, with the keys of the file destination plus `id` and `time_us`
+class NDJSONWriter : public ExportWriter {
+	public:
+		NDJSONWriter() : file(NULL) {}
+		~NDJSONWriter() {
+			if ((file != NULL) && (file != stdout)) {
+				fclose(file);
+			}
+		}
+
+		bool open(string path) {
+			file = (path == "-") ? stdout : fopen(path.c_str(), "w");
+			return file != NULL;
+		}
+
+		void write(const ExportRow &row) {
+			out += "{\"id\":" + to_string(row.id);
+			out += ",\"time\":" + to_string(row.time_us / 1000000);
+			out += ",\"time_us\":" + to_string(row.time_us);
+			out += ",\"level\":" + to_string(row.level);
+			out += ",\"logger\":"; json_append_string(out, row.logger ? *row.logger : "");
+			out += ",\"host\":"; json_append_string(out, row.host ? *row.host : "");
+			out += ",\"pid\":" + to_string(row.pid);
+			out += ",\"file\":"; json_append_string(out, row.source ? *row.source : "");
+			out += ",\"function\":"; json_append_string(out, row.function ? *row.function : "");
+			out += ",\"line\":" + to_string(std::max(row.line, 0));
+			out += ",\"tags\":[";
+			if (row.tags != NULL) {
+				for (size_t i = 0; i < row.tags->size(); i++) {
+					out += (i > 0) ? "," : "";
+					json_append_string(out, (*row.tags)[i]);
+				}
+			}
+			out += "],\"message\":"; json_append_string(out, *row.message);
+			if (!row.fields->empty()) {
+				out += ",\"fields\":" + *row.fields;
+			}
+			if (!row.context->empty()) {
+				out += ",\"context\":" + *row.context;
+			}
+			out += "}\n";
+		}
+
+		bool flush() {
+			bool written = (fwrite(out.data(), 1, out.size(), file) == out.size());
+			out.clear();
+			return written;
+		}
+
+		bool close() {
+			bool closed = flush() && (fflush(file) == 0);
+			if (file != stdout) {
+				closed = (fclose(file) == 0) && closed;
+			}
+			file = NULL;
+			return closed;
+		}
+
+	private:
+		FILE *file;
+		string out;
+};
+
+// Columnar export, the low cardinality columns are dictionary encoded
+class ParquetExportWriter : public ExportWriter {
+	public:
+		enum { ID, TIME, LEVEL, LOGGER, HOST, PID, SOURCE, FUNCTION, LINE, TAGS, MESSAGE, FIELDS, CONTEXT };
+
+		ParquetExportWriter() : writer({
+			{ "id", ParquetWriter::INT64, false, false, ParquetWriter::NONE },
+			{ "time", ParquetWriter::INT64, false, false, ParquetWriter::TIMESTAMP_MICROS },
+			{ "level", ParquetWriter::INT32, false, true, ParquetWriter::NONE },
+			{ "logger", ParquetWriter::STRING, true, true, ParquetWriter::UTF8 },
+			{ "host", ParquetWriter::STRING, true, true, ParquetWriter::UTF8 },
+			{ "pid", ParquetWriter::INT32, false, false, ParquetWriter::NONE },
+			{ "source", ParquetWriter::STRING, true, true, ParquetWriter::UTF8 },
+			{ "function", ParquetWriter::STRING, true, true, ParquetWriter::UTF8 },
+			{ "line", ParquetWriter::INT32, true, false, ParquetWriter::NONE },
+			{ "tags", ParquetWriter::STRING, true, true, ParquetWriter::UTF8 },
+			{ "message", ParquetWriter::STRING, true, false, ParquetWriter::UTF8 },
+			{ "fields", ParquetWriter::STRING, true, false, ParquetWriter::JSON },
+			{ "context", ParquetWriter::STRING, true, false, ParquetWriter::JSON }
+		}) {}
+
+		bool open(string path) {
+			return writer.open(path);
+		}
+
+		void write(const ExportRow &row) {
+			writer.set_int(ID, row.id);
+			writer.set_int(TIME, row.time_us);
+			writer.set_int(LEVEL, row.level);
+			set_optional(LOGGER, row.logger);
+			set_optional(HOST, row.host);
+			writer.set_int(PID, row.pid);
+			set_optional(SOURCE, row.source);
+			set_optional(FUNCTION, row.function);
+			if (row.line >= 0) {
+				writer.set_int(LINE, row.line);
+			} else {
+				writer.set_null(LINE);
+			}
+			if ((row.tags != NULL) && !row.tags->empty()) {
+				string joined = "";
+				for (size_t i = 0; i < row.tags->size(); i++) {
+					joined += (i > 0) ? "," : "";
+					joined += (*row.tags)[i];
+				}
+				writer.set_string(TAGS, joined);
+			} else {
+				writer.set_null(TAGS);
+			}
+			writer.set_string(MESSAGE, *row.message);
+			set_optional(FIELDS, row.fields->empty() ? NULL : row.fields);
+			set_optional(CONTEXT, row.context->empty() ? NULL : row.context);
+			writer.end_row();
+		}
+
+		bool flush() {
+			return true;
+		}
+
+		bool close() {
+			return writer.close();
+		}
+
+	private:
+		void set_optional(size_t column, const string *value) {
+			if (value != NULL) {
+				writer.set_string(column, *value);
+			} else {
+				writer.set_null(column);
+			}
+		}
+
+		ParquetWriter writer;
+};
+
+/*
+ * Export
+ */
+
+// Writer for the format of `options` with its file opened, NULL with `error` set
+static ExportWriter *open_writer(const ExportOptions &options, string &error) {
+	ExportWriter *writer = NULL;
+	if (options.format == "parquet") {
+		writer = new ParquetExportWriter();
+	} else if ((options.format == "ndjson") || options.format.empty()) {
+		writer = new NDJSONWriter();
+	} else {
+		error = "Unknown export format " + options.format;
+		return NULL;
+	}
+	if (!writer->open(options.path)) {
+		error = "Could not open " + options.path + ": " + strerror(errno);
+		delete writer;
+		return NULL;
+	}
+	return writer;
+}
+
+// Close and delete `writer`, returns `exported` or -1 with `error` set
+static long close_writer(ExportWriter *writer, const ExportOptions &options, long exported, string &error) {
+	if (!writer->close() && (exported >= 0)) {
+		error = "Could not write " + options.path + ": " + strerror(errno);
+		exported = -1;
+	}
+	delete writer;
+	return exported;
+}
+
+long export_log(DBConnection *connection, const ExportOptions &options, string &error) {
+	if (!connection->valid) {
+		error = "Could not connect to the DB";
+		return -1;
+	}
+	if ((connection->db_type != "sqlite") && (connection->db_type != "postgres")) {
+		error = "Export needs a SQLite or Postgres DB";
+		return -1;
+	}
+
+	ExportWriter *writer = open_writer(options, error);
+	if (writer == NULL) {
+		return -1;
+	}
+
+	ExportDimensions dimensions(connection);
+	string sql =
+		"SELECT \"id\", \"level\", \"message\", \"pid\", \"time\", \"loggerID\", \"hostnameID\", \"functionID\", \"fields\", \"tagsetID\", \"context\" "
+		"FROM \"" + connection->prefix + "_log\" WHERE \"id\" > $1 ORDER BY \"id\" LIMIT " + to_string(options.page_size > 0 ? options.page_size : 10000) + ";";
+	int64_t after = find_start_id(connection, (options.from_us > 0) ? options.from_us - time_slack_us : 0) - 1;
+	int64_t stop_us = (options.to_us > 0) ? options.to_us + time_slack_us : 0;
+	long exported = 0;
+	bool done = false;
+
+	while (!done) {
+		auto parameters = vector<string>();
+		parameters.push_back(to_string(after));
+		auto result = connection->query(sql, parameters);
+		if (!connection->valid) {
+			delete result;
+			error = "Lost the DB connection";
+			exported = -1;
+			break;
+		}
+		done = result->empty();
+
+		for (auto &row : *result) {
+			after = std::atoll(row["id"].c_str());
+			int64_t time = time_us(connection, row["time"]);
+			if ((stop_us > 0) && (time >= stop_us)) {
+				done = true;
+				break;
+			}
+			if ((std::atoi(row["level"].c_str()) < options.min_level) ||
+				((options.from_us > 0) && (time < options.from_us)) ||
+				((options.to_us > 0) && (time >= options.to_us))) {
+				continue;
+			}
+			const ExportFunction *function = dimensions.function(row["functionID"]);
+			ExportRow export_row;
+			export_row.id = after;
+			export_row.time_us = time;
+			export_row.level = std::atoi(row["level"].c_str());
+			export_row.pid = std::atoi(row["pid"].c_str());
+			export_row.logger = dimensions.logger(row["loggerID"]);
+			export_row.host = dimensions.host(row["hostnameID"]);
+			export_row.source = (function != NULL) ? dimensions.source(function->source_id) : NULL;
+			export_row.function = (function != NULL) ? &function->name : NULL;
+			export_row.line = (function && !function->line.empty()) ? std::atoi(function->line.c_str()) : -1;
+			export_row.tags = dimensions.tagset(row["tagsetID"]);
+			export_row.message = &row["message"];
+			export_row.fields = &row["fields"];
+			export_row.context = &row["context"];
+			writer->write(export_row);
+			exported++;
+		}
+		delete result;
+
+		if (!writer->flush()) {
+			error = "Could not write " + options.path + ": " + strerror(errno);
+			exported = -1;
+			break;
+		}
+	}
+
+	return close_writer(writer, options, exported, error);
+}
+
+long export_segments(string directory, const ExportOptions &options, string &error) {
+	ExportWriter *writer = open_writer(options, error);
+	if (writer == NULL) {
+		return -1;
+	}
+
+	// records are written in batches of `page_size`
+	size_t page_size = (options.page_size > 0) ? options.page_size : 10000;
+	size_t pending = 0;
+	vector<string> tags = vector<string>();
+	bool written = true;
+	long exported = segment_scan(directory, options.from_us, options.to_us, options.min_level,
+		[&](const SegmentRecord &record, SegmentDictionary &dictionary) {
+			tags.clear();
+			for (uint32_t tag : record.tags) {
+				const string *name = dictionary.name(SEGMENT_TAG, tag);
+				if (name != NULL) {
+					tags.push_back(*name);
+				}
+			}
+			std::sort(tags.begin(), tags.end());
+
+			ExportRow row;
+			row.id = (int64_t)record.id;
+			row.time_us = record.time_us;
+			row.level = record.level;
+			row.pid = record.pid;
+			row.logger = dictionary.name(SEGMENT_LOGGER, record.names[SEGMENT_LOGGER]);
+			row.host = dictionary.name(SEGMENT_HOST, record.names[SEGMENT_HOST]);
+			row.source = dictionary.name(SEGMENT_FILE, record.names[SEGMENT_FILE]);
+			row.function = dictionary.name(SEGMENT_FUNCTION, record.names[SEGMENT_FUNCTION]);
+			row.line = record.line;
+			row.tags = &tags;
+			row.message = &record.message;
+			row.fields = &record.fields;
+			row.context = &record.context;
+			writer->write(row);
+
+			if (++pending >= page_size) {
+				pending = 0;
+				written = writer->flush();
+			}
+			return written;
+		}, error);
+
+	if ((exported >= 0) && !(written && writer->flush())) {
+		error = "Could not write " + options.path + ": " + strerror(errno);
+		exported = -1;
+	}
+	return close_writer(writer, options, exported, error);
+}
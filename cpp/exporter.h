@@ -0,0 +1,35 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <string>
+#include <stdint.h>
+
+#include "db.h"
+
+using std::string;
+
+struct ExportOptions {
+	string path;         // output file, "-" for stdout
+	string format;       // "ndjson" or "parquet"
+	int64_t from_us;     // first time (microseconds since the epoch, inclusive), 0 for no limit
+	int64_t to_us;       // last time (exclusive), 0 for no limit
+	int min_level;
+	size_t page_size;    // rows per query
+};
+
+// Bulk export of the log table of a SQLite or Postgres DB.
+//
+// Rows are read in `id` order with keyset pagination (`WHERE id > last ORDER BY id LIMIT n`), the
+// dimension tables are held in memory and resolved in C++ instead of joining them in SQL. The time
+// filter starts at the first ID found by a binary search over the primary key and stops a few
+// minutes past `to_us`, entries are written in batches so their times are only roughly ordered.
+// Memory is bounded by one page (and one row group for Parquet) plus the dimensions.
+//
+// Returns the number of exported entries or -1 with `error` set.
+long export_log(DBConnection *connection, const ExportOptions &options, string &error);
+
+// Export of the segment storage in `directory`, same formats and filters as export_log(). The
+// sparse indexes of the segments pick where the time range starts, see segment_scan().
+long export_segments(string directory, const ExportOptions &options, string &error);
+
+#endif // EXPORTER_H
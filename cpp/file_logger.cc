@@ -0,0 +1,161 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "file_logger.h"
+#include "json.h"
+#include "stats.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+using std::cerr;
+using std::to_string;
+using std::vector;
+
+void format_ndjson(string &out, const LogEntry &entry) {
+	out += "{\"time\":" + to_string(entry.date);
+	out += ",\"level\":" + to_string(entry.level);
+	out += ",\"logger\":"; json_append_string(out, entry.logger_name);
+	out += ",\"host\":"; json_append_string(out, entry.hostname);
+	out += ",\"pid\":" + to_string(entry.pid);
+	out += ",\"file\":"; json_append_string(out, entry.filename);
+	out += ",\"function\":"; json_append_string(out, entry.function);
+	out += ",\"line\":" + to_string(entry.line);
+	out += ",\"column\":" + to_string(entry.column);
+	out += ",\"tags\":[";
+	bool first = true;
+	for (const string &tag : entry.tags->names) {
+		if (!first) {
+			out += ",";
+		}
+		json_append_string(out, tag);
+		first = false;
+	}
+	out += "],\"message\":"; json_append_string(out, entry.message());
+	if (entry.fields.size() > 0) {
+		// already serialized by JSON.stringify
+		out += ",\"fields\":" + entry.fields;
+	}
+	if (entry.context.size() > 0) {
+		out += ",\"context\":" + entry.context;
+	}
+	out += "}\n";
+}
+
+FileSink::FileSink(string path, size_t max_size, int max_files, int level, set<string> tags, size_t queue_size) :
+	Sink(level, tags, queue_size), path(path), max_size(max_size), max_files(max_files) {
+
+	fd = -1;
+	size = 0;
+	open_file();
+}
+
+FileSink::~FileSink() {
+	stop();
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+void
+FileSink::open_file() {
+	fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		cerr << "Could not open log file " << path << ": " << strerror(errno) << "\n";
+		return;
+	}
+
+	struct stat info;
+	size = (fstat(fd, &info) == 0) ? info.st_size : 0;
+}
+
+void
+FileSink::roll_over() {
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	// shift `path.N-1` to `path.N`, the oldest file is overwritten
+	for (int i = max_files - 1; i >= 1; i--) {
+		string from = path + "." + to_string(i);
+		string to = path + "." + to_string(i + 1);
+		rename(from.c_str(), to.c_str());
+	}
+	if (max_files > 0) {
+		rename(path.c_str(), (path + ".1").c_str());
+	} else {
+		unlink(path.c_str());
+	}
+
+	open_file();
+}
+
+void
+FileSink::reopen() {
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+	open_file();
+}
+
+void
+FileSink::write(const LogEntry *entries, size_t count) {
+	vector<string> lines = vector<string>(count);
+	size_t bytes = 0;
+	for (size_t i = 0; i < count; i++) {
+		format_ndjson(lines[i], entries[i]);
+		bytes += lines[i].size();
+	}
+
+	if ((max_size > 0) && (size > 0) && (size + bytes > max_size)) {
+		roll_over();
+	}
+	if (fd < 0) {
+		stats_add(stats.dropped, count);
+		return;
+	}
+
+	// write all lines with as few syscalls as possible, retry on partial writes
+	vector<struct iovec> iov = vector<struct iovec>(count);
+	for (size_t i = 0; i < count; i++) {
+		iov[i].iov_base = (void *)lines[i].data();
+		iov[i].iov_len = lines[i].size();
+	}
+
+	size_t index = 0;
+	while (index < count) {
+		int chunk = (int)std::min(count - index, (size_t)IOV_MAX);
+		ssize_t written = writev(fd, &iov[index], chunk);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			cerr << "Could not write to log file " << path << ": " << strerror(errno) << "\n";
+			stats_add(stats.dropped, count - index);
+			return;
+		}
+
+		size += written;
+		stats_add(stats.bytes_file, written);
+
+		// skip completely written buffers, adjust the partially written one
+		while ((index < count) && ((size_t)written >= iov[index].iov_len)) {
+			written -= iov[index].iov_len;
+			index++;
+		}
+		if (index < count) {
+			iov[index].iov_base = (char *)iov[index].iov_base + written;
+			iov[index].iov_len -= written;
+		}
+	}
+}
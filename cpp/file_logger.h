@@ -0,0 +1,38 @@
+#ifndef FILE_LOGGER_H
+#define FILE_LOGGER_H
+
+#include <string>
+
+#include "log_entry.h"
+#include "sink.h"
+
+using std::string;
+
+// Append one NDJSON line for the entry to `out`
+void format_ndjson(string &out, const LogEntry &entry);
+
+// Append-only NDJSON file, batches are written with one `writev` call.
+// When the file would grow over `max_size` bytes it is renamed to `<path>.1`
+// (older files are shifted up to `<path>.<max_files>`) and a new file is started.
+class FileSink : public Sink {
+	public:
+		FileSink(string path, size_t max_size, int max_files, int level, set<string> tags, size_t queue_size);
+		~FileSink();
+
+		const string path;
+		const size_t max_size;
+		const int max_files;
+
+	protected:
+		void write(const LogEntry *entries, size_t count);
+		void reopen();
+
+	private:
+		void open_file();
+		void roll_over();
+
+		int fd;
+		size_t size;
+};
+
+#endif // FILE_LOGGER_H
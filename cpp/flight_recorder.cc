@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include "flight_recorder.h"
+
+// longest stored logger, tags, file and function strings, the message gets the rest of the slot
+static const size_t string_limits[] = { 48, 64, 96, 64 };
+
+// Longest prefix of `value` of at most `length` bytes that does not end in the middle of a UTF-8 sequence
+static size_t utf8_prefix(const string &value, size_t length) {
+	if (length >= value.size()) {
+		return value.size();
+	}
+	while ((length > 0) && (((unsigned char)value[length] & 0xc0) == 0x80)) {
+		length--;
+	}
+	return length;
+}
+
+FlightRecorder::FlightRecorder(size_t capacity, int level) :
+	level(level), capacity(capacity) {
+
+	// a power of two, so the slot of a sequence number is a mask away
+	size_t slot_count = 1;
+	while (slot_count < capacity) {
+		slot_count <<= 1;
+	}
+	slots = new Slot[slot_count];
+	mask = slot_count - 1;
+	for (size_t i = 0; i < slot_count; i++) {
+		slots[i].sequence = 0;
+	}
+	head = 0;
+	taken = 0;
+}
+
+FlightRecorder::~FlightRecorder() {
+	delete[] slots;
+}
+
+void
+FlightRecorder::record(const LogEntry &entry, bool persisted) {
+	uint64_t sequence = head.fetch_add(1, std::memory_order_relaxed);
+	Slot &slot = slots[sequence & mask];
+
+	slot.sequence.store(sequence * 2 + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.time_us = entry.time_us;
+	slot.level = entry.level;
+	slot.line = entry.line;
+	slot.persisted = persisted ? 1 : 0;
+
+	size_t used = 0;
+	auto append = [&](int index, const string &value, size_t limit) {
+		size_t length = utf8_prefix(value, std::min(limit, sizeof(slot.data) - used));
+		memcpy(slot.data + used, value.data(), length);
+		slot.lengths[index] = length;
+		used += length;
+	};
+	append(LOGGER, entry.logger_name, string_limits[LOGGER]);
+
+	string tags = "";
+	for (const string &tag : entry.tags->names) {
+		tags += (tags.size() > 0) ? "\x1f" + tag : tag;
+	}
+	append(TAGS, tags, string_limits[TAGS]);
+	append(FILENAME, entry.filename, string_limits[FILENAME]);
+	append(FUNCTION, entry.function, string_limits[FUNCTION]);
+
+	// message parts are copied one by one, a cut off message ends with "..."
+	size_t message_start = used;
+	bool truncated = false;
+	for (const string &part : entry.parts) {
+		size_t available = sizeof(slot.data) - used;
+		if (part.size() + 1 > available) {
+			size_t length = utf8_prefix(part, (available > 3) ? available - 3 : 0);
+			memcpy(slot.data + used, part.data(), length);
+			used += length;
+			truncated = true;
+			break;
+		}
+		memcpy(slot.data + used, part.data(), part.size());
+		used += part.size();
+		slot.data[used++] = ' ';
+	}
+	if (truncated) {
+		size_t length = std::min((size_t)3, sizeof(slot.data) - used);
+		memcpy(slot.data + used, "...", length);
+		used += length;
+	}
+	slot.lengths[MESSAGE] = used - message_start;
+
+	slot.sequence.store(sequence * 2 + 2, std::memory_order_release);
+}
+
+vector<LogEntry>
+FlightRecorder::take(bool include_persisted) {
+	vector<LogEntry> entries = vector<LogEntry>();
+	uint64_t end = head.load(std::memory_order_acquire);
+	uint64_t start = taken.exchange(end);
+	if (end - start > mask + 1) {
+		start = end - (mask + 1);
+	}
+
+	char hostname[1024] = {};
+	gethostname(hostname, sizeof(hostname) - 1);
+	TagSetRef marker = TagSet::intern({ "flight-recorder" });
+
+	for (uint64_t sequence = start; sequence < end; sequence++) {
+		Slot &slot = slots[sequence & mask];
+		uint64_t before = slot.sequence.load(std::memory_order_acquire);
+		if (before != sequence * 2 + 2) {
+			continue;
+		}
+
+		// copy first, the slot may be overwritten while it is read
+		int64_t time_us = slot.time_us;
+		int level = slot.level;
+		int line = slot.line;
+		bool persisted = (slot.persisted != 0);
+		string strings[STRING_COUNT];
+		size_t offset = 0;
+		for (int i = 0; i < STRING_COUNT; i++) {
+			size_t length = std::min((size_t)slot.lengths[i], sizeof(slot.data) - offset);
+			strings[i] = string(slot.data + offset, length);
+			offset += length;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if ((slot.sequence.load(std::memory_order_relaxed) != before) || (persisted && !include_persisted)) {
+			continue;
+		}
+
+		LogEntry entry;
+		entry.level = level;
+		entry.time_us = time_us;
+		entry.date = time_us / 1000000;
+		entry.hostname = hostname;
+		entry.pid = getpid();
+		entry.logger_name = strings[LOGGER];
+		entry.filename = strings[FILENAME];
+		entry.function = strings[FUNCTION];
+		entry.line = line;
+		entry.column = 0;
+		// parts were recorded space separated, the entry gets them back as a single part
+		if ((strings[MESSAGE].size() > 0) && (strings[MESSAGE].back() == ' ')) {
+			strings[MESSAGE].pop_back();
+		}
+		entry.parts.push_back(strings[MESSAGE]);
+
+		set<string> tags = marker->names;
+		size_t tag_start = 0;
+		while (tag_start < strings[TAGS].size()) {
+			size_t tag_end = strings[TAGS].find('\x1f', tag_start);
+			tag_end = (tag_end == string::npos) ? strings[TAGS].size() : tag_end;
+			tags.insert(strings[TAGS].substr(tag_start, tag_end - tag_start));
+			tag_start = tag_end + 1;
+		}
+		entry.tags = TagSet::intern(tags);
+		entries.push_back(std::move(entry));
+	}
+	return entries;
+}
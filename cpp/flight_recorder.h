@@ -0,0 +1,58 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "log_entry.h"
+
+using std::string;
+using std::vector;
+
+// Fixed size in-memory ring of recent log entries, including the ones below the level that is
+// persisted, for post-mortems after a fatal entry or crash.
+//
+// Recording is lock free: a writer claims the next sequence number and overwrites the oldest slot.
+// Every slot is a compact binary record (level, time, line and the logger, tags, file, function
+// and message strings truncated to fit into `slot_size` bytes) guarded by a sequence lock, a
+// reader skips slots that are overwritten while it copies them.
+class FlightRecorder {
+	public:
+		FlightRecorder(size_t capacity, int level);
+		~FlightRecorder();
+
+		// record an entry, `persisted` marks entries that were also handed to the sinks
+		void record(const LogEntry &entry, bool persisted);
+
+		// entries recorded since the last call, oldest first. Entries marked as persisted are
+		// skipped unless `include_persisted` is set. Entries get the `flight-recorder` tag.
+		vector<LogEntry> take(bool include_persisted);
+
+		// lowest recorded level
+		const int level;
+		const size_t capacity;
+
+		static const size_t slot_size = 512;
+
+	private:
+		enum { LOGGER, TAGS, FILENAME, FUNCTION, MESSAGE, STRING_COUNT };
+
+		struct Slot {
+			std::atomic<uint64_t> sequence; // odd while it is written
+			int64_t time_us;
+			int32_t level;
+			int32_t line;
+			uint8_t persisted;
+			uint16_t lengths[STRING_COUNT];
+			char data[slot_size - 40];
+		};
+
+		Slot *slots;
+		size_t mask;
+		std::atomic<uint64_t> head;
+		std::atomic<uint64_t> taken;
+};
+
+#endif // FLIGHT_RECORDER_H
@@ -0,0 +1,93 @@
+#include "hash.h"
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// little endian reads byte by byte, independent of alignment and host byte order
+static inline uint64_t read64(const unsigned char *p) {
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; i--) {
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t lane_round(uint64_t accumulator, uint64_t lane) {
+	accumulator += lane * prime2;
+	accumulator = rotl(accumulator, 31);
+	return accumulator * prime1;
+}
+
+static inline uint64_t merge(uint64_t accumulator, uint64_t value) {
+	accumulator ^= lane_round(0, value);
+	return accumulator * prime1 + prime4;
+}
+
+uint64_t xxhash64(const void *data, size_t length, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + length;
+	uint64_t hash;
+
+	if (length >= 32) {
+		uint64_t v1 = seed + prime1 + prime2;
+		uint64_t v2 = seed + prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - prime1;
+		const unsigned char *limit = end - 32;
+		do {
+			v1 = lane_round(v1, read64(p));
+			v2 = lane_round(v2, read64(p + 8));
+			v3 = lane_round(v3, read64(p + 16));
+			v4 = lane_round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		hash = merge(hash, v1);
+		hash = merge(hash, v2);
+		hash = merge(hash, v3);
+		hash = merge(hash, v4);
+	} else {
+		hash = seed + prime5;
+	}
+	hash += (uint64_t)length;
+
+	while (p + 8 <= end) {
+		hash ^= lane_round(0, read64(p));
+		hash = rotl(hash, 27) * prime1 + prime4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		hash ^= (uint64_t)read32(p) * prime1;
+		hash = rotl(hash, 23) * prime2 + prime3;
+		p += 4;
+	}
+	while (p < end) {
+		hash ^= (*p) * prime5;
+		hash = rotl(hash, 11) * prime1;
+		p++;
+	}
+
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+int64_t hash_id(const string &key) {
+	uint64_t hash = xxhash64(key.data(), key.size());
+	return (int64_t)((hash & ((1ULL << 62) - 1)) | (1ULL << 62));
+}
@@ -0,0 +1,18 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+using std::string;
+
+// XXH64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md)
+uint64_t xxhash64(const void *data, size_t length, uint64_t seed = 0);
+
+// Dimension ID derived from the natural key of a row, always in [2^62, 2^63) so it is a
+// positive int8. It can still equal the ID of another row: on SQLite, AUTOINCREMENT continues
+// from the largest hash once rows are inserted without hash IDs, so rows are found by their key
+int64_t hash_id(const string &key);
+
+#endif // HASH_H
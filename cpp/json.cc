@@ -0,0 +1,145 @@
+#include "json.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define JSON_X86 1
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/*
+ * Scanning: find the next byte that is not plain printable ASCII, i.e. a control character, `"`,
+ * `\` or the start of a multi byte UTF-8 sequence. Runs of plain bytes are copied as a whole.
+ */
+
+static size_t scan_scalar(const char *data, size_t i, size_t size) {
+	for (; i < size; i++) {
+		unsigned char c = data[i];
+		if ((c < 0x20) || (c == '"') || (c == '\\') || (c >= 0x80)) {
+			break;
+		}
+	}
+	return i;
+}
+
+#ifdef JSON_X86
+
+// bytes >= 0x80 are negative as signed chars, so "less than 0x20" also finds them
+static size_t scan_sse2(const char *data, size_t i, size_t size) {
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	for (; i + 16 <= size; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i special = _mm_or_si128(_mm_cmplt_epi8(chunk, space),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+		int mask = _mm_movemask_epi8(special);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return scan_scalar(data, i, size);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *data, size_t i, size_t size) {
+	const __m256i space = _mm256_set1_epi8(0x20);
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	for (; i + 32 <= size; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(space, chunk),
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)));
+		unsigned int mask = _mm256_movemask_epi8(special);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return scan_sse2(data, i, size);
+}
+
+static size_t (*const scan)(const char *, size_t, size_t) = __builtin_cpu_supports("avx2") ? scan_avx2 : scan_sse2;
+
+#else
+
+static size_t (*const scan)(const char *, size_t, size_t) = scan_scalar;
+
+#endif
+
+// Length of the valid UTF-8 sequence at `data`, 0 if it is invalid, overlong, a surrogate or
+// beyond U+10FFFF
+static size_t utf8_length(const unsigned char *data, size_t available) {
+	unsigned char c = data[0];
+	size_t length;
+	unsigned char low = 0x80, high = 0xbf;
+	if ((c >= 0xc2) && (c <= 0xdf)) {
+		length = 2;
+	} else if ((c >= 0xe0) && (c <= 0xef)) {
+		length = 3;
+		low = (c == 0xe0) ? 0xa0 : 0x80;
+		high = (c == 0xed) ? 0x9f : 0xbf;
+	} else if ((c >= 0xf0) && (c <= 0xf4)) {
+		length = 4;
+		low = (c == 0xf0) ? 0x90 : 0x80;
+		high = (c == 0xf4) ? 0x8f : 0xbf;
+	} else {
+		return 0;
+	}
+
+	if (length > available || (data[1] < low) || (data[1] > high)) {
+		return 0;
+	}
+	for (size_t i = 2; i < length; i++) {
+		if ((data[i] & 0xc0) != 0x80) {
+			return 0;
+		}
+	}
+	return length;
+}
+
+void json_append_string(string &out, const string &value) {
+	out.reserve(out.size() + value.size() + 2);
+	out += '"';
+
+	const char *data = value.data();
+	size_t size = value.size();
+	size_t start = 0;
+	size_t i = 0;
+	while ((i = scan(data, i, size)) < size) {
+		unsigned char c = data[i];
+		if (c >= 0x80) {
+			size_t length = utf8_length((const unsigned char *)data + i, size - i);
+			if (length > 0) {
+				i += length;
+				continue;
+			}
+		}
+
+		// flush the run of characters that need no escaping
+		out.append(data + start, i - start);
+		i++;
+		start = i;
+
+		switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			default:
+				if (c >= 0x80) {
+					// invalid UTF-8 would make the whole line unparseable
+					out += "\\ufffd";
+				} else {
+					out += "\\u00";
+					out += hex_digits[c >> 4];
+					out += hex_digits[c & 0x0f];
+				}
+		}
+	}
+	out.append(data + start, size - start);
+
+	out += '"';
+}
@@ -0,0 +1,12 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+
+using std::string;
+
+// Append `value` as a quoted and escaped JSON string to `out`, invalid UTF-8 bytes are replaced
+// with U+FFFD. Runs that need no escaping are found with SSE2/AVX2 where available.
+void json_append_string(string &out, const string &value);
+
+#endif // JSON_H
@@ -0,0 +1,51 @@
+#ifndef LOG_ENTRY_H
+#define LOG_ENTRY_H
+
+#include <string>
+#include <set>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#include "tag_set.h"
+
+using std::set;
+using std::string;
+using std::vector;
+
+// Binary argument of a log call (Buffer, TypedArray, ArrayBuffer), stored in the attachment table
+struct LogAttachment {
+	string type;  // constructor name, e.g. `Buffer`
+	size_t size;  // original size, `data` is truncated to the configured maximum
+	string data;
+};
+
+// A fully serialized log entry, owns all of its data so it can be handed to sink queues
+struct LogEntry {
+	int level;
+	time_t date;
+	int64_t time_us; // same time in microseconds since the epoch
+	string hostname;
+	int pid;
+	string filename;
+	string function;
+	int line;
+	int column;
+	vector<string> parts;
+	string fields;
+	string context; // JSON object of the async context, empty if there is none
+	vector<LogAttachment> attachments;
+	TagSetRef tags = TagSet::empty();
+	string logger_name;
+
+	// space separated message as stored in the DB
+	string message() const {
+		string message = "";
+		for (const string &part : parts) {
+			message += part + " ";
+		}
+		return message;
+	}
+};
+
+#endif // LOG_ENTRY_H
@@ -1,12 +1,27 @@
+#include <algorithm>
 #include <string>
 #include <iostream>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <unistd.h>
 #include <time.h>
+#include <uv.h>
 
 #include "logger.h"
 #include "db.h"
 #include "stdout_logger.h"
 #include "db_logger.h"
+#include "file_logger.h"
+#include "collector_logger.h"
+#include "segment_logger.h"
+#include "destination.h"
+#include "exporter.h"
+#include "shard.h"
+#include "source_map.h"
+#include "tail.h"
+#include "probes.h"
+#include "stats.h"
 
 using v8::Context;
 using v8::Function;
@@ -26,12 +41,45 @@ using v8::Object;
 using v8::EscapableHandleScope;
 using v8::StackTrace;
 using v8::StackFrame;
+using v8::Array;
 using std::string;
 using std::cout;
+using std::to_string;
+using std::lock_guard;
+using std::mutex;
 
-static DBConnection *connection = NULL;
 static Persistent<Object> node_path;
 
+// Open live tails, the worker thread of a tail wakes up the event loop through `async`
+struct TailSubscription {
+	uv_async_t async;
+	Tail *tail;
+	Isolate *isolate;
+	v8::Global<Context> context;
+	v8::Global<Function> callback;
+};
+static map<int, TailSubscription *> tail_subscriptions;
+static int next_tail_id = 1;
+
+// Queries running on a worker thread with their own connection (export, rollups), the worker
+// wakes up the event loop through `async` when `run` returns (-1 with `error` set on failure)
+struct DBJob {
+	uv_async_t async;
+	std::thread worker;
+	std::function<long(DBConnection *, DBJob *)> run;
+	long count;
+	vector< map<string, string> > *rows;
+	string error;
+	Isolate *isolate;
+	v8::Global<Context> context;
+	v8::Global<Function> callback;
+};
+
+// Relative paths of the original sources of source mapped call sites, path.relative() is only
+// called once per source
+static mutex relative_sources_mutex;
+static map<string, string> relative_sources;
+
 
 /*
  * Helper funcs
@@ -72,13 +120,75 @@ static inline int get_int_from_dict(Isolate *isolate, const Local<Object>obj, st
 	return get_value_from_dict(isolate, obj, key)->IntegerValue(isolate->GetCurrentContext()).FromMaybe(0);
 }
 
+static inline int64_t get_int64_from_dict(Isolate *isolate, const Local<Object>obj, string key) {
+	return get_value_from_dict(isolate, obj, key)->IntegerValue(isolate->GetCurrentContext()).FromMaybe(0);
+}
+
 static inline bool get_bool_from_dict(Isolate *isolate, const Local<Object>obj, string key) {
 	return get_value_from_dict(isolate, obj, key)->BooleanValue(isolate);
 }
 
+static inline vector<string> get_string_array_from_dict(Isolate *isolate, const Local<Object>obj, string key) {
+	vector<string> result = vector<string>();
 
-// Initialize DB connection, will terminate and overwrite the old connection
-static inline void initializeDB(Isolate *isolate, const Local<Object> config) {
+	Local<Value> value = get_value_from_dict(isolate, obj, key);
+	if (!value->IsArray()) {
+		return result;
+	}
+
+	Local<Array> array = value.As<Array>();
+	for (uint32_t i = 0; i < array->Length(); i++) {
+		Local<Value> item = array->Get(isolate->GetCurrentContext(), i).ToLocalChecked();
+		result.push_back(get_string_from_value(isolate, item));
+	}
+	return result;
+}
+
+static inline set<string> get_string_set_from_dict(Isolate *isolate, const Local<Object>obj, string key) {
+	vector<string> values = get_string_array_from_dict(isolate, obj, key);
+	return set<string>(values.begin(), values.end());
+}
+
+// Create a file sink from a configuration object
+static FileSink *create_file_sink(Isolate *isolate, const Local<Object> config) {
+	string path = get_string_from_dict(isolate, config, "path");
+	if (path == "undefined") {
+		isolate->ThrowException(Exception::Error(local_string(isolate, "File sink configuration needs a `path`.")));
+		return NULL;
+	}
+
+	int max_files = 5;
+	if (get_value_from_dict(isolate, config, "maxFiles")->IsNumber()) {
+		max_files = get_int_from_dict(isolate, config, "maxFiles");
+	}
+
+	return new FileSink(
+		path,
+		get_int_from_dict(isolate, config, "maxSize"),
+		max_files,
+		get_int_from_dict(isolate, config, "level"),
+		get_string_set_from_dict(isolate, config, "tags"),
+		get_int_from_dict(isolate, config, "queue")
+	);
+}
+
+// The segment sink of `directory`. The sink of the current configuration holds the lock of the
+// directory, it is kept when the settings did not change and closed before the new one opens otherwise.
+static SegmentSink *segment_sink(Destination *destination, const string &directory, size_t segment_size, size_t queue_size) {
+	SegmentSink *sink = destination->segment_sink;
+	if ((sink != NULL) && (sink->directory == directory)) {
+		if ((sink->segment_size == std::max(segment_size, (size_t)1024 * 1024)) && (sink->queue_size == queue_size)) {
+			return sink;
+		}
+		destination->sinks.erase(std::find(destination->sinks.begin(), destination->sinks.end(), sink));
+		destination->segment_sink = NULL;
+		delete sink;
+	}
+	return new SegmentSink(directory, segment_size, 0, queue_size);
+}
+
+// Initialize the sinks of a destination, will flush and replace the old sinks
+static inline void initializeSinks(Isolate *isolate, Destination *destination, const Local<Object> config) {
 	// unpack config object
 	string db_host = get_string_from_dict(isolate, config, "host");
 	int db_port = get_int_from_dict(isolate, config, "port");
@@ -95,13 +205,9 @@ static inline void initializeDB(Isolate *isolate, const Local<Object> config) {
 		log_level = get_int_from_dict(isolate, config, "level");
 	}
 
-	bool log_to_stdout = false;
+	bool log_to_stdout = destination->log_to_stdout;
 	if (get_value_from_dict(isolate, config, "stdout")->IsBoolean()) {
 		log_to_stdout = get_bool_from_dict(isolate, config, "stdout");
-	} else {
-		if (connection) {
-			log_to_stdout = connection->log_to_stdout;
-		}
 	}
 
 	if (prefix == "undefined") {
@@ -117,21 +223,128 @@ static inline void initializeDB(Isolate *isolate, const Local<Object> config) {
 		return;
 	}
 
-	// close old connection if set
-	if (connection != NULL) {
-		if (log_level < 0) {
-			log_level = connection->global_log_level;
+	// create new sinks before tearing down the old ones, so a bad file config does not leave us without sinks
+	vector<Sink *> sinks = vector<Sink *>();
+	Local<Value> file_config = get_value_from_dict(isolate, config, "file");
+	if (file_config->IsArray()) {
+		Local<Array> array = file_config.As<Array>();
+		for (uint32_t i = 0; i < array->Length(); i++) {
+			Local<Value> item = array->Get(isolate->GetCurrentContext(), i).ToLocalChecked();
+			FileSink *sink = item->IsObject() ? create_file_sink(isolate, item.As<Object>()) : NULL;
+			if (sink == NULL) {
+				for (auto sink : sinks) delete sink;
+				return;
+			}
+			sinks.push_back(sink);
 		}
-		delete connection;
-		connection = NULL;
+	} else if (file_config->IsObject()) {
+		FileSink *sink = create_file_sink(isolate, file_config.As<Object>());
+		if (sink == NULL) {
+			return;
+		}
+		sinks.push_back(sink);
 	}
 
-	// create new connection
-	connection = new DBConnection(db_type, db_host, db_port, db_user, db_password, db_name, prefix, logger_name);
-	connection->log_to_stdout = log_to_stdout;
 	if (log_level >= 0) {
-		connection->global_log_level = log_level;
+		destination->level = log_level;
+	}
+	destination->configured = true;
+	destination->log_to_stdout = log_to_stdout;
+	destination->structured_fields = get_bool_from_dict(isolate, config, "fields");
+	destination->source_maps = get_bool_from_dict(isolate, config, "sourceMaps");
+	destination->attachment_max_size = get_value_from_dict(isolate, config, "attachmentMaxSize")->IsNumber() ?
+		get_int_from_dict(isolate, config, "attachmentMaxSize") : 65536;
+
+	// `flightRecorder: true` or `{ size, level, path }`
+	Local<Value> recorder_config = get_value_from_dict(isolate, config, "flightRecorder");
+	delete destination->flight_recorder;
+	destination->flight_recorder = NULL;
+	destination->flight_recorder_path = "";
+	if (recorder_config->IsObject()) {
+		Local<Object> recorder_options = recorder_config.As<Object>();
+		int size = get_int_from_dict(isolate, recorder_options, "size");
+		destination->flight_recorder = new FlightRecorder((size > 0) ? size : 4096, get_int_from_dict(isolate, recorder_options, "level"));
+		string path = get_string_from_dict(isolate, recorder_options, "path");
+		destination->flight_recorder_path = (path != "undefined") ? path : "";
+	} else if (recorder_config->IsTrue()) {
+		destination->flight_recorder = new FlightRecorder(4096, 0);
 	}
+
+	Local<Value> context_storage = get_value_from_dict(isolate, config, "context");
+	if (context_storage->IsObject() && get_value_from_dict(isolate, context_storage.As<Object>(), "getStore")->IsFunction()) {
+		destination->context_storage.Reset(isolate, context_storage.As<Object>());
+	} else {
+		destination->context_storage.Reset();
+	}
+	destination->logger_name = logger_name;
+
+	StdoutSink *stdout_sink = new StdoutSink(
+		get_int_from_dict(isolate, config, "stdoutLevel"),
+		get_int_from_dict(isolate, config, "stdoutQueue"),
+		get_string_from_dict(isolate, config, "stdoutFormat") == "json"
+	);
+
+	// create new connection or hand entries to the local collector
+	DBSink *db_sink = NULL;
+	SegmentSink *new_segment_sink = NULL;
+	if (db_type == "collector") {
+		string socket_path = get_string_from_dict(isolate, config, "socket");
+		if (socket_path == "undefined") {
+			socket_path = "/tmp/dblogger.sock";
+		}
+		size_t queue_size = 10000;
+		if (get_value_from_dict(isolate, config, "queue")->IsNumber()) {
+			queue_size = get_int_from_dict(isolate, config, "queue");
+		}
+		sinks.push_back(new CollectorSink(socket_path, 0, queue_size));
+	} else if (db_type == "segment") {
+		// append-only segment files, `name` is the directory
+		int segment_size = get_int_from_dict(isolate, config, "segmentSize");
+		new_segment_sink = segment_sink(destination, db_name, (segment_size > 0) ? segment_size : 64 * 1024 * 1024, get_int_from_dict(isolate, config, "queue"));
+		sinks.push_back(new_segment_sink);
+	} else if (db_type != "none") {
+		// sharded SQLite: `name` is a directory, every process writes to its own file
+		int shards = get_int_from_dict(isolate, config, "shards");
+		if ((db_type == "sqlite") && (shards > 0)) {
+			db_name = shard_path(db_name, getpid(), shards);
+		}
+
+		int layout = get_value_from_dict(isolate, config, "layout")->IsNumber() ? get_int_from_dict(isolate, config, "layout") : 1;
+		DBConnection *connection = new DBConnection(db_type, db_host, db_port, db_user, db_password, db_name, prefix, logger_name, layout);
+		if (get_bool_from_dict(isolate, config, "hashIds")) {
+			connection->enable_hash_ids();
+		}
+
+		db_sink = new DBSink(connection, 0, get_int_from_dict(isolate, config, "queue"));
+
+		// `rollup: true` writes the counters every 10 seconds, a number sets the interval
+		Local<Value> rollup = get_value_from_dict(isolate, config, "rollup");
+		db_sink->rollup_interval = rollup->IsNumber() ? get_int_from_dict(isolate, config, "rollup") : (rollup->BooleanValue(isolate) ? 10 : 0);
+
+		// `retention: { maxAge, maxRows, maxBytes }` on SQLite
+		Local<Value> retention_config = get_value_from_dict(isolate, config, "retention");
+		if (retention_config->IsObject()) {
+			Local<Object> retention_options = retention_config.As<Object>();
+			RetentionPolicy retention;
+			retention.max_age = get_int64_from_dict(isolate, retention_options, "maxAge");
+			retention.max_rows = get_int64_from_dict(isolate, retention_options, "maxRows");
+			retention.max_bytes = get_int64_from_dict(isolate, retention_options, "maxBytes");
+			db_sink->start_retention(retention);
+		}
+
+		db_sink->field_indexes = get_string_array_from_dict(isolate, config, "fieldIndexes");
+		db_sink->field_gin_index = get_bool_from_dict(isolate, config, "fieldsGin");
+		connection->setup_field_indexes(db_sink->field_indexes, db_sink->field_gin_index);
+
+		// index profiles are built in the background, Postgres builds can take hours on large tables
+		string index_profile = get_string_from_dict(isolate, config, "indexProfile");
+		if (index_profile != "undefined") {
+			db_sink->start_index_profile(index_profile);
+		}
+	}
+
+	// flush and close old sinks
+	destination->reconfigure(stdout_sink, db_sink, sinks, new_segment_sink);
 }
 
 // JSON.stringify() a value
@@ -149,6 +362,85 @@ static string JSONStringify(Isolate *isolate, Local<Value> obj) {
 	return string(*String::Utf8Value(isolate, result));
 }
 
+// Buffers, typed arrays, DataViews and ArrayBuffers are stored as binary attachments
+static inline bool is_binary(Local<Value> val) {
+	return val->IsArrayBufferView() || val->IsArrayBuffer();
+}
+
+// Copy the bytes of a binary argument once, up to `max_size`
+static LogAttachment binary_attachment(Isolate *isolate, Local<Value> val, size_t max_size) {
+	LogAttachment attachment;
+	Local<v8::ArrayBufferView> view;
+	if (val->IsArrayBuffer()) {
+		Local<v8::ArrayBuffer> buffer = val.As<v8::ArrayBuffer>();
+		view = v8::Uint8Array::New(buffer, 0, buffer->ByteLength());
+		attachment.type = "ArrayBuffer";
+	} else {
+		view = val.As<v8::ArrayBufferView>();
+		attachment.type = get_string_from_value(isolate, view->GetConstructorName());
+	}
+
+	attachment.size = view->ByteLength();
+	attachment.data.resize((attachment.size < max_size) ? attachment.size : max_size);
+	if (attachment.data.size() > 0) {
+		view->CopyContents(&attachment.data[0], attachment.data.size());
+	}
+	return attachment;
+}
+
+// Plain objects are merged into the structured fields, arrays, dates and errors stay in the message
+static inline bool is_field_object(Local<Value> val) {
+	return val->IsObject() && !val->IsArray() && !val->IsDate() && !val->IsNativeError() && !val->IsFunction();
+}
+
+// Object.assign() the own enumerable properties of `source` to `target`
+static void merge_fields(Isolate *isolate, Local<Object> target, Local<Object> source) {
+	Local<Context> context = isolate->GetCurrentContext();
+	Local<Array> keys;
+	if (!source->GetOwnPropertyNames(context).ToLocal(&keys)) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < keys->Length(); i++) {
+		Local<Value> key = keys->Get(context, i).ToLocalChecked();
+		Local<Value> value;
+		if (source->Get(context, key).ToLocal(&value)) {
+			target->Set(context, key, value).Check();
+		}
+	}
+}
+
+// Fields of the current async context as JSON: the store of the context storage may be a
+// plain object or a Map, everything else is no context
+static string read_context(Isolate *isolate, const v8::Global<Object> &storage) {
+	Local<Context> context = isolate->GetCurrentContext();
+	Local<Object> storage_object = Local<Object>::New(isolate, storage);
+	Local<Function> get_store = get_value_from_dict(isolate, storage_object, "getStore").As<Function>();
+
+	Local<Value> store;
+	if (!get_store->Call(context, storage_object, 0, NULL).ToLocal(&store) || !store->IsObject() || store->IsArray()) {
+		return "";
+	}
+
+	Local<Object> fields;
+	if (store->IsMap()) {
+		// flat array of keys and values
+		Local<Array> entries = store.As<v8::Map>()->AsArray();
+		if (entries->Length() == 0) {
+			return "";
+		}
+		fields = Object::New(isolate);
+		for (uint32_t i = 0; i + 1 < entries->Length(); i += 2) {
+			fields->Set(context, entries->Get(context, i).ToLocalChecked(), entries->Get(context, i + 1).ToLocalChecked()).Check();
+		}
+	} else {
+		fields = store.As<Object>();
+	}
+
+	string result = JSONStringify(isolate, fields);
+	return (result == "{}") ? "" : result;
+}
+
 // Use the node internal path.relative() function to calculate a relative path
 static string relativePath(Isolate *isolate, Local<Value> to, char *from) {
 	// get the unbound path module inserted into isolate
@@ -173,70 +465,217 @@ static string relativePath(Isolate *isolate, Local<Value> to, char *from) {
 	return string(*String::Utf8Value(isolate, to));
 }
 
+// Keep an entry below the level of the logger in the flight recorder: the call site is not
+// resolved through path.relative() or source maps and arguments are only serialized until the
+// record is full
+static void record_flight(int level, Logger *logger, const FunctionCallbackInfo<Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+
+	LogEntry entry;
+	entry.level = level;
+	entry.logger_name = logger->logger_name;
+	entry.tags = logger->tags;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	entry.time_us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+	Local<StackFrame> frame = StackTrace::CurrentStackTrace(isolate, 1, StackTrace::kOverview)->GetFrame(isolate, 0);
+	entry.line = frame->GetLineNumber();
+	entry.filename = get_string_from_value(isolate, frame->GetScriptName());
+	String::Utf8Value function(isolate, frame->GetFunctionName());
+	entry.function = (*function != NULL) ? string(*function) + "()" : "<global scope>";
+
+	size_t bytes = 0;
+	for (int i = 0; (i < args.Length()) && (bytes < FlightRecorder::slot_size); i++) {
+		Local<Value> val = args[i];
+		string item;
+		if (is_binary(val)) {
+			item = "<binary>";
+		} else if (val->IsArray() || val->IsObject()) {
+			item = JSONStringify(isolate, val);
+		} else {
+			item = get_string_from_value(isolate, val);
+		}
+		bytes += item.size() + 1;
+		entry.parts.push_back(std::move(item));
+	}
+
+	logger->destination->flight_recorder->record(entry, false);
+}
+
 // Save a log entry
 static void log(int level, Logger *logger, const FunctionCallbackInfo<Value>& args) {
-	if (level < logger->level) {
+	FlightRecorder *flight_recorder = logger->destination->flight_recorder;
+
+	// entries no sink takes skip the stack trace and the serialization of their arguments
+	if ((level < logger->level) || !logger->destination->accepts(level, *logger->tags, logger->log_to_stdout)) {
+		if ((flight_recorder != NULL) && (level >= flight_recorder->level)) {
+			record_flight(level, logger, args);
+		}
+		stats_add(stats.filtered);
 		return;
 	}
 
+	DBLOGGER_PROBE1(log__start, level);
+	StatsTimer timer(stats.log_time);
+	stats_add(stats.entries[((level >= 0) && (level <= 60)) ? level / 10 : 0]);
+
 	Isolate* isolate = args.GetIsolate();
 
-	// fetch date
-	time_t now = time(NULL);
+	LogEntry entry;
+	entry.level = level;
+	entry.logger_name = logger->logger_name;
+	entry.tags = logger->tags;
+
+	// fetch date, the DB stores microseconds in layout 2
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	entry.date = now.tv_sec;
+	entry.time_us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 
 	// fetch host name
 	char c_hostname[1024]; gethostname(c_hostname, 1024);
-	string hostname = string(c_hostname);
+	entry.hostname = string(c_hostname);
 
 	// fetch pid
-	int pid = getpid();
+	entry.pid = getpid();
 
 	// fetch stack frame for: filename, source line, function name
+	DBLOGGER_PROBE0(stack__start);
+	uint64_t stack_start = stats_now();
 	Local<StackFrame> frame = StackTrace::CurrentStackTrace(isolate, 1, StackTrace::kOverview)->GetFrame(isolate, 0);
 	char c_path[1024] = {}; getcwd(c_path, 1024);
-	string filename = relativePath(isolate, frame->GetScriptName(), c_path);
+	entry.line = frame->GetLineNumber();
+	entry.column = frame->GetColumn();
+
+	// original file and position of transpiled code, maps are parsed once per script and
+	// positions resolved once per call site
+	SourcePosition position;
+	if (logger->destination->source_maps && SourceMapCache::resolve(get_string_from_value(isolate, frame->GetScriptName()), entry.line, entry.column, position)) {
+		lock_guard<mutex> lock(relative_sources_mutex);
+		auto search = relative_sources.find(position.source);
+		if (search == relative_sources.end()) {
+			string relative = (position.source[0] == '/') ? relativePath(isolate, local_string(isolate, position.source), c_path) : position.source;
+			search = relative_sources.insert(std::make_pair(position.source, relative)).first;
+		}
+		entry.filename = search->second;
+		entry.line = position.line;
+		entry.column = position.column;
+	} else {
+		entry.filename = relativePath(isolate, frame->GetScriptName(), c_path);
+	}
 
-	string function;
 	if (*String::Utf8Value(isolate, frame->GetFunctionName()) != NULL) {
-		function = string(*String::Utf8Value(isolate, frame->GetFunctionName())) + "()";
+		entry.function = string(*String::Utf8Value(isolate, frame->GetFunctionName())) + "()";
 	} else {
 		// if we get no function the call was from the toplevel scope
-		function = "<global scope>";
+		entry.function = "<global scope>";
 	}
-	int line = frame->GetLineNumber();
-	int column = frame->GetColumn();
+	stats.stack_time.record(stats_now() - stack_start);
+	DBLOGGER_PROBE1(stack__done, entry.line);
 
 	// convert all arguments to readable values (JSON.stringify objects and arrays)
-	vector<string> objs = vector<string>();
+	DBLOGGER_PROBE1(serialize__start, args.Length());
+	uint64_t serialize_start = stats_now();
+	if (!logger->destination->context_storage.IsEmpty()) {
+		entry.context = read_context(isolate, logger->destination->context_storage);
+	}
+	Local<Object> fields_object;
+	string message;
+	size_t count = 0;
 	for(int i = 0; i < args.Length(); i++) {
 		Local<Value> val = Local<Object>::Cast(args[i]);
-		string item;
+		bool attach = is_binary(val) && (logger->destination->attachment_max_size > 0);
+
+		if (!attach && logger->destination->structured_fields && is_field_object(val)) {
+			// collect into the fields object, serialized once after the loop
+			if (fields_object.IsEmpty()) {
+				fields_object = Object::New(isolate);
+			}
+			merge_fields(isolate, fields_object, val.As<Object>());
+			continue;
+		}
+
+		if (count++ > 0) {
+			message += ' ';
+		}
+
+		// binary data is attached as is, the message only names it
+		if (attach) {
+			LogAttachment attachment = binary_attachment(isolate, val, logger->destination->attachment_max_size);
+			message += "<" + attachment.type + " " + to_string(attachment.size) + " bytes>";
+			entry.attachments.push_back(std::move(attachment));
+			continue;
+		}
 
 		if (val->IsArray() || val->IsObject()) {
 			// stringify arrays and objects
-			item = JSONStringify(isolate, val);
+			message += JSONStringify(isolate, val);
 		} else {
-			// just convert to string
-			item = string(*String::Utf8Value(
-				isolate,
-				val->ToString(isolate->GetCurrentContext()).ToLocalChecked()
-			));
+			// convert to string and copy the UTF-8 straight into the message
+			Local<String> text = val->ToString(isolate->GetCurrentContext()).ToLocalChecked();
+			size_t offset = message.size();
+			message.resize(offset + text->Utf8Length(isolate));
+			text->WriteUtf8(isolate, &message[offset], message.size() - offset, NULL, String::NO_NULL_TERMINATION | String::REPLACE_INVALID_UTF8);
 		}
-
-		// add to argument list
-		objs.push_back(item);
 	}
 
-	// if stdout logging is enabled emit a log line
-	if (logger->log_to_stdout) {
-		log_stdout(level, now, hostname, pid, filename, function, line, column, objs, logger->tags);
+	// one part holding the whole message, built once for all sinks
+	if (count > 0) {
+		entry.parts.push_back(std::move(message));
+	}
+	if (!fields_object.IsEmpty()) {
+		entry.fields = JSONStringify(isolate, fields_object);
 	}
+	stats.serialize_time.record(stats_now() - serialize_start);
+#ifdef DBLOGGER_HAVE_PROBES
+	size_t serialized_bytes = entry.fields.size();
+	for (const string &part : entry.parts) {
+		serialized_bytes += part.size();
+	}
+	DBLOGGER_PROBE1(serialize__done, serialized_bytes);
+#endif
 
-	// log to the database
-	if (!connection->valid) {
-		logger->rotate();
+	// emit to stdout if enabled, the database and all other sinks
+	logger->destination->dispatch(entry, logger->log_to_stdout);
+	if ((flight_recorder != NULL) && (level >= flight_recorder->level)) {
+		flight_recorder->record(entry, true);
 	}
-	log_db(connection, level, now, hostname, pid, filename, function, line, column, objs, logger->tags);
+	DBLOGGER_PROBE1(log__done, level);
+}
+
+// Convert a latency histogram to a JS object, all values in microseconds
+static Local<Object> histogram_object(Isolate *isolate, const Histogram &histogram) {
+	Local<Context> context = isolate->GetCurrentContext();
+	Local<Object> result = Object::New(isolate);
+
+	uint64_t count = histogram.count();
+	double mean = (count > 0) ? ((double)histogram.sum() / count) : 0;
+
+	result->Set(context, local_string(isolate, "count"), Number::New(isolate, count)).Check();
+	result->Set(context, local_string(isolate, "mean"), Number::New(isolate, mean / 1000.0)).Check();
+	result->Set(context, local_string(isolate, "p50"), Number::New(isolate, histogram.percentile(50) / 1000.0)).Check();
+	result->Set(context, local_string(isolate, "p90"), Number::New(isolate, histogram.percentile(90) / 1000.0)).Check();
+	result->Set(context, local_string(isolate, "p99"), Number::New(isolate, histogram.percentile(99) / 1000.0)).Check();
+	result->Set(context, local_string(isolate, "p999"), Number::New(isolate, histogram.percentile(99.9) / 1000.0)).Check();
+	result->Set(context, local_string(isolate, "max"), Number::New(isolate, histogram.max() / 1000.0)).Check();
+
+	return result;
+}
+
+// Convert a hit/miss counter pair to a JS object
+static Local<Object> cache_object(Isolate *isolate, uint64_t hits, uint64_t misses) {
+	Local<Context> context = isolate->GetCurrentContext();
+	Local<Object> result = Object::New(isolate);
+
+	double rate = (hits + misses > 0) ? ((double)hits / (hits + misses)) : 0;
+
+	result->Set(context, local_string(isolate, "hits"), Number::New(isolate, hits)).Check();
+	result->Set(context, local_string(isolate, "misses"), Number::New(isolate, misses)).Check();
+	result->Set(context, local_string(isolate, "hitRate"), Number::New(isolate, rate)).Check();
+
+	return result;
 }
 
 /*
@@ -248,7 +687,9 @@ Persistent<Function> Logger::constructor;
 Logger::Logger() {
 	level = 0;
 	log_to_stdout = false;
-	tags = set<string>();
+	tags = TagSet::empty();
+	destination = Destination::get("default");
+	logger_name = destination->logger_name;
 }
 
 Logger::~Logger() {}
@@ -284,6 +725,23 @@ void Logger::Init(Local<Object> exports, Local<Value> module) {
 	// Prototype log rotation function
 	NODE_SET_PROTOTYPE_METHOD(tpl, "rotate", Rotate);
 
+	// Prototype flush function for queued sinks
+	NODE_SET_PROTOTYPE_METHOD(tpl, "flush", Flush);
+
+	// Prototype flight recorder dump of all destinations, called on uncaught exceptions and signals
+	NODE_SET_PROTOTYPE_METHOD(tpl, "flightDump", FlightDump);
+
+	// Prototype runtime statistics function
+	NODE_SET_PROTOTYPE_METHOD(tpl, "stats", GetStats);
+
+	// Prototype live tail functions, wrapped into an async iterator by `tail()` in index.js
+	NODE_SET_PROTOTYPE_METHOD(tpl, "tailSubscribe", TailSubscribe);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "tailClose", TailClose);
+
+	// Prototype background queries, wrapped into promises by `export()` and `rollup()` in index.js
+	NODE_SET_PROTOTYPE_METHOD(tpl, "exportStart", ExportStart);
+	NODE_SET_PROTOTYPE_METHOD(tpl, "rollupQuery", RollupQuery);
+
 	// Return create function, set class name
 	constructor.Reset(isolate, tpl->GetFunction(isolate->GetCurrentContext()).ToLocalChecked());
 	auto result = exports->Set(
@@ -305,21 +763,28 @@ void Logger::New(const FunctionCallbackInfo<Value>& args) {
 		if (args.Length() > 0) {
 			Local<Object> config = Local<Object>::Cast(args[0]);
 			if (config->IsObject()) {
-				// argument is an configuration object, re-initialize DB
-				initializeDB(isolate, config);
+				// argument is an configuration object, bind to the destination and re-initialize its sinks
+				string destination_name = get_string_from_dict(isolate, config, "destination");
+				if (destination_name == "undefined") {
+					destination_name = "default";
+				}
+				Destination *destination = Destination::get(destination_name);
+				initializeSinks(isolate, destination, config);
 
-				if (!connection) {
+				if (!destination->configured) {
 					// Invoked without configuration
+					delete obj;
 					isolate->ThrowException(Exception::Error(local_string(isolate, "You have to provide a configuration object for the first instanciation of a logger.")));
 					return;
 				}
+				obj->destination = destination;
 
 				// if the config object contains a `level` set the log level to that value
 				Local<Value> level = get_value_from_dict(isolate, config, "level");
 				if (level->IsNumber()) {
 					obj->level = level->NumberValue(isolate->GetCurrentContext()).FromMaybe(0);
 				} else {
-					obj->level = connection->global_log_level;
+					obj->level = destination->level;
 				}
 
 				// additionally log to stdout?
@@ -327,32 +792,31 @@ void Logger::New(const FunctionCallbackInfo<Value>& args) {
 				if (stdout->IsBoolean()) {
 					obj->log_to_stdout = stdout->BooleanValue(isolate);
 				} else {
-					obj->log_to_stdout = connection->log_to_stdout;
+					obj->log_to_stdout = destination->log_to_stdout;
 				}
 
-				if (!connection->valid) {
+				if (destination->db_sink && !destination->db_sink->connection->valid) {
 					obj->log_to_stdout = true;
 				}
 
-				// logger name
+				// logger name, defaults to the name the destination has been configured with
 				Local<Value> logger_name = get_value_from_dict(isolate, config, "logger");
-				if (logger_name->IsString()) {
-					connection->logger_name = get_string_from_value(isolate, logger_name);
-				}
-				if (!logger_name->IsString() || (connection->logger_name == "")) {
-					connection->logger_name = "default";
+				if (logger_name->IsString() && (get_string_from_value(isolate, logger_name) != "")) {
+					obj->logger_name = get_string_from_value(isolate, logger_name);
+				} else {
+					obj->logger_name = destination->logger_name;
 				}
 			} else if (config->IsNumber()) {
 				// first argument is a number, assume this is the log level
 				obj->level = config->NumberValue(isolate->GetCurrentContext()).FromMaybe(0);
-				obj->log_to_stdout = connection->log_to_stdout;
+				obj->log_to_stdout = obj->destination->log_to_stdout;
 			} else {
-				obj->level = connection->global_log_level;
-				obj->log_to_stdout = connection->log_to_stdout;
+				obj->level = obj->destination->level;
+				obj->log_to_stdout = obj->destination->log_to_stdout;
 			}
 		} else {
-			obj->level = connection->global_log_level;
-			obj->log_to_stdout = connection->log_to_stdout;
+			obj->level = obj->destination->level;
+			obj->log_to_stdout = obj->destination->log_to_stdout;
 		}
 
 		// return logger object
@@ -401,6 +865,9 @@ void Logger::Error(const FunctionCallbackInfo<Value>& args) {
 void Logger::Fatal(const FunctionCallbackInfo<Value>& args) {
 	Logger* logger = ObjectWrap::Unwrap<Logger>(args.Holder());
 	log(60, logger, args);
+
+	// the process is probably about to die, keep what led up to it
+	logger->destination->dump_flight_recorder();
 }
 
 /*
@@ -421,21 +888,21 @@ void Logger::Tag(const FunctionCallbackInfo<Value>& context) {
 
 	Logger* obj = ObjectWrap::Unwrap<Logger>(result);;
 
-	// copy tags from parent
-	for(auto tag : logger->tags) {
-		obj->tags.insert(tag);
-	}
-
 	// copy settings from parent
 	obj->log_to_stdout = logger->log_to_stdout;
 	obj->level = logger->level;
+	obj->destination = logger->destination;
+	obj->logger_name = logger->logger_name;
 
-	// add new tags from arguments
+	// add new tags from arguments to the tags of the parent, the set is interned once here
+	// so log calls only copy a reference
+	set<string> tags = logger->tags->names;
 	for(int i = 0; i < context.Length(); i++) {
 		Local<Value> val = Local<Object>::Cast(context[i]);
 		string tag = get_string_from_value(isolate, val);
-		obj->tags.insert(tag);
+		tags.insert(tag);
 	}
+	obj->tags = TagSet::intern(tags);
 
 	// return new instance
     context.GetReturnValue().Set(result);
@@ -447,25 +914,359 @@ void Logger::Tag(const FunctionCallbackInfo<Value>& context) {
  */
 
 void Logger::Rotate(const FunctionCallbackInfo<Value>& context) {
+	stats_add(stats.rotations);
 	rotate();
 }
 
 void Logger::rotate(void) {
-	if (connection != NULL) {
-		auto new_connection = new DBConnection(
-			connection->db_type,
-			connection->db_host,
-			connection->db_port,
-			connection->db_user,
-			connection->db_password,
-			connection->db_name,
-			connection->prefix,
-			connection->logger_name
-		);
-		new_connection->logger_name = connection->logger_name;
-		new_connection->global_log_level = connection->global_log_level;
-		new_connection->log_to_stdout = connection->log_to_stdout;
+	Destination::rotate_all();
+
+	// scripts may have been replaced by a deployment
+	SourceMapCache::clear();
+}
+
+/*
+ * Wait for all queued log entries to be written
+ */
+
+void Logger::Flush(const FunctionCallbackInfo<Value>& context) {
+	flush();
+}
+
+void Logger::flush(void) {
+	Destination::flush_all();
+}
+
+
+/*
+ * Live tail
+ */
+
+// Hand the rows read by the worker thread to the JS callback, runs on the event loop
+static void tail_deliver(uv_async_t *handle) {
+	TailSubscription *subscription = (TailSubscription *)handle->data;
+	Isolate *isolate = subscription->isolate;
+	v8::HandleScope scope(isolate);
+	Local<Context> context = subscription->context.Get(isolate);
+	Context::Scope context_scope(context);
+
+	auto rows = subscription->tail->take();
+	if (rows.empty()) {
+		return;
+	}
+
+	Local<Array> result = Array::New(isolate, rows.size());
+	for (size_t i = 0; i < rows.size(); i++) {
+		Local<Object> row = Object::New(isolate);
+		for (auto &column : rows[i]) {
+			row->Set(context, local_string(isolate, column.first), local_string(isolate, column.second)).Check();
+		}
+		result->Set(context, i, row).Check();
+	}
+
+	// the callback may close the subscription
+	Local<Value> argv[] = { result };
+	node::MakeCallback(isolate, context->Global(), subscription->callback.Get(isolate), 1, argv, node::async_context{ 0, 0 });
+}
+
+static void tail_closed(uv_handle_t *handle) {
+	TailSubscription *subscription = (TailSubscription *)handle->data;
+	subscription->context.Reset();
+	subscription->callback.Reset();
+	delete subscription;
+}
+
+// `tailSubscribe({ minLevel, tags }, callback)`: read new rows of the DB of the destination,
+// `callback` is called with arrays of rows. Returns the ID for `tailClose()`.
+void Logger::TailSubscribe(const FunctionCallbackInfo<Value>& args) {
+	Logger* logger = ObjectWrap::Unwrap<Logger>(args.Holder());
+	Isolate* isolate = args.GetIsolate();
+
+	DBSink *db_sink = logger->destination->db_sink;
+	if ((db_sink == NULL) || ((db_sink->connection->db_type != "sqlite") && (db_sink->connection->db_type != "postgres"))) {
+		isolate->ThrowException(Exception::Error(local_string(isolate, "tail() needs a SQLite or Postgres destination.")));
+		return;
+	}
+	if ((args.Length() < 2) || !args[1]->IsFunction()) {
+		isolate->ThrowException(Exception::TypeError(local_string(isolate, "tailSubscribe() needs a callback.")));
+		return;
+	}
+
+	int min_level = 0;
+	set<string> tags = set<string>();
+	if (args[0]->IsObject()) {
+		Local<Object> options = args[0].As<Object>();
+		min_level = get_int_from_dict(isolate, options, "minLevel");
+		tags = get_string_set_from_dict(isolate, options, "tags");
+	}
+
+	TailSubscription *subscription = new TailSubscription();
+	subscription->isolate = isolate;
+	subscription->context.Reset(isolate, isolate->GetCurrentContext());
+	subscription->callback.Reset(isolate, args[1].As<Function>());
+	uv_async_init(node::GetCurrentEventLoop(isolate), &subscription->async, tail_deliver);
+	subscription->async.data = subscription;
+	subscription->tail = new Tail(db_sink->connection, min_level, tags, [subscription] {
+		uv_async_send(&subscription->async);
+	});
+
+	int id = next_tail_id++;
+	tail_subscriptions[id] = subscription;
+	args.GetReturnValue().Set(Number::New(isolate, id));
+}
+
+void Logger::TailClose(const FunctionCallbackInfo<Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	int id = (args.Length() > 0) ? args[0]->IntegerValue(isolate->GetCurrentContext()).FromMaybe(0) : 0;
+
+	auto search = tail_subscriptions.find(id);
+	if (search == tail_subscriptions.end()) {
+		return;
+	}
+	TailSubscription *subscription = search->second;
+	tail_subscriptions.erase(search);
+
+	// stops the worker, no wakeups after this
+	delete subscription->tail;
+	subscription->tail = NULL;
+	uv_close((uv_handle_t *)&subscription->async, tail_closed);
+}
+
+/*
+ * Background queries
+ */
+
+static void db_job_closed(uv_handle_t *handle) {
+	DBJob *job = (DBJob *)handle->data;
+	job->context.Reset();
+	job->callback.Reset();
+	delete job->rows;
+	delete job;
+}
+
+// Call the JS callback with `(error, result)`, runs on the event loop
+static void db_job_done(uv_async_t *handle) {
+	DBJob *job = (DBJob *)handle->data;
+	Isolate *isolate = job->isolate;
+	v8::HandleScope scope(isolate);
+	Local<Context> context = job->context.Get(isolate);
+	Context::Scope context_scope(context);
+
+	job->worker.join();
+	Local<Value> argv[] = { v8::Null(isolate), Number::New(isolate, job->count) };
+	if (job->count < 0) {
+		argv[0] = Exception::Error(local_string(isolate, job->error));
+		argv[1] = v8::Undefined(isolate);
+	} else if (job->rows != NULL) {
+		Local<Array> result = Array::New(isolate, job->rows->size());
+		for (size_t i = 0; i < job->rows->size(); i++) {
+			Local<Object> row = Object::New(isolate);
+			for (auto &column : (*job->rows)[i]) {
+				row->Set(context, local_string(isolate, column.first), local_string(isolate, column.second)).Check();
+			}
+			result->Set(context, i, row).Check();
+		}
+		argv[1] = result;
+	}
+	Local<Function> callback = job->callback.Get(isolate);
+	uv_close((uv_handle_t *)&job->async, db_job_closed);
+	node::MakeCallback(isolate, context->Global(), callback, 2, argv, node::async_context{ 0, 0 });
+}
+
+// Run `job->run` on a worker thread with a new connection to the DB of `db_sink`
+static void db_job_start(Isolate *isolate, DBSink *db_sink, Local<Function> callback, DBJob *job) {
+	job->count = 0;
+	job->rows = NULL;
+	job->isolate = isolate;
+	job->context.Reset(isolate, isolate->GetCurrentContext());
+	job->callback.Reset(isolate, callback);
+	uv_async_init(node::GetCurrentEventLoop(isolate), &job->async, db_job_done);
+	job->async.data = job;
+
+	// jobs without a DB (segment storage) run on the worker thread as well
+	if (db_sink == NULL) {
+		job->worker = std::thread([job] {
+			job->count = job->run(NULL, job);
+			uv_async_send(&job->async);
+		});
+		return;
+	}
+
+	const DBConnection *writer = db_sink->connection;
+	job->worker = std::thread([job, db_type = writer->db_type, db_host = writer->db_host, db_port = writer->db_port,
+		db_user = writer->db_user, db_password = writer->db_password, db_name = writer->db_name, prefix = writer->prefix,
+		application_name = writer->application_name] {
+
+		DBConnection *connection = new DBConnection(db_type, db_host, db_port, db_user, db_password, db_name, prefix, application_name);
+		job->count = job->run(connection, job);
 		delete connection;
-		connection = new_connection;
+		uv_async_send(&job->async);
+	});
+}
+
+// The DB sink of a logger for background queries, throws if there is none
+static DBSink *job_db_sink(Isolate *isolate, Logger *logger, const FunctionCallbackInfo<Value>& args, string name) {
+	DBSink *db_sink = logger->destination->db_sink;
+	if ((db_sink == NULL) || ((db_sink->connection->db_type != "sqlite") && (db_sink->connection->db_type != "postgres"))) {
+		isolate->ThrowException(Exception::Error(local_string(isolate, name + "() needs a SQLite or Postgres destination.")));
+		return NULL;
+	}
+	if ((args.Length() < 2) || !args[0]->IsObject() || !args[1]->IsFunction()) {
+		isolate->ThrowException(Exception::TypeError(local_string(isolate, name + "() needs options and a callback.")));
+		return NULL;
+	}
+	return db_sink;
+}
+
+// `exportStart({ path, format, from, to, minLevel, batch }, callback)`: export the log table of the
+// DB of the destination, `from` and `to` are milliseconds since the epoch. `callback` gets the
+// number of exported entries.
+void Logger::ExportStart(const FunctionCallbackInfo<Value>& args) {
+	Logger* logger = ObjectWrap::Unwrap<Logger>(args.Holder());
+	Isolate* isolate = args.GetIsolate();
+	Local<Context> context = isolate->GetCurrentContext();
+
+	// segment storage is read from its files, without a DB connection
+	SegmentSink *segment_sink = logger->destination->segment_sink;
+	DBSink *db_sink = NULL;
+	if (segment_sink == NULL) {
+		db_sink = job_db_sink(isolate, logger, args, "exportStart");
+		if (db_sink == NULL) {
+			return;
+		}
+	} else if ((args.Length() < 2) || !args[0]->IsObject() || !args[1]->IsFunction()) {
+		isolate->ThrowException(Exception::TypeError(local_string(isolate, "exportStart() needs options and a callback.")));
+		return;
 	}
+
+	Local<Object> options = args[0].As<Object>();
+	ExportOptions export_options;
+	export_options.path = get_string_from_dict(isolate, options, "path");
+	export_options.format = get_string_from_dict(isolate, options, "format");
+	if (export_options.format == "undefined") {
+		export_options.format = "ndjson";
+	}
+	export_options.from_us = (int64_t)get_value_from_dict(isolate, options, "from")->NumberValue(context).FromMaybe(0) * 1000;
+	export_options.to_us = (int64_t)get_value_from_dict(isolate, options, "to")->NumberValue(context).FromMaybe(0) * 1000;
+	export_options.min_level = get_int_from_dict(isolate, options, "minLevel");
+	int batch_size = get_int_from_dict(isolate, options, "batch");
+	export_options.page_size = (batch_size > 0) ? batch_size : 10000;
+
+	DBJob *job = new DBJob();
+	string directory = (segment_sink != NULL) ? segment_sink->directory : "";
+	job->run = [export_options, directory](DBConnection *connection, DBJob *job) {
+		if (connection == NULL) {
+			return export_segments(directory, export_options, job->error);
+		}
+		return export_log(connection, export_options, job->error);
+	};
+	db_job_start(isolate, db_sink, args[1].As<Function>(), job);
+}
+
+// `rollupQuery({ from, to, minLevel, interval, groupBy }, callback)`: entry counts from the
+// rollup table of the DB of the destination, `from` and `to` are milliseconds since the epoch.
+// `callback` gets the rows of rollup_query().
+void Logger::RollupQuery(const FunctionCallbackInfo<Value>& args) {
+	Logger* logger = ObjectWrap::Unwrap<Logger>(args.Holder());
+	Isolate* isolate = args.GetIsolate();
+	Local<Context> context = isolate->GetCurrentContext();
+
+	DBSink *db_sink = job_db_sink(isolate, logger, args, "rollupQuery");
+	if (db_sink == NULL) {
+		return;
+	}
+
+	Local<Object> options = args[0].As<Object>();
+	int64_t from = (int64_t)get_value_from_dict(isolate, options, "from")->NumberValue(context).FromMaybe(0) / 1000;
+	int64_t to = (int64_t)get_value_from_dict(isolate, options, "to")->NumberValue(context).FromMaybe(0) / 1000;
+	int min_level = get_int_from_dict(isolate, options, "minLevel");
+	int interval = get_int_from_dict(isolate, options, "interval");
+	set<string> group_by = get_string_set_from_dict(isolate, options, "groupBy");
+
+	DBJob *job = new DBJob();
+	job->run = [from, to, min_level, interval, group_by](DBConnection *connection, DBJob *job) {
+		if (!connection->valid) {
+			job->error = "Could not connect to the DB";
+			return -1L;
+		}
+		job->rows = rollup_query(connection, from, to, min_level, interval, group_by);
+		if (job->rows == NULL) {
+			job->error = "Could not query the rollup table";
+			return -1L;
+		}
+		return (long)job->rows->size();
+	};
+	db_job_start(isolate, db_sink, args[1].As<Function>(), job);
+}
+
+/*
+ * Flight recorder
+ */
+
+void Logger::FlightDump(const FunctionCallbackInfo<Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	args.GetReturnValue().Set(Number::New(isolate, Destination::dump_flight_recorders()));
+}
+
+/*
+ * Runtime statistics
+ */
+
+void Logger::GetStats(const FunctionCallbackInfo<Value>& context) {
+	Isolate* isolate = context.GetIsolate();
+	Local<Context> cx = isolate->GetCurrentContext();
+	Local<Object> result = Object::New(isolate);
+
+	// entries per level
+	const char *level_names[] = { "other", "trace", "debug", "info", "warn", "error", "fatal" };
+	Local<Object> entries = Object::New(isolate);
+	for (int i = 0; i < 7; i++) {
+		entries->Set(cx, local_string(isolate, level_names[i]), Number::New(isolate, stats.entries[i].load())).Check();
+	}
+	result->Set(cx, local_string(isolate, "entries"), entries).Check();
+	result->Set(cx, local_string(isolate, "filtered"), Number::New(isolate, stats.filtered.load())).Check();
+	result->Set(cx, local_string(isolate, "dropped"), Number::New(isolate, stats.dropped.load())).Check();
+
+	// database
+	Local<Object> db = Object::New(isolate);
+	db->Set(cx, local_string(isolate, "statements"), Number::New(isolate, stats.db_statements.load())).Check();
+	db->Set(cx, local_string(isolate, "errors"), Number::New(isolate, stats.db_errors.load())).Check();
+	db->Set(cx, local_string(isolate, "reconnects"), Number::New(isolate, stats.reconnects.load())).Check();
+	db->Set(cx, local_string(isolate, "rotations"), Number::New(isolate, stats.rotations.load())).Check();
+	DBSink *db_sink = ObjectWrap::Unwrap<Logger>(context.Holder())->destination->db_sink;
+	db->Set(cx, local_string(isolate, "indexProfile"), local_string(isolate, (db_sink != NULL) ? db_sink->index_profile_status() : "none")).Check();
+	result->Set(cx, local_string(isolate, "db"), db).Check();
+
+	// caches
+	Local<Object> cache = Object::New(isolate);
+	cache->Set(cx, local_string(isolate, "tag"), cache_object(isolate, stats.tag_cache_hits.load(), stats.tag_cache_misses.load())).Check();
+	cache->Set(cx, local_string(isolate, "dimension"), cache_object(isolate, stats.dimension_cache_hits.load(), stats.dimension_cache_misses.load())).Check();
+	result->Set(cx, local_string(isolate, "cache"), cache).Check();
+
+	// bytes written
+	Local<Object> bytes = Object::New(isolate);
+	bytes->Set(cx, local_string(isolate, "stdout"), Number::New(isolate, stats.bytes_stdout.load())).Check();
+	bytes->Set(cx, local_string(isolate, "db"), Number::New(isolate, stats.bytes_db.load())).Check();
+	bytes->Set(cx, local_string(isolate, "file"), Number::New(isolate, stats.bytes_file.load())).Check();
+	bytes->Set(cx, local_string(isolate, "collector"), Number::New(isolate, stats.bytes_collector.load())).Check();
+	result->Set(cx, local_string(isolate, "bytes"), bytes).Check();
+
+	// latency histograms
+	Local<Object> latency = Object::New(isolate);
+	latency->Set(cx, local_string(isolate, "log"), histogram_object(isolate, stats.log_time)).Check();
+	latency->Set(cx, local_string(isolate, "stack"), histogram_object(isolate, stats.stack_time)).Check();
+	latency->Set(cx, local_string(isolate, "serialize"), histogram_object(isolate, stats.serialize_time)).Check();
+	latency->Set(cx, local_string(isolate, "stdout"), histogram_object(isolate, stats.stdout_time)).Check();
+	latency->Set(cx, local_string(isolate, "db"), histogram_object(isolate, stats.db_time)).Check();
+	latency->Set(cx, local_string(isolate, "dbExecute"), histogram_object(isolate, stats.db_execute_time)).Check();
+	latency->Set(cx, local_string(isolate, "dbQuery"), histogram_object(isolate, stats.db_query_time)).Check();
+	latency->Set(cx, local_string(isolate, "dbInsert"), histogram_object(isolate, stats.db_insert_time)).Check();
+	result->Set(cx, local_string(isolate, "latency"), latency).Check();
+
+	// `stats(true)` resets all counters after reading them
+	if ((context.Length() > 0) && context[0]->BooleanValue(isolate)) {
+		stats.reset();
+	}
+
+	context.GetReturnValue().Set(result);
 }
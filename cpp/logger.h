@@ -7,6 +7,8 @@
 #include <node.h>
 #include <node_object_wrap.h>
 
+#include "tag_set.h"
+
 using v8::Local;
 using v8::Object;
 using v8::Function;
@@ -16,13 +18,18 @@ using v8::FunctionCallbackInfo;
 using std::set;
 using std::string;
 
+class Destination;
+
 class Logger : public node::ObjectWrap {
 	public:
 		static void Init(Local<Object> exports, Local<Value> module);
 		static void rotate(void);
+		static void flush(void);
 		bool log_to_stdout;
-		set<string> tags;
+		TagSetRef tags;
 		int level;
+		Destination *destination;
+		string logger_name;
 
 	private:
 		explicit Logger();
@@ -33,6 +40,13 @@ class Logger : public node::ObjectWrap {
 
 		static void Tag(const FunctionCallbackInfo<Value>& info);
 		static void Rotate(const FunctionCallbackInfo<Value>& info);
+		static void Flush(const FunctionCallbackInfo<Value>& info);
+		static void GetStats(const FunctionCallbackInfo<Value>& info);
+		static void FlightDump(const FunctionCallbackInfo<Value>& info);
+		static void TailSubscribe(const FunctionCallbackInfo<Value>& info);
+		static void TailClose(const FunctionCallbackInfo<Value>& info);
+		static void ExportStart(const FunctionCallbackInfo<Value>& info);
+		static void RollupQuery(const FunctionCallbackInfo<Value>& info);
 
 		static void Trace(const FunctionCallbackInfo<Value>& info);
 		static void Debug(const FunctionCallbackInfo<Value>& info);
@@ -0,0 +1,335 @@
+/*
+ * dblogger-migrate: converts the log table of a running DB to layout 2 (64 bit IDs,
+ * microsecond timestamps, no AUTOINCREMENT on SQLite) without stopping the writers.
+ *
+ * 1. `<prefix>_log_v2` is created and filled from `<prefix>_log` in small batches, each batch
+ *    is its own transaction so writers are only blocked for a moment. Interrupted runs continue
+ *    where they stopped.
+ * 2. The indexes of the log table are re-created on the new table under a temporary name, the
+ *    switch only renames them (SQLite: in the schema table). The old indexes are kept with `_v1`.
+ * 3. In one short transaction the remaining rows are copied and the tables are swapped, the old
+ *    table is kept as `<prefix>_log_v1` unless --drop-old is given. On Postgres this copies every
+ *    row missing in the new table, rows can be committed after rows with higher IDs.
+ *
+ * Writers that still send seconds are converted to microseconds by a trigger on the new table,
+ * they switch to microseconds on their next reconnect or rotation.
+ *
+ * With --index-profile only the indexes of the profile are created, see setup_index_profile().
+ */
+
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+
+#include "cli.h"
+#include "db.h"
+#include "schema.h"
+
+using std::cerr;
+using std::to_string;
+using std::vector;
+
+static void usage(void) {
+	cerr << "Usage: dblogger-migrate --name <name> [options]\n\n"
+		"  --batch <count>           Rows copied per transaction (default: 10000)\n"
+		"  --pause <ms>              Pause between batches (default: 10)\n"
+		"  --drop-old                Drop the old log table after the switch\n"
+		"  --index-profile <name>    Only create the indexes of a profile (time) on the log table\n\n"
+		<< connection_usage("");
+}
+
+// Quote an identifier for the DB type
+static string quote(DBConnection *connection, string name) {
+	if (connection->db_type == "sqlite") {
+		return "`" + name + "`";
+	}
+	return "\"" + name + "\"";
+}
+
+// First column of the first row of a query, `fallback` if there is no row or the value is NULL
+static string scalar(DBConnection *connection, string sql, string fallback) {
+	auto result = connection->query(sql);
+	string value = fallback;
+	if ((result->size() > 0) && (result->front()["value"].size() > 0)) {
+		value = result->front()["value"];
+	}
+	delete result;
+	return value;
+}
+
+// Run the statements of the table switch, the transaction is rolled back on the first error
+static bool execute_switch(DBConnection *connection, const vector<string> &statements) {
+	for (const string &sql : statements) {
+		if (!connection->execute(sql)) {
+			cerr << "Switching failed, nothing has been changed: " << sql << "\n";
+			if (connection->db_type == "sqlite") {
+				connection->execute("ROLLBACK;");
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool has_column(DBConnection *connection, string table, string column) {
+	if (connection->db_type == "sqlite") {
+		return scalar(connection, "SELECT COUNT(*) AS value FROM pragma_table_info('" + table + "') WHERE name = '" + column + "'", "0") != "0";
+	}
+	return scalar(connection, "SELECT COUNT(*) AS value FROM information_schema.columns WHERE table_schema = current_schema() AND table_name = '" + table + "' AND column_name = '" + column + "'", "0") != "0";
+}
+
+static bool create_table(DBConnection *connection, string prefix, string table) {
+	for (string sql : schema_log_table(connection->db_type, prefix, table)) {
+		if (!connection->execute(sql)) {
+			return false;
+		}
+	}
+
+	// columns added by later schema versions
+	if (!has_column(connection, table, "fields")) {
+		string type = (connection->db_type == "sqlite") ? "TEXT DEFAULT NULL" : "jsonb";
+		if (!connection->execute("ALTER TABLE " + quote(connection, table) + " ADD COLUMN " + quote(connection, "fields") + " " + type + ";")) {
+			return false;
+		}
+	}
+	if (!has_column(connection, table, "context")) {
+		string type = (connection->db_type == "sqlite") ? "TEXT DEFAULT NULL" : "jsonb";
+		if (!connection->execute("ALTER TABLE " + quote(connection, table) + " ADD COLUMN " + quote(connection, "context") + " " + type + ";")) {
+			return false;
+		}
+	}
+	if (!has_column(connection, table, "tagsetID")) {
+		string type = (connection->db_type == "sqlite") ? "INTEGER DEFAULT NULL" : "int4";
+		if (!connection->execute(
+			"ALTER TABLE " + quote(connection, table) + " ADD COLUMN " + quote(connection, "tagsetID") + " " + type +
+			" REFERENCES " + quote(connection, prefix + "_tagset") + " (" + quote(connection, "id") + ") ON DELETE SET NULL ON UPDATE CASCADE;"
+		)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Copy the rows matching `condition` (on the source table `s`) in ID order
+static bool copy_where(DBConnection *connection, string source, string target, string condition, string limit) {
+	string columns = "\"id\", \"level\", \"message\", \"pid\", \"time\", \"functionID\", \"loggerID\", \"hostnameID\", \"fields\", \"tagsetID\", \"context\"";
+	string sql =
+		"INSERT INTO \"" + target + "\" (" + columns + ") "
+		"SELECT s.\"id\", s.\"level\", s.\"message\", s.\"pid\", s.\"time\" * 1000000, s.\"functionID\", s.\"loggerID\", s.\"hostnameID\", s.\"fields\", s.\"tagsetID\", s.\"context\" "
+		"FROM \"" + source + "\" s WHERE " + condition + " ORDER BY s.\"id\"" + (limit.size() > 0 ? " LIMIT " + limit : "") + ";";
+	return connection->execute(sql);
+}
+
+// Copy up to `limit` rows with an ID above `last_id`, returns the highest copied ID
+static string copy_rows(DBConnection *connection, string source, string target, string last_id, string limit) {
+	if (!copy_where(connection, source, target, "s.\"id\" > " + last_id, limit)) {
+		return "";
+	}
+	return scalar(connection, "SELECT max(\"id\") AS value FROM \"" + target + "\"", "0");
+}
+
+// Copy all rows that are not in the target yet. Postgres hands out IDs before the rows are
+// committed, a row committed after the batch that passed its ID is only found this way.
+static bool copy_missing_rows(DBConnection *connection, string source, string target) {
+	return copy_where(connection, source, target, "NOT EXISTS (SELECT 1 FROM \"" + target + "\" t WHERE t.\"id\" = s.\"id\")", "");
+}
+
+int main(int argc, char **argv) {
+	map<string, string> arguments;
+	if (!parse_arguments(argc, argv, arguments) || (arguments.count("name") == 0)) {
+		usage();
+		return 1;
+	}
+
+	DBConnection *connection = connect_from_arguments(arguments, "", "migrate");
+	if (!connection->valid || ((connection->db_type != "sqlite") && (connection->db_type != "postgres"))) {
+		cerr << "Could not connect to the DB\n";
+		return 1;
+	}
+	if (arguments.count("index-profile") > 0) {
+		string profile = get_argument(arguments, "index-profile", "");
+		cerr << "Creating the indexes of profile " << profile << "\n";
+		bool created = (connection->setup_index_profile(profile) == INDEX_PROFILE_DONE);
+		delete connection;
+		return created ? 0 : 1;
+	}
+	if (connection->layout >= 2) {
+		cerr << "The log table already uses layout " << connection->layout << "\n";
+		delete connection;
+		return 0;
+	}
+
+	bool sqlite = (connection->db_type == "sqlite");
+	string prefix = connection->prefix;
+	string log_table = prefix + "_log";
+	string new_table = prefix + "_log_v2";
+	string old_table = prefix + "_log_v1";
+	string batch = to_string(get_int_argument(arguments, "batch", 10000));
+	int pause = get_int_argument(arguments, "pause", 10);
+
+	if (scalar(connection, sqlite ?
+		"SELECT COUNT(*) AS value FROM sqlite_master WHERE type = 'table' AND name = '" + old_table + "'" :
+		"SELECT COUNT(*) AS value FROM pg_catalog.pg_tables WHERE schemaname = current_schema() AND tablename = '" + old_table + "'", "0") != "0") {
+		cerr << old_table << " exists already, drop it or rename it before migrating again\n";
+		delete connection;
+		return 1;
+	}
+
+	// 1. create the new table and copy in batches until it caught up
+	if (!create_table(connection, prefix, new_table)) {
+		cerr << "Could not create " << new_table << "\n";
+		delete connection;
+		return 1;
+	}
+
+	string last_id = scalar(connection, "SELECT max(\"id\") AS value FROM \"" + new_table + "\"", "0");
+	string end_id = scalar(connection, "SELECT max(\"id\") AS value FROM \"" + log_table + "\"", "0");
+	cerr << "Copying " << log_table << " from ID " << last_id << " to " << end_id << "\n";
+	while (std::stoll(last_id) < std::stoll(end_id)) {
+		string copied = copy_rows(connection, log_table, new_table, last_id, batch);
+		if (copied.empty()) {
+			cerr << "Copying failed after ID " << last_id << ", run again to continue\n";
+			delete connection;
+			return 1;
+		}
+		if (copied == last_id) {
+			break;
+		}
+		last_id = copied;
+		if (pause > 0) {
+			usleep(pause * 1000);
+		}
+	}
+
+	// 2. indexes are built now under a temporary name and get their names in the switch
+	vector<string> index_names = vector<string>();
+	vector<string> index_sql = vector<string>();
+	auto indexes = connection->query(sqlite ?
+		"SELECT name, sql FROM sqlite_master WHERE type = 'index' AND tbl_name = '" + log_table + "' AND sql IS NOT NULL" :
+		"SELECT indexname AS name, indexdef AS sql FROM pg_indexes WHERE schemaname = current_schema() AND tablename = '" + log_table + "' "
+		"AND indexname NOT IN (SELECT conname FROM pg_constraint)"
+	);
+	for (auto &index : *indexes) {
+		index_names.push_back(index["name"]);
+		index_sql.push_back(index["sql"]);
+	}
+	delete indexes;
+
+	for (size_t i = 0; i < index_sql.size(); i++) {
+		// CREATE [UNIQUE] INDEX name ON schema.table USING ... (Postgres), ... ON table (columns) ... (SQLite)
+		string sql = index_sql[i];
+		size_t name_start = sql.find("INDEX ");
+		size_t on_start = sql.find(" ON ");
+		size_t definition_start = sqlite ? sql.find("(", (on_start != string::npos) ? on_start : 0) : sql.find(" USING ");
+		if ((name_start == string::npos) || (on_start == string::npos) || (definition_start == string::npos)) {
+			cerr << "Can not copy index " << index_names[i] << ": " << sql << "\n";
+			delete connection;
+			return 1;
+		}
+		sql = sql.substr(0, name_start) + "INDEX IF NOT EXISTS " + quote(connection, index_names[i] + "_v2") + " ON " + quote(connection, new_table) +
+			(sqlite ? " " : "") + sql.substr(definition_start);
+		cerr << "Creating index " << index_names[i] << "_v2\n";
+		if (!connection->execute(sql)) {
+			delete connection;
+			return 1;
+		}
+	}
+
+	// 3. copy the remaining rows and swap the tables while writers wait
+	cerr << "Switching tables\n";
+	bool locked;
+	if (sqlite) {
+		// keep views and foreign keys referencing the log table by name
+		connection->execute("PRAGMA legacy_alter_table = ON;");
+		locked = connection->execute("BEGIN IMMEDIATE;");
+	} else {
+		locked = connection->execute("BEGIN;") && connection->execute("LOCK TABLE \"" + log_table + "\" IN SHARE ROW EXCLUSIVE MODE;");
+	}
+	if (!locked) {
+		cerr << "Could not lock " << log_table << "\n";
+		delete connection;
+		return 1;
+	}
+
+	// SQLite has one writer at a time, its IDs are committed in order
+	if (sqlite ? copy_rows(connection, log_table, new_table, last_id, "").empty() : !copy_missing_rows(connection, log_table, new_table)) {
+		cerr << "Copying the remaining rows failed\n";
+		delete connection;
+		return 1;
+	}
+
+	vector<string> statements = vector<string>();
+	if (sqlite) {
+		statements.push_back("DROP TRIGGER IF EXISTS `" + new_table + "_time_us`;");
+		statements.push_back("ALTER TABLE `" + log_table + "` RENAME TO `" + old_table + "`;");
+		statements.push_back("ALTER TABLE `" + new_table + "` RENAME TO `" + log_table + "`;");
+		for (string sql : schema_log_table("sqlite", prefix, log_table)) {
+			statements.push_back(sql);
+		}
+	} else {
+		statements.push_back("ALTER TABLE \"" + log_table + "\" RENAME TO \"" + old_table + "\";");
+		statements.push_back("ALTER TABLE \"" + new_table + "\" RENAME TO \"" + log_table + "\";");
+		statements.push_back("ALTER TABLE \"" + old_table + "\" RENAME CONSTRAINT \"" + log_table + "_id_key\" TO \"" + old_table + "_id_key\";");
+		statements.push_back("ALTER TABLE \"" + log_table + "\" RENAME CONSTRAINT \"" + new_table + "_id_key\" TO \"" + log_table + "_id_key\";");
+		for (string name : index_names) {
+			statements.push_back("ALTER INDEX \"" + name + "\" RENAME TO \"" + name + "_v1\";");
+			statements.push_back("ALTER INDEX \"" + name + "_v2\" RENAME TO \"" + name + "\";");
+		}
+		statements.push_back("DROP TRIGGER IF EXISTS \"" + prefix + "_log_notify\" ON \"" + old_table + "\";");
+		for (string sql : schema_log_notify(prefix, log_table)) {
+			statements.push_back(sql);
+		}
+		statements.push_back("SELECT setval('" + new_table + "_id_seq', (SELECT COALESCE(max(\"id\"), 0) + 1 FROM \"" + log_table + "\"), false);");
+
+		// views and foreign keys follow the renamed table, point them to the new one
+		statements.push_back("DROP VIEW IF EXISTS \"" + prefix + "_log_tags\";");
+		statements.push_back("CREATE VIEW \"" + prefix + "_log_tags\" AS "
+			"SELECT \"tagID\", \"logID\" FROM \"" + prefix + "_log_tag\" "
+			"UNION ALL SELECT m.\"tagID\", l.\"id\" AS \"logID\" FROM \"" + log_table + "\" l JOIN \"" + prefix + "_tagset_member\" m ON m.\"tagsetID\" = l.\"tagsetID\";"
+		);
+		statements.push_back("ALTER TABLE \"" + prefix + "_log_tag\" DROP CONSTRAINT IF EXISTS \"" + prefix + "_log_tag_log_fk\";");
+		statements.push_back("ALTER TABLE \"" + prefix + "_log_tag\" ADD CONSTRAINT \"" + prefix + "_log_tag_log_fk\" FOREIGN KEY (\"logID\") REFERENCES \"" + log_table + "\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT VALID;");
+		statements.push_back("ALTER TABLE \"" + prefix + "_attachment\" DROP CONSTRAINT IF EXISTS \"" + prefix + "_attachment_log_fk\";");
+		statements.push_back("ALTER TABLE \"" + prefix + "_attachment\" ADD CONSTRAINT \"" + prefix + "_attachment_log_fk\" FOREIGN KEY (\"logID\") REFERENCES \"" + log_table + "\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT VALID;");
+	}
+	statements.push_back("UPDATE " + quote(connection, prefix + "_schema") + " SET layout = 2;");
+
+	bool switched = execute_switch(connection, statements);
+	if (switched && sqlite && !index_names.empty()) {
+		// SQLite can not rename indexes, the names are swapped in the schema table and the schema
+		// version is bumped so connections reload it (see "Making Other Kinds Of Table Schema Changes"
+		// in the ALTER TABLE documentation of SQLite)
+		string version = scalar(connection, "SELECT schema_version AS value FROM pragma_schema_version()", "0");
+		statements = vector<string>();
+		statements.push_back("PRAGMA writable_schema = ON;");
+		for (string name : index_names) {
+			statements.push_back("UPDATE sqlite_master SET name = '" + name + "_v1', sql = replace(sql, '" + name + "', '" + name + "_v1') WHERE type = 'index' AND name = '" + name + "';");
+			statements.push_back("UPDATE sqlite_master SET name = '" + name + "', sql = replace(sql, '" + name + "_v2', '" + name + "') WHERE type = 'index' AND name = '" + name + "_v2';");
+		}
+		statements.push_back("PRAGMA schema_version = " + to_string(std::stoll(version) + 1) + ";");
+		statements.push_back("PRAGMA writable_schema = OFF;");
+		switched = execute_switch(connection, statements);
+	}
+	if (!switched || !execute_switch(connection, vector<string>{ "COMMIT;" })) {
+		delete connection;
+		return 1;
+	}
+
+	// validating the foreign key does not block writers
+	if (!sqlite) {
+		connection->execute("ALTER TABLE \"" + prefix + "_log_tag\" VALIDATE CONSTRAINT \"" + prefix + "_log_tag_log_fk\";");
+		connection->execute("ALTER TABLE \"" + prefix + "_attachment\" VALIDATE CONSTRAINT \"" + prefix + "_attachment_log_fk\";");
+	} else {
+		connection->execute("PRAGMA legacy_alter_table = OFF;");
+	}
+
+	if (arguments.count("drop-old") > 0) {
+		connection->execute("DROP TABLE " + quote(connection, old_table) + ";");
+		cerr << "Done, " << old_table << " has been dropped\n";
+	} else {
+		cerr << "Done, the old table is kept as " << old_table << "\n";
+	}
+
+	delete connection;
+	return 0;
+}
@@ -0,0 +1,452 @@
+#include <cstring>
+#include "parquet.h"
+
+/*
+ * Thrift compact protocol, only what the Parquet footer and page headers need
+ */
+
+class ThriftWriter {
+	public:
+		enum FieldType { BOOL_TRUE = 1, I32 = 5, I64 = 6, BINARY = 8, LIST = 9, STRUCT = 12 };
+
+		ThriftWriter() : last_field(0) {}
+
+		void field_i32(int16_t id, int32_t value) {
+			field_header(id, I32);
+			varint(zigzag(value));
+		}
+
+		void field_i64(int16_t id, int64_t value) {
+			field_header(id, I64);
+			varint(zigzag(value));
+		}
+
+		void field_binary(int16_t id, const string &value) {
+			field_header(id, BINARY);
+			binary(value);
+		}
+
+		void field_struct_begin(int16_t id) {
+			field_header(id, STRUCT);
+			struct_begin();
+		}
+
+		void field_list_begin(int16_t id, FieldType element_type, size_t size) {
+			field_header(id, LIST);
+			list_header(element_type, size);
+		}
+
+		// elements of lists
+		void i32(int32_t value) { varint(zigzag(value)); }
+		void binary(const string &value) {
+			varint(value.size());
+			out += value;
+		}
+		void struct_begin() {
+			stack.push_back(last_field);
+			last_field = 0;
+		}
+		void struct_end() {
+			out += (char)0; // stop field
+			last_field = stack.back();
+			stack.pop_back();
+		}
+
+		string out;
+
+	private:
+		static uint64_t zigzag(int64_t value) {
+			return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+		}
+
+		void varint(uint64_t value) {
+			while (value >= 0x80) {
+				out += (char)((value & 0x7f) | 0x80);
+				value >>= 7;
+			}
+			out += (char)value;
+		}
+
+		void field_header(int16_t id, FieldType type) {
+			int delta = id - last_field;
+			if ((delta > 0) && (delta <= 15)) {
+				out += (char)((delta << 4) | type);
+			} else {
+				out += (char)type;
+				varint(zigzag(id));
+			}
+			last_field = id;
+		}
+
+		void list_header(FieldType element_type, size_t size) {
+			if (size < 15) {
+				out += (char)((size << 4) | element_type);
+			} else {
+				out += (char)(0xf0 | element_type);
+				varint(size);
+			}
+		}
+
+		int16_t last_field;
+		vector<int16_t> stack;
+};
+
+/*
+ * Encodings
+ */
+
+enum Encoding { PLAIN = 0, PLAIN_DICTIONARY = 2, RLE = 3, RLE_DICTIONARY = 8 };
+enum PageType { DATA_PAGE = 0, DICTIONARY_PAGE = 2 };
+
+static void put_u32(string &out, uint32_t value) {
+	char bytes[4] = { (char)(value & 0xff), (char)((value >> 8) & 0xff), (char)((value >> 16) & 0xff), (char)((value >> 24) & 0xff) };
+	out.append(bytes, 4);
+}
+
+static void put_u64(string &out, uint64_t value) {
+	put_u32(out, (uint32_t)(value & 0xffffffff));
+	put_u32(out, (uint32_t)(value >> 32));
+}
+
+static void put_varint(string &out, uint64_t value) {
+	while (value >= 0x80) {
+		out += (char)((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += (char)value;
+}
+
+static int bit_width(uint32_t max_value) {
+	int width = 0;
+	while (max_value > 0) {
+		width++;
+		max_value >>= 1;
+	}
+	return width;
+}
+
+// RLE / bit-packing hybrid: runs of at least 8 equal values are run length encoded, everything
+// in between is bit-packed in groups of 8 (the last group is padded with zeros)
+static void put_rle_hybrid(string &out, const vector<uint32_t> &values, int width) {
+	size_t byte_width = (width + 7) / 8;
+	size_t count = values.size();
+	size_t i = 0;
+
+	auto run_length = [&](size_t start) {
+		size_t end = start;
+		while ((end < count) && (values[end] == values[start])) {
+			end++;
+		}
+		return end - start;
+	};
+
+	while (i < count) {
+		size_t run = run_length(i);
+		if (run >= 8) {
+			put_varint(out, (uint64_t)run << 1);
+			for (size_t b = 0; b < byte_width; b++) {
+				out += (char)((values[i] >> (8 * b)) & 0xff);
+			}
+			i += run;
+			continue;
+		}
+
+		// bit-pack groups until a long run starts at a group boundary
+		size_t start = i;
+		size_t groups = 0;
+		while (i < count) {
+			i = (i + 8 < count) ? i + 8 : count;
+			groups++;
+			if ((i < count) && (run_length(i) >= 8)) {
+				break;
+			}
+		}
+		put_varint(out, ((uint64_t)groups << 1) | 1);
+
+		uint64_t buffer = 0;
+		int buffered = 0;
+		for (size_t j = start; j < start + groups * 8; j++) {
+			uint64_t value = (j < count) ? values[j] : 0;
+			buffer |= value << buffered;
+			buffered += width;
+			while (buffered >= 8) {
+				out += (char)(buffer & 0xff);
+				buffer >>= 8;
+				buffered -= 8;
+			}
+		}
+		if (buffered > 0) {
+			out += (char)(buffer & 0xff);
+		}
+	}
+}
+
+static string page_header(PageType type, size_t size, size_t values, Encoding encoding) {
+	ThriftWriter thrift;
+	thrift.struct_begin();
+	thrift.field_i32(1, type);
+	thrift.field_i32(2, size); // uncompressed
+	thrift.field_i32(3, size); // compressed
+	if (type == DATA_PAGE) {
+		thrift.field_struct_begin(5);
+		thrift.field_i32(1, values);
+		thrift.field_i32(2, encoding);
+		thrift.field_i32(3, RLE);
+		thrift.field_i32(4, RLE);
+		thrift.struct_end();
+	} else {
+		thrift.field_struct_begin(7);
+		thrift.field_i32(1, values);
+		thrift.field_i32(2, encoding);
+		thrift.struct_end();
+	}
+	thrift.struct_end();
+	return thrift.out;
+}
+
+/*
+ * Writer
+ */
+
+ParquetWriter::ParquetWriter(vector<Column> columns, size_t row_group_size) :
+	columns(columns), row_group_size(row_group_size), buffers(columns.size()) {
+
+	rows = 0;
+	total_rows = 0;
+	file = NULL;
+	offset = 0;
+	failed = false;
+}
+
+ParquetWriter::~ParquetWriter() {
+	if ((file != NULL) && (file != stdout)) {
+		fclose(file);
+	}
+}
+
+bool
+ParquetWriter::open(string path) {
+	file = (path == "-") ? stdout : fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	return write("PAR1");
+}
+
+bool
+ParquetWriter::write(const string &data) {
+	if (failed || (fwrite(data.data(), 1, data.size(), file) != data.size())) {
+		failed = true;
+		return false;
+	}
+	offset += data.size();
+	return true;
+}
+
+void
+ParquetWriter::set_int(size_t column, int64_t value) {
+	// dictionary values are kept as text and converted back when the dictionary page is written
+	if (columns[column].dictionary) {
+		set_string(column, std::to_string(value));
+		return;
+	}
+	buffers[column].defined.push_back(true);
+	buffers[column].ints.push_back(value);
+}
+
+void
+ParquetWriter::set_string(size_t column, const string &value) {
+	ColumnBuffer &buffer = buffers[column];
+	buffer.defined.push_back(true);
+	if (!columns[column].dictionary) {
+		buffer.strings.push_back(value);
+		return;
+	}
+
+	auto search = buffer.dictionary_ids.find(value);
+	if (search == buffer.dictionary_ids.end()) {
+		uint32_t id = buffer.dictionary.size();
+		search = buffer.dictionary_ids.emplace(value, id).first;
+		buffer.dictionary.push_back(value);
+	}
+	buffer.indices.push_back(search->second);
+}
+
+void
+ParquetWriter::set_null(size_t column) {
+	buffers[column].defined.push_back(false);
+}
+
+void
+ParquetWriter::end_row() {
+	rows++;
+	if (rows >= row_group_size) {
+		flush_row_group();
+	}
+}
+
+void
+ParquetWriter::flush_row_group() {
+	if (rows == 0) {
+		return;
+	}
+
+	vector<ChunkInfo> chunks = vector<ChunkInfo>();
+	for (size_t c = 0; c < columns.size(); c++) {
+		const Column &column = columns[c];
+		ColumnBuffer &buffer = buffers[c];
+		ChunkInfo chunk;
+		chunk.offset = offset;
+		chunk.dictionary_offset = -1;
+		chunk.values = rows;
+
+		// dictionary page: PLAIN encoded values, integer columns keep their type
+		if (column.dictionary) {
+			string page = "";
+			for (size_t i = 0; i < buffer.dictionary.size(); i++) {
+				const string &value = buffer.dictionary[i];
+				if (column.type == INT32) {
+					put_u32(page, (uint32_t)std::stoll(value));
+				} else if (column.type == INT64) {
+					put_u64(page, (uint64_t)std::stoll(value));
+				} else {
+					put_u32(page, value.size());
+					page += value;
+				}
+			}
+			chunk.dictionary_offset = offset;
+			write(page_header(DICTIONARY_PAGE, page.size(), buffer.dictionary.size(), PLAIN_DICTIONARY));
+			write(page);
+		}
+
+		// data page: definition levels of optional columns, then the values of the defined rows
+		string page = "";
+		if (column.optional) {
+			vector<uint32_t> levels = vector<uint32_t>();
+			for (bool defined : buffer.defined) {
+				levels.push_back(defined ? 1 : 0);
+			}
+			string encoded = "";
+			put_rle_hybrid(encoded, levels, 1);
+			put_u32(page, encoded.size());
+			page += encoded;
+		}
+		if (column.dictionary) {
+			uint32_t max_index = buffer.dictionary.empty() ? 0 : buffer.dictionary.size() - 1;
+			int width = bit_width(max_index);
+			page += (char)width;
+			put_rle_hybrid(page, buffer.indices, width);
+		} else if (column.type == INT32) {
+			for (int64_t value : buffer.ints) {
+				put_u32(page, (uint32_t)value);
+			}
+		} else if (column.type == INT64) {
+			for (int64_t value : buffer.ints) {
+				put_u64(page, (uint64_t)value);
+			}
+		} else {
+			for (const string &value : buffer.strings) {
+				put_u32(page, value.size());
+				page += value;
+			}
+		}
+		chunk.data_offset = offset;
+		write(page_header(DATA_PAGE, page.size(), rows, column.dictionary ? RLE_DICTIONARY : PLAIN));
+		write(page);
+		chunk.size = offset - chunk.offset;
+		chunks.push_back(chunk);
+
+		buffer = ColumnBuffer();
+	}
+
+	row_groups.push_back(chunks);
+	row_group_rows.push_back(rows);
+	total_rows += rows;
+	rows = 0;
+}
+
+bool
+ParquetWriter::close() {
+	if (file == NULL) {
+		return false;
+	}
+	flush_row_group();
+
+	ThriftWriter thrift;
+	thrift.struct_begin();
+	thrift.field_i32(1, 1); // version
+
+	// schema: the root followed by one leaf per column
+	thrift.field_list_begin(2, ThriftWriter::STRUCT, columns.size() + 1);
+	thrift.struct_begin();
+	thrift.field_binary(4, "schema");
+	thrift.field_i32(5, columns.size());
+	thrift.struct_end();
+	for (const Column &column : columns) {
+		thrift.struct_begin();
+		thrift.field_i32(1, column.type);
+		thrift.field_i32(3, column.optional ? 1 : 0);
+		thrift.field_binary(4, column.name);
+		if (column.converted_type != NONE) {
+			thrift.field_i32(6, column.converted_type);
+		}
+		thrift.struct_end();
+	}
+
+	thrift.field_i64(3, total_rows);
+	thrift.field_list_begin(4, ThriftWriter::STRUCT, row_groups.size());
+	for (size_t g = 0; g < row_groups.size(); g++) {
+		int64_t total_size = 0;
+		thrift.struct_begin();
+		thrift.field_list_begin(1, ThriftWriter::STRUCT, columns.size());
+		for (size_t c = 0; c < columns.size(); c++) {
+			const ChunkInfo &chunk = row_groups[g][c];
+			total_size += chunk.size;
+
+			thrift.struct_begin();
+			thrift.field_i64(2, chunk.offset);
+			thrift.field_struct_begin(3);
+			thrift.field_i32(1, columns[c].type);
+			if (columns[c].dictionary) {
+				thrift.field_list_begin(2, ThriftWriter::I32, 3);
+				thrift.i32(PLAIN_DICTIONARY);
+				thrift.i32(RLE_DICTIONARY);
+				thrift.i32(RLE);
+			} else {
+				thrift.field_list_begin(2, ThriftWriter::I32, 2);
+				thrift.i32(PLAIN);
+				thrift.i32(RLE);
+			}
+			thrift.field_list_begin(3, ThriftWriter::BINARY, 1);
+			thrift.binary(columns[c].name);
+			thrift.field_i32(4, 0); // uncompressed
+			thrift.field_i64(5, chunk.values);
+			thrift.field_i64(6, chunk.size);
+			thrift.field_i64(7, chunk.size);
+			thrift.field_i64(9, chunk.data_offset);
+			if (chunk.dictionary_offset >= 0) {
+				thrift.field_i64(11, chunk.dictionary_offset);
+			}
+			thrift.struct_end();
+			thrift.struct_end();
+		}
+		thrift.field_i64(2, total_size);
+		thrift.field_i64(3, row_group_rows[g]);
+		thrift.struct_end();
+	}
+	thrift.field_binary(6, "dblogger");
+	thrift.struct_end();
+
+	string footer = thrift.out;
+	put_u32(footer, thrift.out.size());
+	footer += "PAR1";
+	write(footer);
+
+	if (file != stdout) {
+		failed = (fclose(file) != 0) || failed;
+	} else {
+		fflush(file);
+	}
+	file = NULL;
+	return !failed;
+}
@@ -0,0 +1,83 @@
+#ifndef PARQUET_H
+#define PARQUET_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using std::map;
+using std::string;
+using std::vector;
+
+// Minimal Parquet file writer (https://parquet.apache.org/docs/file-format/): flat schema of
+// INT32, INT64 and UTF8 columns, uncompressed, one data page per column and row group.
+// Columns marked `dictionary` get a dictionary page per row group and RLE encoded indices,
+// the others are PLAIN encoded. Only one row group is buffered in memory.
+class ParquetWriter {
+	public:
+		enum Type { INT32 = 1, INT64 = 2, STRING = 6 };
+
+		// Parquet ConvertedType annotations
+		static const int NONE = -1;
+		static const int UTF8 = 0;
+		static const int TIMESTAMP_MICROS = 10;
+		static const int JSON = 19;
+
+		struct Column {
+			string name;
+			Type type;
+			bool optional;
+			bool dictionary;
+			int converted_type;
+		};
+
+		ParquetWriter(vector<Column> columns, size_t row_group_size = 65536);
+		~ParquetWriter();
+
+		bool open(string path);
+
+		// values of the current row, every column has to be set once per row
+		void set_int(size_t column, int64_t value);
+		void set_string(size_t column, const string &value);
+		void set_null(size_t column);
+		void end_row();
+
+		// write the buffered rows and the footer
+		bool close();
+
+	private:
+		struct ColumnBuffer {
+			vector<bool> defined;
+			vector<int64_t> ints;
+			vector<string> strings;
+			map<string, uint32_t> dictionary_ids;
+			vector<string> dictionary;
+			vector<uint32_t> indices;
+		};
+
+		struct ChunkInfo {
+			int64_t offset;
+			int64_t dictionary_offset;
+			int64_t data_offset;
+			int64_t size;
+			int64_t values;
+		};
+
+		void flush_row_group();
+		bool write(const string &data);
+
+		vector<Column> columns;
+		size_t row_group_size;
+		vector<ColumnBuffer> buffers;
+		size_t rows;
+		int64_t total_rows;
+		vector< vector<ChunkInfo> > row_groups;
+		vector<int64_t> row_group_rows;
+		FILE *file;
+		int64_t offset;
+		bool failed;
+};
+
+#endif // PARQUET_H
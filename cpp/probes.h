@@ -0,0 +1,39 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes of the `dblogger` provider. With systemtap's <sys/sdt.h> available every probe
+// compiles to a single nop plus a note section entry, tools like bpftrace or perf patch the nop
+// when attaching. Without the header (or with DBLOGGER_NO_PROBES defined) probes compile to nothing.
+//
+//   bpftrace -e 'usdt:./build/Release/dblogger.node:dblogger:db__query__done { @[str(arg0)] = count(); }'
+//
+// Probes:
+//   log__start(level)                      log__done(level)
+//   stack__start()                         stack__done(line)
+//   serialize__start(arguments)            serialize__done(bytes)
+//   stdout__start(level)                   stdout__done(level, bytes)
+//   db__start(entries)                     db__done(entries)
+//   db__execute__start(sql, bytes)         db__execute__done(sql, success)
+//   db__query__start(sql, bytes)           db__query__done(sql, rows)
+//   db__insert__start(sql, bytes)          db__insert__done(sql, id)
+//
+// `sql` is the statement text without parameters, so it identifies the statement.
+
+#if !defined(DBLOGGER_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DBLOGGER_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef DBLOGGER_HAVE_PROBES
+#define DBLOGGER_PROBE0(name) DTRACE_PROBE(dblogger, name)
+#define DBLOGGER_PROBE1(name, a) DTRACE_PROBE1(dblogger, name, a)
+#define DBLOGGER_PROBE2(name, a, b) DTRACE_PROBE2(dblogger, name, a, b)
+#else
+#define DBLOGGER_PROBE0(name) do {} while (0)
+#define DBLOGGER_PROBE1(name, a) do {} while (0)
+#define DBLOGGER_PROBE2(name, a, b) do {} while (0)
+#endif
+
+#endif // PROBES_H
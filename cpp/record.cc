@@ -0,0 +1,153 @@
+#include <cstring>
+#include "record.h"
+
+static inline void put_u32(string &out, uint32_t value) {
+	char bytes[4] = { (char)(value & 0xff), (char)((value >> 8) & 0xff), (char)((value >> 16) & 0xff), (char)((value >> 24) & 0xff) };
+	out.append(bytes, 4);
+}
+
+static inline void put_u64(string &out, uint64_t value) {
+	put_u32(out, (uint32_t)(value & 0xffffffff));
+	put_u32(out, (uint32_t)(value >> 32));
+}
+
+static inline void put_string(string &out, const string &value) {
+	put_u32(out, (uint32_t)value.size());
+	out.append(value);
+}
+
+// Reads values from a payload, every read fails once the payload is exhausted
+class RecordReader {
+	public:
+		RecordReader(const char *data, size_t length) : ok(true), data((const unsigned char *)data), length(length), offset(0) {}
+
+		uint32_t u32() {
+			if (!available(4)) return 0;
+			uint32_t value = data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | ((uint32_t)data[offset + 3] << 24);
+			offset += 4;
+			return value;
+		}
+
+		uint64_t u64() {
+			uint64_t low = u32();
+			uint64_t high = u32();
+			return low | (high << 32);
+		}
+
+		string str() {
+			uint32_t size = u32();
+			if (!available(size)) return string();
+			string value = string((const char *)data + offset, size);
+			offset += size;
+			return value;
+		}
+
+		bool ok;
+
+	private:
+		bool available(size_t size) {
+			if (!ok || (length - offset < size)) {
+				ok = false;
+			}
+			return ok;
+		}
+
+		const unsigned char *data;
+		size_t length;
+		size_t offset;
+};
+
+bool record_append_frame(string &out, const LogEntry &entry) {
+	size_t start = out.size();
+	put_u32(out, 0); // length, patched below
+
+	out += (char)record_version;
+	put_u32(out, (uint32_t)entry.level);
+	put_u64(out, (uint64_t)entry.time_us);
+	put_u32(out, (uint32_t)entry.pid);
+	put_u32(out, (uint32_t)entry.line);
+	put_u32(out, (uint32_t)entry.column);
+	put_string(out, entry.hostname);
+	put_string(out, entry.filename);
+	put_string(out, entry.function);
+	put_string(out, entry.fields);
+	put_string(out, entry.logger_name);
+
+	put_u32(out, (uint32_t)entry.parts.size());
+	for (const string &part : entry.parts) {
+		put_string(out, part);
+	}
+	put_u32(out, (uint32_t)entry.tags->names.size());
+	for (const string &tag : entry.tags->names) {
+		put_string(out, tag);
+	}
+	put_string(out, entry.context);
+	put_u32(out, (uint32_t)entry.attachments.size());
+	for (const LogAttachment &attachment : entry.attachments) {
+		put_string(out, attachment.type);
+		put_u64(out, (uint64_t)attachment.size);
+		put_string(out, attachment.data);
+	}
+
+	if (out.size() - start - 4 > record_max_size) {
+		out.resize(start);
+		return false;
+	}
+
+	uint32_t length = (uint32_t)(out.size() - start - 4);
+	out[start] = (char)(length & 0xff);
+	out[start + 1] = (char)((length >> 8) & 0xff);
+	out[start + 2] = (char)((length >> 16) & 0xff);
+	out[start + 3] = (char)((length >> 24) & 0xff);
+	return true;
+}
+
+bool record_decode(const char *data, size_t length, LogEntry &entry) {
+	// older versions are still accepted from processes that were started before an update
+	uint8_t version = (length > 0) ? (uint8_t)data[0] : 0;
+	if ((version < 1) || (version > record_version)) {
+		return false;
+	}
+
+	RecordReader reader = RecordReader(data + 1, length - 1);
+	entry.level = (int)reader.u32();
+	if (version == 1) {
+		entry.date = (time_t)reader.u64();
+		entry.time_us = (int64_t)entry.date * 1000000;
+	} else {
+		entry.time_us = (int64_t)reader.u64();
+		entry.date = (time_t)(entry.time_us / 1000000);
+	}
+	entry.pid = (int)reader.u32();
+	entry.line = (int)reader.u32();
+	entry.column = (int)reader.u32();
+	entry.hostname = reader.str();
+	entry.filename = reader.str();
+	entry.function = reader.str();
+	entry.fields = reader.str();
+	entry.logger_name = reader.str();
+
+	uint32_t count = reader.u32();
+	entry.parts.clear();
+	for (uint32_t i = 0; (i < count) && reader.ok; i++) {
+		entry.parts.push_back(reader.str());
+	}
+	count = reader.u32();
+	set<string> tags = set<string>();
+	for (uint32_t i = 0; (i < count) && reader.ok; i++) {
+		tags.insert(reader.str());
+	}
+	entry.tags = TagSet::intern(tags);
+	entry.context = (version >= 3) ? reader.str() : string();
+	entry.attachments.clear();
+	count = (version >= 4) ? reader.u32() : 0;
+	for (uint32_t i = 0; (i < count) && reader.ok; i++) {
+		LogAttachment attachment;
+		attachment.type = reader.str();
+		attachment.size = (size_t)reader.u64();
+		attachment.data = reader.str();
+		entry.attachments.push_back(std::move(attachment));
+	}
+
+	return reader.ok;
+}
@@ -0,0 +1,23 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <string>
+#include <stdint.h>
+
+#include "log_entry.h"
+
+using std::string;
+
+// Binary wire format for log entries sent to the collector.
+// A frame is a 4 byte little endian payload length followed by the payload.
+static const uint8_t record_version = 4; // 4: attachments, 3: context, 2: time in microseconds, 1: seconds
+static const uint32_t record_max_size = 16 * 1024 * 1024;
+
+// Append a complete frame for `entry` to `out`. A payload larger than `record_max_size` would
+// make the collector close the connection, it is not appended and false is returned.
+bool record_append_frame(string &out, const LogEntry &entry);
+
+// Decode a payload (without the length prefix), returns false on malformed data
+bool record_decode(const char *data, size_t length, LogEntry &entry);
+
+#endif // RECORD_H
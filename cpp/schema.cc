@@ -0,0 +1,470 @@
+#include "schema.h"
+
+void
+SchemaMigration::add(string sql) {
+	SchemaStep step;
+	step.sql = sql;
+	steps.push_back(step);
+}
+
+void
+SchemaMigration::add_column(string table, string column, string sql) {
+	SchemaStep step;
+	step.sql = sql;
+	step.table = table;
+	step.column = column;
+	steps.push_back(step);
+}
+
+/*
+ * Layout 2 log table: 64 bit IDs, microsecond timestamps and no AUTOINCREMENT on SQLite.
+ * Writers that still send seconds (older versions, writers started before a migration)
+ * are converted by a trigger.
+ */
+
+vector<string> schema_log_table(string db_type, string prefix, string table) {
+	vector<string> statements = vector<string>();
+
+	if (db_type == "sqlite") {
+		// a plain rowid table, AUTOINCREMENT would update sqlite_sequence on every insert
+		statements.push_back("CREATE TABLE IF NOT EXISTS `" + table + "` (`id` INTEGER PRIMARY KEY, `level` INTEGER NOT NULL, `message` TEXT, `pid` INTEGER NOT NULL, `time` INTEGER NOT NULL, `functionID` INTEGER REFERENCES `" + prefix + "_function` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, `loggerID` INTEGER REFERENCES `" + prefix + "_logger` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, `hostnameID` INTEGER REFERENCES `" + prefix + "_hosts` (`id`) ON DELETE SET NULL ON UPDATE CASCADE);");
+		statements.push_back("CREATE TRIGGER IF NOT EXISTS `" + table + "_time_us` AFTER INSERT ON `" + table + "` WHEN NEW.`time` < 100000000000 BEGIN "
+			"UPDATE `" + table + "` SET `time` = NEW.`time` * 1000000 WHERE `id` = NEW.`id`; END;");
+	} else if (db_type == "postgres") {
+		statements.push_back("CREATE SEQUENCE IF NOT EXISTS \"" + table + "_id_seq\";");
+		statements.push_back("CREATE TABLE IF NOT EXISTS \"" + table + "\" ("
+			"	\"id\" int8 NOT NULL DEFAULT nextval('" + table + "_id_seq'),"
+			"	\"level\" int4 NOT NULL DEFAULT 0, \"message\" text COLLATE \"default\","
+			"	\"pid\" int4 NOT NULL, \"time\" int8 NOT NULL, \"functionID\" int4, \"loggerID\" int4, \"hostnameID\" int4,"
+			"	CONSTRAINT \"" + table + "_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_log_function_fk\" FOREIGN KEY (\"functionID\") REFERENCES \"" + prefix + "_function\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_log_host_fk\" FOREIGN KEY (\"hostnameID\") REFERENCES \"" + prefix + "_hosts\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_log_logger_fk\" FOREIGN KEY (\"loggerID\") REFERENCES \"" + prefix + "_logger\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		statements.push_back("ALTER SEQUENCE \"" + table + "_id_seq\" OWNED BY \"" + table + "\".\"id\";");
+		statements.push_back("CREATE OR REPLACE FUNCTION \"" + prefix + "_log_time_us\"() RETURNS trigger AS $$ BEGIN NEW.\"time\" := NEW.\"time\" * 1000000; RETURN NEW; END; $$ LANGUAGE plpgsql;");
+		statements.push_back("DROP TRIGGER IF EXISTS \"" + table + "_time_us\" ON \"" + table + "\";");
+		statements.push_back("CREATE TRIGGER \"" + table + "_time_us\" BEFORE INSERT ON \"" + table + "\" FOR EACH ROW WHEN (NEW.\"time\" < 100000000000) EXECUTE PROCEDURE \"" + prefix + "_log_time_us\"();");
+	}
+
+	return statements;
+}
+
+/*
+ * Postgres ingest functions: resolve all dimensions and insert the log row server side,
+ * so an entry with uncached dimensions costs one round trip instead of one per dimension.
+ */
+
+// PL/pgSQL block: look up a dimension row into `target` and insert it if it is missing, a row
+// inserted by a concurrent writer is found by the second lookup
+static string pg_upsert(string table, string columns, string values, string condition, string target) {
+	return
+		"SELECT t.\"id\" INTO " + target + " FROM \"" + table + "\" t WHERE " + condition + "; "
+		"IF NOT FOUND THEN "
+			"INSERT INTO \"" + table + "\" (" + columns + ") VALUES (" + values + ") ON CONFLICT DO NOTHING RETURNING \"id\" INTO " + target + "; "
+			"IF " + target + " IS NULL THEN "
+				"SELECT t.\"id\" INTO " + target + " FROM \"" + table + "\" t WHERE " + condition + "; "
+			"END IF; "
+		"END IF; ";
+}
+
+static vector<string> postgres_ingest_functions(string prefix) {
+	vector<string> statements = vector<string>();
+
+	// one entry, returns the ID of the log row and the resolved dimension IDs for the client cache
+	statements.push_back(
+		"CREATE OR REPLACE FUNCTION \"" + prefix + "_ingest\"("
+			"p_level int4, p_message text, p_pid int4, p_time int8, p_logger text, p_host text, p_source text, "
+			"p_function text, p_line int4, p_fields jsonb, p_tags text[], p_context jsonb, "
+			"OUT log_id int8, OUT logger_id int4, OUT host_id int4, OUT source_id int4, OUT function_id int4, OUT tagset_id int4"
+		") AS $$ "
+		"DECLARE v_tag text; v_tag_id int4; v_tag_ids int4[] := '{}'; v_tag_list text; "
+		"BEGIN "
+			+ pg_upsert(prefix + "_logger", "\"name\"", "p_logger", "t.\"name\" = p_logger", "logger_id")
+			+ pg_upsert(prefix + "_hosts", "\"name\"", "p_host", "t.\"name\" = p_host", "host_id")
+			+ pg_upsert(prefix + "_source", "\"path\"", "p_source", "t.\"path\" = p_source", "source_id")
+			+ pg_upsert(prefix + "_function", "\"name\", \"lineNumber\", \"sourceID\"", "p_function, p_line, source_id",
+				"t.\"name\" = p_function AND t.\"lineNumber\" = p_line AND t.\"sourceID\" = source_id", "function_id") +
+
+			// tag IDs ordered by tag name (byte order like the client), see fetch_tagset()
+			"IF coalesce(array_length(p_tags, 1), 0) > 0 THEN "
+				"FOR v_tag IN SELECT DISTINCT u COLLATE \"C\" FROM unnest(p_tags) u ORDER BY 1 LOOP "
+					+ pg_upsert(prefix + "_tag", "\"name\"", "v_tag", "t.\"name\" = v_tag", "v_tag_id") +
+					"v_tag_ids := v_tag_ids || v_tag_id; "
+				"END LOOP; "
+				"v_tag_list := array_to_string(v_tag_ids, ','); "
+				"SELECT t.\"id\" INTO tagset_id FROM \"" + prefix + "_tagset\" t WHERE t.\"tagIDs\" = v_tag_list; "
+				"IF NOT FOUND THEN "
+					"INSERT INTO \"" + prefix + "_tagset\" (\"tagIDs\") VALUES (v_tag_list) ON CONFLICT DO NOTHING RETURNING \"id\" INTO tagset_id; "
+					"IF FOUND THEN "
+						"INSERT INTO \"" + prefix + "_tagset_member\" (\"tagsetID\", \"tagID\") SELECT tagset_id, unnest(v_tag_ids) ON CONFLICT DO NOTHING; "
+					"ELSE "
+						"SELECT t.\"id\" INTO tagset_id FROM \"" + prefix + "_tagset\" t WHERE t.\"tagIDs\" = v_tag_list; "
+					"END IF; "
+				"END IF; "
+			"END IF; "
+
+			"INSERT INTO \"" + prefix + "_log\" (level, message, pid, time, \"loggerID\", \"hostnameID\", \"functionID\", fields, \"tagsetID\", context) "
+				"VALUES (p_level, p_message, p_pid, p_time, logger_id, host_id, function_id, p_fields, tagset_id, p_context) RETURNING \"id\" INTO log_id; "
+		"END; $$ LANGUAGE plpgsql;"
+	);
+
+	// a batch of entries as arrays, the tags of an entry are joined with the unit separator (0x1f)
+	statements.push_back(
+		"CREATE OR REPLACE FUNCTION \"" + prefix + "_ingest_batch\"("
+			"p_levels int4[], p_messages text[], p_pids int4[], p_times int8[], p_loggers text[], p_hosts text[], p_sources text[], "
+			"p_functions text[], p_lines int4[], p_fields jsonb[], p_tags text[], p_contexts jsonb[]"
+		") RETURNS TABLE (log_id int8, logger_id int4, host_id int4, source_id int4, function_id int4, tagset_id int4) AS $$ "
+		"BEGIN "
+			"FOR i IN 1 .. coalesce(array_length(p_levels, 1), 0) LOOP "
+				"RETURN QUERY SELECT * FROM \"" + prefix + "_ingest\"(p_levels[i], p_messages[i], p_pids[i], p_times[i], p_loggers[i], p_hosts[i], "
+					"p_sources[i], p_functions[i], p_lines[i], p_fields[i], string_to_array(p_tags[i], E'\\x1f'), p_contexts[i]); "
+			"END LOOP; "
+		"END; $$ LANGUAGE plpgsql;"
+	);
+
+	return statements;
+}
+
+/*
+ * SQLite
+ */
+
+static vector<SchemaMigration> sqlite_migrations(string prefix, int layout) {
+	vector<SchemaMigration> migrations = vector<SchemaMigration>();
+
+	// Version 1: initial schema
+	{
+		SchemaMigration migration = SchemaMigration(1);
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_hosts` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(255) NOT NULL, UNIQUE (id), CONSTRAINT 'host_unique' UNIQUE (name COLLATE NOCASE));");
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_logger` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(255) NOT NULL, UNIQUE (id), CONSTRAINT 'name_unique' UNIQUE (name COLLATE NOCASE));");
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_tag` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(255) NOT NULL, UNIQUE (id), CONSTRAINT 'tag_unique' UNIQUE (name COLLATE NOCASE));");
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_source` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `path` VARCHAR(1024) NOT NULL, UNIQUE (id), CONSTRAINT 'path_unique' UNIQUE (path));");
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_function` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `name` VARCHAR(1024) NOT NULL, `lineNumber` INTEGER DEFAULT NULL, `sourceID` INTEGER REFERENCES `" + prefix + "_source` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, UNIQUE (id), CONSTRAINT 'func_unique' UNIQUE (name, lineNumber, sourceID));");
+		if (layout >= 2) {
+			for (string sql : schema_log_table("sqlite", prefix, prefix + "_log")) {
+				migration.add(sql);
+			}
+		} else {
+			migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_log` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `level` INTEGER NOT NULL, `message` TEXT, `pid` INTEGER NOT NULL, `time` INTEGER NOT NULL, `functionID` INTEGER REFERENCES `" + prefix + "_function` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, `loggerID` INTEGER REFERENCES `" + prefix + "_logger` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, `hostnameID` INTEGER REFERENCES `" + prefix + "_hosts` (`id`) ON DELETE SET NULL ON UPDATE CASCADE, UNIQUE (id));");
+		}
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_log_tag` (`tagID` INTEGER NOT NULL REFERENCES `" + prefix + "_tag` (`id`) ON DELETE CASCADE ON UPDATE CASCADE, `logID` INTEGER NOT NULL REFERENCES `" + prefix + "_log` (`id`) ON DELETE CASCADE ON UPDATE CASCADE, PRIMARY KEY (`tagID`, `logID`));");
+		migrations.push_back(migration);
+	}
+
+	// Version 2: structured fields
+	{
+		SchemaMigration migration = SchemaMigration(2);
+		migration.add_column(prefix + "_log", "fields", "ALTER TABLE `" + prefix + "_log` ADD COLUMN `fields` TEXT DEFAULT NULL;");
+		migrations.push_back(migration);
+	}
+
+	// Version 3: tag sets, one tagsetID per log row instead of one log_tag row per tag
+	{
+		SchemaMigration migration = SchemaMigration(3);
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_tagset` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `tagIDs` TEXT NOT NULL, UNIQUE (id), CONSTRAINT 'tagset_unique' UNIQUE (tagIDs));");
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_tagset_member` (`tagsetID` INTEGER NOT NULL REFERENCES `" + prefix + "_tagset` (`id`) ON DELETE CASCADE ON UPDATE CASCADE, `tagID` INTEGER NOT NULL REFERENCES `" + prefix + "_tag` (`id`) ON DELETE CASCADE ON UPDATE CASCADE, PRIMARY KEY (`tagsetID`, `tagID`));");
+		migration.add("CREATE INDEX IF NOT EXISTS `" + prefix + "_tagset_member_tag_idx` ON `" + prefix + "_tagset_member` (`tagID`);");
+		migration.add_column(prefix + "_log", "tagsetID", "ALTER TABLE `" + prefix + "_log` ADD COLUMN `tagsetID` INTEGER DEFAULT NULL REFERENCES `" + prefix + "_tagset` (`id`) ON DELETE SET NULL ON UPDATE CASCADE;");
+		migration.add("CREATE INDEX IF NOT EXISTS `" + prefix + "_log_tagset_idx` ON `" + prefix + "_log` (`tagsetID`) WHERE `tagsetID` IS NOT NULL;");
+		migration.add("CREATE VIEW IF NOT EXISTS `" + prefix + "_log_tags` AS "
+			"SELECT `tagID`, `logID` FROM `" + prefix + "_log_tag` "
+			"UNION ALL SELECT m.`tagID`, l.`id` AS `logID` FROM `" + prefix + "_log` l JOIN `" + prefix + "_tagset_member` m ON m.`tagsetID` = l.`tagsetID`;"
+		);
+		migrations.push_back(migration);
+	}
+
+	// Version 4: storage layout of the log table
+	{
+		SchemaMigration migration = SchemaMigration(4);
+		migration.add_column(prefix + "_schema", "layout", "ALTER TABLE `" + prefix + "_schema` ADD COLUMN `layout` INTEGER NOT NULL DEFAULT 1;");
+		migrations.push_back(migration);
+	}
+
+	// Version 5: server side ingest functions, Postgres only
+	migrations.push_back(SchemaMigration(5));
+
+	// Version 6: async context of the log call
+	{
+		SchemaMigration migration = SchemaMigration(6);
+		migration.add_column(prefix + "_log", "context", "ALTER TABLE `" + prefix + "_log` ADD COLUMN `context` TEXT DEFAULT NULL;");
+		migrations.push_back(migration);
+	}
+
+	// Version 7: binary attachments
+	{
+		SchemaMigration migration = SchemaMigration(7);
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_attachment` (`id` INTEGER PRIMARY KEY, `logID` INTEGER NOT NULL REFERENCES `" + prefix + "_log` (`id`) ON DELETE CASCADE ON UPDATE CASCADE, `position` INTEGER NOT NULL, `type` VARCHAR(255) NOT NULL, `size` INTEGER NOT NULL, `data` BLOB NOT NULL);");
+		migration.add("CREATE INDEX IF NOT EXISTS `" + prefix + "_attachment_log_idx` ON `" + prefix + "_attachment` (`logID`);");
+		migrations.push_back(migration);
+	}
+
+	// Version 8: notifications for live tails, Postgres only
+	migrations.push_back(SchemaMigration(8));
+
+	// Version 9: entry counts per minute, 0 stands for an unknown dimension (NULLs would not conflict)
+	{
+		SchemaMigration migration = SchemaMigration(9);
+		migration.add("CREATE TABLE IF NOT EXISTS `" + prefix + "_rollup_minute` (`minute` INTEGER NOT NULL, `level` INTEGER NOT NULL, `loggerID` INTEGER NOT NULL DEFAULT 0, `hostnameID` INTEGER NOT NULL DEFAULT 0, `functionID` INTEGER NOT NULL DEFAULT 0, `count` INTEGER NOT NULL, PRIMARY KEY (`minute`, `level`, `loggerID`, `hostnameID`, `functionID`)) WITHOUT ROWID;");
+		migrations.push_back(migration);
+	}
+
+	// Version 10: retention deletes tag rows by log ID, the primary key starts with the tag
+	{
+		SchemaMigration migration = SchemaMigration(10);
+		migration.add("CREATE INDEX IF NOT EXISTS `" + prefix + "_log_tag_log_idx` ON `" + prefix + "_log_tag` (`logID`);");
+		migrations.push_back(migration);
+	}
+
+	return migrations;
+}
+
+/*
+ * Postgres
+ */
+
+static vector<SchemaMigration> postgres_migrations(string prefix, int layout) {
+	vector<SchemaMigration> migrations = vector<SchemaMigration>();
+
+	// Version 1: initial schema
+	{
+		SchemaMigration migration = SchemaMigration(1);
+
+		// Hosts + Indexes
+		migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_hosts_id_seq\";");
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_hosts\" ("
+			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_hosts_id_seq'),"
+			"	\"name\" varchar(1024) NOT NULL COLLATE \"default\","
+			"	CONSTRAINT \"" + prefix + "_logger_hosts_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_host_name_idx\" UNIQUE (\"name\") NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_host_name_idx\" ON \"" + prefix + "_hosts\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_hosts_id_key\" ON \"" + prefix + "_hosts\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+
+		// Logger + Indexes
+		migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_logger_id_seq\";");
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_logger\" ("
+			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_logger_id_seq'),"
+			"	\"name\" varchar(255) NOT NULL COLLATE \"default\","
+			"	CONSTRAINT \"" + prefix + "_logger_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_logger_name_idx\" UNIQUE (\"name\") NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_name_idx\" ON \"" + prefix + "_logger\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_logger_id_key\" ON \"" + prefix + "_logger\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+
+		// Tag + Indexes
+		migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_tag_id_seq\";");
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_tag\" ("
+			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_tag_id_seq'),"
+			"	\"name\" varchar(255) NOT NULL COLLATE \"default\","
+			"	CONSTRAINT \"" + prefix + "_logger_tag_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_tag_name_idx\" UNIQUE (\"name\") NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_tag_id_key\" ON \"" + prefix + "_tag\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_tag_name_idx\" ON \"" + prefix + "_tag\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
+
+		// Source + Indexes
+		migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_source_id_seq\";");
+		migration.add("CREATE TABLE IF NOT EXISTS\"" + prefix + "_source\" ("
+			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_source_id_seq'),"
+			"	\"path\" varchar(1024) NOT NULL COLLATE \"default\","
+			"	CONSTRAINT \"" + prefix + "_logger_source_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_source_path_idx\" UNIQUE (\"path\") NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_logger_source_id_key\" ON \"" + prefix + "_source\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_source_path_idx\" ON \"" + prefix + "_source\" USING btree(\"path\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
+
+		// Function + Indexes
+		migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_function_id_seq\";");
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_function\" ("
+			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_function_id_seq'),"
+			"	\"name\" varchar(1024) NOT NULL COLLATE \"default\","
+			"	\"lineNumber\" int4, \"sourceID\" int4,"
+			"	CONSTRAINT \"" + prefix + "_function_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_source_fk\" FOREIGN KEY (\"sourceID\") REFERENCES \"" + prefix + "_source\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_func_uniq\" UNIQUE (\"name\",\"lineNumber\",\"sourceID\") NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_function_id_key\" ON \"" + prefix + "_function\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_func_uniq\" ON \"" + prefix + "_function\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST, \"lineNumber\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST, \"sourceID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+		migration.add("CREATE INDEX IF NOT EXISTS \"" + prefix + "_function_name_idx\" ON \"" + prefix + "_function\" USING btree(\"name\" COLLATE \"default\" \"pg_catalog\".\"text_ops\" ASC NULLS LAST);");
+
+		// Log + Indexes
+		if (layout >= 2) {
+			for (string sql : schema_log_table("postgres", prefix, prefix + "_log")) {
+				migration.add(sql);
+			}
+		} else {
+			migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_log_id_seq\";");
+			migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_log\" ("
+				"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_log_id_seq'),"
+				"	\"level\" int4 NOT NULL DEFAULT 0, \"message\" text COLLATE \"default\","
+				"	\"pid\" int4 NOT NULL, \"time\" int4 NOT NULL, \"functionID\" int4, \"loggerID\" int4, \"hostnameID\" int4,"
+				"	CONSTRAINT \"" + prefix + "_log_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+				"	CONSTRAINT \"" + prefix + "_log_function_fk\" FOREIGN KEY (\"functionID\") REFERENCES \"" + prefix + "_function\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
+				"	CONSTRAINT \"" + prefix + "_log_host_fk\" FOREIGN KEY (\"hostnameID\") REFERENCES \"" + prefix + "_hosts\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
+				"	CONSTRAINT \"" + prefix + "_log_logger_fk\" FOREIGN KEY (\"loggerID\") REFERENCES \"" + prefix + "_logger\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE"
+				");"
+			);
+		}
+		migration.add("CREATE UNIQUE INDEX IF NOT EXISTS \"" + prefix + "_log_id_key\" ON \"" + prefix + "_log\" USING btree(\"id\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+		migration.add("CREATE INDEX IF NOT EXISTS \"" + prefix + "_log_pid_idx\" ON \"" + prefix + "_log\" USING btree(pid \"pg_catalog\".\"int4_ops\" ASC NULLS LAST, \"hostnameID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+
+		// Log->Tag + Indexes
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_log_tag\" ("
+			"	\"tagID\" int4 NOT NULL, \"logID\" int4 NOT NULL,"
+			"	CONSTRAINT \"" + prefix + "_log_tag_id_key\" PRIMARY KEY (\"tagID\", \"logID\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_log_tag_log_fk\" FOREIGN KEY (\"logID\") REFERENCES \"" + prefix + "_log\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_log_tag_tag_fk\" FOREIGN KEY (\"tagID\") REFERENCES \"" + prefix + "_tag\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE INDEX IF NOT EXISTS \"" + prefix + "_log_tag_id_key\" ON \"" + prefix + "_log_tag\" USING btree(\"tagID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST, \"logID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+
+		migrations.push_back(migration);
+	}
+
+	// Version 2: structured fields
+	{
+		SchemaMigration migration = SchemaMigration(2);
+		migration.add("ALTER TABLE \"" + prefix + "_log\" ADD COLUMN IF NOT EXISTS \"fields\" jsonb;");
+		migrations.push_back(migration);
+	}
+
+	// Version 3: tag sets, one tagsetID per log row instead of one log_tag row per tag
+	{
+		SchemaMigration migration = SchemaMigration(3);
+
+		migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_tagset_id_seq\";");
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_tagset\" ("
+			"	\"id\" int4 NOT NULL DEFAULT nextval('" + prefix + "_tagset_id_seq'),"
+			"	\"tagIDs\" text NOT NULL COLLATE \"default\","
+			"	CONSTRAINT \"" + prefix + "_tagset_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_tagset_tags_idx\" UNIQUE (\"tagIDs\") NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_tagset_member\" ("
+			"	\"tagsetID\" int4 NOT NULL, \"tagID\" int4 NOT NULL,"
+			"	CONSTRAINT \"" + prefix + "_tagset_member_id_key\" PRIMARY KEY (\"tagsetID\", \"tagID\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_tagset_member_tagset_fk\" FOREIGN KEY (\"tagsetID\") REFERENCES \"" + prefix + "_tagset\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_tagset_member_tag_fk\" FOREIGN KEY (\"tagID\") REFERENCES \"" + prefix + "_tag\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("CREATE INDEX IF NOT EXISTS \"" + prefix + "_tagset_member_tag_idx\" ON \"" + prefix + "_tagset_member\" USING btree(\"tagID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST);");
+
+		// the new column is NULL for all existing rows, so the partial index is built quickly
+		migration.add("ALTER TABLE \"" + prefix + "_log\" ADD COLUMN IF NOT EXISTS \"tagsetID\" int4 REFERENCES \"" + prefix + "_tagset\" (\"id\") ON UPDATE CASCADE ON DELETE SET NULL;");
+		migration.add("CREATE INDEX IF NOT EXISTS \"" + prefix + "_log_tagset_idx\" ON \"" + prefix + "_log\" USING btree(\"tagsetID\" \"pg_catalog\".\"int4_ops\" ASC NULLS LAST) WHERE \"tagsetID\" IS NOT NULL;");
+
+		// old rows keep their log_tag entries, the view combines both
+		migration.add("CREATE OR REPLACE VIEW \"" + prefix + "_log_tags\" AS "
+			"SELECT \"tagID\", \"logID\" FROM \"" + prefix + "_log_tag\" "
+			"UNION ALL SELECT m.\"tagID\", l.\"id\" AS \"logID\" FROM \"" + prefix + "_log\" l JOIN \"" + prefix + "_tagset_member\" m ON m.\"tagsetID\" = l.\"tagsetID\";"
+		);
+		migrations.push_back(migration);
+	}
+
+	// Version 4: storage layout of the log table
+	{
+		SchemaMigration migration = SchemaMigration(4);
+		migration.add("ALTER TABLE \"" + prefix + "_schema\" ADD COLUMN IF NOT EXISTS \"layout\" int4 NOT NULL DEFAULT 1;");
+		migrations.push_back(migration);
+	}
+
+	// Version 5: server side ingest functions
+	{
+		SchemaMigration migration = SchemaMigration(5);
+		for (string sql : postgres_ingest_functions(prefix)) {
+			migration.add(sql);
+		}
+		migrations.push_back(migration);
+	}
+
+	// Version 6: async context of the log call, the ingest functions get a context argument
+	{
+		SchemaMigration migration = SchemaMigration(6);
+		migration.add("ALTER TABLE \"" + prefix + "_log\" ADD COLUMN IF NOT EXISTS \"context\" jsonb;");
+		migration.add("DROP FUNCTION IF EXISTS \"" + prefix + "_ingest\"(int4, text, int4, int8, text, text, text, text, int4, jsonb, text[]);");
+		migration.add("DROP FUNCTION IF EXISTS \"" + prefix + "_ingest_batch\"(int4[], text[], int4[], int8[], text[], text[], text[], text[], int4[], jsonb[], text[]);");
+		for (string sql : postgres_ingest_functions(prefix)) {
+			migration.add(sql);
+		}
+		migrations.push_back(migration);
+	}
+
+	// Version 7: binary attachments
+	{
+		SchemaMigration migration = SchemaMigration(7);
+		migration.add("CREATE SEQUENCE IF NOT EXISTS \"" + prefix + "_attachment_id_seq\";");
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_attachment\" ("
+			"	\"id\" int8 NOT NULL DEFAULT nextval('" + prefix + "_attachment_id_seq'),"
+			"	\"logID\" int8 NOT NULL, \"position\" int4 NOT NULL, \"type\" varchar(255) NOT NULL, \"size\" int8 NOT NULL, \"data\" bytea NOT NULL,"
+			"	CONSTRAINT \"" + prefix + "_attachment_id_key\" PRIMARY KEY (\"id\") NOT DEFERRABLE INITIALLY IMMEDIATE,"
+			"	CONSTRAINT \"" + prefix + "_attachment_log_fk\" FOREIGN KEY (\"logID\") REFERENCES \"" + prefix + "_log\" (\"id\") ON UPDATE CASCADE ON DELETE CASCADE NOT DEFERRABLE INITIALLY IMMEDIATE"
+			");"
+		);
+		migration.add("ALTER SEQUENCE \"" + prefix + "_attachment_id_seq\" OWNED BY \"" + prefix + "_attachment\".\"id\";");
+		migration.add("CREATE INDEX IF NOT EXISTS \"" + prefix + "_attachment_log_idx\" ON \"" + prefix + "_attachment\" USING btree(\"logID\" \"pg_catalog\".\"int8_ops\" ASC NULLS LAST);");
+		migrations.push_back(migration);
+	}
+
+	// Version 8: notifications for live tails
+	{
+		SchemaMigration migration = SchemaMigration(8);
+		for (string sql : schema_log_notify(prefix, prefix + "_log")) {
+			migration.add(sql);
+		}
+		migrations.push_back(migration);
+	}
+
+	// Version 9: entry counts per minute, 0 stands for an unknown dimension (NULLs would not conflict)
+	{
+		SchemaMigration migration = SchemaMigration(9);
+		migration.add("CREATE TABLE IF NOT EXISTS \"" + prefix + "_rollup_minute\" ("
+			"	\"minute\" int8 NOT NULL, \"level\" int4 NOT NULL,"
+			"	\"loggerID\" int8 NOT NULL DEFAULT 0, \"hostnameID\" int8 NOT NULL DEFAULT 0, \"functionID\" int8 NOT NULL DEFAULT 0, \"count\" int8 NOT NULL,"
+			"	CONSTRAINT \"" + prefix + "_rollup_minute_key\" PRIMARY KEY (\"minute\", \"level\", \"loggerID\", \"hostnameID\", \"functionID\")"
+			");"
+		);
+		migrations.push_back(migration);
+	}
+
+	// Version 10: retention, SQLite only
+	migrations.push_back(SchemaMigration(10));
+
+	return migrations;
+}
+
+vector<string> schema_log_notify(string prefix, string table) {
+	vector<string> statements = vector<string>();
+
+	// the transition table holds the rows of the statement, NOTIFY is delivered on commit. The 32 bit
+	// transaction ID lets listeners skip rows of other transactions within the ID range (`xmin`).
+	statements.push_back(
+		"CREATE OR REPLACE FUNCTION \"" + prefix + "_log_notify\"() RETURNS trigger AS $$ "
+		"BEGIN "
+			"PERFORM pg_notify('" + prefix + "_log', (txid_current() % 4294967296)::text || ',' || min(n.\"id\") || ',' || max(n.\"id\")) "
+				"FROM new_rows n HAVING count(*) > 0; "
+			"RETURN NULL; "
+		"END; $$ LANGUAGE plpgsql;"
+	);
+	statements.push_back("DROP TRIGGER IF EXISTS \"" + prefix + "_log_notify\" ON \"" + table + "\";");
+	statements.push_back(
+		"CREATE TRIGGER \"" + prefix + "_log_notify\" AFTER INSERT ON \"" + table + "\" "
+		"REFERENCING NEW TABLE AS new_rows FOR EACH STATEMENT EXECUTE PROCEDURE \"" + prefix + "_log_notify\"();"
+	);
+	return statements;
+}
+
+vector<SchemaMigration> schema_migrations(string db_type, string prefix, int layout) {
+	if (db_type == "sqlite") {
+		return sqlite_migrations(prefix, layout);
+	} else if (db_type == "postgres") {
+		return postgres_migrations(prefix, layout);
+	}
+	return vector<SchemaMigration>();
+}
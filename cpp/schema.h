@@ -0,0 +1,41 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// A single DDL statement of a migration, if table and column are set the statement
+// is skipped when the column already exists (SQLite has no ADD COLUMN IF NOT EXISTS)
+struct SchemaStep {
+	string sql;
+	string table;
+	string column;
+};
+
+// All steps to upgrade the schema to a version, they run in one transaction
+struct SchemaMigration {
+	SchemaMigration(int version) : version(version), steps() {}
+
+	void add(string sql);
+	void add_column(string table, string column, string sql);
+
+	int version;
+	vector<SchemaStep> steps;
+};
+
+// Ordered list of migrations for a DB type, the last entry is the current schema version.
+// `layout` selects the log table of a new DB (1: 32 bit IDs and seconds, 2: see below).
+vector<SchemaMigration> schema_migrations(string db_type, string prefix, int layout);
+
+// Statements creating a layout 2 log table (64 bit IDs, microsecond timestamps) named `table`
+// without the columns added by later migrations, used for new DBs and by dblogger-migrate
+vector<string> schema_log_table(string db_type, string prefix, string table);
+
+// Postgres statements creating the trigger that announces new rows of the log table `table`
+// on the `<prefix>_log` channel, one notification per INSERT statement: "<xid>,<first id>,<last id>"
+vector<string> schema_log_notify(string prefix, string table);
+
+#endif // SCHEMA_H
@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "segment.h"
+
+using std::to_string;
+
+static const char segment_magic[8] = { 'D', 'B', 'L', 'S', 'E', 'G', '0', '1' };
+
+// Writers of several processes may interleave, the times of consecutive records are only roughly ordered
+static const int64_t time_slack_us = 10 * 60 * 1000000LL;
+
+// Bytes a reader fetches with one pread()
+static const size_t window_size = 1024 * 1024;
+
+/*
+ * Encoding
+ */
+
+static inline void put_u32(string &out, uint32_t value) {
+	char bytes[4] = { (char)(value & 0xff), (char)((value >> 8) & 0xff), (char)((value >> 16) & 0xff), (char)((value >> 24) & 0xff) };
+	out.append(bytes, 4);
+}
+
+static inline void put_u64(string &out, uint64_t value) {
+	put_u32(out, (uint32_t)(value & 0xffffffff));
+	put_u32(out, (uint32_t)(value >> 32));
+}
+
+static inline void put_string(string &out, const string &value) {
+	put_u32(out, (uint32_t)value.size());
+	out.append(value);
+}
+
+static inline uint32_t get_u32(const char *data) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static inline uint64_t get_u64(const char *data) {
+	return get_u32(data) | ((uint64_t)get_u32(data + 4) << 32);
+}
+
+// Reads values from a payload, every read fails once the payload is exhausted
+class PayloadReader {
+	public:
+		PayloadReader(const char *data, size_t length) : ok(true), data(data), length(length), offset(0) {}
+
+		uint8_t u8() {
+			return available(1) ? (uint8_t)data[offset++] : 0;
+		}
+
+		uint32_t u32() {
+			if (!available(4)) return 0;
+			uint32_t value = get_u32(data + offset);
+			offset += 4;
+			return value;
+		}
+
+		uint64_t u64() {
+			if (!available(8)) return 0;
+			uint64_t value = get_u64(data + offset);
+			offset += 8;
+			return value;
+		}
+
+		string str() {
+			uint32_t size = u32();
+			if (!available(size)) return string();
+			string value = string(data + offset, size);
+			offset += size;
+			return value;
+		}
+
+		bool ok;
+
+	private:
+		bool available(size_t size) {
+			if (!ok || (length - offset < size)) {
+				ok = false;
+			}
+			return ok;
+		}
+
+		const char *data;
+		size_t length;
+		size_t offset;
+};
+
+// Lookup table of the CRC-32 used by zlib and PNG
+struct CRC32Table {
+	uint32_t values[256];
+
+	CRC32Table() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = i;
+			for (int bit = 0; bit < 8; bit++) {
+				value = (value & 1) ? (0xedb88320 ^ (value >> 1)) : (value >> 1);
+			}
+			values[i] = value;
+		}
+	}
+};
+
+uint32_t segment_crc32(const char *data, size_t length) {
+	static const CRC32Table table;
+
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < length; i++) {
+		crc = table.values[(crc ^ (unsigned char)data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffff;
+}
+
+void segment_append_frame(string &out, const SegmentRecord &record) {
+	size_t start = out.size();
+	put_u64(out, 0); // length and checksum, patched below
+
+	out += (char)segment_record_version;
+	put_u64(out, record.id);
+	put_u64(out, (uint64_t)record.time_us);
+	put_u32(out, (uint32_t)record.level);
+	put_u32(out, (uint32_t)record.pid);
+	put_u32(out, (uint32_t)record.line);
+	put_u32(out, (uint32_t)record.column);
+	for (int i = 0; i < SEGMENT_TAG; i++) {
+		put_u32(out, record.names[i]);
+	}
+	put_u32(out, (uint32_t)record.tags.size());
+	for (uint32_t tag : record.tags) {
+		put_u32(out, tag);
+	}
+	put_string(out, record.message);
+	put_string(out, record.fields);
+	put_string(out, record.context);
+	put_u32(out, (uint32_t)record.attachments.size());
+	for (const LogAttachment &attachment : record.attachments) {
+		put_string(out, attachment.type);
+		put_u64(out, (uint64_t)attachment.size);
+		put_string(out, attachment.data);
+	}
+
+	string header;
+	put_u32(header, (uint32_t)(out.size() - start - 8));
+	put_u32(header, segment_crc32(out.data() + start + 8, out.size() - start - 8));
+	out.replace(start, 8, header);
+}
+
+size_t segment_read_frame(const char *data, size_t size, size_t offset, SegmentRecord &record) {
+	if ((offset + 8 > size) || (offset + 8 < offset)) {
+		return 0;
+	}
+	uint32_t length = get_u32(data + offset);
+	if ((length == 0) || (length > size - offset - 8)) {
+		return 0;
+	}
+	const char *payload = data + offset + 8;
+	if (segment_crc32(payload, length) != get_u32(data + offset + 4)) {
+		return 0;
+	}
+
+	PayloadReader reader = PayloadReader(payload, length);
+	if (reader.u8() != segment_record_version) {
+		return 0;
+	}
+	record.id = reader.u64();
+	record.time_us = (int64_t)reader.u64();
+	record.level = (int)reader.u32();
+	record.pid = (int)reader.u32();
+	record.line = (int)reader.u32();
+	record.column = (int)reader.u32();
+	for (int i = 0; i < SEGMENT_TAG; i++) {
+		record.names[i] = reader.u32();
+	}
+	uint32_t count = reader.u32();
+	record.tags.clear();
+	for (uint32_t i = 0; (i < count) && reader.ok; i++) {
+		record.tags.push_back(reader.u32());
+	}
+	record.message = reader.str();
+	record.fields = reader.str();
+	record.context = reader.str();
+	count = reader.u32();
+	record.attachments.clear();
+	for (uint32_t i = 0; (i < count) && reader.ok; i++) {
+		LogAttachment attachment;
+		attachment.type = reader.str();
+		attachment.size = (size_t)reader.u64();
+		attachment.data = reader.str();
+		record.attachments.push_back(std::move(attachment));
+	}
+
+	return reader.ok ? 8 + length : 0;
+}
+
+/*
+ * Files
+ */
+
+string segment_path(const string &directory, uint64_t number, const string &extension) {
+	char name[64];
+	snprintf(name, sizeof(name), "segment-%08llu.", (unsigned long long)number);
+	return directory + "/" + name + extension;
+}
+
+vector<uint64_t> segment_numbers(const string &directory) {
+	vector<uint64_t> numbers = vector<uint64_t>();
+	DIR *dir = opendir(directory.c_str());
+	if (dir == NULL) {
+		return numbers;
+	}
+
+	struct dirent *item;
+	while ((item = readdir(dir)) != NULL) {
+		// segments that are still being created end with .tmp
+		unsigned long long number;
+		int end = 0;
+		if ((sscanf(item->d_name, "segment-%llu.log%n", &number, &end) == 1) && (end > 0) && (item->d_name[end] == '\0')) {
+			numbers.push_back(number);
+		}
+	}
+	closedir(dir);
+
+	std::sort(numbers.begin(), numbers.end());
+	return numbers;
+}
+
+string segment_header(uint64_t first_id) {
+	string header = string(segment_magic, sizeof(segment_magic));
+	put_u64(header, first_id);
+	header.resize(segment_header_size, '\0');
+	return header;
+}
+
+uint64_t segment_first_id(const char *data, size_t size) {
+	if ((size < segment_header_size) || (memcmp(data, segment_magic, sizeof(segment_magic)) != 0)) {
+		return 0;
+	}
+	return get_u64(data + sizeof(segment_magic));
+}
+
+/*
+ * Dictionary
+ */
+
+SegmentDictionary::SegmentDictionary() : fd(-1), writable(false), loaded(0) {}
+
+SegmentDictionary::~SegmentDictionary() {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+bool
+SegmentDictionary::open(const string &directory, bool writable) {
+	string path = directory + "/dictionary";
+	this->writable = writable;
+	fd = ::open(path.c_str(), writable ? (O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC) : (O_RDONLY | O_CLOEXEC), 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	load();
+	if (writable && (ftruncate(fd, loaded) != 0)) {
+		return false;
+	}
+	return true;
+}
+
+void
+SegmentDictionary::load() {
+	struct stat info;
+	if ((fd < 0) || (fstat(fd, &info) != 0) || ((uint64_t)info.st_size <= loaded)) {
+		return;
+	}
+
+	string data = string(info.st_size - loaded, '\0');
+	ssize_t length = pread(fd, &data[0], data.size(), loaded);
+	size_t offset = 0;
+	while ((length > 0) && (offset + 8 <= (size_t)length)) {
+		uint32_t size = get_u32(data.data() + offset);
+		if ((size < 5) || (size > (size_t)length - offset - 8) || (segment_crc32(data.data() + offset + 8, size) != get_u32(data.data() + offset + 4))) {
+			break;
+		}
+
+		// IDs are assigned in order, the ID field guards against a corrupt side file
+		uint8_t dimension = (uint8_t)data[offset + 8];
+		uint32_t id = get_u32(data.data() + offset + 9);
+		if ((dimension >= SEGMENT_DIMENSIONS) || (id != names[dimension].size() + 1)) {
+			break;
+		}
+		string name = data.substr(offset + 13, size - 5);
+		ids[dimension][name] = id;
+		names[dimension].push_back(std::move(name));
+		offset += 8 + size;
+	}
+	loaded += offset;
+}
+
+uint32_t
+SegmentDictionary::id(SegmentDimension dimension, const string &name) {
+	if (name.empty()) {
+		return 0;
+	}
+	auto search = ids[dimension].find(name);
+	if (search != ids[dimension].end()) {
+		return search->second;
+	}
+	if (!writable) {
+		return 0;
+	}
+
+	uint32_t id = names[dimension].size() + 1;
+	string payload = string(1, (char)dimension);
+	put_u32(payload, id);
+	payload += name;
+	string frame;
+	put_u32(frame, (uint32_t)payload.size());
+	put_u32(frame, segment_crc32(payload.data(), payload.size()));
+	frame += payload;
+	if (write(fd, frame.data(), frame.size()) != (ssize_t)frame.size()) {
+		// cut off a partial write, the name is stored as empty
+		if (ftruncate(fd, loaded) != 0) {
+			writable = false;
+		}
+		return 0;
+	}
+
+	loaded += frame.size();
+	ids[dimension][name] = id;
+	names[dimension].push_back(name);
+	return id;
+}
+
+const string *
+SegmentDictionary::name(SegmentDimension dimension, uint32_t id) const {
+	if ((id == 0) || (id > names[dimension].size())) {
+		return NULL;
+	}
+	return &names[dimension][id - 1];
+}
+
+/*
+ * Index
+ */
+
+vector<SegmentIndexEntry> segment_load_index(const string &path) {
+	vector<SegmentIndexEntry> index = vector<SegmentIndexEntry>();
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return index;
+	}
+
+	char entry[segment_index_entry_size];
+	while (read(fd, entry, sizeof(entry)) == (ssize_t)sizeof(entry)) {
+		index.push_back({ get_u64(entry), (int64_t)get_u64(entry + 8), get_u64(entry + 16) });
+	}
+	close(fd);
+	return index;
+}
+
+void segment_append_index_entry(string &out, const SegmentIndexEntry &entry) {
+	put_u64(out, entry.id);
+	put_u64(out, (uint64_t)entry.time_us);
+	put_u64(out, entry.offset);
+}
+
+/*
+ * Scan
+ */
+
+static bool known_names(const SegmentRecord &record, const SegmentDictionary &dictionary) {
+	for (int i = 0; i < SEGMENT_TAG; i++) {
+		if ((record.names[i] != 0) && (dictionary.name((SegmentDimension)i, record.names[i]) == NULL)) {
+			return false;
+		}
+	}
+	for (uint32_t tag : record.tags) {
+		if (dictionary.name(SEGMENT_TAG, tag) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Reads the frames of a segment through a buffer filled with pread(). The writer truncates the
+// active segment when it seals it, a mapping of the old size would fault past the new end of the
+// file while pread() just returns fewer bytes.
+class SegmentWindow {
+	public:
+		explicit SegmentWindow(int fd) : fd(fd), start(0) {}
+
+		// see segment_read_frame()
+		size_t read_frame(size_t offset, SegmentRecord &record) {
+			if (!fill(offset, 8)) {
+				return 0;
+			}
+			uint32_t length = get_u32(data.data() + offset - start);
+			if ((length == 0) || !fill(offset, 8 + (size_t)length)) {
+				return 0;
+			}
+			return segment_read_frame(data.data(), data.size(), offset - start, record);
+		}
+
+	private:
+		// make sure the buffer holds `length` bytes at `offset`, false at the end of the file
+		bool fill(size_t offset, size_t length) {
+			if ((offset >= start) && (offset + length <= start + data.size())) {
+				return true;
+			}
+			data.resize(std::max(length, window_size));
+			ssize_t count = pread(fd, &data[0], data.size(), offset);
+			data.resize((count > 0) ? count : 0);
+			start = offset;
+			return data.size() >= length;
+		}
+
+		int fd;
+		string data;
+		size_t start; // file offset of data
+};
+
+long segment_scan(const string &directory, int64_t from_us, int64_t to_us, int min_level,
+	std::function<bool(const SegmentRecord &, SegmentDictionary &)> callback, string &error) {
+
+	SegmentDictionary dictionary;
+	if (!dictionary.open(directory, false)) {
+		error = "Could not open the segment dictionary of " + directory + ": " + strerror(errno);
+		return -1;
+	}
+
+	vector<uint64_t> numbers = segment_numbers(directory);
+	vector< vector<SegmentIndexEntry> > indexes = vector< vector<SegmentIndexEntry> >();
+	for (uint64_t number : numbers) {
+		indexes.push_back(segment_load_index(segment_path(directory, number, "idx")));
+	}
+
+	// start in the last segment that begins before the time range, at its last indexed record before it
+	int64_t start_us = (from_us > 0) ? from_us - time_slack_us : 0;
+	int64_t stop_us = (to_us > 0) ? to_us + time_slack_us : 0;
+	size_t first = 0;
+	for (size_t i = 0; (start_us > 0) && (i < numbers.size()); i++) {
+		if (!indexes[i].empty() && (indexes[i][0].time_us <= start_us)) {
+			first = i;
+		}
+	}
+
+	long visited = 0;
+	bool done = false;
+	SegmentRecord record;
+	for (size_t i = first; (i < numbers.size()) && !done; i++) {
+		const vector<SegmentIndexEntry> &index = indexes[i];
+		if (index.empty() || ((stop_us > 0) && (index[0].time_us >= stop_us))) {
+			done = !index.empty();
+			continue;
+		}
+
+		size_t start = 0;
+		while ((start + 1 < index.size()) && (index[start + 1].time_us < start_us)) {
+			start++;
+		}
+
+		int fd = open(segment_path(directory, numbers[i], "log").c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			continue;
+		}
+
+		// IDs are consecutive, anything else is left over from before a crash
+		uint64_t expected = index[start].id;
+		size_t offset = index[start].offset;
+		size_t length;
+		SegmentWindow window = SegmentWindow(fd);
+		while ((length = window.read_frame(offset, record)) > 0) {
+			if (record.id != expected) {
+				break;
+			}
+			expected++;
+			offset += length;
+
+			if ((stop_us > 0) && (record.time_us >= stop_us)) {
+				done = true;
+				break;
+			}
+			if ((record.level < min_level) ||
+				((from_us > 0) && (record.time_us < from_us)) ||
+				((to_us > 0) && (record.time_us >= to_us))) {
+				continue;
+			}
+			if (!known_names(record, dictionary)) {
+				dictionary.load();
+			}
+			visited++;
+			if (!callback(record, dictionary)) {
+				done = true;
+				break;
+			}
+		}
+		close(fd);
+	}
+
+	return visited;
+}
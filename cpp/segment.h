@@ -0,0 +1,117 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "log_entry.h"
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+// Append-only segment storage (`type: 'segment'`), a directory with
+//
+//   segment-<n>.log  segment files, preallocated while they are written: a header followed by
+//                    frames of a 4 byte payload length, a CRC-32 of the payload and the payload.
+//                    A zero length ends the frames, sealed segments are truncated to their frames.
+//   segment-<n>.idx  sparse index: ID, time and offset of every `segment_index_interval`th record
+//   dictionary       logger, host, file, function and tag names by ID, records only hold the IDs
+//   lock             flock()ed by the writing process
+//
+// Numbers are little endian. Entry IDs grow by one from record to record across all segments.
+
+enum SegmentDimension { SEGMENT_LOGGER, SEGMENT_HOST, SEGMENT_FILE, SEGMENT_FUNCTION, SEGMENT_TAG, SEGMENT_DIMENSIONS };
+
+static const uint8_t segment_record_version = 1;
+static const size_t segment_header_size = 64;
+static const size_t segment_index_interval = 256;
+static const size_t segment_index_entry_size = 24;
+
+// A stored entry, names are dictionary IDs with 0 for an empty name
+struct SegmentRecord {
+	uint64_t id;
+	int64_t time_us;
+	int level;
+	int pid;
+	int line;
+	int column;
+	uint32_t names[SEGMENT_TAG]; // logger, host, file and function
+	vector<uint32_t> tags;
+	string message;
+	string fields;
+	string context;
+	vector<LogAttachment> attachments;
+};
+
+struct SegmentIndexEntry {
+	uint64_t id;
+	int64_t time_us;
+	uint64_t offset;
+};
+
+uint32_t segment_crc32(const char *data, size_t length);
+
+// Append the frame of `record` to `out`
+void segment_append_frame(string &out, const SegmentRecord &record);
+
+// Size of the valid frame at `offset` of a segment mapped at `data`, 0 at the end of the frames
+// or for a torn or corrupt frame. The payload is decoded into `record`.
+size_t segment_read_frame(const char *data, size_t size, size_t offset, SegmentRecord &record);
+
+// Entries of the index file `path`
+vector<SegmentIndexEntry> segment_load_index(const string &path);
+
+// Append an index entry in its file format to `out`
+void segment_append_index_entry(string &out, const SegmentIndexEntry &entry);
+
+// File of segment `number` with extension "log" or "idx"
+string segment_path(const string &directory, uint64_t number, const string &extension);
+
+// Numbers of the segments in `directory`, ascending
+vector<uint64_t> segment_numbers(const string &directory);
+
+// Header of a new segment whose first record gets `first_id`
+string segment_header(uint64_t first_id);
+
+// First ID of a segment from its header, 0 if it is not a segment
+uint64_t segment_first_id(const char *data, size_t size);
+
+// Names by dimension and ID. A writable dictionary appends new names to the side file before
+// the records that use them are written, readers load names appended later on demand.
+class SegmentDictionary {
+	public:
+		SegmentDictionary();
+		~SegmentDictionary();
+
+		// load the side file of `directory`, a writable dictionary cuts off a torn record at its end
+		bool open(const string &directory, bool writable);
+
+		// read names appended since the last load
+		void load();
+
+		// ID of `name`, new names get the next ID (writable dictionaries only, 0 otherwise)
+		uint32_t id(SegmentDimension dimension, const string &name);
+
+		// name of an ID, NULL if it is not known (yet)
+		const string *name(SegmentDimension dimension, uint32_t id) const;
+
+	private:
+		int fd;
+		bool writable;
+		uint64_t loaded; // bytes of the side file that were read
+		vector<string> names[SEGMENT_DIMENSIONS];
+		unordered_map<string, uint32_t> ids[SEGMENT_DIMENSIONS];
+};
+
+// Visit the records in `directory` with `from_us` <= time < `to_us` (0: no limit) and a level of at
+// least `min_level` in ID order. The sparse indexes pick the first segment and the offset to start
+// at, the scan stops at the first record a few minutes past `to_us`. `callback` returns false to
+// stop. Returns the number of visited records or -1 with `error` set.
+long segment_scan(const string &directory, int64_t from_us, int64_t to_us, int min_level,
+	std::function<bool(const SegmentRecord &, SegmentDictionary &)> callback, string &error);
+
+#endif // SEGMENT_H
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "segment_logger.h"
+#include "stats.h"
+
+using std::cerr;
+
+SegmentSink::SegmentSink(string directory, size_t segment_size, int level, size_t queue_size) :
+	Sink(level, set<string>(), queue_size), directory(directory), segment_size(std::max(segment_size, (size_t)1024 * 1024)) {
+
+	valid = false;
+	fd = -1;
+	index_fd = -1;
+	data = NULL;
+	capacity = 0;
+	number = 0;
+	used = 0;
+	next_id = 1;
+	records = 0;
+
+	mkdir(directory.c_str(), 0755);
+	lock_fd = open((directory + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if ((lock_fd < 0) || (flock(lock_fd, LOCK_EX | LOCK_NB) != 0)) {
+		cerr << "Could not lock segment directory " << directory << ", is another process writing to it? " << strerror(errno) << "\n";
+		return;
+	}
+	if (!dictionary.open(directory, true)) {
+		cerr << "Could not open the segment dictionary of " << directory << ": " << strerror(errno) << "\n";
+		return;
+	}
+	valid = recover();
+}
+
+SegmentSink::~SegmentSink() {
+	stop();
+	seal();
+	if (lock_fd >= 0) {
+		close(lock_fd);
+	}
+}
+
+// Continue the last segment after the last valid frame, a sealed last segment is followed by a new one
+bool
+SegmentSink::recover() {
+	vector<uint64_t> numbers = segment_numbers(directory);
+	if (numbers.empty()) {
+		return create_segment(1, 1);
+	}
+
+	number = numbers.back();
+	string path = segment_path(directory, number, "log");
+	fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+	struct stat info;
+	if ((fd < 0) || (fstat(fd, &info) != 0)) {
+		cerr << "Could not open segment " << path << ": " << strerror(errno) << "\n";
+		return false;
+	}
+	capacity = info.st_size;
+	void *mapping = (capacity > 0) ? mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	uint64_t first_id = (mapping != MAP_FAILED) ? segment_first_id((const char *)mapping, capacity) : 0;
+	if (first_id == 0) {
+		cerr << "Segment " << path << " is damaged, move it out of " << directory << " to continue\n";
+		if (mapping != MAP_FAILED) {
+			munmap(mapping, capacity);
+		}
+		return false;
+	}
+	data = (char *)mapping;
+
+	// start at the last indexed frame that is intact, index entries are written before their frame
+	vector<SegmentIndexEntry> index = segment_load_index(segment_path(directory, number, "idx"));
+	size_t kept = index.size();
+	while ((kept > 0) && !((segment_read_frame(data, capacity, index[kept - 1].offset, record) > 0) && (record.id == index[kept - 1].id))) {
+		kept--;
+	}
+	used = (kept > 0) ? index[kept - 1].offset : segment_header_size;
+	next_id = (kept > 0) ? index[kept - 1].id : first_id;
+
+	size_t length;
+	while (((length = segment_read_frame(data, capacity, used, record)) > 0) && (record.id == next_id)) {
+		used += length;
+		next_id++;
+	}
+	records = next_id - first_id;
+
+	index_fd = open(segment_path(directory, number, "idx").c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if ((index_fd < 0) || (ftruncate(index_fd, kept * segment_index_entry_size) != 0)) {
+		cerr << "Could not open the index of segment " << path << ": " << strerror(errno) << "\n";
+		return false;
+	}
+
+	if (capacity < segment_size) {
+		seal();
+		return create_segment(number + 1, next_id);
+	}
+
+	// readers stop in front of a torn frame, the next write replaces it
+	memset(data + used, 0, std::min(capacity - used, (size_t)8));
+	return true;
+}
+
+// The header is written before the segment gets its name, so the last segment always has one
+bool
+SegmentSink::create_segment(uint64_t number, uint64_t first_id) {
+	string path = segment_path(directory, number, "log");
+	string temporary = path + ".tmp";
+	string header = segment_header(first_id);
+
+	int segment_fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	int error = (segment_fd < 0) ? errno : posix_fallocate(segment_fd, 0, segment_size);
+	if ((error == 0) && (pwrite(segment_fd, header.data(), header.size(), 0) != (ssize_t)header.size())) {
+		error = errno;
+	}
+	if ((error == 0) && (rename(temporary.c_str(), path.c_str()) != 0)) {
+		error = errno;
+	}
+	void *mapping = (error == 0) ? mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment_fd, 0) : MAP_FAILED;
+	if (mapping == MAP_FAILED) {
+		cerr << "Could not create segment " << path << ": " << strerror(error ? error : errno) << "\n";
+		if (segment_fd >= 0) {
+			close(segment_fd);
+			unlink(temporary.c_str());
+		}
+		return false;
+	}
+
+	index_fd = open(segment_path(directory, number, "idx").c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	fd = segment_fd;
+	data = (char *)mapping;
+	capacity = segment_size;
+	this->number = number;
+	used = segment_header_size;
+	next_id = first_id;
+	records = 0;
+	return true;
+}
+
+// Unmap the current segment and truncate it to its frames
+void
+SegmentSink::seal() {
+	if (data != NULL) {
+		munmap(data, capacity);
+		data = NULL;
+	}
+	if (fd >= 0) {
+		if (ftruncate(fd, used) != 0) {
+			cerr << "Could not seal segment " << segment_path(directory, number, "log") << ": " << strerror(errno) << "\n";
+		}
+		close(fd);
+		fd = -1;
+	}
+	if (index_fd >= 0) {
+		close(index_fd);
+		index_fd = -1;
+	}
+}
+
+void
+SegmentSink::append(const LogEntry &entry) {
+	record.id = next_id;
+	record.time_us = entry.time_us;
+	record.level = entry.level;
+	record.pid = entry.pid;
+	record.line = entry.line;
+	record.column = entry.column;
+	record.names[SEGMENT_LOGGER] = dictionary.id(SEGMENT_LOGGER, entry.logger_name);
+	record.names[SEGMENT_HOST] = dictionary.id(SEGMENT_HOST, entry.hostname);
+	record.names[SEGMENT_FILE] = dictionary.id(SEGMENT_FILE, entry.filename);
+	record.names[SEGMENT_FUNCTION] = dictionary.id(SEGMENT_FUNCTION, entry.function);
+	record.tags.clear();
+	for (const string &tag : entry.tags->names) {
+		record.tags.push_back(dictionary.id(SEGMENT_TAG, tag));
+	}
+	record.message = entry.message();
+	record.fields = entry.fields;
+	record.context = entry.context;
+	record.attachments = entry.attachments;
+
+	frame.clear();
+	segment_append_frame(frame, record);
+	if (frame.size() > segment_size - segment_header_size) {
+		stats_add(stats.dropped);
+		return;
+	}
+	if (used + frame.size() > capacity) {
+		seal();
+		if (!create_segment(number + 1, next_id)) {
+			valid = false;
+			stats_add(stats.dropped);
+			return;
+		}
+	}
+
+	if (records % segment_index_interval == 0) {
+		string index_entry;
+		segment_append_index_entry(index_entry, { record.id, record.time_us, used });
+		if (::write(index_fd, index_entry.data(), index_entry.size()) != (ssize_t)index_entry.size()) {
+			cerr << "Could not write the index of segment " << segment_path(directory, number, "log") << ": " << strerror(errno) << "\n";
+		}
+	}
+
+	// the length goes in last, readers see either the whole frame or the end of the frames
+	memcpy(data + used + 4, frame.data() + 4, frame.size() - 4);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(data + used, frame.data(), 4);
+
+	used += frame.size();
+	next_id++;
+	records++;
+	stats_add(stats.bytes_db, frame.size());
+}
+
+void
+SegmentSink::write(const LogEntry *entries, size_t count) {
+	if (!valid) {
+		stats_add(stats.dropped, count);
+		return;
+	}
+
+	StatsTimer timer(stats.db_time);
+	for (size_t i = 0; (i < count) && valid; i++) {
+		append(entries[i]);
+	}
+}
+
+// Start writing the mapped pages back, they survive a crash of the process either way
+void
+SegmentSink::write_pending() {
+	if (data != NULL) {
+		msync(data, used, MS_ASYNC);
+	}
+}
+
+void
+SegmentSink::reopen() {
+	if (!valid) {
+		return;
+	}
+	seal();
+	valid = create_segment(number + 1, next_id);
+}
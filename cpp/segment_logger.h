@@ -0,0 +1,53 @@
+#ifndef SEGMENT_LOGGER_H
+#define SEGMENT_LOGGER_H
+
+#include <string>
+
+#include "log_entry.h"
+#include "segment.h"
+#include "sink.h"
+
+using std::string;
+
+// Writes entries to the append-only segment files of `directory`, see segment.h.
+//
+// The current segment is preallocated to `segment_size` bytes and memory mapped, a write copies
+// the frames into the mapping without a system call. When a frame does not fit anymore the segment
+// is sealed (truncated to its frames) and the next one is started, rotation seals it as well.
+// After a crash the last segment is scanned up to its last valid frame and its index is rebuilt.
+// Only one process can write to a directory at a time.
+class SegmentSink : public Sink {
+	public:
+		SegmentSink(string directory, size_t segment_size, int level, size_t queue_size);
+		~SegmentSink();
+
+		const string directory;
+		const size_t segment_size;
+
+	protected:
+		void write(const LogEntry *entries, size_t count);
+		void write_pending();
+		void reopen();
+
+	private:
+		bool recover();
+		bool create_segment(uint64_t number, uint64_t first_id);
+		void seal();
+		void append(const LogEntry &entry);
+
+		bool valid;
+		int lock_fd;
+		int fd;
+		int index_fd;
+		char *data;
+		size_t capacity; // mapped bytes
+		uint64_t number;
+		size_t used;
+		uint64_t next_id;
+		uint64_t records; // in the current segment
+		SegmentDictionary dictionary;
+		SegmentRecord record;
+		string frame;
+};
+
+#endif // SEGMENT_LOGGER_H
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "shard.h"
+
+using std::to_string;
+
+string shard_path(string directory, int pid, int shards) {
+	mkdir(directory.c_str(), 0755);
+	return directory + "/shard-" + to_string(pid % shards) + ".db";
+}
+
+vector<string> list_shards(string directory) {
+	vector<string> result = vector<string>();
+
+	DIR *dir = opendir(directory.c_str());
+	if (dir == NULL) {
+		return result;
+	}
+
+	struct dirent *item;
+	while ((item = readdir(dir)) != NULL) {
+		string name = item->d_name;
+		if ((name.size() > 9) && (name.substr(0, 6) == "shard-") && (name.substr(name.size() - 3) == ".db")) {
+			result.push_back(directory + "/" + name);
+		}
+	}
+	closedir(dir);
+
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+static bool has_column(sqlite3 *db, string schema, string table, string column) {
+	string sql = "SELECT COUNT(*) FROM pragma_table_info(?1, ?2) WHERE name = ?3;";
+	sqlite3_stmt *stmt = NULL;
+	bool result = false;
+	if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, table.c_str(), table.size(), SQLITE_TRANSIENT);
+		sqlite3_bind_text(stmt, 2, schema.c_str(), schema.size(), SQLITE_TRANSIENT);
+		sqlite3_bind_text(stmt, 3, column.c_str(), column.size(), SQLITE_TRANSIENT);
+		result = (sqlite3_step(stmt) == SQLITE_ROW) && (sqlite3_column_int(stmt, 0) > 0);
+	}
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+string shard_select(sqlite3 *db, string schema, string prefix, string shard_name, string tag_separator) {
+	string p = "\"" + schema + "\".\"" + prefix;
+	string context = has_column(db, schema, prefix + "_log", "context") ? "l.context" : "NULL";
+	return
+		"SELECT '" + shard_name + "' AS shard, l.id AS id, l.level AS level, l.message AS message, l.pid AS pid, l.time AS time, "
+		"g.name AS logger, h.name AS host, s.path AS source, f.name AS function, f.\"lineNumber\" AS line, l.fields AS fields, "
+		"(SELECT group_concat(t.name, '" + tag_separator + "') FROM " + p + "_tagset_member\" m JOIN " + p + "_tag\" t ON t.id = m.\"tagID\" WHERE m.\"tagsetID\" = l.\"tagsetID\") AS tags, "
+		+ context + " AS context "
+		"FROM " + p + "_log\" l "
+		"LEFT JOIN " + p + "_logger\" g ON g.id = l.\"loggerID\" "
+		"LEFT JOIN " + p + "_hosts\" h ON h.id = l.\"hostnameID\" "
+		"LEFT JOIN " + p + "_function\" f ON f.id = l.\"functionID\" "
+		"LEFT JOIN " + p + "_source\" s ON s.id = f.\"sourceID\"";
+}
+
+static string shard_column_text(sqlite3_stmt *stmt, int column) {
+	const char *text = (const char *)sqlite3_column_text(stmt, column);
+	return text ? string(text) : string();
+}
+
+void shard_row_entry(sqlite3_stmt *stmt, LogEntry &entry) {
+	entry.level = sqlite3_column_int(stmt, 2);
+	string message = shard_column_text(stmt, 3);
+	if ((message.size() > 0) && (message.back() == ' ')) {
+		// message() appends the separator again
+		message.pop_back();
+	}
+	entry.parts.push_back(message);
+	entry.pid = sqlite3_column_int(stmt, 4);
+	// seconds in layout 1 shards, microseconds in layout 2 shards
+	int64_t time = sqlite3_column_int64(stmt, 5);
+	if (time >= 100000000000) {
+		entry.time_us = time;
+		entry.date = (time_t)(time / 1000000);
+	} else {
+		entry.date = (time_t)time;
+		entry.time_us = time * 1000000;
+	}
+	entry.logger_name = shard_column_text(stmt, 6);
+	entry.hostname = shard_column_text(stmt, 7);
+	entry.filename = shard_column_text(stmt, 8);
+	entry.function = shard_column_text(stmt, 9);
+	entry.line = sqlite3_column_int(stmt, 10);
+	entry.column = 0;
+	entry.fields = shard_column_text(stmt, 11);
+
+	string tags = shard_column_text(stmt, 12);
+	set<string> names = set<string>();
+	size_t start = 0;
+	while (start < tags.size()) {
+		size_t end = tags.find('\x1f', start);
+		if (end == string::npos) {
+			end = tags.size();
+		}
+		names.insert(tags.substr(start, end - start));
+		start = end + 1;
+	}
+	entry.tags = TagSet::intern(names);
+	entry.context = shard_column_text(stmt, 13);
+}
+
+sqlite3_stmt *shard_attachment_statement(sqlite3 *db, string schema, string prefix) {
+	if (!has_column(db, schema, prefix + "_attachment", "logID")) {
+		return NULL;
+	}
+	string sql = "SELECT type, size, data FROM \"" + schema + "\".\"" + prefix + "_attachment\" WHERE \"logID\" = ?1 ORDER BY position;";
+	sqlite3_stmt *stmt = NULL;
+	if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) != SQLITE_OK) {
+		sqlite3_finalize(stmt);
+		return NULL;
+	}
+	return stmt;
+}
+
+bool shard_read_attachments(sqlite3_stmt *stmt, int64_t log_id, LogEntry &entry) {
+	sqlite3_bind_int64(stmt, 1, log_id);
+	int status;
+	while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+		LogAttachment attachment;
+		attachment.type = shard_column_text(stmt, 0);
+		attachment.size = sqlite3_column_int64(stmt, 1);
+		const char *data = (const char *)sqlite3_column_blob(stmt, 2);
+		attachment.data = data ? string(data, sqlite3_column_bytes(stmt, 2)) : string();
+		entry.attachments.push_back(std::move(attachment));
+	}
+	sqlite3_reset(stmt);
+	return status == SQLITE_DONE;
+}
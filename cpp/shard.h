@@ -0,0 +1,40 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "log_entry.h"
+
+using std::string;
+using std::vector;
+
+// Sharded SQLite: every process writes to `<directory>/shard-<pid % shards>.db`, so processes
+// do not serialize on one database lock. All shards have the same schema.
+
+// Path of the shard file for a process, creates the directory if needed
+string shard_path(string directory, int pid, int shards);
+
+// Sorted list of all shard files in a directory
+vector<string> list_shards(string directory);
+
+// SELECT of all log entries of one shard with resolved dimension names, `schema` is the
+// name the shard is attached as to `db`. Columns: shard, id, level, message, pid, time, logger,
+// host, source, function, line, fields, tags (joined with `tag_separator`), context. Columns
+// that an older shard does not have yet are NULL.
+string shard_select(sqlite3 *db, string schema, string prefix, string shard_name, string tag_separator);
+
+// Fill a log entry from the current row of a shard_select statement with "\x1f" as the tag
+// separator, accepts the time in seconds (layout 1) and microseconds (layout 2)
+void shard_row_entry(sqlite3_stmt *stmt, LogEntry &entry);
+
+// Statement reading the attachments of one log entry of a shard, NULL if the shard has no
+// attachment table. Finalize it with sqlite3_finalize().
+sqlite3_stmt *shard_attachment_statement(sqlite3 *db, string schema, string prefix);
+
+// Add the attachments of the log entry `log_id` to `entry`, they are written with the entry
+// under its new ID. Returns false if they could not be read.
+bool shard_read_attachments(sqlite3_stmt *stmt, int64_t log_id, LogEntry &entry);
+
+#endif // SHARD_H
@@ -0,0 +1,299 @@
+/*
+ * dblogger-shards: reads and merges the shard files of a sharded SQLite destination.
+ *
+ * --query attaches all shards to an in-memory DB, creates the temporary `<prefix>_log_all`
+ * view (UNION ALL of all shards with resolved names) and prints the result of the query.
+ * --merge copies the entries of all shards with their attachments into a target DB, with
+ * --delete the merged entries are removed from the shards and the shard files are vacuumed.
+ * Every shard keeps the ID of the last entry merged into a target, so interrupted or repeated
+ * merges do not write entries twice.
+ */
+
+#include <iostream>
+#include <vector>
+#include <sqlite3.h>
+
+#include "cli.h"
+#include "db_logger.h"
+#include "shard.h"
+#include "stats.h"
+
+using std::cerr;
+using std::cout;
+using std::to_string;
+using std::vector;
+
+static void usage(void) {
+	cerr << "Usage: dblogger-shards --dir <directory> --query <sql>\n"
+		"       dblogger-shards --dir <directory> --merge [--delete] --target-name <name> [target options]\n\n"
+		"  --dir <directory>         Shard directory (the `name` of the sharded destination)\n"
+		"  --prefix <prefix>         Table prefix of the shards (default: logger)\n"
+		"  --query <sql>             Run a query, `<prefix>_log_all` contains the entries of all shards\n"
+		"  --merge                   Copy all entries into the target DB\n"
+		"  --delete                  Remove merged entries from the shards and vacuum them\n"
+		"  --batch <count>           Entries per transaction when merging (default: 1000)\n\n"
+		<< connection_usage("target-");
+}
+
+static string column_text(sqlite3_stmt *stmt, int column) {
+	const char *text = (const char *)sqlite3_column_text(stmt, column);
+	return text ? string(text) : string();
+}
+
+static string shard_name(string path) {
+	size_t slash = path.rfind('/');
+	return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+static int query_shards(vector<string> shards, string prefix, string sql) {
+	sqlite3 *db = NULL;
+	if (sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_URI, NULL) != SQLITE_OK) {
+		cerr << "Could not open in-memory DB\n";
+		return 1;
+	}
+
+	int limit = sqlite3_limit(db, SQLITE_LIMIT_ATTACHED, -1);
+	if ((int)shards.size() > limit) {
+		cerr << "Found " << shards.size() << " shards but SQLite can only attach " << limit << ", merge them first\n";
+		sqlite3_close_v2(db);
+		return 1;
+	}
+
+	sqlite3_busy_timeout(db, 5000);
+
+	string view = "";
+	for (size_t i = 0; i < shards.size(); i++) {
+		string schema = "shard" + to_string(i);
+		string attach = "ATTACH DATABASE 'file:" + shards[i] + "?mode=ro' AS " + schema + ";";
+		char *error = NULL;
+		if (sqlite3_exec(db, attach.c_str(), NULL, NULL, &error) != SQLITE_OK) {
+			cerr << "Could not attach " << shards[i] << ": " << error << "\n";
+			sqlite3_free(error);
+			sqlite3_close_v2(db);
+			return 1;
+		}
+
+		view += (i > 0) ? " UNION ALL " : "";
+		view += shard_select(db, schema, prefix, shard_name(shards[i]), ", ");
+	}
+
+	// views referencing attached DBs have to be temporary
+	view = "CREATE TEMP VIEW \"" + prefix + "_log_all\" AS " + view + ";";
+	char *error = NULL;
+	if (sqlite3_exec(db, view.c_str(), NULL, NULL, &error) != SQLITE_OK) {
+		cerr << "Could not create view: " << error << "\n";
+		sqlite3_free(error);
+		sqlite3_close_v2(db);
+		return 1;
+	}
+
+	sqlite3_stmt *stmt = NULL;
+	if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) != SQLITE_OK) {
+		cerr << "Could not prepare query: " << sqlite3_errmsg(db) << "\n";
+		sqlite3_close_v2(db);
+		return 1;
+	}
+
+	// tab separated output with a header line
+	int columns = sqlite3_column_count(stmt);
+	for (int i = 0; i < columns; i++) {
+		cout << (i > 0 ? "\t" : "") << sqlite3_column_name(stmt, i);
+	}
+	cout << "\n";
+
+	int status;
+	while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+		for (int i = 0; i < columns; i++) {
+			cout << (i > 0 ? "\t" : "") << column_text(stmt, i);
+		}
+		cout << "\n";
+	}
+	if (status != SQLITE_DONE) {
+		cerr << "Query failed: " << sqlite3_errmsg(db) << "\n";
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_close_v2(db);
+	return (status == SQLITE_DONE) ? 0 : 1;
+}
+
+// Single integer result of a query, `fallback` if there is no row or the value is NULL
+static int64_t query_int(sqlite3 *db, string sql, int64_t fallback) {
+	int64_t value = fallback;
+	sqlite3_stmt *stmt = NULL;
+	if ((sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) == SQLITE_OK) &&
+		(sqlite3_step(stmt) == SQLITE_ROW) && (sqlite3_column_type(stmt, 0) != SQLITE_NULL)) {
+		value = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return value;
+}
+
+// Copy the entries of one shard into the target, returns the number of merged entries or -1.
+// The ID of the last merged entry is kept per target in `<prefix>_merge` of the shard, a failed
+// or repeated run continues after it instead of merging the entries again.
+static long merge_shard(string path, string prefix, DBConnection *target, DimensionCache &cache, size_t batch_size, bool remove) {
+	sqlite3 *db = NULL;
+	if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+		cerr << "Could not open " << path << "\n";
+		sqlite3_close_v2(db);
+		return -1;
+	}
+	sqlite3_busy_timeout(db, 5000);
+
+	// only merge what is there now, writers may keep appending
+	string p = "\"" + prefix;
+	int64_t last_id = query_int(db, "SELECT max(id) FROM " + p + "_log\";", -1);
+	if (last_id < 0) {
+		sqlite3_close_v2(db);
+		return 0;
+	}
+
+	string sql = "CREATE TABLE IF NOT EXISTS " + p + "_merge\" (target TEXT PRIMARY KEY, last_id INTEGER NOT NULL, time INTEGER NOT NULL);";
+	char *error = NULL;
+	if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &error) != SQLITE_OK) {
+		cerr << "Could not create the watermark table in " << path << ": " << error << "\n";
+		sqlite3_free(error);
+		sqlite3_close_v2(db);
+		return -1;
+	}
+
+	string key = connection_key(target);
+	int64_t merged_id = query_int(db, "SELECT last_id FROM " + p + "_merge\" WHERE target = '" + key + "';", 0);
+
+	// ASCII unit separator, tags may contain commas. Every batch is a new read, the shard is not
+	// kept locked while the target is written.
+	string select = shard_select(db, "main", prefix, shard_name(path), "\x1f") + " WHERE l.id > ?1 AND l.id <= ?2 ORDER BY l.id LIMIT ?3;";
+	string update = "INSERT OR REPLACE INTO " + p + "_merge\" (target, last_id, time) VALUES (?1, ?2, strftime('%s', 'now'));";
+	sqlite3_stmt *read_stmt = NULL;
+	sqlite3_stmt *update_stmt = NULL;
+	if ((sqlite3_prepare_v2(db, select.c_str(), select.size(), &read_stmt, NULL) != SQLITE_OK) ||
+		(sqlite3_prepare_v2(db, update.c_str(), update.size(), &update_stmt, NULL) != SQLITE_OK)) {
+		cerr << "Could not read " << path << ": " << sqlite3_errmsg(db) << "\n";
+		sqlite3_finalize(read_stmt);
+		sqlite3_close_v2(db);
+		return -1;
+	}
+	sqlite3_stmt *attachment_stmt = shard_attachment_statement(db, "main", prefix);
+	bool has_attachments = (attachment_stmt != NULL);
+
+	long merged = 0;
+	bool failed = false;
+	vector<LogEntry> batch = vector<LogEntry>();
+	while (merged_id < last_id) {
+		sqlite3_bind_int64(read_stmt, 1, merged_id);
+		sqlite3_bind_int64(read_stmt, 2, last_id);
+		sqlite3_bind_int64(read_stmt, 3, batch_size);
+		int64_t batch_last_id = merged_id;
+		bool attachments_read = true;
+		int status;
+		while ((status = sqlite3_step(read_stmt)) == SQLITE_ROW) {
+			LogEntry entry;
+			shard_row_entry(read_stmt, entry);
+			batch_last_id = sqlite3_column_int64(read_stmt, 1);
+			if (has_attachments) {
+				attachments_read = attachments_read && shard_read_attachments(attachment_stmt, batch_last_id, entry);
+			}
+			batch.push_back(entry);
+		}
+		sqlite3_reset(read_stmt);
+		if ((status != SQLITE_DONE) || !attachments_read) {
+			cerr << "Could not read " << path << ": " << sqlite3_errmsg(db) << "\n";
+			failed = true;
+			break;
+		}
+		if (batch.size() == 0) {
+			break;
+		}
+
+		uint64_t dropped = stats.dropped.load();
+		log_db_batch(target, cache, batch.data(), batch.size());
+		if (!target->valid || (stats.dropped.load() != dropped)) {
+			failed = true;
+			break;
+		}
+
+		sqlite3_bind_text(update_stmt, 1, key.c_str(), key.size(), SQLITE_TRANSIENT);
+		sqlite3_bind_int64(update_stmt, 2, batch_last_id);
+		status = sqlite3_step(update_stmt);
+		sqlite3_reset(update_stmt);
+		if (status != SQLITE_DONE) {
+			cerr << "Could not update the watermark of " << path << ": " << sqlite3_errmsg(db) << "\n";
+			failed = true;
+			break;
+		}
+
+		merged += batch.size();
+		merged_id = batch_last_id;
+		batch.clear();
+	}
+	sqlite3_finalize(read_stmt);
+	sqlite3_finalize(update_stmt);
+	sqlite3_finalize(attachment_stmt);
+
+	if (failed) {
+		cerr << "Merging " << path << " failed after entry " << merged_id << ", run again to continue\n";
+		sqlite3_close_v2(db);
+		return -1;
+	}
+
+	if (remove) {
+		// the watermark goes with the entries, IDs of layout 2 shards start at 1 again once the table is empty
+		sql = "BEGIN; DELETE FROM " + p + "_log\" WHERE id <= " + to_string(last_id) + ";";
+		if (has_attachments) {
+			sql += "DELETE FROM " + p + "_attachment\" WHERE \"logID\" <= " + to_string(last_id) + ";";
+		}
+		sql += "DELETE FROM " + p + "_merge\" WHERE target = '" + key + "'; COMMIT; VACUUM;";
+		if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &error) != SQLITE_OK) {
+			cerr << "Could not remove merged entries from " << path << ": " << error << "\n";
+			sqlite3_free(error);
+			sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		}
+	}
+
+	sqlite3_close_v2(db);
+	return merged;
+}
+
+int main(int argc, char **argv) {
+	map<string, string> arguments;
+	if (!parse_arguments(argc, argv, arguments) || (arguments.count("dir") == 0) ||
+		((arguments.count("query") == 0) && (arguments.count("merge") == 0))) {
+		usage();
+		return 1;
+	}
+
+	string prefix = get_argument(arguments, "prefix", "logger");
+	vector<string> shards = list_shards(get_argument(arguments, "dir", ""));
+	if (shards.size() == 0) {
+		cerr << "No shards found in " << get_argument(arguments, "dir", "") << "\n";
+		return 1;
+	}
+
+	if (arguments.count("query") > 0) {
+		return query_shards(shards, prefix, get_argument(arguments, "query", ""));
+	}
+
+	DBConnection *target = connect_from_arguments(arguments, "target-", "shards");
+	if (!target->valid || (target->db_name == "undefined")) {
+		cerr << "Could not connect to the target DB\n";
+		delete target;
+		return 1;
+	}
+
+	DimensionCache cache;
+	size_t batch_size = get_int_argument(arguments, "batch", 1000);
+	bool remove = (arguments.count("delete") > 0);
+	int result = 0;
+	for (string shard : shards) {
+		long merged = merge_shard(shard, prefix, target, cache, (batch_size > 0) ? batch_size : 1000, remove);
+		if (merged < 0) {
+			result = 1;
+			break;
+		}
+		cerr << shard << ": merged " << merged << " entries\n";
+	}
+
+	delete target;
+	return result;
+}
@@ -0,0 +1,288 @@
+/*
+ * dblogger-ship: copies the entries of local SQLite log files into a central DB.
+ *
+ * The log table of a source file is read in `id` order starting after a watermark, the
+ * dimensions (logger, host, source, function, tags) are resolved to the IDs of the target
+ * through a cache and the entries are written in large batches. The watermark is stored in
+ * `<prefix>_ship` inside the source file itself, one row per target, so a file renamed by log
+ * rotation keeps its position: files matching --rotated are shipped before the live file and
+ * can be removed with --delete-rotated once they are complete.
+ *
+ * Attachments are copied with their entries. Entries are delivered at least once, a batch that
+ * was written but whose watermark could not be updated is sent again on the next pass.
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <glob.h>
+#include <signal.h>
+#include <sqlite3.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "db_logger.h"
+#include "shard.h"
+#include "stats.h"
+
+using std::cerr;
+using std::to_string;
+using std::vector;
+
+static volatile sig_atomic_t terminate_requested = 0;
+
+static void handle_signal(int signal) {
+	terminate_requested = 1;
+}
+
+static void usage(void) {
+	cerr << "Usage: dblogger-ship --source <file> --target-name <name> [options] [target options]\n\n"
+		"  --source <file>           Live SQLite log file\n"
+		"  --rotated <pattern>       Glob pattern of rotated log files, shipped before the live file\n"
+		"  --delete-rotated          Remove rotated files once all their entries are shipped and\n"
+		"                            they were not modified for a minute\n"
+		"  --prefix <prefix>         Table prefix of the source files (default: logger)\n"
+		"  --batch <count>           Entries per transaction (default: 5000)\n"
+		"  --interval <seconds>      Pause between passes (default: 5)\n"
+		"  --once                    Ship everything that is there now and exit\n\n"
+		<< connection_usage("target-");
+}
+
+static string file_name(string path) {
+	size_t slash = path.rfind('/');
+	return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+// Single integer result of a query, `fallback` if there is no row or the value is NULL
+static int64_t query_int(sqlite3 *db, string sql, int64_t fallback) {
+	int64_t value = fallback;
+	sqlite3_stmt *stmt = NULL;
+	if ((sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) == SQLITE_OK) &&
+		(sqlite3_step(stmt) == SQLITE_ROW) && (sqlite3_column_type(stmt, 0) != SQLITE_NULL)) {
+		value = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return value;
+}
+
+// Ship all entries of one file, returns the number of shipped entries or -1.
+// `complete` is set when the watermark reached the last entry of the file.
+static long ship_file(string path, string prefix, DBConnection *target, DimensionCache &cache, size_t batch_size, bool &complete) {
+	complete = false;
+
+	sqlite3 *db = NULL;
+	if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+		cerr << "Could not open " << path << "\n";
+		sqlite3_close_v2(db);
+		return -1;
+	}
+	sqlite3_busy_timeout(db, 5000);
+
+	// the logger has not created its tables yet
+	string p = "\"" + prefix;
+	if (query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = '" + prefix + "_log';", 0) == 0) {
+		sqlite3_close_v2(db);
+		complete = true;
+		return 0;
+	}
+
+	string sql = "CREATE TABLE IF NOT EXISTS " + p + "_ship\" (target TEXT PRIMARY KEY, last_id INTEGER NOT NULL, time INTEGER NOT NULL);";
+	char *error = NULL;
+	if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &error) != SQLITE_OK) {
+		cerr << "Could not create the watermark table in " << path << ": " << error << "\n";
+		sqlite3_free(error);
+		sqlite3_close_v2(db);
+		return -1;
+	}
+
+	string key = connection_key(target);
+	int64_t last_id = query_int(db, "SELECT last_id FROM " + p + "_ship\" WHERE target = '" + key + "';", 0);
+
+	string select = shard_select(db, "main", prefix, file_name(path), "\x1f") + " WHERE l.id > ?1 ORDER BY l.id LIMIT ?2;";
+	string update = "INSERT OR REPLACE INTO " + p + "_ship\" (target, last_id, time) VALUES (?1, ?2, strftime('%s', 'now'));";
+	sqlite3_stmt *read_stmt = NULL;
+	sqlite3_stmt *update_stmt = NULL;
+	if ((sqlite3_prepare_v2(db, select.c_str(), select.size(), &read_stmt, NULL) != SQLITE_OK) ||
+		(sqlite3_prepare_v2(db, update.c_str(), update.size(), &update_stmt, NULL) != SQLITE_OK)) {
+		cerr << "Could not read " << path << ": " << sqlite3_errmsg(db) << "\n";
+		sqlite3_finalize(read_stmt);
+		sqlite3_close_v2(db);
+		return -1;
+	}
+	sqlite3_stmt *attachment_stmt = shard_attachment_statement(db, "main", prefix);
+
+	long shipped = 0;
+	bool failed = false;
+	vector<LogEntry> batch = vector<LogEntry>();
+	while (!terminate_requested) {
+		// every batch is a new read, so the live file is not kept locked while the target is written
+		sqlite3_bind_int64(read_stmt, 1, last_id);
+		sqlite3_bind_int64(read_stmt, 2, batch_size);
+		int64_t batch_last_id = last_id;
+		int status;
+		bool attachments_read = true;
+		while ((status = sqlite3_step(read_stmt)) == SQLITE_ROW) {
+			LogEntry entry;
+			shard_row_entry(read_stmt, entry);
+			batch_last_id = sqlite3_column_int64(read_stmt, 1);
+			if (attachment_stmt != NULL) {
+				attachments_read = attachments_read && shard_read_attachments(attachment_stmt, batch_last_id, entry);
+			}
+			batch.push_back(entry);
+		}
+		sqlite3_reset(read_stmt);
+		if ((status != SQLITE_DONE) || !attachments_read) {
+			cerr << "Could not read " << path << ": " << sqlite3_errmsg(db) << "\n";
+			failed = true;
+			break;
+		}
+		if (batch.size() == 0) {
+			complete = true;
+			break;
+		}
+
+		uint64_t dropped = stats.dropped.load();
+		log_db_batch(target, cache, batch.data(), batch.size());
+		if (!target->valid || (stats.dropped.load() != dropped)) {
+			cerr << "Shipping " << path << " failed after entry " << last_id << "\n";
+			failed = true;
+			break;
+		}
+
+		sqlite3_bind_text(update_stmt, 1, key.c_str(), key.size(), SQLITE_TRANSIENT);
+		sqlite3_bind_int64(update_stmt, 2, batch_last_id);
+		status = sqlite3_step(update_stmt);
+		sqlite3_reset(update_stmt);
+		if (status != SQLITE_DONE) {
+			cerr << "Could not update the watermark of " << path << ": " << sqlite3_errmsg(db) << "\n";
+			failed = true;
+			break;
+		}
+
+		shipped += batch.size();
+		last_id = batch_last_id;
+		if (batch.size() < batch_size) {
+			complete = true;
+			break;
+		}
+		batch.clear();
+	}
+
+	sqlite3_finalize(read_stmt);
+	sqlite3_finalize(update_stmt);
+	sqlite3_finalize(attachment_stmt);
+	sqlite3_close_v2(db);
+	return failed ? -1 : shipped;
+}
+
+// True if neither the file nor its WAL was modified in the last `seconds`
+static bool idle(string path, int seconds) {
+	time_t now = time(NULL);
+	string files[] = { path, path + "-wal" };
+	for (string file : files) {
+		struct stat info;
+		if ((stat(file.c_str(), &info) == 0) && (info.st_mtime > now - seconds)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool ends_with(string value, string suffix) {
+	return (value.size() >= suffix.size()) && (value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+// Rotated files matching the pattern in name order, the live file and the WAL, shared memory
+// and journal files of SQLite are never included
+static vector<string> rotated_files(string pattern, string source) {
+	vector<string> files = vector<string>();
+	if (pattern.empty()) {
+		return files;
+	}
+
+	glob_t matches;
+	if (glob(pattern.c_str(), 0, NULL, &matches) == 0) {
+		for (size_t i = 0; i < matches.gl_pathc; i++) {
+			string path = matches.gl_pathv[i];
+			if ((path != source) && !ends_with(path, "-wal") && !ends_with(path, "-shm") && !ends_with(path, "-journal")) {
+				files.push_back(path);
+			}
+		}
+	}
+	globfree(&matches);
+	return files;
+}
+
+int main(int argc, char **argv) {
+	map<string, string> arguments;
+	if (!parse_arguments(argc, argv, arguments) || (arguments.count("source") == 0)) {
+		usage();
+		return 1;
+	}
+
+	string source = get_argument(arguments, "source", "");
+	string rotated = get_argument(arguments, "rotated", "");
+	string prefix = get_argument(arguments, "prefix", "logger");
+	bool delete_rotated = (arguments.count("delete-rotated") > 0);
+	bool once = (arguments.count("once") > 0);
+	int batch_size = get_int_argument(arguments, "batch", 5000);
+	int interval = get_int_argument(arguments, "interval", 5);
+
+	DBConnection *target = connect_from_arguments(arguments, "target-", "ship");
+	if (!target->valid || (target->db_name == "undefined")) {
+		cerr << "Could not connect to the target DB\n";
+		delete target;
+		return 1;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	DimensionCache cache;
+	int result = 0;
+	while (!terminate_requested) {
+		if (!target->valid) {
+			// the cached IDs may belong to a different DB after a failover
+			delete target;
+			target = connect_from_arguments(arguments, "target-", "ship");
+			cache.clear();
+			stats_add(stats.reconnects);
+		}
+
+		bool failed = !target->valid;
+		vector<string> files = rotated_files(rotated, source);
+		files.push_back(source);
+		for (size_t i = 0; (i < files.size()) && !failed && !terminate_requested; i++) {
+			bool complete = false;
+			long shipped = ship_file(files[i], prefix, target, cache, (batch_size > 0) ? batch_size : 5000, complete);
+			if (shipped < 0) {
+				failed = true;
+				break;
+			}
+			if (shipped > 0) {
+				cerr << files[i] << ": shipped " << shipped << " entries\n";
+			}
+
+			// the live file is last, a rotated file may still be written until its logger rotates
+			if (complete && delete_rotated && (i + 1 < files.size()) && idle(files[i], 60)) {
+				if (unlink(files[i].c_str()) == 0) {
+					cerr << files[i] << ": removed\n";
+				}
+			}
+		}
+
+		if (once) {
+			result = failed ? 1 : 0;
+			break;
+		}
+		// interrupted by the signal handlers
+		sleep((interval > 0) ? interval : 1);
+	}
+
+	delete target;
+	return result;
+}
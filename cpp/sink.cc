@@ -0,0 +1,128 @@
+#include <vector>
+#include "sink.h"
+#include "stats.h"
+
+using std::vector;
+using std::unique_lock;
+using std::lock_guard;
+using std::mutex;
+
+Sink::Sink(int level, set<string> tags, size_t queue_size, size_t batch_size) :
+	level(level), tags(tags), queue_size(queue_size), batch_size(batch_size) {
+
+	dropped = 0;
+	busy = false;
+	stopping = false;
+
+	if (queue_size > 0) {
+		worker = std::thread(&Sink::run, this);
+	}
+}
+
+Sink::~Sink() {
+	stop();
+}
+
+bool
+Sink::accepts(int level, const TagSet &tags) const {
+	if (level < this->level) {
+		return false;
+	}
+	if (this->tags.empty()) {
+		return true;
+	}
+
+	// at least one of the tags of the sink has to be set on the entry
+	for (const string &tag : this->tags) {
+		if (tags.contains(tag)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+Sink::submit(const LogEntry &entry) {
+	if (!accepts(entry)) {
+		return;
+	}
+
+	if (queue_size == 0) {
+		lock_guard<mutex> lock(write_mutex);
+		write(&entry, 1);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		if (queue.size() >= queue_size) {
+			dropped++;
+			stats_add(stats.dropped);
+			return;
+		}
+		queue.push_back(entry);
+	}
+	queue_changed.notify_all();
+}
+
+void
+Sink::flush() {
+	if (queue_size > 0) {
+		unique_lock<mutex> lock(queue_mutex);
+		queue_changed.wait(lock, [this]{ return (queue.empty() && !busy) || stopping; });
+	}
+
+	lock_guard<mutex> lock(write_mutex);
+	write_pending();
+}
+
+void
+Sink::rotate() {
+	lock_guard<mutex> lock(write_mutex);
+	reopen();
+}
+
+void
+Sink::stop() {
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		if (stopping) {
+			return;
+		}
+		stopping = true;
+	}
+	queue_changed.notify_all();
+
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+void
+Sink::run() {
+	vector<LogEntry> batch = vector<LogEntry>();
+
+	while (true) {
+		{
+			unique_lock<mutex> lock(queue_mutex);
+			busy = false;
+			queue_changed.notify_all();
+			queue_changed.wait(lock, [this]{ return !queue.empty() || stopping; });
+
+			// write all remaining entries before stopping
+			if (queue.empty() && stopping) {
+				return;
+			}
+
+			batch.clear();
+			while (!queue.empty() && (batch.size() < batch_size)) {
+				batch.push_back(std::move(queue.front()));
+				queue.pop_front();
+			}
+			busy = true;
+		}
+
+		lock_guard<mutex> lock(write_mutex);
+		write(batch.data(), batch.size());
+	}
+}
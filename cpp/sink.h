@@ -0,0 +1,69 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "log_entry.h"
+
+using std::set;
+using std::string;
+
+// A log destination.
+//
+// Every sink filters entries by level and tags. With a queue size of 0 entries are written
+// synchronously on the calling thread, otherwise they are put into a bounded queue that is
+// drained by a worker thread of the sink, so a slow sink never stalls the others.
+// If the queue is full new entries are dropped and counted. The worker hands at most
+// `batch_size` entries to `write()` at once.
+//
+// Subclasses have to call `stop()` in their destructor before their members go away.
+class Sink {
+	public:
+		Sink(int level, set<string> tags, size_t queue_size, size_t batch_size = 256);
+		virtual ~Sink();
+
+		bool accepts(int level, const TagSet &tags) const;
+		bool accepts(const LogEntry &entry) const { return accepts(entry.level, *entry.tags); }
+		void submit(const LogEntry &entry);
+
+		// wait until all queued entries have been written
+		void flush();
+
+		// re-open files or connections, called on log rotation
+		void rotate();
+
+		const int level;
+		const set<string> tags;
+		const size_t queue_size;
+		const size_t batch_size;
+		std::atomic<uint64_t> dropped;
+
+	protected:
+		// write a batch of entries, called with the write lock held
+		virtual void write(const LogEntry *entries, size_t count) = 0;
+		virtual void reopen() {}
+		// write data held back by the sink (e.g. aggregated counters), called by flush() with the write lock held
+		virtual void write_pending() {}
+
+		void stop();
+
+		std::mutex write_mutex;
+
+	private:
+		void run();
+
+		std::mutex queue_mutex;
+		std::condition_variable queue_changed;
+		std::deque<LogEntry> queue;
+		bool busy;
+		bool stopping;
+		std::thread worker;
+};
+
+#endif // SINK_H
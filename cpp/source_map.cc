@@ -0,0 +1,501 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include "source_map.h"
+
+using std::ifstream;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::stringstream;
+
+/*
+ * Minimal JSON reader, only what a source map needs: strings, arrays of strings and
+ * skipping everything else (`sourcesContent` may be large).
+ */
+
+class JSONReader {
+	public:
+		JSONReader(const string &json) : json(json), offset(0) {}
+
+		bool object_start() { return consume('{'); }
+		bool object_end() { return consume('}'); }
+		bool array_start() { return consume('['); }
+		bool array_end() { return consume(']'); }
+		bool comma() { return consume(','); }
+		bool colon() { return consume(':'); }
+
+		bool null() {
+			skip_whitespace();
+			if (json.compare(offset, 4, "null") == 0) {
+				offset += 4;
+				return true;
+			}
+			return false;
+		}
+
+		bool string_value(string &value) {
+			if (!consume('"')) {
+				return false;
+			}
+			value.clear();
+			while (offset < json.size()) {
+				char c = json[offset++];
+				if (c == '"') {
+					return true;
+				}
+				if (c != '\\') {
+					value += c;
+					continue;
+				}
+				if (offset >= json.size()) {
+					return false;
+				}
+				c = json[offset++];
+				switch (c) {
+					case 'n': value += '\n'; break;
+					case 'r': value += '\r'; break;
+					case 't': value += '\t'; break;
+					case 'b': value += '\b'; break;
+					case 'f': value += '\f'; break;
+					case 'u': {
+						uint32_t code = 0;
+						if (!hex4(code)) {
+							return false;
+						}
+						// surrogate pair
+						if ((code >= 0xd800) && (code < 0xdc00) && (json.compare(offset, 2, "\\u") == 0)) {
+							uint32_t low = 0;
+							offset += 2;
+							if (!hex4(low)) {
+								return false;
+							}
+							code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+						}
+						append_utf8(value, code);
+						break;
+					}
+					default: value += c; break;
+				}
+			}
+			return false;
+		}
+
+		bool skip_value() {
+			skip_whitespace();
+			if (offset >= json.size()) {
+				return false;
+			}
+			char c = json[offset];
+			if (c == '"') {
+				string ignored;
+				return string_value(ignored);
+			}
+			if ((c == '{') || (c == '[')) {
+				char close = (c == '{') ? '}' : ']';
+				offset++;
+				if (consume(close)) {
+					return true;
+				}
+				do {
+					if (c == '{') {
+						string key;
+						if (!string_value(key) || !colon()) {
+							return false;
+						}
+					}
+					if (!skip_value()) {
+						return false;
+					}
+				} while (comma());
+				return consume(close);
+			}
+
+			// number, true, false, null
+			size_t start = offset;
+			while ((offset < json.size()) && (strchr(",}] \t\r\n", json[offset]) == NULL)) {
+				offset++;
+			}
+			return offset > start;
+		}
+
+	private:
+		const string &json;
+		size_t offset;
+
+		void skip_whitespace() {
+			while ((offset < json.size()) && ((json[offset] == ' ') || (json[offset] == '\t') || (json[offset] == '\r') || (json[offset] == '\n'))) {
+				offset++;
+			}
+		}
+
+		bool consume(char c) {
+			skip_whitespace();
+			if ((offset < json.size()) && (json[offset] == c)) {
+				offset++;
+				return true;
+			}
+			return false;
+		}
+
+		bool hex4(uint32_t &code) {
+			if (offset + 4 > json.size()) {
+				return false;
+			}
+			for (int i = 0; i < 4; i++) {
+				char c = json[offset++];
+				code <<= 4;
+				if ((c >= '0') && (c <= '9')) {
+					code |= c - '0';
+				} else if ((c >= 'a') && (c <= 'f')) {
+					code |= c - 'a' + 10;
+				} else if ((c >= 'A') && (c <= 'F')) {
+					code |= c - 'A' + 10;
+				} else {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		static void append_utf8(string &out, uint32_t code) {
+			if (code < 0x80) {
+				out += (char)code;
+			} else if (code < 0x800) {
+				out += (char)(0xc0 | (code >> 6));
+				out += (char)(0x80 | (code & 0x3f));
+			} else if (code < 0x10000) {
+				out += (char)(0xe0 | (code >> 12));
+				out += (char)(0x80 | ((code >> 6) & 0x3f));
+				out += (char)(0x80 | (code & 0x3f));
+			} else {
+				out += (char)(0xf0 | (code >> 18));
+				out += (char)(0x80 | ((code >> 12) & 0x3f));
+				out += (char)(0x80 | ((code >> 6) & 0x3f));
+				out += (char)(0x80 | (code & 0x3f));
+			}
+		}
+};
+
+/*
+ * Path helpers
+ */
+
+static string directory_of(const string &path) {
+	size_t slash = path.rfind('/');
+	return (slash == string::npos) ? "." : path.substr(0, slash);
+}
+
+// URLs other than file:// can not be resolved to a path
+static bool is_url(const string &path) {
+	size_t colon = path.find("://");
+	return (colon != string::npos) && (path.compare(0, 7, "file://") != 0);
+}
+
+// Join and normalize a path, `.` and `..` segments are removed
+static string join_path(const string &directory, string path) {
+	if (path.compare(0, 7, "file://") == 0) {
+		path = path.substr(7);
+	}
+
+	// webpack://<namespace>/./src/file.ts, the path after the namespace is relative to the project
+	string joined;
+	if (path.compare(0, 10, "webpack://") == 0) {
+		size_t slash = path.find('/', 10);
+		joined = (slash == string::npos) ? path.substr(10) : path.substr(slash + 1);
+	} else if (is_url(path)) {
+		return path;
+	} else {
+		joined = ((path.size() > 0) && (path[0] == '/')) ? path : directory + "/" + path;
+	}
+
+	vector<string> segments = vector<string>();
+	stringstream stream(joined);
+	string segment;
+	while (std::getline(stream, segment, '/')) {
+		if (segment.empty() || (segment == ".")) {
+			continue;
+		}
+		if (segment == "..") {
+			if (segments.size() > 0) {
+				segments.pop_back();
+			}
+			continue;
+		}
+		segments.push_back(segment);
+	}
+
+	bool absolute = (joined.size() > 0) && (joined[0] == '/');
+	string result = "";
+	for (const string &part : segments) {
+		result += ((result.size() > 0) || absolute) ? "/" + part : part;
+	}
+	return result.empty() ? (absolute ? "/" : ".") : result;
+}
+
+static bool read_file(const string &path, string &content) {
+	ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	stringstream buffer;
+	buffer << file.rdbuf();
+	content = buffer.str();
+	return true;
+}
+
+static string base64_decode(const string &input) {
+	string output;
+	uint32_t buffer = 0;
+	int bits = 0;
+	for (char c : input) {
+		int value;
+		if ((c >= 'A') && (c <= 'Z')) value = c - 'A';
+		else if ((c >= 'a') && (c <= 'z')) value = c - 'a' + 26;
+		else if ((c >= '0') && (c <= '9')) value = c - '0' + 52;
+		else if ((c == '+') || (c == '-')) value = 62;
+		else if ((c == '/') || (c == '_')) value = 63;
+		else continue;
+
+		buffer = (buffer << 6) | value;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			output += (char)((buffer >> bits) & 0xff);
+		}
+	}
+	return output;
+}
+
+/*
+ * SourceMap
+ */
+
+shared_ptr<SourceMap>
+SourceMap::load(const string &script_name) {
+	// ES modules are named by their file:// URL
+	string script_path = (script_name.compare(0, 7, "file://") == 0) ? script_name.substr(7) : script_name;
+	string script;
+	if ((script_path.empty()) || (script_path[0] != '/') || !read_file(script_path, script)) {
+		return NULL;
+	}
+
+	// the last sourceMappingURL comment wins
+	size_t comment = script.rfind("sourceMappingURL=");
+	if ((comment != string::npos) && (comment >= 4) && ((script.compare(comment - 4, 4, "//# ") == 0) || (script.compare(comment - 4, 4, "//@ ") == 0))) {
+		size_t start = comment + 17;
+		size_t end = script.find_first_of(" \t\r\n*", start);
+		string url = script.substr(start, (end == string::npos) ? string::npos : end - start);
+
+		if (url.compare(0, 5, "data:") == 0) {
+			size_t data = url.find(";base64,");
+			if (data == string::npos) {
+				return NULL;
+			}
+			return parse(base64_decode(url.substr(data + 8)), directory_of(script_path));
+		}
+
+		string map_path = join_path(directory_of(script_path), url);
+		string json;
+		if (!is_url(map_path) && read_file(map_path, json)) {
+			return parse(json, directory_of(map_path));
+		}
+		return NULL;
+	}
+
+	string json;
+	if (read_file(script_path + ".map", json)) {
+		return parse(json, directory_of(script_path));
+	}
+	return NULL;
+}
+
+shared_ptr<SourceMap>
+SourceMap::parse(const string &json, const string &directory) {
+	JSONReader reader(json);
+	string source_root = "";
+	string mappings = "";
+	vector<string> raw_sources = vector<string>();
+	bool has_mappings = false;
+
+	if (!reader.object_start()) {
+		return NULL;
+	}
+	if (!reader.object_end()) {
+		do {
+			string key;
+			if (!reader.string_value(key) || !reader.colon()) {
+				return NULL;
+			}
+
+			if (key == "sourceRoot") {
+				if (!reader.null() && !reader.string_value(source_root)) {
+					return NULL;
+				}
+			} else if (key == "mappings") {
+				if (!reader.string_value(mappings)) {
+					return NULL;
+				}
+				has_mappings = true;
+			} else if (key == "sources") {
+				if (!reader.array_start()) {
+					return NULL;
+				}
+				if (!reader.array_end()) {
+					do {
+						string source;
+						if (!reader.null() && !reader.string_value(source)) {
+							return NULL;
+						}
+						raw_sources.push_back(source);
+					} while (reader.comma());
+					if (!reader.array_end()) {
+						return NULL;
+					}
+				}
+			} else if (key == "sections") {
+				// index maps are not supported
+				return NULL;
+			} else if (!reader.skip_value()) {
+				return NULL;
+			}
+		} while (reader.comma());
+		if (!reader.object_end()) {
+			return NULL;
+		}
+	}
+	if (!has_mappings) {
+		return NULL;
+	}
+
+	auto map = make_shared<SourceMap>();
+
+	string root = source_root.empty() ? directory : join_path(directory, source_root);
+	for (const string &source : raw_sources) {
+		map->sources.push_back(join_path(root, source));
+	}
+
+	// decode the base64 VLQ mappings, all fields but the generated column are relative to
+	// the previous segment over all lines
+	int32_t fields[4] = { 0, 0, 0, 0 };
+	map->lines.push_back(vector<Segment>());
+	int32_t segment[5];
+	int count = 0;
+	int32_t value = 0;
+	int shift = 0;
+	for (size_t i = 0; i <= mappings.size(); i++) {
+		char c = (i < mappings.size()) ? mappings[i] : ';';
+		if ((c == ',') || (c == ';')) {
+			// segments with one field have no source position, the name index is not used
+			if (count >= 4) {
+				for (int f = 0; f < 4; f++) {
+					fields[f] += segment[f];
+				}
+				if ((fields[1] >= 0) && (fields[1] < (int32_t)map->sources.size())) {
+					map->lines.back().push_back({ fields[0], fields[1], fields[2], fields[3] });
+				}
+			} else if (count == 1) {
+				fields[0] += segment[0];
+			}
+			count = 0;
+
+			if (c == ';') {
+				std::sort(map->lines.back().begin(), map->lines.back().end(), [](const Segment &a, const Segment &b) {
+					return a.generated_column < b.generated_column;
+				});
+				if (i < mappings.size()) {
+					map->lines.push_back(vector<Segment>());
+				}
+				fields[0] = 0;
+			}
+			continue;
+		}
+
+		const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		const char *digit = strchr(alphabet, c);
+		if ((digit == NULL) || (c == '\0')) {
+			return NULL;
+		}
+		int32_t bits = digit - alphabet;
+		value += (bits & 31) << shift;
+		if (bits & 32) {
+			shift += 5;
+			continue;
+		}
+
+		// lowest bit is the sign
+		if (count < 5) {
+			segment[count++] = (value & 1) ? -(value >> 1) : (value >> 1);
+		}
+		value = 0;
+		shift = 0;
+	}
+
+	return map;
+}
+
+bool
+SourceMap::lookup(int line, int column, SourcePosition &position) const {
+	if ((line < 1) || (line > (int)lines.size())) {
+		return false;
+	}
+
+	// last segment starting at or before the column
+	const vector<Segment> &segments = lines[line - 1];
+	auto after = std::upper_bound(segments.begin(), segments.end(), column - 1, [](int32_t value, const Segment &segment) {
+		return value < segment.generated_column;
+	});
+	if (after == segments.begin()) {
+		return false;
+	}
+	const Segment &segment = *(after - 1);
+
+	position.source = sources[segment.source];
+	position.line = segment.line + 1;
+	position.column = segment.column + 1;
+	return true;
+}
+
+/*
+ * SourceMapCache
+ */
+
+static mutex cache_mutex;
+static map< string, shared_ptr<SourceMap> > maps;
+static map< tuple<string, int, int>, SourcePosition > call_sites;
+
+bool
+SourceMapCache::resolve(const string &script_path, int line, int column, SourcePosition &position) {
+	lock_guard<mutex> lock(cache_mutex);
+
+	auto key = tuple<string, int, int>(script_path, line, column);
+	auto site = call_sites.find(key);
+	if (site != call_sites.end()) {
+		position = site->second;
+		return !position.source.empty();
+	}
+
+	auto search = maps.find(script_path);
+	if (search == maps.end()) {
+		// scripts without a map are cached as NULL
+		search = maps.insert(std::make_pair(script_path, SourceMap::load(script_path))).first;
+	}
+
+	SourcePosition resolved = { "", 0, 0 };
+	if (search->second) {
+		search->second->lookup(line, column, resolved);
+	}
+	call_sites[key] = resolved;
+
+	position = resolved;
+	return !resolved.source.empty();
+}
+
+void
+SourceMapCache::clear() {
+	lock_guard<mutex> lock(cache_mutex);
+	maps.clear();
+	call_sites.clear();
+}
@@ -0,0 +1,64 @@
+#ifndef SOURCE_MAP_H
+#define SOURCE_MAP_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <stdint.h>
+
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::tuple;
+using std::vector;
+
+// Original position of a generated position, `source` is an absolute path, a path relative
+// to the project for `webpack://` sources or an URL that can not be resolved to a file
+struct SourcePosition {
+	string source;
+	int line;   // 1 based
+	int column; // 1 based
+};
+
+// Version 3 source map (https://sourcemaps.info/spec.html), the mappings are decoded once
+// into sorted segments per generated line. Index maps (`sections`) are not supported.
+class SourceMap {
+	public:
+		// Load the map of a script: the `sourceMappingURL` comment at the end of the script
+		// (a file next to it or an inline base64 data URL) or `<script>.map`. Returns NULL
+		// if the script has no readable map.
+		static shared_ptr<SourceMap> load(const string &script_name);
+
+		// Parse the JSON of a map, relative sources are resolved against `directory`
+		static shared_ptr<SourceMap> parse(const string &json, const string &directory);
+
+		// Original position of a 1 based generated line and column
+		bool lookup(int line, int column, SourcePosition &position) const;
+
+	private:
+		struct Segment {
+			int32_t generated_column;
+			int32_t source;
+			int32_t line;
+			int32_t column;
+		};
+
+		vector<string> sources;
+		vector< vector<Segment> > lines;
+};
+
+// Process wide cache of resolved call sites, keyed by (script, line, column). Every script
+// is read and parsed once, scripts without a map are remembered as well.
+class SourceMapCache {
+	public:
+		// Original position of a call site, false if the script has no map or the position is
+		// not mapped. Thread safe.
+		static bool resolve(const string &script_path, int line, int column, SourcePosition &position);
+
+		// Forget all maps and call sites, e.g. after a deployment replaced the scripts
+		static void clear();
+};
+
+#endif // SOURCE_MAP_H
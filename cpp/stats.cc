@@ -0,0 +1,138 @@
+#include "stats.h"
+
+Stats stats;
+
+static inline int highest_bit(uint64_t value) {
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(value);
+#else
+	int bit = 0;
+	while (value >>= 1) {
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+/*
+ * Histogram
+ */
+
+Histogram::Histogram() {
+	reset();
+}
+
+int
+Histogram::index_for(uint64_t value) {
+	if (value < (uint64_t)sub_bucket_count) {
+		return (int)value;
+	}
+	int shift = highest_bit(value) - sub_bucket_bits;
+	return ((shift + 1) << sub_bucket_bits) + (int)((value >> shift) & (sub_bucket_count - 1));
+}
+
+uint64_t
+Histogram::value_for(int index) {
+	if (index < sub_bucket_count) {
+		return index;
+	}
+	int shift = (index >> sub_bucket_bits) - 1;
+	uint64_t sub_bucket = index & (sub_bucket_count - 1);
+
+	// report the middle of the bucket
+	uint64_t lower = (sub_bucket_count + sub_bucket) << shift;
+	return lower + (((uint64_t)1 << shift) >> 1);
+}
+
+void
+Histogram::record(uint64_t value) {
+	buckets[index_for(value)].fetch_add(1, std::memory_order_relaxed);
+	total_count.fetch_add(1, std::memory_order_relaxed);
+	total_sum.fetch_add(value, std::memory_order_relaxed);
+
+	uint64_t current = max_value.load(std::memory_order_relaxed);
+	while ((value > current) && !max_value.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+		// current has been reloaded, try again
+	}
+}
+
+void
+Histogram::reset() {
+	for (int i = 0; i < bucket_count; i++) {
+		buckets[i].store(0, std::memory_order_relaxed);
+	}
+	total_count.store(0, std::memory_order_relaxed);
+	total_sum.store(0, std::memory_order_relaxed);
+	max_value.store(0, std::memory_order_relaxed);
+}
+
+uint64_t
+Histogram::count() const {
+	return total_count.load(std::memory_order_relaxed);
+}
+
+uint64_t
+Histogram::sum() const {
+	return total_sum.load(std::memory_order_relaxed);
+}
+
+uint64_t
+Histogram::max() const {
+	return max_value.load(std::memory_order_relaxed);
+}
+
+uint64_t
+Histogram::percentile(double percent) const {
+	uint64_t total = count();
+	if (total == 0) {
+		return 0;
+	}
+
+	uint64_t target = (uint64_t)((percent / 100.0) * total + 0.5);
+	if (target < 1) {
+		target = 1;
+	}
+
+	uint64_t seen = 0;
+	for (int i = 0; i < bucket_count; i++) {
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if (seen >= target) {
+			uint64_t value = value_for(i);
+			return (value < max()) ? value : max();
+		}
+	}
+	return max();
+}
+
+/*
+ * Stats
+ */
+
+Stats::Stats() {
+	reset();
+}
+
+void
+Stats::reset() {
+	for (int i = 0; i < 7; i++) {
+		entries[i].store(0, std::memory_order_relaxed);
+	}
+
+	atomic<uint64_t> *counters[] = {
+		&filtered, &dropped,
+		&db_statements, &db_errors, &reconnects, &rotations,
+		&tag_cache_hits, &tag_cache_misses, &dimension_cache_hits, &dimension_cache_misses,
+		&bytes_stdout, &bytes_db, &bytes_file, &bytes_collector
+	};
+	for (auto counter : counters) {
+		counter->store(0, std::memory_order_relaxed);
+	}
+
+	Histogram *histograms[] = {
+		&log_time, &stack_time, &serialize_time, &stdout_time,
+		&db_time, &db_execute_time, &db_query_time, &db_insert_time
+	};
+	for (auto histogram : histograms) {
+		histogram->reset();
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+using std::atomic;
+
+// Log-linear latency histogram (HDR style): every power of two is split into
+// 8 linear sub-buckets, so recorded values have a relative error of at most 12.5%.
+// Recording is a single relaxed atomic increment, values are nanoseconds.
+class Histogram {
+	public:
+		Histogram();
+		void record(uint64_t value);
+		void reset();
+
+		uint64_t count() const;
+		uint64_t sum() const;
+		uint64_t max() const;
+		uint64_t percentile(double percent) const;
+
+	private:
+		static const int sub_bucket_bits = 3;
+		static const int sub_bucket_count = 1 << sub_bucket_bits;
+		static const int bucket_count = (64 - sub_bucket_bits + 1) << sub_bucket_bits;
+
+		static int index_for(uint64_t value);
+		static uint64_t value_for(int index);
+
+		atomic<uint64_t> buckets[bucket_count];
+		atomic<uint64_t> total_count;
+		atomic<uint64_t> total_sum;
+		atomic<uint64_t> max_value;
+};
+
+// Process wide logger statistics, all members are updated lock free
+struct Stats {
+	Stats();
+	void reset();
+
+	// log entries by level / 10 (index 0 is used for non standard levels)
+	atomic<uint64_t> entries[7];
+	atomic<uint64_t> filtered;
+	atomic<uint64_t> dropped;
+
+	atomic<uint64_t> db_statements;
+	atomic<uint64_t> db_errors;
+	atomic<uint64_t> reconnects;
+	atomic<uint64_t> rotations;
+
+	atomic<uint64_t> tag_cache_hits;
+	atomic<uint64_t> tag_cache_misses;
+	atomic<uint64_t> dimension_cache_hits;
+	atomic<uint64_t> dimension_cache_misses;
+
+	atomic<uint64_t> bytes_stdout;
+	atomic<uint64_t> bytes_db;
+	atomic<uint64_t> bytes_file;
+	atomic<uint64_t> bytes_collector;
+
+	Histogram log_time;
+	Histogram stack_time;
+	Histogram serialize_time;
+	Histogram stdout_time;
+	Histogram db_time;
+	Histogram db_execute_time;
+	Histogram db_query_time;
+	Histogram db_insert_time;
+};
+
+extern Stats stats;
+
+static inline void stats_add(atomic<uint64_t> &counter, uint64_t value = 1) {
+	counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+static inline uint64_t stats_now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+}
+
+// Records the lifetime of the timer object into a histogram
+class StatsTimer {
+	public:
+		explicit StatsTimer(Histogram &histogram) : histogram(histogram), start(stats_now()) {}
+		~StatsTimer() { histogram.record(stats_now() - start); }
+
+	private:
+		Histogram &histogram;
+		const uint64_t start;
+};
+
+#endif // STATS_H
@@ -1,44 +1,80 @@
 #include <iostream>
 #include "stdout_logger.h"
+#include "file_logger.h"
+#include "probes.h"
+#include "stats.h"
 
 using std::cout;
 using std::cerr;
+using std::to_string;
 static locale_t locale = newlocale(LC_ALL_MASK, "C", NULL);
 
-void log_stdout(int level, time_t date, string hostname, int pid, string filename, string function, int line, int column, vector<string>parts, set<string>tags) {
-	const struct tm *tstruct = localtime(&date);
-	char c_date[256]; strftime_l(c_date, 256, "%Y-%m-%dT%H:%M:%S", tstruct, locale);
-	string date_string = string(c_date);
-
-	if (level >= 50) {
-		cerr << date_string << " ";
-		cerr << filename << "@";
-		cerr << function << ":";
-		cerr << line << ":";
-		cerr << column;
-		for (string tag: tags) {
-			cerr << " [" << tag << "]";
-		}
-		cerr << ": ";
-		for (string item: parts) {
-			cerr << item << " ";
-		}
-		cerr << "\n";
+// assemble the line to emit it with one write
+static string format_text(const LogEntry &entry) {
+	struct tm tstruct; localtime_r(&entry.date, &tstruct);
+	char c_date[256]; strftime_l(c_date, 256, "%Y-%m-%dT%H:%M:%S", &tstruct, locale);
+
+	string output = string(c_date) + " ";
+	output += entry.filename + "@";
+	output += entry.function + ":";
+	output += to_string(entry.line) + ":";
+	output += to_string(entry.column);
+	for (const string &tag: entry.tags->names) {
+		output += " [" + tag + "]";
+	}
+	output += ": ";
+	for (const string &item: entry.parts) {
+		output += item + " ";
+	}
+	if (entry.fields.size() > 0) {
+		output += entry.fields + " ";
+	}
+	if (entry.context.size() > 0) {
+		output += entry.context + " ";
+	}
+	output += "\n";
+	return output;
+}
+
+size_t log_stdout(const LogEntry &entry, bool json) {
+	string output;
+	if (json) {
+		// same object as the file sink writes, escaped so embedded newlines do not split the line
+		format_ndjson(output, entry);
 	} else {
-		cout << date_string << " ";
-		cout << filename << "@";
-		cout << function << ":";
-		cout << line << ":";
-		cout << column;
-		for (string tag: tags) {
-			cout << " [" << tag << "]";
-		}
-		cout << ": ";
-		for (string item: parts) {
-			cout << item << " ";
-		}
-		cout << "\n";
+		output = format_text(entry);
+	}
 
+	if (entry.level >= 50) {
+		cerr << output;
+	} else {
+		cout << output;
 		cout.flush();
 	}
+
+	return output.size();
+}
+
+/*
+ * Sink
+ */
+
+StdoutSink::StdoutSink(int level, size_t queue_size, bool json) : Sink(level, set<string>(), queue_size), json(json) {}
+
+StdoutSink::~StdoutSink() {
+	stop();
+}
+
+void
+StdoutSink::write(const LogEntry *entries, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		DBLOGGER_PROBE1(stdout__start, entries[i].level);
+		size_t bytes;
+		{
+			StatsTimer timer(stats.stdout_time);
+			bytes = log_stdout(entries[i], json);
+		}
+		stats_add(stats.bytes_stdout, bytes);
+		DBLOGGER_PROBE2(stdout__done, entries[i].level, bytes);
+	}
 }
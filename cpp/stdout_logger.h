@@ -5,10 +5,26 @@
 #include <set>
 #include <vector>
 
+#include "log_entry.h"
+#include "sink.h"
+
 using std::set;
 using std::string;
 using std::vector;
 
-void log_stdout(int level, time_t date, string hostname, int pid, string filename, string function, int line, int column, vector<string>parts, set<string>tags);
+// write one entry as a human readable line or, with `json`, as one NDJSON object
+size_t log_stdout(const LogEntry &entry, bool json = false);
+
+// Writes log lines to stdout, or to stderr for level >= 50
+class StdoutSink : public Sink {
+	public:
+		StdoutSink(int level, size_t queue_size, bool json = false);
+		~StdoutSink();
+
+		const bool json;
+
+	protected:
+		void write(const LogEntry *entries, size_t count);
+};
 
-#endif // STDOUT_LOGGER_H
\ No newline at end of file
+#endif // STDOUT_LOGGER_H
@@ -0,0 +1,63 @@
+#include <map>
+#include <mutex>
+#include "tag_set.h"
+
+using std::map;
+using std::mutex;
+using std::lock_guard;
+using std::weak_ptr;
+
+static mutex registry_mutex;
+static map< set<string>, weak_ptr<const TagSet> > registry;
+static size_t prune_size = 1024;
+
+static string joined(const set<string> &names) {
+	string key = "";
+	for (const string &name : names) {
+		key += (key.size() > 0) ? "\x1f" + name : name;
+	}
+	return key;
+}
+
+TagSet::TagSet(const set<string> &names) : names(names), key(joined(names)) {
+}
+
+TagSetRef
+TagSet::empty() {
+	static TagSetRef empty_set = std::make_shared<const TagSet>(set<string>());
+	return empty_set;
+}
+
+TagSetRef
+TagSet::intern(const set<string> &names) {
+	if (names.empty()) {
+		return empty();
+	}
+
+	lock_guard<mutex> lock(registry_mutex);
+
+	auto search = registry.find(names);
+	if (search != registry.end()) {
+		TagSetRef existing = search->second.lock();
+		if (existing) {
+			return existing;
+		}
+	}
+
+	TagSetRef tag_set = std::make_shared<const TagSet>(names);
+	registry[names] = tag_set;
+
+	// drop sets no logger uses anymore when the registry grew a lot (tags with IDs in them)
+	if (registry.size() >= prune_size) {
+		for (auto it = registry.begin(); it != registry.end();) {
+			if (it->second.expired()) {
+				it = registry.erase(it);
+			} else {
+				++it;
+			}
+		}
+		prune_size = (registry.size() * 2 > 1024) ? registry.size() * 2 : 1024;
+	}
+
+	return tag_set;
+}
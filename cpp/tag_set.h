@@ -0,0 +1,31 @@
+#ifndef TAG_SET_H
+#define TAG_SET_H
+
+#include <memory>
+#include <set>
+#include <string>
+
+using std::set;
+using std::shared_ptr;
+using std::string;
+
+class TagSet;
+typedef shared_ptr<const TagSet> TagSetRef;
+
+// Immutable, process wide interned set of tags. Loggers intern their tags once in `tag()`,
+// log entries only share the reference. Sets that no logger uses anymore are dropped, so sinks
+// cache DB IDs by `key`, which is the same for every instance of a set.
+class TagSet {
+	public:
+		static TagSetRef intern(const set<string> &names);
+		static TagSetRef empty();
+
+		const set<string> names;
+		const string key; // the sorted names separated by \x1f
+
+		bool contains(const string &name) const { return names.count(name) > 0; }
+
+		explicit TagSet(const set<string> &names);
+};
+
+#endif // TAG_SET_H
@@ -0,0 +1,197 @@
+#include <cstdlib>
+#include <sstream>
+#include "tail.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::to_string;
+using std::unique_lock;
+
+// all open tails, writers publish to the ones reading the same DB
+static mutex tails_mutex;
+static set<Tail *> tails;
+static std::atomic<int> open_tails(0);
+
+Tail::Tail(DBConnection *writer, int min_level, set<string> tags, std::function<void()> wakeup) :
+	db_type(writer->db_type), db_host(writer->db_host), db_port(writer->db_port),
+	db_user(writer->db_user), db_password(writer->db_password), db_name(writer->db_name),
+	prefix(writer->prefix), application_name(writer->application_name),
+	min_level(min_level), tags(tags), wakeup(wakeup) {
+
+	dropped = 0;
+	stopping = false;
+	{
+		lock_guard<mutex> lock(tails_mutex);
+		tails.insert(this);
+		open_tails++;
+	}
+	worker = std::thread(&Tail::run, this);
+}
+
+Tail::~Tail() {
+	{
+		lock_guard<mutex> lock(tails_mutex);
+		tails.erase(this);
+		open_tails--;
+	}
+	{
+		lock_guard<mutex> lock(tail_mutex);
+		stopping = true;
+	}
+	ranges_changed.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+bool
+Tail::active() {
+	return open_tails.load(std::memory_order_relaxed) > 0;
+}
+
+void
+Tail::publish(const DBConnection *writer, int64_t first, int64_t last) {
+	lock_guard<mutex> lock(tails_mutex);
+	for (Tail *tail : tails) {
+		if ((tail->db_type != "sqlite") || (tail->db_name != writer->db_name) || (tail->prefix != writer->prefix)) {
+			continue;
+		}
+		{
+			lock_guard<mutex> tail_lock(tail->tail_mutex);
+			tail->ranges.push_back({ first, last, "" });
+		}
+		tail->ranges_changed.notify_all();
+	}
+}
+
+vector< map<string, string> >
+Tail::take() {
+	lock_guard<mutex> lock(tail_mutex);
+	vector< map<string, string> > result = vector< map<string, string> >();
+	result.swap(rows);
+	return result;
+}
+
+void
+Tail::run() {
+	bool postgres = (db_type == "postgres");
+	DBConnection *connection = NULL;
+
+	while (true) {
+		if ((connection == NULL) || !connection->valid) {
+			delete connection;
+			connection = new DBConnection(db_type, db_host, db_port, db_user, db_password, db_name, prefix, application_name);
+			if (postgres) {
+				connection->listen(prefix + "_log");
+			}
+			if (!connection->valid) {
+				// rows announced while reconnecting are not read
+				unique_lock<mutex> lock(tail_mutex);
+				ranges_changed.wait_for(lock, std::chrono::seconds(1), [this] { return stopping; });
+				if (stopping) {
+					break;
+				}
+				continue;
+			}
+		}
+
+		vector<Range> pending = vector<Range>();
+		if (postgres) {
+			vector<string> payloads = vector<string>();
+			connection->wait_notifications(500, payloads);
+			for (const string &payload : payloads) {
+				// <xid>,<first id>,<last id>
+				std::istringstream stream(payload);
+				string xid, first, last;
+				if (std::getline(stream, xid, ',') && std::getline(stream, first, ',') && std::getline(stream, last, ',')) {
+					pending.push_back({ std::atoll(first.c_str()), std::atoll(last.c_str()), xid });
+				}
+			}
+
+			lock_guard<mutex> lock(tail_mutex);
+			if (stopping) {
+				break;
+			}
+		} else {
+			unique_lock<mutex> lock(tail_mutex);
+			ranges_changed.wait(lock, [this] { return stopping || !ranges.empty(); });
+			if (stopping) {
+				break;
+			}
+			pending.assign(ranges.begin(), ranges.end());
+			ranges.clear();
+		}
+
+		for (const Range &range : pending) {
+			read(connection, range);
+		}
+	}
+
+	delete connection;
+}
+
+// Read the rows of an announced range that pass the level and tag filter
+void
+Tail::read(DBConnection *connection, const Range &range) {
+	bool sqlite = (db_type == "sqlite");
+	string p = "\"" + prefix;
+	string tag_names = sqlite ? "group_concat(t.\"name\", char(31))" : "string_agg(t.\"name\", chr(31) ORDER BY t.\"name\")";
+	string sql =
+		"SELECT l.\"id\", l.\"level\", l.\"message\", l.\"pid\", l.\"time\", g.\"name\" AS logger, h.\"name\" AS host, "
+			"s.\"path\" AS source, f.\"name\" AS function, f.\"lineNumber\" AS line, l.\"fields\", l.\"context\", "
+			"(SELECT " + tag_names + " FROM " + p + "_tagset_member\" m JOIN " + p + "_tag\" t ON t.\"id\" = m.\"tagID\" WHERE m.\"tagsetID\" = l.\"tagsetID\") AS tags "
+		"FROM " + p + "_log\" l "
+		"LEFT JOIN " + p + "_logger\" g ON g.\"id\" = l.\"loggerID\" "
+		"LEFT JOIN " + p + "_hosts\" h ON h.\"id\" = l.\"hostnameID\" "
+		"LEFT JOIN " + p + "_function\" f ON f.\"id\" = l.\"functionID\" "
+		"LEFT JOIN " + p + "_source\" s ON s.\"id\" = f.\"sourceID\" "
+		"WHERE l.\"id\" BETWEEN $1 AND $2 AND l.\"level\" >= $3";
+
+	auto parameters = vector<string>();
+	parameters.push_back(to_string(range.first));
+	parameters.push_back(to_string(range.last));
+	parameters.push_back(to_string(min_level));
+	if (!range.xid.empty()) {
+		// other transactions may have inserted rows within the range
+		sql += " AND l.xmin::text = $4";
+		parameters.push_back(range.xid);
+	}
+	sql += " ORDER BY l.\"id\";";
+
+	auto result = connection->query(sql, parameters);
+	size_t added = 0;
+	{
+		lock_guard<mutex> lock(tail_mutex);
+		for (auto &row : *result) {
+			// at least one of the tags has to be set on the entry, like the tag filter of sinks
+			if (!tags.empty()) {
+				bool found = false;
+				std::istringstream names(row["tags"]);
+				string name;
+				while (!found && std::getline(names, name, '\x1f')) {
+					found = (tags.count(name) > 0);
+				}
+				if (!found) {
+					continue;
+				}
+			}
+
+			if (rows.size() >= queue_limit) {
+				dropped++;
+				continue;
+			}
+
+			// microseconds for both layouts
+			if (connection->layout < 2) {
+				row["time"] = to_string(std::atoll(row["time"].c_str()) * 1000000);
+			}
+			rows.push_back(row);
+			added++;
+		}
+	}
+	delete result;
+
+	if (added > 0) {
+		wakeup();
+	}
+}
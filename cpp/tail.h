@@ -0,0 +1,83 @@
+#ifndef TAIL_H
+#define TAIL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "db.h"
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+// Live tail of a log table.
+//
+// A worker thread waits for announced ID ranges and reads the new rows with a primary key range
+// scan on its own connection, the DB is never polled. Postgres announces the rows of every INSERT
+// statement on the `<prefix>_log` channel (schema version 8), so writers of all processes are seen.
+// SQLite has no notifications, only entries written by DB sinks of this process are seen: they
+// report the rowids of their inserts with publish().
+//
+// Rows have the keys id, level, message, pid, time (microseconds), logger, host, source, function,
+// line, fields, context and tags (joined with 0x1f). `wakeup` is called from the worker thread
+// whenever take() has new rows.
+class Tail {
+	public:
+		Tail(DBConnection *writer, int min_level, set<string> tags, std::function<void()> wakeup);
+		~Tail();
+
+		// rows read since the last call, at most `queue_limit` rows are kept
+		vector< map<string, string> > take();
+
+		// rows that did not fit into the queue
+		std::atomic<uint64_t> dropped;
+
+		// announce rows inserted into the log table of a SQLite DB by this process
+		static void publish(const DBConnection *writer, int64_t first, int64_t last);
+
+		// true if any tail is open, writers skip publish() otherwise
+		static bool active();
+
+		static const size_t queue_limit = 10000;
+
+	private:
+		struct Range {
+			int64_t first;
+			int64_t last;
+			string xid;
+		};
+
+		void run();
+		void read(DBConnection *connection, const Range &range);
+
+		const string db_type;
+		const string db_host;
+		const int db_port;
+		const string db_user;
+		const string db_password;
+		const string db_name;
+		const string prefix;
+		const string application_name;
+		const int min_level;
+		const set<string> tags;
+		std::function<void()> wakeup;
+
+		std::mutex tail_mutex;
+		std::condition_variable ranges_changed;
+		std::deque<Range> ranges;
+		vector< map<string, string> > rows;
+		bool stopping;
+		std::thread worker;
+};
+
+#endif // TAIL_H
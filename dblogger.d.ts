@@ -16,6 +16,41 @@ declare namespace dblogger {
 		Fatal = 60
 	}
 
+	export interface FileOptions {
+		/** Path of the NDJSON file, entries are appended */
+		path: string,
+		/** Roll over to `<path>.1` when the file would grow beyond this many bytes (0: never) */
+		maxSize?: number,
+		/** Number of rolled over files to keep (default: 5) */
+		maxFiles?: number,
+		/** Minimum log level for this file */
+		level?: LogLevel,
+		/** Only write entries that have at least one of these tags */
+		tags?: string[],
+		/** Size of the write queue, 0 writes synchronously (default: 0) */
+		queue?: number,
+	}
+
+	export interface RetentionOptions {
+		/** Delete entries older than this many seconds */
+		maxAge?: number,
+		/** Keep at most this many entries */
+		maxRows?: number,
+		/** Delete the oldest entries while the pages in use exceed this many bytes */
+		maxBytes?: number,
+	}
+
+	export interface FlightRecorderOptions {
+		/** Number of recent entries to keep (default: 4096) */
+		size?: number,
+		/** Minimum log level to record (default: 0) */
+		level?: LogLevel,
+		/** Append all recorded entries to this NDJSON file instead of writing the unpersisted ones to the sinks */
+		path?: string,
+		/** Also write out the recorded entries when the process receives this signal */
+		signal?: string,
+	}
+
 	export interface BaseOptions {
 		type: 'postgres' | 'sqlite' | 'none',
 		level: LogLevel,
@@ -23,6 +58,42 @@ declare namespace dblogger {
 		stdout: boolean,
 		/** Logger name */
 		logger: string,
+		/** Name of the destination to log to (default: `default`), see readme */
+		destination?: string,
+		/** Merge object arguments into the `fields` column instead of the message */
+		fields?: boolean,
+		/** Keys of the `fields` column that get an expression index */
+		fieldIndexes?: string[],
+		/** Postgres only: GIN index on the `fields` column for containment queries */
+		fieldsGin?: boolean,
+		/** AsyncLocalStorage whose current store (object or Map) is saved in the `context` column */
+		context?: { getStore(): any },
+		/** Store the original file and line of transpiled scripts that have a source map */
+		sourceMaps?: boolean,
+		/** Bytes stored per Buffer/TypedArray/ArrayBuffer argument in the attachment table, 0 logs them as text (default: 65536) */
+		attachmentMaxSize?: number,
+		/** Size of the DB write queue, 0 writes synchronously (default: 0) */
+		queue?: number,
+		/** Minimum log level for stdout */
+		stdoutLevel?: LogLevel,
+		/** Size of the stdout write queue, 0 writes synchronously (default: 0) */
+		stdoutQueue?: number,
+		/** Line format for stdout, `json` writes NDJSON objects (default: text) */
+		stdoutFormat?: 'text' | 'json',
+		/** Additionally append entries to one or more NDJSON files */
+		file?: FileOptions | FileOptions[],
+		/** Log table layout for new DBs: 2 uses 64 bit IDs and microsecond timestamps (default: 1) */
+		layout?: 1 | 2,
+		/** Use hashes of the names as logger, host, source, function and tag IDs (Postgres: needs int8 ID columns) */
+		hashIds?: boolean,
+		/** Indexes for time and level queries, built in the background */
+		indexProfile?: 'time',
+		/** Count entries per minute in the rollup table, a number sets the write interval in seconds (true: 10) */
+		rollup?: boolean | number,
+		/** SQLite: delete the oldest entries beyond these limits in the background */
+		retention?: RetentionOptions,
+		/** Keep recent entries in memory and write them out on fatal(), uncaught exceptions or a signal */
+		flightRecorder?: boolean | FlightRecorderOptions,
 	}
 
 	export interface NoneOptions extends BaseOptions {
@@ -41,11 +112,129 @@ declare namespace dblogger {
 
 	export interface SqliteOptions extends BaseOptions {
 		type: 'sqlite',
-		/** File name for sqlite */
+		/** File name for sqlite, the shard directory if `shards` is set */
 		name: string,
+		/** Write to `<name>/shard-<pid % shards>.db` instead of a single file, see readme */
+		shards?: number,
+	}
+
+	export interface CollectorOptions extends BaseOptions {
+		type: 'collector',
+		/** Unix domain socket of the `dblogger-collector` (default: `/tmp/dblogger.sock`) */
+		socket?: string,
 	}
 
-	export type Options = PostgresOptions | SqliteOptions | NoneOptions;
+	export interface SegmentOptions extends BaseOptions {
+		type: 'segment',
+		/** Directory of the segment files */
+		name: string,
+		/** Size of a segment file in bytes (default: 64 MiB) */
+		segmentSize?: number,
+	}
+
+	export type Options = PostgresOptions | SqliteOptions | CollectorOptions | SegmentOptions | NoneOptions;
+
+	/** Latency distribution, all values in microseconds */
+	export interface LatencyStats {
+		count: number,
+		mean: number,
+		p50: number,
+		p90: number,
+		p99: number,
+		p999: number,
+		max: number,
+	}
+
+	export interface CacheStats {
+		hits: number,
+		misses: number,
+		/** hits / (hits + misses) */
+		hitRate: number,
+	}
+
+	export interface Stats {
+		/** Log entries written per level */
+		entries: { other: number, trace: number, debug: number, info: number, warn: number, error: number, fatal: number },
+		/** Log calls below the log level of the logger or not accepted by any sink */
+		filtered: number,
+		/** Log entries that could not be written to the DB */
+		dropped: number,
+		db: { statements: number, errors: number, reconnects: number, rotations: number, indexProfile: 'none' | 'building' | 'done' | 'skipped' | 'failed' },
+		cache: { tag: CacheStats, dimension: CacheStats },
+		bytes: { stdout: number, db: number, file: number, collector: number },
+		latency: {
+			log: LatencyStats,
+			stack: LatencyStats,
+			serialize: LatencyStats,
+			stdout: LatencyStats,
+			db: LatencyStats,
+			dbExecute: LatencyStats,
+			dbQuery: LatencyStats,
+			dbInsert: LatencyStats,
+		},
+	}
+
+	export interface TailOptions {
+		/** Minimum log level of the entries (default: all) */
+		minLevel?: LogLevel,
+		/** Only entries with at least one of these tags */
+		tags?: string[],
+	}
+
+	export interface TailEntry {
+		id: number,
+		level: number,
+		message: string,
+		pid: number,
+		time: Date,
+		logger: string,
+		host: string,
+		source: string,
+		function: string,
+		line: number,
+		tags: string[],
+		fields: object | null,
+		context: object | null,
+	}
+
+	export interface ExportOptions {
+		/** Output file */
+		path: string,
+		/** Output format (default: 'ndjson') */
+		format?: 'ndjson' | 'parquet',
+		/** First time to export */
+		from?: Date | number,
+		/** Export entries before this time */
+		to?: Date | number,
+		/** Minimum log level of the entries (default: all) */
+		minLevel?: LogLevel,
+		/** Entries per query (default: 10000) */
+		batch?: number,
+	}
+
+	export interface RollupOptions {
+		/** First time to count */
+		from?: Date | number,
+		/** Count entries before this time */
+		to?: Date | number,
+		/** Minimum log level of the entries (default: all) */
+		minLevel?: LogLevel,
+		/** Bucket size in seconds (default: 60) */
+		interval?: number,
+		/** Columns to group by (default: all) */
+		groupBy?: ('level' | 'logger' | 'host' | 'function')[],
+	}
+
+	export interface RollupRow {
+		time: Date,
+		count: number,
+		level?: number,
+		logger?: string,
+		host?: string,
+		function?: string,
+		source?: string,
+		line?: number,
+	}
 
 	export interface Logger {
 		trace(...args: any[]): void;
@@ -58,6 +247,18 @@ declare namespace dblogger {
 
 		tag(...tag: string[]): Logger;
 		rotate(): void;
+		/** Wait until all queued log entries have been written */
+		flush(): void;
+		/** Runtime statistics of all loggers in this process, pass `true` to reset the counters */
+		stats(reset?: boolean): Stats;
+		/** New entries of the DB of this logger as they are written, leaving the loop ends the subscription */
+		tail(options?: TailOptions): AsyncIterableIterator<TailEntry>;
+		/** Write the entries of the DB of this logger to a file, resolves to the number of entries */
+		export(options: ExportOptions): Promise<number>;
+		/** Entry counts of the rollup table of the DB of this logger */
+		rollup(options?: RollupOptions): Promise<RollupRow[]>;
+		/** Write out the flight recorders of all destinations, returns the number of entries */
+		flightDump(): number;
 	}
 }
 
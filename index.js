@@ -1,5 +1,151 @@
 const { Logger } = require('bindings')('dblogger')
-module.exports = (options) => new Logger(options);
+const flightSignals = new Set();
+
+module.exports = (options) => {
+	// dump the flight recorders on a signal, e.g. `flightRecorder: { signal: 'SIGUSR2' }`
+	const signal = options && options.flightRecorder && options.flightRecorder.signal;
+	if (signal && !flightSignals.has(signal)) {
+		flightSignals.add(signal);
+		process.on(signal, () => {
+			new Logger().flightDump();
+		});
+	}
+	return new Logger(options);
+};
+
+// convert a row of the tail, the native side hands over all columns as strings ('' for NULL)
+function tailEntry(row) {
+	return {
+		id: Number(row.id),
+		level: Number(row.level),
+		message: row.message,
+		pid: Number(row.pid),
+		time: new Date(Number(row.time) / 1000),
+		logger: row.logger,
+		host: row.host,
+		source: row.source,
+		function: row.function,
+		line: Number(row.line),
+		tags: row.tags ? row.tags.split('\x1f') : [],
+		fields: row.fields ? JSON.parse(row.fields) : null,
+		context: row.context ? JSON.parse(row.context) : null,
+	};
+}
+
+// Async iterator of new log entries: `for await (const entry of logger.tail({ minLevel: 40 })) ...`,
+// leaving the loop closes the subscription
+Logger.prototype.tail = function (options) {
+	const pending = [];
+	let waiting = null;
+	let closed = false;
+
+	const id = this.tailSubscribe(options || {}, (rows) => {
+		for (const row of rows) {
+			pending.push(tailEntry(row));
+		}
+		if (waiting && (pending.length > 0)) {
+			const resolve = waiting;
+			waiting = null;
+			resolve({ value: pending.shift(), done: false });
+		}
+	});
+
+	const close = () => {
+		if (!closed) {
+			closed = true;
+			this.tailClose(id);
+		}
+		if (waiting) {
+			waiting({ value: undefined, done: true });
+			waiting = null;
+		}
+		return Promise.resolve({ value: undefined, done: true });
+	};
+
+	return {
+		next() {
+			if (pending.length > 0) {
+				return Promise.resolve({ value: pending.shift(), done: false });
+			}
+			if (closed) {
+				return Promise.resolve({ value: undefined, done: true });
+			}
+			return new Promise((resolve) => { waiting = resolve; });
+		},
+		return: close,
+		throw(error) {
+			close();
+			return Promise.reject(error);
+		},
+		[Symbol.asyncIterator]() {
+			return this;
+		},
+	};
+};
+
+// copy of query options with `from` and `to` in milliseconds
+function timeRange(options, defaults) {
+	const settings = Object.assign({}, defaults, options);
+	for (const key of ['from', 'to']) {
+		if (settings[key] instanceof Date) {
+			settings[key] = settings[key].getTime();
+		}
+	}
+	return settings;
+}
+
+// run a background query of the native side as a promise, queued entries are written first so
+// they are included
+function backgroundQuery(logger, method, settings, convert) {
+	logger.flush();
+	return new Promise((resolve, reject) => {
+		method.call(logger, settings, (error, result) => {
+			if (error) {
+				reject(error);
+			} else {
+				resolve(convert(result));
+			}
+		});
+	});
+}
+
+// Export the entries of the DB destination to an NDJSON or Parquet file, resolves to the number of
+// exported entries
+Logger.prototype.export = function (options) {
+	return backgroundQuery(this, this.exportStart, timeRange(options), (count) => count);
+};
+
+// convert a row of the rollup table, only the grouped columns are set
+function rollupRow(row) {
+	const result = { time: new Date(Number(row.time) * 1000), count: Number(row.count) };
+	for (const key of ['level', 'line']) {
+		if (key in row) {
+			result[key] = Number(row[key]);
+		}
+	}
+	for (const key of ['logger', 'host', 'function', 'source']) {
+		if (key in row) {
+			result[key] = row[key];
+		}
+	}
+	return result;
+}
+
+// Entry counts per minute (or `interval` seconds) from the rollup table of the DB destination
+Logger.prototype.rollup = function (options) {
+	const settings = timeRange(options, { groupBy: ['level', 'logger', 'host', 'function'] });
+	return backgroundQuery(this, this.rollupQuery, settings, (rows) => rows.map(rollupRow));
+};
+
+// write out all queued log entries before the process exits
+process.on('exit', () => {
+	new Logger().flush();
+});
+
+// keep the entries that led up to a crash, the monitor does not change how the exception is handled
+process.on('uncaughtExceptionMonitor', () => {
+	new Logger().flightDump();
+});
 
 process.on('SIGHUP', () => {
 	const logger = new Logger();
@@ -40,6 +40,12 @@ process.nextTick(() => {
 
 	bla();
 
+	// re-configuring a segment logger has to keep writing to the locked directory
+	new Logger({ type: "segment", name: "./test-segments", destination: "segments" }).info("Segment logger");
+	let segments = new Logger({ type: "segment", name: "./test-segments", destination: "segments" });
+	segments.info("Re-configured segment logger");
+	console.log('segment entries dropped:', segments.stats().dropped);
+
 });
 
 setInterval(() => {
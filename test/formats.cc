@@ -0,0 +1,716 @@
+/*
+ * dblogger-test-formats: round trips of the binary formats of the native code. Segment frames
+ * and index entries, segment directories written by SegmentSink (dictionary, sealing, recovery
+ * after a crash), collector records and Parquet files, which are read back with the minimal
+ * reader below. Prints the failed checks and exits with 1 if there are any, run with `npm test`.
+ */
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../cpp/parquet.h"
+#include "../cpp/record.h"
+#include "../cpp/segment.h"
+#include "../cpp/segment_logger.h"
+
+using std::cerr;
+using std::map;
+using std::pair;
+using std::set;
+using std::string;
+using std::to_string;
+using std::vector;
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static bool check(bool ok, const char *text, const char *file, int line) {
+	if (!ok) {
+		cerr << file << ":" << line << ": check failed: " << text << "\n";
+		failures++;
+	}
+	return ok;
+}
+
+static uint32_t get_u32(const string &data, size_t offset) {
+	const unsigned char *bytes = (const unsigned char *)data.data() + offset;
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint64_t get_u64(const string &data, size_t offset) {
+	return get_u32(data, offset) | ((uint64_t)get_u32(data, offset + 4) << 32);
+}
+
+static string read_file(const string &path) {
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream content;
+	content << file.rdbuf();
+	return content.str();
+}
+
+static void remove_directory(const string &path) {
+	DIR *dir = opendir(path.c_str());
+	if (dir == NULL) {
+		return;
+	}
+	struct dirent *item;
+	while ((item = readdir(dir)) != NULL) {
+		string name = item->d_name;
+		if ((name != ".") && (name != "..")) {
+			unlink((path + "/" + name).c_str());
+		}
+	}
+	closedir(dir);
+	rmdir(path.c_str());
+}
+
+// Entry `i` of the test data: UTF-8 and NUL bytes, empty and set fields, context, tags and attachments
+static LogEntry test_entry(int i) {
+	LogEntry entry;
+	entry.level = 10 * (1 + i % 6);
+	entry.time_us = 1700000000000000 + (int64_t)i * 1234567;
+	entry.date = (time_t)(entry.time_us / 1000000);
+	entry.hostname = "host-" + to_string(i % 3);
+	entry.pid = 1000 + i;
+	entry.filename = "src/file" + to_string(i % 5) + ".js";
+	entry.function = "fn" + to_string(i % 7) + "()";
+	entry.line = i;
+	entry.column = i % 80;
+	entry.parts.push_back("message " + to_string(i) + " \xc3\xa4\xe2\x82\xac");
+	if (i % 4 == 0) {
+		entry.parts.push_back(string("with\0nul", 8));
+	}
+	entry.fields = (i % 3 == 0) ? "" : "{\"i\":" + to_string(i) + "}";
+	entry.context = (i % 5 == 0) ? "{\"request\":\"r" + to_string(i) + "\"}" : "";
+	if (i % 6 == 0) {
+		LogAttachment attachment;
+		attachment.type = "Buffer";
+		attachment.data = string("\x00\x01\xff", 3) + to_string(i);
+		attachment.size = attachment.data.size() + 100;
+		entry.attachments.push_back(attachment);
+	}
+	set<string> tags = set<string>();
+	if (i % 2) {
+		tags.insert("odd");
+	}
+	if (i % 3 == 0) {
+		tags.insert("three");
+	}
+	entry.tags = TagSet::intern(tags);
+	entry.logger_name = (i % 2) ? "api" : "worker";
+	return entry;
+}
+
+static bool same_attachments(const vector<LogAttachment> &a, const vector<LogAttachment> &b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); i++) {
+		if ((a[i].type != b[i].type) || (a[i].size != b[i].size) || (a[i].data != b[i].data)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Collector records
+ */
+
+static void test_records(void) {
+	for (int i = 0; i < 50; i++) {
+		LogEntry entry = test_entry(i);
+		string frame = "prefix";
+		CHECK(record_append_frame(frame, entry));
+		CHECK(get_u32(frame, 6) == frame.size() - 10);
+
+		LogEntry decoded;
+		if (!CHECK(record_decode(frame.data() + 10, frame.size() - 10, decoded))) {
+			continue;
+		}
+		CHECK(decoded.level == entry.level);
+		CHECK(decoded.time_us == entry.time_us);
+		CHECK(decoded.date == entry.date);
+		CHECK(decoded.pid == entry.pid);
+		CHECK(decoded.line == entry.line);
+		CHECK(decoded.column == entry.column);
+		CHECK(decoded.hostname == entry.hostname);
+		CHECK(decoded.filename == entry.filename);
+		CHECK(decoded.function == entry.function);
+		CHECK(decoded.fields == entry.fields);
+		CHECK(decoded.logger_name == entry.logger_name);
+		CHECK(decoded.parts == entry.parts);
+		CHECK(decoded.tags->names == entry.tags->names);
+		CHECK(decoded.context == entry.context);
+		CHECK(same_attachments(decoded.attachments, entry.attachments));
+
+		// a cut payload is rejected instead of read past its end
+		LogEntry cut;
+		CHECK(!record_decode(frame.data() + 10, frame.size() - 11, cut));
+	}
+
+	// the collector closes the connection for larger frames, they are not appended
+	LogEntry large = test_entry(1);
+	large.parts = vector<string>{ string(record_max_size + 1, 'x') };
+	string out = "abc";
+	CHECK(!record_append_frame(out, large));
+	CHECK(out == "abc");
+}
+
+/*
+ * Segment frames
+ */
+
+static SegmentRecord test_record(int i) {
+	LogEntry entry = test_entry(i);
+	SegmentRecord record;
+	record.id = 100 + i;
+	record.time_us = entry.time_us;
+	record.level = entry.level;
+	record.pid = entry.pid;
+	record.line = entry.line;
+	record.column = entry.column;
+	for (int dimension = 0; dimension < SEGMENT_TAG; dimension++) {
+		record.names[dimension] = (i + dimension) % 4;
+	}
+	record.tags = (i % 2) ? vector<uint32_t>{ 1, (uint32_t)i } : vector<uint32_t>();
+	record.message = entry.message();
+	record.fields = entry.fields;
+	record.context = entry.context;
+	record.attachments = entry.attachments;
+	return record;
+}
+
+static bool same_record(const SegmentRecord &a, const SegmentRecord &b) {
+	for (int dimension = 0; dimension < SEGMENT_TAG; dimension++) {
+		if (a.names[dimension] != b.names[dimension]) {
+			return false;
+		}
+	}
+	return (a.id == b.id) && (a.time_us == b.time_us) && (a.level == b.level) && (a.pid == b.pid) &&
+		(a.line == b.line) && (a.column == b.column) && (a.tags == b.tags) && (a.message == b.message) &&
+		(a.fields == b.fields) && (a.context == b.context) && same_attachments(a.attachments, b.attachments);
+}
+
+static void test_segment_frames(const string &directory) {
+	// a segment as the writer leaves it: header, frames and the zeroed rest of the preallocation
+	string data = segment_header(100);
+	CHECK(data.size() == segment_header_size);
+	vector<size_t> offsets = vector<size_t>();
+	for (int i = 0; i < 100; i++) {
+		offsets.push_back(data.size());
+		segment_append_frame(data, test_record(i));
+	}
+	size_t end = data.size();
+	offsets.push_back(end);
+	data.resize(end + 4096, '\0');
+
+	CHECK(segment_first_id(data.data(), data.size()) == 100);
+	CHECK(segment_first_id("not a segment", 13) == 0);
+
+	SegmentRecord record;
+	size_t offset = segment_header_size;
+	for (int i = 0; i < 100; i++) {
+		size_t length = segment_read_frame(data.data(), data.size(), offset, record);
+		CHECK(length == offsets[i + 1] - offsets[i]);
+		CHECK(same_record(record, test_record(i)));
+		offset += (length > 0) ? length : offsets[i + 1] - offsets[i];
+	}
+	CHECK(segment_read_frame(data.data(), data.size(), end, record) == 0);
+
+	// a torn frame at the end of the file and a corrupt payload end the frames
+	CHECK(segment_read_frame(data.data(), offsets[50] - 1, offsets[49], record) == 0);
+	CHECK(segment_read_frame(data.data(), offsets[49] + 4, offsets[49], record) == 0);
+	string corrupt = data;
+	corrupt[offsets[10] + 20] ^= 0x40;
+	CHECK(segment_read_frame(corrupt.data(), corrupt.size(), offsets[10], record) == 0);
+	CHECK(segment_read_frame(corrupt.data(), corrupt.size(), offsets[11], record) == offsets[12] - offsets[11]);
+
+	// sparse index entries
+	string index = "";
+	for (int i = 0; i < 100; i += 10) {
+		segment_append_index_entry(index, { (uint64_t)(100 + i), test_record(i).time_us, offsets[i] });
+	}
+	CHECK(index.size() == 10 * segment_index_entry_size);
+	string path = directory + "/test.idx";
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	CHECK(::write(fd, index.data(), index.size()) == (ssize_t)index.size());
+	close(fd);
+	vector<SegmentIndexEntry> loaded = segment_load_index(path);
+	if (CHECK(loaded.size() == 10)) {
+		for (int i = 0; i < 10; i++) {
+			CHECK(loaded[i].id == (uint64_t)(100 + 10 * i));
+			CHECK(loaded[i].time_us == test_record(10 * i).time_us);
+			CHECK(loaded[i].offset == offsets[10 * i]);
+		}
+	}
+	unlink(path.c_str());
+}
+
+/*
+ * Segment directories
+ */
+
+// Scan all records and compare them with the entries they were written from
+static long check_segments(const string &directory, int64_t from_us, int64_t to_us, int min_level, long expected) {
+	string error;
+	uint64_t next_id = 0;
+	long matching = 0;
+	long visited = segment_scan(directory, from_us, to_us, min_level, [&](const SegmentRecord &record, SegmentDictionary &dictionary) {
+		CHECK(record.id > next_id);
+		next_id = record.id;
+
+		LogEntry entry = test_entry((int)record.id - 1);
+		const string *logger = dictionary.name(SEGMENT_LOGGER, record.names[SEGMENT_LOGGER]);
+		const string *host = dictionary.name(SEGMENT_HOST, record.names[SEGMENT_HOST]);
+		const string *file = dictionary.name(SEGMENT_FILE, record.names[SEGMENT_FILE]);
+		const string *function = dictionary.name(SEGMENT_FUNCTION, record.names[SEGMENT_FUNCTION]);
+		set<string> tags = set<string>();
+		for (uint32_t tag : record.tags) {
+			const string *name = dictionary.name(SEGMENT_TAG, tag);
+			tags.insert(name ? *name : "?");
+		}
+		bool same = (record.time_us == entry.time_us) && (record.level == entry.level) && (record.pid == entry.pid) &&
+			(record.line == entry.line) && (record.column == entry.column) && (record.message == entry.message()) &&
+			(record.fields == entry.fields) && (record.context == entry.context) && same_attachments(record.attachments, entry.attachments) &&
+			logger && (*logger == entry.logger_name) && host && (*host == entry.hostname) &&
+			file && (*file == entry.filename) && function && (*function == entry.function) && (tags == entry.tags->names);
+		matching += same ? 1 : 0;
+		return true;
+	}, error);
+	CHECK(error.empty());
+	CHECK(visited == expected);
+	CHECK(matching == visited);
+	return visited;
+}
+
+static void test_segment_files(const string &directory) {
+	// a writer that crashes: the process ends without sealing the segment it writes to
+	const int crashed = 20000;
+	pid_t child = fork();
+	if (child == 0) {
+		SegmentSink *sink = new SegmentSink(directory, 1024 * 1024, 0, 0);
+		for (int i = 0; i < crashed; i++) {
+			sink->submit(test_entry(i));
+		}
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(child, &status, 0);
+	CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+	vector<uint64_t> numbers = segment_numbers(directory);
+	if (!CHECK(numbers.size() >= 2)) {
+		return;
+	}
+	check_segments(directory, 0, 0, 0, crashed);
+
+	// tear the end of the active segment and of the dictionary as a crash in the middle of a write would
+	string path = segment_path(directory, numbers.back(), "log");
+	string data = read_file(path);
+	SegmentRecord record;
+	size_t offset = segment_header_size;
+	size_t length;
+	while ((length = segment_read_frame(data.data(), data.size(), offset, record)) > 0) {
+		offset += length;
+	}
+	string torn = string("\x40\x00\x00\x00\x12\x34\x56\x78torn", 12);
+	int fd = open(path.c_str(), O_WRONLY);
+	CHECK(pwrite(fd, torn.data(), torn.size(), offset) == (ssize_t)torn.size());
+	close(fd);
+	fd = open((directory + "/dictionary").c_str(), O_WRONLY | O_APPEND);
+	CHECK(::write(fd, "\x02\x07", 2) == 2);
+	close(fd);
+	check_segments(directory, 0, 0, 0, crashed);
+
+	// the next writer continues after the last valid frame with new names, then seals
+	const int total = crashed + 2000;
+	SegmentSink *sink = new SegmentSink(directory, 1024 * 1024, 0, 0);
+	for (int i = crashed; i < total; i++) {
+		LogEntry entry = test_entry(i);
+		sink->submit(entry);
+	}
+	delete sink;
+	check_segments(directory, 0, 0, 0, total);
+
+	// level and time filters
+	long errors = 0;
+	long in_range = 0;
+	int64_t from_us = test_entry(1000).time_us;
+	int64_t to_us = test_entry(6000).time_us;
+	for (int i = 0; i < total; i++) {
+		errors += (test_entry(i).level >= 50) ? 1 : 0;
+		in_range += ((i >= 1000) && (i < 6000)) ? 1 : 0;
+	}
+	check_segments(directory, 0, 0, 50, errors);
+	check_segments(directory, from_us, to_us, 0, in_range);
+}
+
+/*
+ * Parquet
+ */
+
+// Thrift compact protocol values, structs by field ID
+struct ThriftValue {
+	int64_t i = 0;
+	string binary;
+	vector<ThriftValue> list;
+	map<int16_t, ThriftValue> fields;
+
+	const ThriftValue &operator[](int16_t id) const {
+		static const ThriftValue missing = ThriftValue();
+		auto search = fields.find(id);
+		return (search != fields.end()) ? search->second : missing;
+	}
+	bool has(int16_t id) const { return fields.count(id) > 0; }
+};
+
+class ThriftReader {
+	public:
+		ThriftReader(const string &data, size_t offset) : offset(offset), ok(true), data(data) {}
+
+		ThriftValue read_struct() {
+			ThriftValue value;
+			int16_t last = 0;
+			while (ok) {
+				uint8_t header = byte();
+				if (header == 0) {
+					break;
+				}
+				int type = header & 0x0f;
+				int16_t id = (header >> 4) ? last + (header >> 4) : (int16_t)zigzag(varint());
+				if ((type == 1) || (type == 2)) {
+					value.fields[id].i = (type == 1);
+				} else {
+					value.fields[id] = read(type);
+				}
+				last = id;
+			}
+			return value;
+		}
+
+		size_t offset;
+		bool ok;
+
+	private:
+		ThriftValue read(int type) {
+			ThriftValue value;
+			if ((type == 1) || (type == 2) || (type == 3)) {
+				value.i = byte();
+			} else if ((type == 4) || (type == 5) || (type == 6)) {
+				value.i = zigzag(varint());
+			} else if (type == 7) {
+				offset += 8;
+			} else if (type == 8) {
+				uint64_t size = varint();
+				ok = ok && (offset + size <= data.size());
+				value.binary = ok ? data.substr(offset, size) : string();
+				offset += size;
+			} else if ((type == 9) || (type == 10)) {
+				uint8_t header = byte();
+				uint64_t size = ((header >> 4) == 15) ? varint() : (header >> 4);
+				for (uint64_t n = 0; (n < size) && ok; n++) {
+					value.list.push_back(read(header & 0x0f));
+				}
+			} else if (type == 12) {
+				value = read_struct();
+			} else {
+				ok = false;
+			}
+			return value;
+		}
+
+		uint8_t byte() {
+			ok = ok && (offset < data.size());
+			return ok ? (uint8_t)data[offset++] : 0;
+		}
+
+		uint64_t varint() {
+			uint64_t value = 0;
+			for (int shift = 0; ok && (shift < 64); shift += 7) {
+				uint8_t b = byte();
+				value |= (uint64_t)(b & 0x7f) << shift;
+				if ((b & 0x80) == 0) {
+					break;
+				}
+			}
+			return value;
+		}
+
+		static int64_t zigzag(uint64_t value) {
+			return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+		}
+
+		const string &data;
+};
+
+static uint64_t read_varint(const string &data, size_t &offset) {
+	uint64_t value = 0;
+	for (int shift = 0; (offset < data.size()) && (shift < 64); shift += 7) {
+		uint8_t b = data[offset++];
+		value |= (uint64_t)(b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			break;
+		}
+	}
+	return value;
+}
+
+// RLE / bit-packing hybrid encoded values
+static vector<uint32_t> read_rle_hybrid(const string &data, size_t offset, int width, size_t count) {
+	vector<uint32_t> values = vector<uint32_t>();
+	while ((values.size() < count) && (offset < data.size())) {
+		uint64_t header = read_varint(data, offset);
+		if (header & 1) {
+			size_t bits = 0;
+			for (size_t n = 0; n < (header >> 1) * 8; n++) {
+				uint32_t value = 0;
+				for (int b = 0; b < width; b++, bits++) {
+					size_t position = offset + bits / 8;
+					if ((position < data.size()) && ((data[position] >> (bits % 8)) & 1)) {
+						value |= 1u << b;
+					}
+				}
+				if (values.size() < count) {
+					values.push_back(value);
+				}
+			}
+			offset += (header >> 1) * width;
+		} else {
+			uint32_t value = 0;
+			for (int b = 0; b < (width + 7) / 8; b++) {
+				value |= (uint32_t)(uint8_t)data[offset++] << (8 * b);
+			}
+			for (uint64_t n = 0; (n < (header >> 1)) && (values.size() < count); n++) {
+				values.push_back(value);
+			}
+		}
+	}
+	return values;
+}
+
+// PLAIN encoded values as text
+static vector<string> read_plain(const string &data, size_t offset, int type, size_t count) {
+	vector<string> values = vector<string>();
+	for (size_t n = 0; (n < count) && (offset < data.size()); n++) {
+		if (type == ParquetWriter::INT32) {
+			values.push_back(to_string((int32_t)get_u32(data, offset)));
+			offset += 4;
+		} else if (type == ParquetWriter::INT64) {
+			values.push_back(to_string((int64_t)get_u64(data, offset)));
+			offset += 8;
+		} else {
+			uint32_t size = get_u32(data, offset);
+			values.push_back(data.substr(offset + 4, size));
+			offset += 4 + size;
+		}
+	}
+	return values;
+}
+
+// (defined, value) per row
+typedef vector< pair<bool, string> > ParquetValues;
+
+struct ParquetFile {
+	ThriftValue metadata;
+	vector<ParquetValues> columns;
+};
+
+static bool read_parquet(const string &path, ParquetFile &parquet) {
+	string file = read_file(path);
+	if (!CHECK((file.size() >= 12) && (file.substr(0, 4) == "PAR1") && (file.substr(file.size() - 4) == "PAR1"))) {
+		return false;
+	}
+	uint32_t footer_size = get_u32(file, file.size() - 8);
+	ThriftReader footer = ThriftReader(file, file.size() - 8 - footer_size);
+	parquet.metadata = footer.read_struct();
+	if (!CHECK(footer.ok && (footer.offset == file.size() - 8))) {
+		return false;
+	}
+
+	const vector<ThriftValue> &schema = parquet.metadata[2].list;
+	size_t column_count = (schema.size() > 0) ? schema.size() - 1 : 0;
+	parquet.columns = vector<ParquetValues>(column_count);
+	for (const ThriftValue &row_group : parquet.metadata[4].list) {
+		const vector<ThriftValue> &chunks = row_group[1].list;
+		if (!CHECK(chunks.size() == column_count)) {
+			return false;
+		}
+		for (size_t c = 0; c < column_count; c++) {
+			const ThriftValue &meta = chunks[c][3];
+			int type = (int)schema[c + 1][1].i;
+			bool optional = (schema[c + 1][3].i == 1);
+			CHECK(meta[1].i == type);
+			CHECK(meta[3].list.size() == 1 && (meta[3].list[0].binary == schema[c + 1][4].binary));
+
+			size_t offset = meta.has(11) ? meta[11].i : meta[9].i;
+			size_t chunk_end = offset + meta[7].i;
+			int64_t read = 0;
+			vector<string> dictionary = vector<string>();
+			while ((read < meta[5].i) && (offset < chunk_end)) {
+				ThriftReader page_reader = ThriftReader(file, offset);
+				ThriftValue header = page_reader.read_struct();
+				if (!CHECK(page_reader.ok)) {
+					return false;
+				}
+				string page = file.substr(page_reader.offset, header[3].i);
+				CHECK(header[2].i == header[3].i);
+				offset = page_reader.offset + header[3].i;
+
+				if (header[1].i == 2) {
+					dictionary = read_plain(page, 0, type, header[7][1].i);
+					CHECK((int64_t)dictionary.size() == header[7][1].i);
+					continue;
+				}
+				CHECK(header[1].i == 0);
+				size_t count = header[5][1].i;
+				size_t position = 0;
+				vector<uint32_t> levels = vector<uint32_t>(count, 1);
+				if (optional) {
+					uint32_t size = get_u32(page, 0);
+					levels = read_rle_hybrid(page.substr(4, size), 0, 1, count);
+					position = 4 + size;
+				}
+				size_t defined = 0;
+				for (uint32_t level : levels) {
+					defined += level;
+				}
+
+				vector<string> values = vector<string>();
+				int encoding = (int)header[5][2].i;
+				if (encoding == 8) {
+					int width = (uint8_t)page[position];
+					for (uint32_t index : read_rle_hybrid(page, position + 1, width, defined)) {
+						values.push_back(CHECK(index < dictionary.size()) ? dictionary[index] : string());
+					}
+				} else {
+					CHECK(encoding == 0);
+					values = read_plain(page, position, type, defined);
+				}
+				if (!CHECK((levels.size() == count) && (values.size() == defined))) {
+					return false;
+				}
+
+				size_t next = 0;
+				for (uint32_t level : levels) {
+					parquet.columns[c].push_back(level ? std::make_pair(true, values[next++]) : std::make_pair(false, string()));
+				}
+				read += count;
+			}
+			CHECK(read == meta[5].i);
+		}
+	}
+	return true;
+}
+
+static void test_parquet(const string &directory) {
+	vector<ParquetWriter::Column> columns = vector<ParquetWriter::Column>{
+		{ "id", ParquetWriter::INT64, false, false, ParquetWriter::NONE },
+		{ "level", ParquetWriter::INT32, false, true, ParquetWriter::NONE },
+		{ "time", ParquetWriter::INT64, false, false, ParquetWriter::TIMESTAMP_MICROS },
+		{ "message", ParquetWriter::STRING, false, false, ParquetWriter::UTF8 },
+		{ "logger", ParquetWriter::STRING, true, true, ParquetWriter::UTF8 },
+		{ "fields", ParquetWriter::STRING, true, false, ParquetWriter::JSON },
+		{ "line", ParquetWriter::INT32, true, false, ParquetWriter::NONE },
+		{ "constant", ParquetWriter::STRING, false, true, ParquetWriter::UTF8 },
+		{ "pid", ParquetWriter::INT64, true, true, ParquetWriter::NONE },
+	};
+
+	// long runs and short alternations for both halves of the RLE hybrid, a dictionary of one value
+	const int rows = 1000;
+	vector<ParquetValues> expected = vector<ParquetValues>(columns.size());
+	string path = directory + "/test.parquet";
+	ParquetWriter writer = ParquetWriter(columns, 300);
+	CHECK(writer.open(path));
+	for (int i = 0; i < rows; i++) {
+		LogEntry entry = test_entry(i);
+		vector< pair<bool, string> > row = vector< pair<bool, string> >{
+			{ true, to_string((int64_t)i - 500) },
+			{ true, to_string(10 * (1 + (i / 20) % 6)) },
+			{ true, to_string(entry.time_us) },
+			{ true, (i % 97 == 0) ? string() : entry.message() },
+			{ i % 7 != 0, (i % 3 == 0) ? "api" : ((i % 3 == 1) ? "worker" : "db") },
+			{ i % 2 != 0, entry.fields },
+			{ i % 10 != 0, to_string(-i) },
+			{ true, "x" },
+			{ i % 11 != 0, to_string(5000000000 + i / 100) },
+		};
+		for (size_t c = 0; c < columns.size(); c++) {
+			if (!row[c].first) {
+				writer.set_null(c);
+				row[c].second = "";
+			} else if (columns[c].type == ParquetWriter::STRING) {
+				writer.set_string(c, row[c].second);
+			} else {
+				writer.set_int(c, strtoll(row[c].second.c_str(), NULL, 10));
+			}
+			expected[c].push_back(row[c]);
+		}
+		writer.end_row();
+	}
+	CHECK(writer.close());
+
+	ParquetFile parquet;
+	if (read_parquet(path, parquet)) {
+		CHECK(parquet.metadata[3].i == rows);
+		CHECK(parquet.metadata[4].list.size() == 4);
+		const vector<ThriftValue> &schema = parquet.metadata[2].list;
+		if (CHECK(schema.size() == columns.size() + 1)) {
+			CHECK(schema[0][5].i == (int64_t)columns.size());
+			for (size_t c = 0; c < columns.size(); c++) {
+				CHECK(schema[c + 1][4].binary == columns[c].name);
+				CHECK(schema[c + 1][1].i == columns[c].type);
+				CHECK(schema[c + 1][3].i == (columns[c].optional ? 1 : 0));
+				CHECK(schema[c + 1].has(6) == (columns[c].converted_type != ParquetWriter::NONE));
+				CHECK(!schema[c + 1].has(6) || (schema[c + 1][6].i == columns[c].converted_type));
+				CHECK(parquet.columns[c] == expected[c]);
+			}
+		}
+	}
+
+	// a file without rows is still valid
+	ParquetWriter empty = ParquetWriter(columns);
+	CHECK(empty.open(path));
+	CHECK(empty.close());
+	if (read_parquet(path, parquet)) {
+		CHECK(parquet.metadata[3].i == 0);
+		CHECK(parquet.metadata[4].list.empty());
+	}
+	unlink(path.c_str());
+}
+
+int main(int argc, char **argv) {
+	char directory_template[] = "/tmp/dblogger-test-XXXXXX";
+	if (mkdtemp(directory_template) == NULL) {
+		cerr << "Could not create a temporary directory\n";
+		return 1;
+	}
+	string directory = directory_template;
+
+	test_records();
+	test_segment_frames(directory);
+	test_parquet(directory);
+	string segments = directory + "/segments";
+	test_segment_files(segments);
+
+	remove_directory(segments);
+	remove_directory(directory);
+	if (failures > 0) {
+		cerr << failures << " checks failed\n";
+		return 1;
+	}
+	cerr << "All format checks passed\n";
+	return 0;
+}